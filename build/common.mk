@@ -7,6 +7,8 @@ HDRS_MAIN = \
 	../../src/polarisengine.h \
 	../../src/anime.h \
 	../../src/conf.h \
+	../../src/cpu.h \
+	../../src/workers.h \
 	../../src/event.h \
 	../../src/file.h \
 	../../src/glyph.h \
@@ -31,6 +33,8 @@ HDRS_MAIN = \
 SRCS_MAIN = \
 	../../src/anime.c \
 	../../src/conf.c \
+	../../src/cpu.c \
+	../../src/workers.c \
 	../../src/ciel.c \
 	../../src/event.c \
 	../../src/file.c \
@@ -100,6 +104,8 @@ SRCS_UNITY = \
 	../../src/halwrap.c \
 	../../src/anime.c \
 	../../src/conf.c \
+	../../src/cpu.c \
+	../../src/workers.c \
 	../../src/ciel.c \
 	../../src/event.c \
 	../../src/glyph.c \
@@ -5,6 +5,8 @@ SRCS = \
 	halwrap.c \
 	anime.c \
 	conf.c \
+	cpu.c \
+	workers.c \
 	ciel.c \
 	event.c \
 	glyph.c \
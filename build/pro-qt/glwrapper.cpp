@@ -341,6 +341,11 @@ void q_glTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei wi
     F->glTexImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
 }
 
+void q_glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid *pixels)
+{
+    F->glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+}
+
 void q_glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices)
 {
     F->glDrawElements(mode, count, type, indices);
@@ -57,7 +57,11 @@ SRC="\
 	anime.h \
 	anime.c \
 	conf.h \
+	cpu.h \
+	workers.h \
 	conf.c \
+	cpu.c \
+	workers.c \
 	ciel.h \
 	ciel.c \
 	event.h \
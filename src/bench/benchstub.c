@@ -0,0 +1,194 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Polaris Engine
+ * Copyright (C) 2024, The Authors. All rights reserved.
+ */
+
+/*
+ * Stub HAL for the Benchmarks
+ *  - Provides the HAL functions, the config variables and the log
+ *    functions that image.c, glyph.c, readimage.c, file.c and package.c
+ *    refer to.
+ *  - There is no window and no renderer, so image updates are ignored.
+ */
+
+#include "../polarisengine.h"
+
+#include <stdarg.h>
+
+/*
+ * Config
+ *  - The values are the defaults of the game templates.
+ *  - imagebench.c sets conf_font_global_file by the command line.
+ *  - filebench.c sets conf_release to read only from the package.
+ */
+int conf_window_width = 1280;
+int conf_window_height = 720;
+int conf_image_pool_size;
+char *conf_font_global_file;
+char *conf_font_main_file;
+char *conf_font_alt1_file;
+char *conf_font_alt2_file;
+int conf_font_size = 32;
+int conf_font_color_r = 255;
+int conf_font_color_g = 255;
+int conf_font_color_b = 255;
+int conf_msgbox_fill_color_a = 255;
+int conf_msgbox_fill_color_r;
+int conf_msgbox_fill_color_g;
+int conf_msgbox_fill_color_b;
+char *conf_emoticon_name[EMOTICON_COUNT];
+char *conf_emoticon_file[EMOTICON_COUNT];
+int conf_serif_quote_indent;
+int conf_release;
+
+/*
+ * Forward declaration.
+ */
+static void log_stub(const char *level, const char *s, va_list ap);
+
+/*
+ * HAL
+ */
+
+bool log_info(const char *s, ...)
+{
+	va_list ap;
+
+	va_start(ap, s);
+	log_stub("info", s, ap);
+	va_end(ap);
+	return true;
+}
+
+bool log_warn(const char *s, ...)
+{
+	va_list ap;
+
+	va_start(ap, s);
+	log_stub("warn", s, ap);
+	va_end(ap);
+	return true;
+}
+
+bool log_error(const char *s, ...)
+{
+	va_list ap;
+
+	va_start(ap, s);
+	log_stub("error", s, ap);
+	va_end(ap);
+	return true;
+}
+
+static void log_stub(const char *level, const char *s, va_list ap)
+{
+	fprintf(stderr, "%s: ", level);
+	vfprintf(stderr, s, ap);
+	fprintf(stderr, "\n");
+}
+
+/* The paths are relative to the current directory, as in x11main.c. */
+char *make_valid_path(const char *dir, const char *fname)
+{
+	char *buf;
+	size_t len;
+
+	if (dir == NULL)
+		dir = "";
+
+	len = strlen(dir) + 1 + strlen(fname) + 1;
+	buf = malloc(len);
+	if (buf == NULL)
+		return NULL;
+
+	if (strlen(dir) > 0)
+		snprintf(buf, len, "%s/%s", dir, fname);
+	else
+		snprintf(buf, len, "%s", fname);
+
+	return buf;
+}
+
+void notify_image_update(struct image *img)
+{
+	UNUSED_PARAMETER(img);
+}
+
+void notify_image_free(struct image *img)
+{
+	UNUSED_PARAMETER(img);
+}
+
+/*
+ * Engine functions outside the benchmark
+ *  - The message drawing in glyph.c refers to them, but the benchmark
+ *    draws glyphs directly.
+ */
+
+struct image *get_layer_image(int layer)
+{
+	UNUSED_PARAMETER(layer);
+	return NULL;
+}
+
+bool is_quoted_serif(const char *msg)
+{
+	UNUSED_PARAMETER(msg);
+	return false;
+}
+
+/*
+ * Log messages (log.c)
+ */
+
+void log_api_error(const char *api)
+{
+	log_error("API error: %s", api);
+}
+
+void log_file_name_case(const char *dir, const char *file)
+{
+	log_warn("File name case mismatch: %s/%s", dir, file);
+}
+
+void log_dir_not_found(const char *dir)
+{
+	log_error("Directory not found: %s", dir);
+}
+
+void log_dir_file_open(const char *dir, const char *file)
+{
+	log_error("Cannot open file: %s/%s", dir, file);
+}
+
+void log_file_open(const char *fname)
+{
+	log_error("Cannot open file: %s", fname);
+}
+
+void log_file_write(const char *file)
+{
+	log_error("Cannot write file: %s", file);
+}
+
+void log_font_file_error(const char *font)
+{
+	log_error("Cannot load font: %s", font);
+}
+
+void log_image_file_error(const char *dir, const char *file)
+{
+	log_error("Cannot load image: %s/%s", dir, file);
+}
+
+void log_memory_helper(const char *file, int line)
+{
+	log_error("Out of memory: %s:%d", file, line);
+}
+
+void log_package_file_error(void)
+{
+	log_error("Broken package file.");
+}
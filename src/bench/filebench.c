@@ -0,0 +1,1038 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Polaris Engine
+ * Copyright (C) 2024, The Authors. All rights reserved.
+ */
+
+/*
+ * File I/O Benchmark
+ *  - Creates a synthetic game directory in a temporary directory, packs
+ *    it into data01.arc with package.c, and times file.c on the real
+ *    files and on the package.
+ *  - Prints the throughput in operations per second as JSON to stdout,
+ *    in the same way as imagebench.
+ *  - With --baseline, the results are compared with a saved output and
+ *    the exit status is 1 if a case is slower than the threshold.
+ *
+ * Usage:
+ *  filebench [--time MS] [--case NAME] [--files N] [--dir DIR]
+ *            [--baseline FILE] [--threshold PERCENT]
+ *  filebench --check [--dir DIR]
+ *
+ * The "repack" case changes a file and times create_package() with and
+ * without the manifest, and update_package(). (Reported as packs per
+ * second, and ms per pack)
+ *
+ * The "replay" case opens and reads files in the order of a play-through
+ * (the numbered files in turn, skipping some as unplayed routes), with
+ * the page cache of data01.arc dropped before each play-through. It packs
+ * with the default layout and with the layout by an access trace of the
+ * same play-through, and reports the number of the seeks (a body that
+ * doesn't follow the previous one) and ms per play-through. (Use --dir
+ * on a disk: the page cache of tmpfs can't be dropped)
+ *
+ * With --check, no case is timed and the file stream is tested instead:
+ * a sparse file larger than 4 GiB is read past the 2 GiB and 4 GiB
+ * offsets with seek_rfile() and tell_rfile(), and the exit status is 1
+ * on a failure. (The file has no data blocks, so it takes no disk space)
+ */
+
+/* For nftw(). */
+#define _GNU_SOURCE
+
+#include "../polarisengine.h"
+#include "../package.h"
+
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/* The default measuring time for a case. (ms) */
+#define DEFAULT_TIME_MS		(1000)
+
+/* The number of the measuring rounds. (The best round is reported.) */
+#define ROUND_COUNT		(5)
+
+/* The default threshold to report a regression. (%) */
+#define DEFAULT_THRESHOLD	(10.0)
+
+/* The maximum number of the baseline results. */
+#define BASELINE_MAX		(64)
+
+/* The default number of the files. (A large title has 20k entries.) */
+#define DEFAULT_FILE_COUNT	(20000)
+
+/* The size of a path in the game directory. */
+#define PATH_SIZE		(256)
+
+/* The scenario for the gets case, and its line count. */
+#define SCENARIO_FILE		"scenario.txt"
+#define SCENARIO_LINES		(50000)
+
+/* The size of a read_rfile() call in the read case. (A decoder reads a chunk.) */
+#define READ_CHUNK_SIZE		(256)
+
+/* The large file for --check, and the offsets of its markers. (Beyond a long and a 32-bit off_t) */
+#define LARGE_FILE		"large.ogg"
+#define LARGE_FILE_SIZE		(((int64_t)5 << 30) + 3)
+#define LARGE_MARK1		(((int64_t)5 << 29) + 1)
+#define LARGE_MARK2		(((int64_t)9 << 29) + 7)
+
+/* The manifest that the packager writes. (MANIFEST_FILE in package.c) */
+#define MANIFEST_FILE		"data01.arc.manifest"
+
+/* One out of this number of the files is skipped in the replay case. */
+#define UNPLAYED_RATIO		(4)
+
+/*
+ * Kinds of the synthetic files.
+ *  - The files are assigned to the kinds in turn by their numbers.
+ */
+static const struct kind {
+	const char *dir;
+	const char *ext;
+	int min_size;
+	int max_size;
+	bool is_text;		/* Compressible. (Deflated in the package) */
+} kind_tbl[] = {
+	{"cv", "ogg", 4096, 16384, false},	/* Voices are the majority. */
+	{"cv", "ogg", 4096, 16384, false},
+	{"cv", "ogg", 4096, 16384, false},
+	{"cv", "ogg", 4096, 16384, false},
+	{"ch", "png", 8192, 32768, false},
+	{"ch", "png", 8192, 32768, false},
+	{"bg", "png", 16384, 65536, false},
+	{"se", "ogg", 2048, 8192, false},
+	{"txt", "txt", 1024, 8192, true},
+	{"gui", "txt", 512, 2048, true},
+};
+
+#define KIND_COUNT	((int)(sizeof(kind_tbl) / sizeof(kind_tbl[0])))
+
+/* Directories that the packager scans. (The same as dir_names[] in package.c) */
+static const char *dir_tbl[] = {
+	"bg", "bgm", "ch", "cg", "cv", "conf", "font", "gui", "rule", "se",
+	"txt", "wms", "anime",
+};
+
+#define DIR_COUNT	((int)(sizeof(dir_tbl) / sizeof(dir_tbl[0])))
+
+/*
+ * A synthetic file.
+ */
+struct bench_file {
+	const char *dir;
+	char file[32];
+};
+
+/*
+ * Sources of the files.
+ */
+enum source {
+	SOURCE_FS,		/* The real files. (conf_release = 0) */
+	SOURCE_PACKAGE,		/* data01.arc only. (conf_release = 1) */
+	SOURCE_COUNT,
+};
+
+static const char *source_name[] = {
+	"fs",
+	"package",
+};
+
+/*
+ * Ways to pack for the repack case.
+ */
+enum pack_mode {
+	PACK_SCRATCH,		/* create_package() without the manifest */
+	PACK_CREATE,		/* create_package(): copies the unchanged bodies */
+	PACK_UPDATE,		/* update_package(): appends the changed files */
+	PACK_COUNT,
+};
+
+static const char *pack_name[] = {
+	"scratch",
+	"create",
+	"update",
+};
+
+/*
+ * Package layouts for the replay case.
+ */
+enum layout {
+	LAYOUT_DEFAULT,		/* The entry order */
+	LAYOUT_TRACED,		/* The first-touch order of the access trace */
+	LAYOUT_COUNT,
+};
+
+static const char *layout_name[] = {
+	"default",
+	"traced",
+};
+
+/*
+ * Cases
+ *  - run() does the operation once for every file and returns the number
+ *    of the operations.
+ *  - A read case runs for each source, a pack case for each pack mode, and
+ *    a layout case for each layout.
+ */
+typedef uint64_t (*run_func)(int mode);
+
+enum case_kind {
+	CASE_READ,
+	CASE_PACK,
+	CASE_LAYOUT,
+};
+
+static uint64_t run_open(int mode);
+static uint64_t run_exist(int mode);
+static uint64_t run_read(int mode);
+static uint64_t run_gets(int mode);
+static uint64_t run_repack(int mode);
+static uint64_t run_replay(int mode);
+
+static const struct bench_case {
+	const char *name;
+	run_func run;
+	enum case_kind kind;
+} case_tbl[] = {
+	{"open", run_open, CASE_READ},
+	{"exist", run_exist, CASE_READ},
+	{"read", run_read, CASE_READ},
+	{"gets", run_gets, CASE_READ},
+	{"repack", run_repack, CASE_PACK},
+	/* The last, since it leaves the package in the traced layout. */
+	{"replay", run_replay, CASE_LAYOUT},
+};
+
+#define CASE_COUNT	((int)(sizeof(case_tbl) / sizeof(case_tbl[0])))
+
+/*
+ * Baseline results.
+ */
+static struct baseline {
+	char name[32];
+	char source[16];
+	double ops;
+} baseline[BASELINE_MAX];
+static int baseline_count;
+
+/*
+ * Options.
+ */
+static double round_sec = DEFAULT_TIME_MS / 1000.0 / ROUND_COUNT;
+static const char *case_filter;
+static const char *base_dir = "/tmp";
+static const char *baseline_file;
+static double threshold = DEFAULT_THRESHOLD;
+static int file_count = DEFAULT_FILE_COUNT;
+static bool check_mode;
+
+/* The synthetic files. */
+static struct bench_file *files;
+
+/* The play-through of the replay case. (Indices of the files) */
+static int *play_order;
+static int play_count;
+
+/* The bodies in the package of the replay case. (By the file index) */
+static uint64_t *body_offset;
+static uint64_t *body_size;
+
+/* The temporary game directory. */
+static char work_dir[PATH_SIZE];
+
+/* The number of the printed results. */
+static int result_count;
+
+/* The number of the regressions. */
+static int regression_count;
+
+/*
+ * Forward declarations.
+ */
+static bool parse_options(int argc, char *argv[]);
+static void print_usage(void);
+static bool load_baseline(const char *fname);
+static bool make_game_dir(void);
+static bool write_file(const char *path, int size, bool is_text);
+static bool write_scenario(void);
+static void remove_game_dir(void);
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw);
+static bool pack(bool update);
+static bool select_source(int source);
+static void run_case(const struct bench_case *c);
+static bool pack_layout(int layout);
+static bool make_play_order(void);
+static int count_seeks(void);
+static void drop_package_cache(void);
+static double measure(run_func run, int mode);
+static double now(void);
+static uint32_t next_random(void);
+static void report(const char *name, const char *source, double ops, const char *extra);
+static bool check_large_file(void);
+static bool write_mark(int fd, int64_t offset);
+static bool read_mark(struct rfile *rf, int64_t offset, int whence, int64_t expected);
+
+/*
+ * Main
+ */
+int main(int argc, char *argv[])
+{
+	int i, ret;
+
+	if (!parse_options(argc, argv))
+		return 2;
+	if (baseline_file != NULL && !load_baseline(baseline_file))
+		return 2;
+
+	/* Make the game directory and the package, and work in it. */
+	ret = 2;
+	if (!make_game_dir())
+		goto out;
+	if (!pack(false))
+		goto out;
+
+	/* Test the file stream instead of timing. */
+	if (check_mode) {
+		ret = check_large_file() ? 0 : 1;
+		goto out;
+	}
+
+	printf("{\n");
+	printf("  \"files\": %d,\n", file_count);
+	printf("  \"results\": [");
+	fflush(stdout);
+
+	for (i = 0; i < CASE_COUNT; i++) {
+		if (case_filter != NULL && strcmp(case_filter, case_tbl[i].name) != 0)
+			continue;
+		run_case(&case_tbl[i]);
+	}
+
+	printf("\n  ]\n}\n");
+
+	ret = 0;
+	if (baseline_file != NULL && regression_count > 0) {
+		fprintf(stderr, "%d case(s) are slower than the baseline by more than %.1f%%.\n",
+			regression_count, threshold);
+		ret = 1;
+	}
+
+out:
+	cleanup_file();
+	remove_game_dir();
+	free(files);
+	free(play_order);
+	free(body_offset);
+	free(body_size);
+	return ret;
+}
+
+static bool parse_options(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--check") == 0) {
+			check_mode = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			print_usage();
+			return false;
+		}
+		if (strcmp(argv[i], "--time") == 0) {
+			round_sec = atof(argv[++i]) / 1000.0 / ROUND_COUNT;
+		} else if (strcmp(argv[i], "--case") == 0) {
+			case_filter = argv[++i];
+		} else if (strcmp(argv[i], "--files") == 0) {
+			file_count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--dir") == 0) {
+			base_dir = argv[++i];
+		} else if (strcmp(argv[i], "--baseline") == 0) {
+			baseline_file = argv[++i];
+		} else if (strcmp(argv[i], "--threshold") == 0) {
+			threshold = atof(argv[++i]);
+		} else {
+			print_usage();
+			return false;
+		}
+	}
+	if (round_sec <= 0 || file_count <= 0 || file_count > 1000000) {
+		print_usage();
+		return false;
+	}
+	return true;
+}
+
+static void print_usage(void)
+{
+	fprintf(stderr,
+		"Usage: filebench [--time MS] [--case NAME] [--files N] [--dir DIR]\n"
+		"                 [--baseline FILE] [--threshold PERCENT]\n"
+		"       filebench --check [--dir DIR]\n"
+		"  --check              Test reading a file larger than 4 GiB\n"
+		"  --time MS            Measuring time for a case (default: %d)\n"
+		"  --case NAME          Run only a case (e.g. open)\n"
+		"  --files N            Number of the synthetic files (default: %d)\n"
+		"  --dir DIR            Where to make the game directory (default: /tmp)\n"
+		"  --baseline FILE      Compare with a saved output\n"
+		"  --threshold PERCENT  Slowdown to report (default: %.0f)\n",
+		DEFAULT_TIME_MS, DEFAULT_FILE_COUNT, DEFAULT_THRESHOLD);
+}
+
+/*
+ * Load a saved output.
+ *  - Each result is on its own line, so we don't need a JSON parser.
+ */
+static bool load_baseline(const char *fname)
+{
+	FILE *fp;
+	char line[256];
+	struct baseline *b;
+
+	fp = fopen(fname, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot open %s\n", fname);
+		return false;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (baseline_count == BASELINE_MAX)
+			break;
+		b = &baseline[baseline_count];
+		if (sscanf(line,
+			   " {\"case\": \"%31[^\"]\", \"source\": \"%15[^\"]\", "
+			   "\"ops_per_s\": %lf",
+			   b->name, b->source, &b->ops) == 3)
+			baseline_count++;
+	}
+	fclose(fp);
+
+	if (baseline_count == 0) {
+		fprintf(stderr, "No result in %s\n", fname);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Make the synthetic game directory, and change the current directory to it.
+ *  - The file contents are the same for every run.
+ */
+static bool make_game_dir(void)
+{
+	const struct kind *k;
+	char path[PATH_SIZE];
+	int i, size;
+
+	snprintf(work_dir, sizeof(work_dir), "%s/filebench-XXXXXX", base_dir);
+	if (mkdtemp(work_dir) == NULL) {
+		fprintf(stderr, "Cannot make a directory in %s\n", base_dir);
+		work_dir[0] = '\0';
+		return false;
+	}
+	if (chdir(work_dir) != 0)
+		return false;
+
+	for (i = 0; i < DIR_COUNT; i++) {
+		if (mkdir(dir_tbl[i], 0755) != 0)
+			return false;
+	}
+
+	files = calloc((size_t)file_count, sizeof(struct bench_file));
+	if (files == NULL)
+		return false;
+	for (i = 0; i < file_count; i++) {
+		k = &kind_tbl[i % KIND_COUNT];
+		files[i].dir = k->dir;
+		snprintf(files[i].file, sizeof(files[i].file), "%06d.%s", i, k->ext);
+
+		size = k->min_size + (int)(next_random() % (uint32_t)(k->max_size - k->min_size + 1));
+		snprintf(path, sizeof(path), "%s/%s", files[i].dir, files[i].file);
+		if (!write_file(path, size, k->is_text))
+			return false;
+	}
+	return write_scenario();
+}
+
+/* Write a file of random bytes, or of random words for a text. */
+static bool write_file(const char *path, int size, bool is_text)
+{
+	static const char *word_tbl[] = {
+		"Polaris", "Engine", "the", "a", "message", "is", "shown", "on",
+		"screen", "and", "voice", "plays", "while", "she", "smiles",
+	};
+	FILE *fp;
+	int i;
+
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot write %s\n", path);
+		return false;
+	}
+	for (i = 0; i < size; i++) {
+		if (!is_text) {
+			fputc((int)(next_random() & 0xff), fp);
+		} else if (next_random() % 12 == 0) {
+			fputc('\n', fp);
+		} else {
+			i += fprintf(fp, "%s ", word_tbl[next_random() % 15]) - 1;
+		}
+	}
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Cannot write %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+/* Write a scenario of commands, messages and labels. */
+static bool write_scenario(void)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen("txt/" SCENARIO_FILE, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot write %s\n", SCENARIO_FILE);
+		return false;
+	}
+	for (i = 0; i < SCENARIO_LINES; i++) {
+		switch (i % 8) {
+		case 0:
+			fprintf(fp, ":label%d\n", i);
+			break;
+		case 1:
+			fprintf(fp, "@bg file=%06d.png duration=0.5\n", i);
+			break;
+		case 2:
+			fprintf(fp, "@ch position=center file=%06d.png\n", i);
+			break;
+		default:
+			fprintf(fp, "*Name*%06d.ogg*The message of the line %d is shown on the screen.\r\n", i, i);
+			break;
+		}
+	}
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Cannot write %s\n", SCENARIO_FILE);
+		return false;
+	}
+	return true;
+}
+
+/* Remove the game directory. */
+static void remove_game_dir(void)
+{
+	if (work_dir[0] == '\0')
+		return;
+	if (chdir("/") != 0)
+		return;
+	nftw(work_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	UNUSED_PARAMETER(st);
+	UNUSED_PARAMETER(flag);
+	UNUSED_PARAMETER(ftw);
+	remove(path);
+	return 0;
+}
+
+/*
+ * Pack the game directory into data01.arc.
+ *  - The packager prints the file names, so its stdout is discarded.
+ */
+static bool pack(bool update)
+{
+	int saved_fd, null_fd;
+	bool ret;
+
+	fflush(stdout);
+	saved_fd = dup(STDOUT_FILENO);
+	null_fd = open("/dev/null", O_WRONLY);
+	if (saved_fd == -1 || null_fd == -1)
+		return false;
+	dup2(null_fd, STDOUT_FILENO);
+	close(null_fd);
+
+	ret = update ? update_package("") : create_package("");
+
+	fflush(stdout);
+	dup2(saved_fd, STDOUT_FILENO);
+	close(saved_fd);
+
+	if (!ret)
+		fprintf(stderr, "Cannot make data01.arc.\n");
+	return ret;
+}
+
+/*
+ * Select the source of the files.
+ *  - file.c is initialized again, so that the cache of the resolved paths
+ *    doesn't carry over from the other source.
+ */
+static bool select_source(int source)
+{
+	cleanup_file();
+	conf_release = source == SOURCE_PACKAGE ? 1 : 0;
+	return init_file();
+}
+
+/* Run a case on every source or pack mode. */
+static void run_case(const struct bench_case *c)
+{
+	char extra[64];
+	double ops;
+	int i, seeks;
+
+	if (c->kind == CASE_LAYOUT) {
+		for (i = 0; i < LAYOUT_COUNT; i++) {
+			if (!pack_layout(i))
+				exit(2);
+			seeks = count_seeks();
+			ops = measure(c->run, i);
+			snprintf(extra, sizeof(extra), ", \"seeks\": %d, \"ms\": %.1f",
+				 seeks, 1000.0 * play_count / ops);
+			report(c->name, layout_name[i], ops, extra);
+		}
+		return;
+	}
+
+	if (c->kind == CASE_PACK) {
+		/* The package is rewritten, so close it. */
+		cleanup_file();
+		for (i = 0; i < PACK_COUNT; i++) {
+			ops = measure(c->run, i);
+			snprintf(extra, sizeof(extra), ", \"ms\": %.1f", 1000.0 / ops);
+			report(c->name, pack_name[i], ops, extra);
+		}
+		return;
+	}
+
+	for (i = 0; i < SOURCE_COUNT; i++) {
+		if (!select_source(i))
+			exit(2);
+		report(c->name, source_name[i], measure(c->run, i), "");
+	}
+}
+
+/*
+ * Pack the game directory from scratch in a layout.
+ *  - The access trace is the play-through of the replay case.
+ */
+static bool pack_layout(int layout)
+{
+	bool ret;
+
+	cleanup_file();
+	if (play_order == NULL && !make_play_order())
+		return false;
+
+	remove(MANIFEST_FILE);
+	set_package_access_trace(layout == LAYOUT_TRACED ? ACCESS_TRACE_FILE : NULL);
+	ret = pack(false);
+	set_package_access_trace(NULL);
+	return ret;
+}
+
+/*
+ * Make the play-through, and write it as an access trace.
+ *  - The files used together have near numbers, but are in different
+ *    directories, so the default layout puts them far apart.
+ */
+static bool make_play_order(void)
+{
+	FILE *fp;
+	int i;
+
+	play_order = malloc((size_t)file_count * sizeof(int));
+	body_offset = calloc((size_t)file_count, sizeof(uint64_t));
+	body_size = calloc((size_t)file_count, sizeof(uint64_t));
+	if (play_order == NULL || body_offset == NULL || body_size == NULL)
+		return false;
+	for (i = 0; i < file_count; i++) {
+		if (next_random() % UNPLAYED_RATIO != 0)
+			play_order[play_count++] = i;
+	}
+
+	fp = fopen(ACCESS_TRACE_FILE, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot write %s\n", ACCESS_TRACE_FILE);
+		return false;
+	}
+	for (i = 0; i < play_count; i++)
+		fprintf(fp, "%s/%s\n", files[play_order[i]].dir, files[play_order[i]].file);
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Cannot write %s\n", ACCESS_TRACE_FILE);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Count the seeks of the play-through in the package.
+ *  - The bodies are read from the manifest, and a body that doesn't start
+ *    at the end of the previous one is a seek.
+ */
+static int count_seeks(void)
+{
+	FILE *fp;
+	char line[1024], dir[16];
+	unsigned long long hash, mtime, raw_size, size, offset, codec;
+	uint64_t end;
+	int i, n, index, seeks;
+
+	fp = fopen(MANIFEST_FILE, "r");
+	if (fp == NULL)
+		exit(2);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%llx %llu %llu %llu %llu %llu %n", &hash, &mtime,
+			   &raw_size, &size, &offset, &codec, &n) != 6)
+			continue;
+		if (sscanf(line + n, "%15[^/]/%d.", dir, &index) != 2 ||
+		    index < 0 || index >= file_count)
+			continue;
+		body_offset[index] = offset;
+		body_size[index] = size;
+	}
+	fclose(fp);
+
+	seeks = 0;
+	end = UINT64_MAX;
+	for (i = 0; i < play_count; i++) {
+		if (body_offset[play_order[i]] != end)
+			seeks++;
+		end = body_offset[play_order[i]] + body_size[play_order[i]];
+	}
+	return seeks;
+}
+
+/* Drop the page cache of the package, so that the next reads go to the disk. */
+static void drop_package_cache(void)
+{
+	int fd;
+
+	fd = open(PACKAGE_FILE, O_RDONLY);
+	if (fd == -1)
+		exit(2);
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+/*
+ * Measure a case.
+ *  - The first call fills the caches.
+ *  - Each round repeats the case for round_sec, and the best round is
+ *    used so that an interruption by the OS doesn't count.
+ */
+static double measure(run_func run, int mode)
+{
+	double start, elapsed, ops, best;
+	uint64_t count;
+	int i;
+
+	run(mode);
+
+	best = 0;
+	for (i = 0; i < ROUND_COUNT; i++) {
+		count = 0;
+		start = now();
+		do {
+			count += run(mode);
+			elapsed = now() - start;
+		} while (elapsed < round_sec);
+
+		ops = (double)count / elapsed;
+		if (ops > best)
+			best = ops;
+	}
+	return best;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+/* xorshift32 with a fixed seed, so that every run uses the same files. */
+static uint32_t next_random(void)
+{
+	static uint32_t state = 2463534242U;
+
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+/*
+ * Print a result, and compare it with the baseline.
+ *  - extra is printed after ops_per_s, so load_baseline() still reads it.
+ */
+static void report(const char *name, const char *source, double ops, const char *extra)
+{
+	double change;
+	int i;
+
+	printf("%s\n    {\"case\": \"%s\", \"source\": \"%s\", \"ops_per_s\": %.1f%s}",
+	       result_count == 0 ? "" : ",", name, source, ops, extra);
+	fflush(stdout);
+	result_count++;
+
+	for (i = 0; i < baseline_count; i++) {
+		if (strcmp(baseline[i].name, name) == 0 &&
+		    strcmp(baseline[i].source, source) == 0)
+			break;
+	}
+	if (i == baseline_count || baseline[i].ops <= 0)
+		return;
+
+	change = (ops / baseline[i].ops - 1.0) * 100.0;
+	fprintf(stderr, "%-14s %-8s %12.1f -> %12.1f ops/s (%+6.1f%%)%s\n",
+		name, source, baseline[i].ops, ops, change,
+		change < -threshold ? "  SLOWER" : "");
+	if (change < -threshold)
+		regression_count++;
+}
+
+/*
+ * Cases
+ */
+
+/* Open and close every file. (A deflated entry is decompressed on open.) */
+static uint64_t run_open(int mode)
+{
+	struct rfile *rf;
+	int i;
+
+	UNUSED_PARAMETER(mode);
+
+	for (i = 0; i < file_count; i++) {
+		rf = open_rfile(files[i].dir, files[i].file, false);
+		if (rf == NULL)
+			exit(2);
+		close_rfile(rf);
+	}
+	return (uint64_t)file_count;
+}
+
+/*
+ * Probe every file as create_image_from_file() does.
+ *  - A miss with another extension, then the hit.
+ */
+static uint64_t run_exist(int mode)
+{
+	char miss[40];
+	int i;
+
+	UNUSED_PARAMETER(mode);
+
+	for (i = 0; i < file_count; i++) {
+		snprintf(miss, sizeof(miss), "%s.webp", files[i].file);
+		if (check_file_exist(files[i].dir, miss) ||
+		    !check_file_exist(files[i].dir, files[i].file))
+			exit(2);
+	}
+	return (uint64_t)file_count * 2;
+}
+
+/* Read every file by small chunks. */
+static uint64_t run_read(int mode)
+{
+	char buf[READ_CHUNK_SIZE];
+	struct rfile *rf;
+	int i;
+
+	UNUSED_PARAMETER(mode);
+
+	for (i = 0; i < file_count; i++) {
+		rf = open_rfile(files[i].dir, files[i].file, false);
+		if (rf == NULL)
+			exit(2);
+		while (read_rfile(rf, buf, sizeof(buf)) == sizeof(buf))
+			;
+		close_rfile(rf);
+	}
+	return (uint64_t)file_count;
+}
+
+/* Read the lines of the scenario as read_script_from_file() does. (Lines/s) */
+static uint64_t run_gets(int mode)
+{
+	char buf[4096];
+	struct rfile *rf;
+	uint64_t lines;
+
+	UNUSED_PARAMETER(mode);
+
+	rf = open_rfile("txt", SCENARIO_FILE, false);
+	if (rf == NULL)
+		exit(2);
+	lines = 0;
+	while (gets_rfile(rf, buf, sizeof(buf)) != NULL)
+		lines++;
+	close_rfile(rf);
+
+	if (lines != SCENARIO_LINES)
+		exit(2);
+	return lines;
+}
+
+/*
+ * Change a file and pack.
+ *  - A file is rewritten with new content and a new mtime each time, so
+ *    that the manifest sees it as changed. (The mtime has 1s resolution.)
+ */
+static uint64_t run_repack(int mode)
+{
+	static int step;
+	const struct kind *k;
+	struct timeval tv[2];
+	char path[PATH_SIZE];
+	int i, size;
+
+	i = (int)(next_random() % (uint32_t)file_count);
+	k = &kind_tbl[i % KIND_COUNT];
+	size = k->min_size + (int)(next_random() % (uint32_t)(k->max_size - k->min_size + 1));
+	snprintf(path, sizeof(path), "%s/%s", files[i].dir, files[i].file);
+	if (!write_file(path, size, k->is_text))
+		exit(2);
+
+	tv[0].tv_sec = tv[1].tv_sec = 1000000000 + step++;
+	tv[0].tv_usec = tv[1].tv_usec = 0;
+	if (utimes(path, tv) != 0)
+		exit(2);
+
+	if (mode == PACK_SCRATCH)
+		remove("data01.arc.manifest");
+	if (!pack(mode == PACK_UPDATE))
+		exit(2);
+	return 1;
+}
+
+/*
+ * Play through with the cold cache. (Files/s)
+ *  - file.c is closed first, so that the package is not mapped while the
+ *    page cache is dropped.
+ */
+static uint64_t run_replay(int mode)
+{
+	char buf[READ_CHUNK_SIZE];
+	struct rfile *rf;
+	int i, index;
+
+	UNUSED_PARAMETER(mode);
+
+	cleanup_file();
+	drop_package_cache();
+	if (!select_source(SOURCE_PACKAGE))
+		exit(2);
+
+	for (i = 0; i < play_count; i++) {
+		index = play_order[i];
+		rf = open_rfile(files[index].dir, files[index].file, false);
+		if (rf == NULL)
+			exit(2);
+		while (read_rfile(rf, buf, sizeof(buf)) == sizeof(buf))
+			;
+		close_rfile(rf);
+	}
+	return (uint64_t)play_count;
+}
+
+/*
+ * Test reading a file larger than 4 GiB.
+ *  - The file is made after packing, so that the packager doesn't read it.
+ *  - Each marker is 8 bytes of its own offset, and is read by seeking
+ *    with SEEK_SET, SEEK_CUR and SEEK_END.
+ */
+static bool check_large_file(void)
+{
+	struct rfile *rf;
+	char path[PATH_SIZE];
+	bool ok;
+	int fd;
+
+	snprintf(path, sizeof(path), "bgm/%s", LARGE_FILE);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "Cannot write %s\n", path);
+		return false;
+	}
+	ok = ftruncate(fd, (off_t)LARGE_FILE_SIZE) == 0 &&
+	     write_mark(fd, LARGE_MARK1) &&
+	     write_mark(fd, LARGE_MARK2) &&
+	     write_mark(fd, LARGE_FILE_SIZE - 8);
+	close(fd);
+	if (!ok) {
+		fprintf(stderr, "Cannot write %s\n", path);
+		return false;
+	}
+
+	if (!select_source(SOURCE_FS))
+		return false;
+	rf = open_rfile("bgm", LARGE_FILE, false);
+	if (rf == NULL)
+		return false;
+
+	ok = true;
+	if ((int64_t)get_rfile_size(rf) != LARGE_FILE_SIZE) {
+		fprintf(stderr, "get_rfile_size() returned %llu\n",
+			(unsigned long long)get_rfile_size(rf));
+		ok = false;
+	}
+	ok = ok && read_mark(rf, LARGE_MARK1, SEEK_SET, LARGE_MARK1);
+	ok = ok && read_mark(rf, LARGE_MARK2 - LARGE_MARK1 - 8, SEEK_CUR, LARGE_MARK2);
+	ok = ok && read_mark(rf, -8, SEEK_END, LARGE_FILE_SIZE - 8);
+	ok = ok && read_mark(rf, LARGE_MARK1 - LARGE_FILE_SIZE, SEEK_CUR, LARGE_MARK1);
+	close_rfile(rf);
+
+	printf("large file: %s\n", ok ? "ok" : "failed");
+	return ok;
+}
+
+/* Write a marker of its own offset. */
+static bool write_mark(int fd, int64_t offset)
+{
+	uint64_t mark;
+
+	mark = (uint64_t)offset;
+	return pwrite(fd, &mark, sizeof(mark), (off_t)offset) == (ssize_t)sizeof(mark);
+}
+
+/* Seek, and read a marker. */
+static bool read_mark(struct rfile *rf, int64_t offset, int whence, int64_t expected)
+{
+	uint64_t mark;
+
+	if (!seek_rfile(rf, offset, whence)) {
+		fprintf(stderr, "seek_rfile() to %lld failed\n", (long long)expected);
+		return false;
+	}
+	if (tell_rfile(rf) != (uint64_t)expected) {
+		fprintf(stderr, "tell_rfile() returned %llu for %lld\n",
+			(unsigned long long)tell_rfile(rf), (long long)expected);
+		return false;
+	}
+	if (read_rfile(rf, &mark, sizeof(mark)) != sizeof(mark) ||
+	    mark != (uint64_t)expected) {
+		fprintf(stderr, "Wrong data at %lld\n", (long long)expected);
+		return false;
+	}
+	if (tell_rfile(rf) != (uint64_t)expected + sizeof(mark)) {
+		fprintf(stderr, "tell_rfile() returned %llu after a read at %lld\n",
+			(unsigned long long)tell_rfile(rf), (long long)expected);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,1357 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Polaris Engine
+ * Copyright (C) 2024, The Authors. All rights reserved.
+ */
+
+/*
+ * Image Kernel Benchmark
+ *  - Times the software rendering kernels of image.c and glyph.c, and
+ *    prints the throughput in MPix/s as JSON to stdout.
+ *  - The SIMD tier follows POLARIS_ENGINE_SIMD, as in the engine.
+ *  - Run in a game directory to time draw_glyph() with a font in "font/".
+ *  - With --baseline, the results are compared with a saved output and
+ *    the exit status is 1 if a case is slower than the threshold.
+ *  - The "fo_lineup" case draws the stage as draw_fo_common() does at the
+ *    start of a fade, with every character position and the boxes.
+ *  - The "upload" case reveals GLYPH_TEXT into a message layer a character
+ *    per frame, and also prints the bytes per frame that the OpenGL HAL
+ *    sends to the texture, for the dirty rows and for the whole image.
+ *  - The "thumb" and "thumb_box" cases draw THUMB_LAYERS layers of the
+ *    screen size to a save data thumbnail. (1920x1080 is a full HD stage)
+ *  - The "pool_churn" case replaces images as a scenario does, and also
+ *    prints the pool statistics and the peak RSS for each image.pool.size.
+ *
+ *  - With --check, no kernel is timed and the alpha handling is tested
+ *    instead, and the exit status is 1 on a failure.
+ *  - imagebench-premul is the same with USE_PREMULTIPLIED_ALPHA, so the
+ *    two outputs compare the blend throughput in both modes.
+ *
+ * Usage:
+ *  imagebench [--time MS] [--kernel NAME] [--font FILE]
+ *             [--baseline FILE] [--threshold PERCENT]
+ *  imagebench --check
+ */
+
+#include "../polarisengine.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* The default measuring time for a case. (ms) */
+#define DEFAULT_TIME_MS		(200)
+
+/* The number of the measuring rounds. (The best round is reported.) */
+#define ROUND_COUNT		(5)
+
+/* The default threshold to report a regression. (%) */
+#define DEFAULT_THRESHOLD	(10.0)
+
+/* The maximum number of the baseline results. */
+#define BASELINE_MAX		(256)
+
+/* The number of the images replaced by the pool churn. (@bg and three @ch) */
+#define CHURN_SLOTS		(4)
+
+/* The layers drawn to a save data thumbnail, and its size. (The default config) */
+#define THUMB_LAYERS		(40)
+#define THUMB_WIDTH		(213)
+#define THUMB_HEIGHT		(120)
+
+/* The size of the source image for the blend check. */
+#define CHECK_SIZE		(256)
+
+/* The tolerance of the blend check against the floating point result. (LSB) */
+#define CHECK_TOLERANCE		(3)
+
+/* The message layer and the font size for the upload case. */
+#define MSG_WIDTH		(1160)
+#define MSG_HEIGHT		(220)
+#define MSG_FONT_SIZE		(30)
+
+/* The text to draw by draw_glyph(). */
+#define GLYPH_TEXT		"Polaris Engine 0123456789 あいうえお漢字かな"
+
+/*
+ * Alpha patterns of the source images.
+ */
+enum pattern {
+	PATTERN_OPAQUE,		/* Every pixel is opaque. */
+	PATTERN_MIXED,		/* Random alpha values. */
+	PATTERN_SPRITE,		/* An opaque box in transparent margins. */
+	PATTERN_TRANSPARENT,	/* Every pixel is transparent. */
+	PATTERN_COUNT,
+};
+
+static const char *pattern_name[] = {
+	"opaque",
+	"mixed",
+	"sprite",
+	"transparent",
+};
+
+/*
+ * Pattern masks.
+ *  - A transparent source is skipped by its content box, so it is timed
+ *    only where the skip itself is worth timing.
+ */
+#define P_OPAQUE	(1 << PATTERN_OPAQUE)
+#define P_BLEND		(P_OPAQUE | (1 << PATTERN_MIXED) | (1 << PATTERN_SPRITE))
+#define P_ALL		((1 << PATTERN_COUNT) - 1)
+
+/*
+ * Image sizes.
+ */
+static const struct size {
+	int w;
+	int h;
+	bool is_4k;		/* Only for the kernels with use_4k. */
+} size_tbl[] = {
+	{64, 64, false},	/* An icon or a glyph cell. */
+	{640, 720, false},	/* A character. */
+	{1280, 720, false},	/* The default screen. */
+	{1920, 1080, false},	/* A full HD screen. */
+	{3840, 2160, true},	/* A 4K screen. (Rule transitions) */
+};
+
+#define SIZE_COUNT	((int)(sizeof(size_tbl) / sizeof(size_tbl[0])))
+
+/* The font sizes for draw_glyph(). */
+static const int font_size_tbl[] = {24, 48};
+
+#define FONT_SIZE_COUNT	((int)(sizeof(font_size_tbl) / sizeof(font_size_tbl[0])))
+
+/*
+ * The images and the parameters for a case.
+ */
+struct bench_ctx {
+	struct image *dst;	/* The same size as src. */
+	struct image *src;
+	struct image *rule;	/* A horizontal gradient. */
+	struct image *thumb;	/* A quarter of src. */
+	struct image *save_thumb; /* THUMB_WIDTH x THUMB_HEIGHT */
+	int w;
+	int h;
+	int font_size;
+};
+
+/*
+ * Kernels
+ *  - run() draws once and returns the number of the processed pixels.
+ */
+typedef uint64_t (*run_func)(struct bench_ctx *ctx);
+
+static uint64_t run_copy(struct bench_ctx *ctx);
+static uint64_t run_fast(struct bench_ctx *ctx);
+static uint64_t run_fast_alpha(struct bench_ctx *ctx);
+static uint64_t run_add(struct bench_ctx *ctx);
+static uint64_t run_dim(struct bench_ctx *ctx);
+static uint64_t run_emoji(struct bench_ctx *ctx);
+static uint64_t run_rule(struct bench_ctx *ctx);
+static uint64_t run_melt(struct bench_ctx *ctx);
+static uint64_t run_scale_nearest(struct bench_ctx *ctx);
+static uint64_t run_scale_box(struct bench_ctx *ctx);
+static uint64_t run_thumb(struct bench_ctx *ctx);
+static uint64_t run_thumb_box(struct bench_ctx *ctx);
+static uint64_t run_ops(struct bench_ctx *ctx);
+static uint64_t run_ops_clear(struct bench_ctx *ctx);
+static uint64_t run_fo_lineup(struct bench_ctx *ctx);
+static uint64_t run_clear(struct bench_ctx *ctx);
+static uint64_t run_clear_rect(struct bench_ctx *ctx);
+static uint64_t run_clear_rects(struct bench_ctx *ctx);
+static uint64_t run_fill_alpha(struct bench_ctx *ctx);
+static uint64_t run_glyph(struct bench_ctx *ctx);
+static uint64_t run_glyph_outline(struct bench_ctx *ctx);
+
+static const struct kernel {
+	const char *name;
+	run_func run;
+	int patterns;
+	bool is_glyph;
+	bool use_4k;
+} kernel_tbl[] = {
+	{"copy", run_copy, P_OPAQUE, false, false},
+	{"fast", run_fast, P_BLEND, false, false},
+	{"fast_alpha", run_fast_alpha, P_BLEND, false, false},
+	{"add", run_add, P_BLEND, false, false},
+	{"dim", run_dim, P_BLEND, false, false},
+	{"emoji", run_emoji, P_BLEND, false, false},
+	{"rule", run_rule, P_OPAQUE, false, true},
+	{"melt", run_melt, P_OPAQUE, false, true},
+	{"scale_nearest", run_scale_nearest, P_OPAQUE, false, false},
+	{"scale_box", run_scale_box, P_ALL, false, false},
+	{"thumb", run_thumb, P_BLEND, false, false},
+	{"thumb_box", run_thumb_box, P_BLEND, false, false},
+	{"ops", run_ops, P_ALL, false, false},
+	{"ops_clear", run_ops_clear, P_OPAQUE, false, false},
+	{"fo_lineup", run_fo_lineup, P_BLEND, false, false},
+	{"clear", run_clear, P_OPAQUE, false, false},
+	{"clear_rect", run_clear_rect, P_OPAQUE, false, false},
+	{"clear_rects", run_clear_rects, P_OPAQUE, false, false},
+	{"fill_alpha", run_fill_alpha, P_OPAQUE, false, false},
+	{"glyph", run_glyph, P_OPAQUE, true, false},
+	{"glyph_outline", run_glyph_outline, P_OPAQUE, true, false},
+};
+
+#define KERNEL_COUNT	((int)(sizeof(kernel_tbl) / sizeof(kernel_tbl[0])))
+
+/*
+ * image.pool.size values for the pool churn.
+ */
+static const struct pool_size {
+	int mb;
+	const char *name;
+} pool_size_tbl[] = {
+	{-1, "pool_off"},
+	{0, "pool_default"},
+	{64, "pool_64mb"},
+};
+
+#define POOL_SIZE_COUNT	((int)(sizeof(pool_size_tbl) / sizeof(pool_size_tbl[0])))
+
+/*
+ * The result of a pool churn, sent from the child process.
+ */
+struct churn_result {
+	double mpix;
+	struct image_pool_stats stats;
+};
+
+/*
+ * Baseline results.
+ */
+static struct baseline {
+	char kernel[32];
+	char size[16];
+	char alpha[16];
+	double mpix;
+} baseline[BASELINE_MAX];
+static int baseline_count;
+
+/*
+ * Options.
+ */
+static double round_sec = DEFAULT_TIME_MS / 1000.0 / ROUND_COUNT;
+static const char *kernel_filter;
+static const char *font_file;
+static const char *baseline_file;
+static double threshold = DEFAULT_THRESHOLD;
+static bool check_mode;
+
+/* The frames and the texture upload bytes counted by the upload case. */
+static uint64_t upload_frames;
+static uint64_t upload_dirty_bytes;
+static uint64_t upload_full_bytes;
+
+/* The number of the printed results. */
+static int result_count;
+
+/* The number of the regressions. */
+static int regression_count;
+
+/*
+ * Forward declarations.
+ */
+static bool parse_options(int argc, char *argv[]);
+static void print_usage(void);
+static bool load_baseline(const char *fname);
+static bool init_font(void);
+static void run_image_cases(const struct kernel *k);
+static void run_glyph_cases(const struct kernel *k);
+static void run_pool_cases(void);
+static void run_upload_case(void);
+static uint64_t run_upload(struct bench_ctx *ctx);
+static uint64_t get_upload_bytes(struct image *img);
+static void run_pool_churn(int pool_size, struct churn_result *res);
+static uint64_t churn_once(struct image **slot, int step);
+static void fill_source(struct image *img, int pattern);
+static void fill_rule(struct image *img);
+static double measure(const struct kernel *k, struct bench_ctx *ctx);
+static double now(void);
+static uint32_t next_random(void);
+static void report(const char *kernel, const char *size, const char *alpha, double mpix,
+		   const char *extra);
+static uint64_t run_thumb_common(struct bench_ctx *ctx, int filter);
+static bool check_alpha(void);
+#if defined(USE_PREMULTIPLIED_ALPHA)
+static bool check_premultiply(void);
+#endif
+static bool check_blend(void);
+static int diff_channel(uint32_t actual, double expected);
+static uint64_t run_glyph_common(struct bench_ctx *ctx, bool use_outline);
+
+/*
+ * Main
+ */
+int main(int argc, char *argv[])
+{
+	bool has_font;
+	int i, ret;
+
+	if (!parse_options(argc, argv))
+		return 2;
+	if (baseline_file != NULL && !load_baseline(baseline_file))
+		return 2;
+
+	/* Select the tier before starting the worker threads. */
+	get_cpu_tier();
+	init_image_pool();
+	if (!init_workers())
+		return 2;
+	if (!init_file())
+		return 2;
+
+	/* Test the alpha handling instead of timing. */
+	if (check_mode) {
+		ret = check_alpha() ? 0 : 1;
+		cleanup_image_pool();
+		cleanup_file();
+		cleanup_workers();
+		return ret;
+	}
+
+	has_font = init_font();
+
+	printf("{\n");
+	printf("  \"tier\": \"%s\",\n", get_cpu_tier_name(get_cpu_tier()));
+#if defined(USE_PREMULTIPLIED_ALPHA)
+	printf("  \"alpha_mode\": \"premultiplied\",\n");
+#else
+	printf("  \"alpha_mode\": \"straight\",\n");
+#endif
+	printf("  \"workers\": %d,\n", get_worker_count());
+	printf("  \"results\": [");
+	fflush(stdout);
+
+	/* Run first, so that the child processes fork from a small heap. */
+	if (kernel_filter == NULL || strcmp(kernel_filter, "pool_churn") == 0)
+		run_pool_cases();
+
+	for (i = 0; i < KERNEL_COUNT; i++) {
+		if (kernel_filter != NULL && strcmp(kernel_filter, kernel_tbl[i].name) != 0)
+			continue;
+		if (kernel_tbl[i].is_glyph) {
+			if (has_font)
+				run_glyph_cases(&kernel_tbl[i]);
+		} else {
+			run_image_cases(&kernel_tbl[i]);
+		}
+	}
+
+	if (has_font && (kernel_filter == NULL || strcmp(kernel_filter, "upload") == 0))
+		run_upload_case();
+
+	printf("\n  ]\n}\n");
+
+	if (has_font)
+		cleanup_glyph();
+	cleanup_image_pool();
+	cleanup_file();
+	cleanup_workers();
+
+	if (baseline_file != NULL && regression_count > 0) {
+		fprintf(stderr, "%d case(s) are slower than the baseline by more than %.1f%%.\n",
+			regression_count, threshold);
+		return 1;
+	}
+	return 0;
+}
+
+/* Parse the command line. */
+static bool parse_options(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--check") == 0) {
+			check_mode = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			print_usage();
+			return false;
+		}
+		if (strcmp(argv[i], "--time") == 0) {
+			round_sec = atof(argv[++i]) / 1000.0 / ROUND_COUNT;
+		} else if (strcmp(argv[i], "--kernel") == 0) {
+			kernel_filter = argv[++i];
+		} else if (strcmp(argv[i], "--font") == 0) {
+			font_file = argv[++i];
+		} else if (strcmp(argv[i], "--baseline") == 0) {
+			baseline_file = argv[++i];
+		} else if (strcmp(argv[i], "--threshold") == 0) {
+			threshold = atof(argv[++i]);
+		} else {
+			print_usage();
+			return false;
+		}
+	}
+	if (round_sec <= 0) {
+		print_usage();
+		return false;
+	}
+	return true;
+}
+
+static void print_usage(void)
+{
+	fprintf(stderr,
+		"Usage: imagebench [--time MS] [--kernel NAME] [--font FILE]\n"
+		"                  [--baseline FILE] [--threshold PERCENT]\n"
+		"       imagebench --check\n"
+		"  --check              Test the alpha handling of the images\n"
+		"  --time MS            Measuring time for a case (default: %d)\n"
+		"  --kernel NAME        Run only a kernel (e.g. fast)\n"
+		"  --font FILE          A font file in font/ for draw_glyph()\n"
+		"  --baseline FILE      Compare with a saved output\n"
+		"  --threshold PERCENT  Slowdown to report (default: %.0f)\n",
+		DEFAULT_TIME_MS, DEFAULT_THRESHOLD);
+}
+
+/*
+ * Load a saved output.
+ *  - Each result is on its own line, so we don't need a JSON parser.
+ */
+static bool load_baseline(const char *fname)
+{
+	FILE *fp;
+	char line[256];
+	struct baseline *b;
+
+	fp = fopen(fname, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot open %s\n", fname);
+		return false;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (baseline_count == BASELINE_MAX)
+			break;
+		b = &baseline[baseline_count];
+		if (sscanf(line,
+			   " {\"kernel\": \"%31[^\"]\", \"size\": \"%15[^\"]\", "
+			   "\"alpha\": \"%15[^\"]\", \"mpix_per_s\": %lf",
+			   b->kernel, b->size, b->alpha, &b->mpix) == 4)
+			baseline_count++;
+	}
+	fclose(fp);
+
+	if (baseline_count == 0) {
+		fprintf(stderr, "No result in %s\n", fname);
+		return false;
+	}
+	return true;
+}
+
+/* Load the font for draw_glyph(). */
+static bool init_font(void)
+{
+	if (font_file == NULL) {
+		fprintf(stderr, "No --font. Skipping draw_glyph().\n");
+		return false;
+	}
+
+	conf_font_global_file = strdup(font_file);
+	if (conf_font_global_file == NULL)
+		return false;
+	if (!init_glyph()) {
+		fprintf(stderr, "Cannot load font/%s. Skipping draw_glyph().\n", font_file);
+		cleanup_glyph();
+		return false;
+	}
+	return true;
+}
+
+/* Run a kernel on every size and alpha pattern. */
+static void run_image_cases(const struct kernel *k)
+{
+	struct bench_ctx ctx;
+	char size[16];
+	int i, j;
+
+	for (i = 0; i < SIZE_COUNT; i++) {
+		if (size_tbl[i].is_4k && !k->use_4k)
+			continue;
+		ctx.w = size_tbl[i].w;
+		ctx.h = size_tbl[i].h;
+		ctx.font_size = 0;
+
+		/* draw_image_rule() needs the rule image of the screen size. */
+		conf_window_width = ctx.w;
+		conf_window_height = ctx.h;
+
+		ctx.dst = create_image(ctx.w, ctx.h);
+		ctx.src = create_image(ctx.w, ctx.h);
+		ctx.rule = create_image(ctx.w, ctx.h);
+		ctx.thumb = create_image(ctx.w / 4, ctx.h / 4);
+		ctx.save_thumb = create_image(THUMB_WIDTH, THUMB_HEIGHT);
+		if (ctx.dst == NULL || ctx.src == NULL || ctx.rule == NULL || ctx.thumb == NULL ||
+		    ctx.save_thumb == NULL)
+			exit(2);
+		fill_rule(ctx.rule);
+
+		snprintf(size, sizeof(size), "%dx%d", ctx.w, ctx.h);
+		for (j = 0; j < PATTERN_COUNT; j++) {
+			if ((k->patterns & (1 << j)) == 0)
+				continue;
+			fill_source(ctx.src, j);
+			clear_image_color(ctx.dst, make_pixel(255, 0, 0, 0));
+			clear_image_color(ctx.thumb, make_pixel(255, 0, 0, 0));
+			clear_image_color(ctx.save_thumb, make_pixel(255, 0, 0, 0));
+			report(k->name, size, pattern_name[j], measure(k, &ctx), "");
+		}
+
+		destroy_image(ctx.dst);
+		destroy_image(ctx.src);
+		destroy_image(ctx.rule);
+		destroy_image(ctx.thumb);
+		destroy_image(ctx.save_thumb);
+	}
+}
+
+/* Run a glyph kernel on every font size. */
+static void run_glyph_cases(const struct kernel *k)
+{
+	struct bench_ctx ctx;
+	char size[16];
+	int i;
+
+	ctx.w = conf_window_width = 1280;
+	ctx.h = conf_window_height = 720;
+	ctx.src = NULL;
+	ctx.rule = NULL;
+	ctx.thumb = NULL;
+	ctx.save_thumb = NULL;
+	ctx.dst = create_image(ctx.w, ctx.h);
+	if (ctx.dst == NULL)
+		exit(2);
+
+	for (i = 0; i < FONT_SIZE_COUNT; i++) {
+		ctx.font_size = font_size_tbl[i];
+		clear_image_color(ctx.dst, make_pixel(255, 0, 0, 0));
+		snprintf(size, sizeof(size), "%dpx", ctx.font_size);
+		report(k->name, size, "none", measure(k, &ctx), "");
+	}
+
+	destroy_image(ctx.dst);
+}
+
+/*
+ * Run the upload case.
+ *  - The bytes don't depend on the time, so they are the averages over
+ *    every frame drawn by measure().
+ */
+static void run_upload_case(void)
+{
+	static const struct kernel k = {"upload", run_upload, P_OPAQUE, true, false};
+	struct bench_ctx ctx;
+	char size[16], extra[128];
+	double mpix;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.w = MSG_WIDTH;
+	ctx.h = MSG_HEIGHT;
+	ctx.font_size = MSG_FONT_SIZE;
+	ctx.dst = create_image(ctx.w, ctx.h);
+	if (ctx.dst == NULL)
+		exit(2);
+
+	upload_frames = 0;
+	upload_dirty_bytes = 0;
+	upload_full_bytes = 0;
+	mpix = measure(&k, &ctx);
+
+	snprintf(size, sizeof(size), "%dx%d", ctx.w, ctx.h);
+	snprintf(extra, sizeof(extra),
+		 ", \"dirty_bytes_per_frame\": %llu, \"full_bytes_per_frame\": %llu",
+		 (unsigned long long)(upload_dirty_bytes / upload_frames),
+		 (unsigned long long)(upload_full_bytes / upload_frames));
+	report(k.name, size, "none", mpix, extra);
+
+	destroy_image(ctx.dst);
+}
+
+/*
+ * Run the pool churn for every image.pool.size.
+ *  - Each size runs in a child process, so that the peak RSS of a size
+ *    doesn't include the others. (The worker threads are not inherited,
+ *    but the churn doesn't use them.)
+ */
+static void run_pool_cases(void)
+{
+	struct churn_result res;
+	struct rusage ru;
+	char extra[160];
+	ssize_t n;
+	pid_t pid;
+	int fd[2], status, i;
+
+	for (i = 0; i < POOL_SIZE_COUNT; i++) {
+		if (pipe(fd) != 0)
+			return;
+		fflush(stdout);
+		fflush(stderr);
+		pid = fork();
+		if (pid == -1) {
+			close(fd[0]);
+			close(fd[1]);
+			return;
+		}
+		if (pid == 0) {
+			close(fd[0]);
+			run_pool_churn(pool_size_tbl[i].mb, &res);
+			if (write(fd[1], &res, sizeof(res)) != (ssize_t)sizeof(res))
+				_exit(2);
+			_exit(0);
+		}
+
+		close(fd[1]);
+		n = read(fd[0], &res, sizeof(res));
+		close(fd[0]);
+		if (wait4(pid, &status, 0, &ru) == -1 || n != (ssize_t)sizeof(res)) {
+			fprintf(stderr, "pool_churn failed for %s.\n", pool_size_tbl[i].name);
+			continue;
+		}
+
+		/* ru_maxrss is in KB on Linux and the BSDs. */
+		snprintf(extra, sizeof(extra),
+			 ", \"reuse\": %llu, \"discard\": %llu, "
+			 "\"peak_pooled_mb\": %.1f, \"peak_rss_mb\": %.1f",
+			 (unsigned long long)res.stats.reuse_count,
+			 (unsigned long long)res.stats.discard_count,
+			 (double)res.stats.peak_pooled_bytes / 1048576.0,
+			 (double)ru.ru_maxrss / 1024.0);
+		report("pool_churn", "1280x720", pool_size_tbl[i].name, res.mpix, extra);
+	}
+}
+
+/*
+ * Replace the images for round_sec, in the same rounds as measure().
+ *  - Counted by the pixels of the created images.
+ */
+static void run_pool_churn(int pool_size, struct churn_result *res)
+{
+	struct image *slot[CHURN_SLOTS];
+	double start, elapsed, mpix;
+	uint64_t pixels;
+	int step, i;
+
+	conf_window_width = 1280;
+	conf_window_height = 720;
+	conf_image_pool_size = pool_size;
+	init_image_pool();
+
+	memset(slot, 0, sizeof(slot));
+	step = 0;
+	res->mpix = 0;
+	for (i = 0; i < ROUND_COUNT; i++) {
+		pixels = 0;
+		start = now();
+		do {
+			pixels += churn_once(slot, step++);
+			elapsed = now() - start;
+		} while (elapsed < round_sec);
+
+		mpix = (double)pixels / elapsed / 1000000.0;
+		if (mpix > res->mpix)
+			res->mpix = mpix;
+	}
+
+	get_image_pool_stats(&res->stats);
+
+	for (i = 0; i < CHURN_SLOTS; i++)
+		destroy_image(slot[i]);
+}
+
+/*
+ * Replace an image.
+ *  - Every fourth step changes @bg, and the others change a @ch of a
+ *    varying width.
+ *  - The new image is loaded before the old one is destroyed, and its
+ *    pixels are written once as the decoder does.
+ */
+static uint64_t churn_once(struct image **slot, int step)
+{
+	static const int ch_width_tbl[] = {560, 600, 640, 700};
+	struct image *img;
+	int i, w, h;
+
+	i = step % CHURN_SLOTS;
+	if (i == 0)
+		w = conf_window_width;
+	else
+		w = ch_width_tbl[(step / CHURN_SLOTS + i) % 4];
+	h = conf_window_height;
+
+	img = create_image(w, h);
+	if (img == NULL)
+		_exit(2);
+	memset(img->pixels, 0xff, (size_t)w * (size_t)h * sizeof(pixel_t));
+
+	if (slot[i] != NULL)
+		destroy_image(slot[i]);
+	slot[i] = img;
+
+	return (uint64_t)w * (uint64_t)h;
+}
+
+/*
+ * Fill a source image with an alpha pattern.
+ *  - The color components don't exceed alpha, so the same data is valid
+ *    for USE_PREMULTIPLIED_ALPHA.
+ */
+static void fill_source(struct image *img, int pattern)
+{
+	pixel_t *p;
+	uint32_t a, r, g, b;
+	int x, y;
+
+	p = img->pixels;
+	for (y = 0; y < img->height; y++) {
+		for (x = 0; x < img->width; x++) {
+			switch (pattern) {
+			case PATTERN_OPAQUE:
+				a = 255;
+				break;
+			case PATTERN_MIXED:
+				a = next_random() & 255;
+				break;
+			case PATTERN_SPRITE:
+				if (x >= img->width / 4 && x < img->width * 3 / 4 && y >= img->height / 8)
+					a = 255;
+				else
+					a = 0;
+				break;
+			default:
+				a = 0;
+				break;
+			}
+			r = next_random() % (a + 1);
+			g = next_random() % (a + 1);
+			b = next_random() % (a + 1);
+			*p++ = make_pixel(a, r, g, b);
+		}
+	}
+
+	/* Set the content box and the opacity, as the image loader does. */
+	analyze_image_alpha(img);
+	notify_image_update(img);
+}
+
+/* Fill a rule image with a horizontal gradient. */
+static void fill_rule(struct image *img)
+{
+	pixel_t *p;
+	uint32_t v;
+	int x, y;
+
+	p = img->pixels;
+	for (y = 0; y < img->height; y++) {
+		for (x = 0; x < img->width; x++) {
+			v = (uint32_t)(x * 255 / (img->width - 1));
+			*p++ = make_pixel(255, v, v, v);
+		}
+	}
+	notify_image_update(img);
+}
+
+/*
+ * Measure a case.
+ *  - The first call selects the kernels and faults the pages in.
+ *  - Each round repeats the kernel for round_sec, and the best round is
+ *    used so that an interruption by the OS doesn't count.
+ */
+static double measure(const struct kernel *k, struct bench_ctx *ctx)
+{
+	double start, elapsed, mpix, best;
+	uint64_t pixels;
+	int i;
+
+	k->run(ctx);
+
+	best = 0;
+	for (i = 0; i < ROUND_COUNT; i++) {
+		pixels = 0;
+		start = now();
+		do {
+			pixels += k->run(ctx);
+			elapsed = now() - start;
+		} while (elapsed < round_sec);
+
+		mpix = (double)pixels / elapsed / 1000000.0;
+		if (mpix > best)
+			best = mpix;
+	}
+	return best;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+/* xorshift32 with a fixed seed, so that every run uses the same images. */
+static uint32_t next_random(void)
+{
+	static uint32_t state = 2463534242U;
+
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+/*
+ * Print a result, and compare it with the baseline.
+ *  - extra is printed after mpix_per_s, so load_baseline() still reads it.
+ */
+static void report(const char *kernel, const char *size, const char *alpha, double mpix,
+		   const char *extra)
+{
+	double change;
+	int i;
+
+	printf("%s\n    {\"kernel\": \"%s\", \"size\": \"%s\", \"alpha\": \"%s\", \"mpix_per_s\": %.1f%s}",
+	       result_count == 0 ? "" : ",", kernel, size, alpha, mpix, extra);
+	fflush(stdout);
+	result_count++;
+
+	for (i = 0; i < baseline_count; i++) {
+		if (strcmp(baseline[i].kernel, kernel) == 0 &&
+		    strcmp(baseline[i].size, size) == 0 &&
+		    strcmp(baseline[i].alpha, alpha) == 0)
+			break;
+	}
+	if (i == baseline_count || baseline[i].mpix <= 0)
+		return;
+
+	change = (mpix / baseline[i].mpix - 1.0) * 100.0;
+	fprintf(stderr, "%-14s %-10s %-12s %10.1f -> %10.1f MPix/s (%+6.1f%%)%s\n",
+		kernel, size, alpha, baseline[i].mpix, mpix, change,
+		change < -threshold ? "  SLOWER" : "");
+	if (change < -threshold)
+		regression_count++;
+}
+
+/*
+ * Kernels
+ */
+
+static uint64_t run_copy(struct bench_ctx *ctx)
+{
+	draw_image_copy(ctx->dst, 0, 0, ctx->src, ctx->w, ctx->h, 0, 0);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+static uint64_t run_fast(struct bench_ctx *ctx)
+{
+	draw_image_fast(ctx->dst, 0, 0, ctx->src, ctx->w, ctx->h, 0, 0, 255);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+static uint64_t run_fast_alpha(struct bench_ctx *ctx)
+{
+	draw_image_fast(ctx->dst, 0, 0, ctx->src, ctx->w, ctx->h, 0, 0, 128);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+static uint64_t run_add(struct bench_ctx *ctx)
+{
+	draw_image_add(ctx->dst, 0, 0, ctx->src, ctx->w, ctx->h, 0, 0, 255);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+static uint64_t run_dim(struct bench_ctx *ctx)
+{
+	draw_image_dim(ctx->dst, 0, 0, ctx->src, ctx->w, ctx->h, 0, 0, 255);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+static uint64_t run_emoji(struct bench_ctx *ctx)
+{
+	draw_image_emoji(ctx->dst, 0, 0, ctx->src, ctx->w, ctx->h, 0, 0, 255);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+static uint64_t run_rule(struct bench_ctx *ctx)
+{
+	draw_image_rule(ctx->dst, ctx->src, ctx->rule, 128);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+static uint64_t run_melt(struct bench_ctx *ctx)
+{
+	draw_image_melt(ctx->dst, ctx->src, ctx->rule, 128);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+/* Shrink to a quarter. (Counted by the source pixels.) */
+static uint64_t run_scale_nearest(struct bench_ctx *ctx)
+{
+	draw_image_scale(ctx->thumb, ctx->w, ctx->h, 0, 0, ctx->src, SCALE_FILTER_NEAREST);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+static uint64_t run_scale_box(struct bench_ctx *ctx)
+{
+	draw_image_scale(ctx->thumb, ctx->w, ctx->h, 0, 0, ctx->src, SCALE_FILTER_BOX);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+/*
+ * Draw the layers to a save data thumbnail as draw_stage_to_thumb() does.
+ *  - Every layer is src of the screen size. (Counted by the source pixels.)
+ */
+static uint64_t run_thumb_common(struct bench_ctx *ctx, int filter)
+{
+	int i;
+
+	for (i = 0; i < THUMB_LAYERS; i++)
+		draw_image_scale(ctx->save_thumb, ctx->w, ctx->h, 0, 0, ctx->src, filter);
+	return (uint64_t)THUMB_LAYERS * (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+static uint64_t run_thumb(struct bench_ctx *ctx)
+{
+	return run_thumb_common(ctx, SCALE_FILTER_NEAREST);
+}
+
+static uint64_t run_thumb_box(struct bench_ctx *ctx)
+{
+	return run_thumb_common(ctx, SCALE_FILTER_BOX);
+}
+
+/* A stage-like frame: a background, two characters and a dimmed one. */
+static uint64_t run_ops(struct bench_ctx *ctx)
+{
+	struct draw_op ops[5];
+	int cw;
+
+	memset(ops, 0, sizeof(ops));
+	cw = ctx->w / 2;
+
+	ops[0].type = DRAW_OP_CLEAR;
+	ops[0].color = make_pixel(255, 0, 0, 0);
+
+	ops[1].type = DRAW_OP_COPY;
+	ops[1].src_image = ctx->rule;
+	ops[1].width = ctx->w;
+	ops[1].height = ctx->h;
+
+	ops[2].type = DRAW_OP_FAST;
+	ops[2].src_image = ctx->src;
+	ops[2].dst_left = 0;
+	ops[2].width = cw;
+	ops[2].height = ctx->h;
+	ops[2].alpha = 255;
+
+	ops[3].type = DRAW_OP_FAST;
+	ops[3].src_image = ctx->src;
+	ops[3].dst_left = ctx->w - cw;
+	ops[3].src_left = ctx->w - cw;
+	ops[3].width = cw;
+	ops[3].height = ctx->h;
+	ops[3].alpha = 255;
+
+	ops[4].type = DRAW_OP_DIM;
+	ops[4].src_image = ctx->src;
+	ops[4].dst_left = ctx->w / 4;
+	ops[4].src_left = ctx->w / 4;
+	ops[4].width = cw;
+	ops[4].height = ctx->h;
+	ops[4].alpha = 255;
+
+	draw_image_ops(ctx->dst, ops, 5);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+/*
+ * The full lineup of draw_fo_common(): the clear, the background, the
+ * second background, six characters (one dimmed), the message box, the
+ * name box and the face.
+ *  - The characters are slices of src, and the boxes are slices of rule.
+ */
+static uint64_t run_fo_lineup(struct bench_ctx *ctx)
+{
+	struct draw_op ops[12];
+	int i, n, cw;
+
+	memset(ops, 0, sizeof(ops));
+	cw = ctx->w * 2 / 5;
+	n = 0;
+
+	/* begin_layer_ops() */
+	ops[n].type = DRAW_OP_CLEAR;
+	ops[n++].color = make_pixel(255, 0, 0, 0);
+
+	/* LAYER_BG and LAYER_BG2 */
+	ops[n].type = DRAW_OP_COPY;
+	ops[n].src_image = ctx->rule;
+	ops[n].width = ctx->w;
+	ops[n++].height = ctx->h;
+	ops[n].type = DRAW_OP_FAST;
+	ops[n].src_image = ctx->src;
+	ops[n].width = ctx->w;
+	ops[n].height = ctx->h;
+	ops[n++].alpha = 128;
+
+	/* LAYER_CHB, LAYER_CHL, LAYER_CHLC, LAYER_CHR, LAYER_CHRC and LAYER_CHC */
+	for (i = 0; i < 6; i++) {
+		ops[n].type = i == 0 ? DRAW_OP_DIM : DRAW_OP_FAST;
+		ops[n].src_image = ctx->src;
+		ops[n].dst_left = (ctx->w - cw) * i / 5;
+		ops[n].src_left = (ctx->w - cw) * i / 5;
+		ops[n].width = cw;
+		ops[n].height = ctx->h;
+		ops[n++].alpha = 255;
+	}
+
+	/* LAYER_MSG, LAYER_NAME and LAYER_CHF */
+	ops[n].type = DRAW_OP_FAST;
+	ops[n].src_image = ctx->src;
+	ops[n].dst_top = ops[n].src_top = ctx->h * 3 / 4;
+	ops[n].width = ctx->w;
+	ops[n].height = ctx->h / 4;
+	ops[n++].alpha = 255;
+	ops[n].type = DRAW_OP_FAST;
+	ops[n].src_image = ctx->src;
+	ops[n].dst_left = ops[n].src_left = ctx->w / 16;
+	ops[n].dst_top = ops[n].src_top = ctx->h * 2 / 3;
+	ops[n].width = ctx->w / 6;
+	ops[n].height = ctx->h / 16;
+	ops[n++].alpha = 255;
+	ops[n].type = DRAW_OP_FAST;
+	ops[n].src_image = ctx->src;
+	ops[n].dst_top = ops[n].src_top = ctx->h * 3 / 4;
+	ops[n].width = ctx->h / 4;
+	ops[n].height = ctx->h / 4;
+	ops[n++].alpha = 255;
+
+	draw_image_ops(ctx->dst, ops, n);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+/* Only the clear of a frame, split into the bands. */
+static uint64_t run_ops_clear(struct bench_ctx *ctx)
+{
+	struct draw_op op;
+
+	memset(&op, 0, sizeof(op));
+	op.type = DRAW_OP_CLEAR;
+	op.color = make_pixel(255, 32, 64, 96);
+
+	draw_image_ops(ctx->dst, &op, 1);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+static uint64_t run_clear(struct bench_ctx *ctx)
+{
+	clear_image_color(ctx->dst, make_pixel(255, 32, 64, 96));
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+/* Clear the center, like a message box. */
+static uint64_t run_clear_rect(struct bench_ctx *ctx)
+{
+	int w, h;
+
+	w = ctx->w * 3 / 4;
+	h = ctx->h * 3 / 4;
+	clear_image_color_rect(ctx->dst, ctx->w / 8, ctx->h / 8, w, h,
+			       make_pixel(128, 32, 32, 32));
+	return (uint64_t)w * (uint64_t)h;
+}
+
+/* Clear the text lines of a message box. */
+static uint64_t run_clear_rects(struct bench_ctx *ctx)
+{
+	struct image_rect rects[4];
+	uint64_t pixels;
+	int i;
+
+	pixels = 0;
+	for (i = 0; i < 4; i++) {
+		rects[i].x = ctx->w / 16;
+		rects[i].y = ctx->h / 4 + ctx->h / 8 * i;
+		rects[i].w = ctx->w * 3 / 4;
+		rects[i].h = ctx->h / 16;
+		pixels += (uint64_t)rects[i].w * (uint64_t)rects[i].h;
+	}
+	clear_image_color_rects(ctx->dst, rects, 4, make_pixel(0, 0, 0, 0));
+	return pixels;
+}
+
+static uint64_t run_fill_alpha(struct bench_ctx *ctx)
+{
+	fill_image_alpha(ctx->dst);
+	return (uint64_t)ctx->w * (uint64_t)ctx->h;
+}
+
+/* Draw GLYPH_TEXT. (Counted by the glyph cells.) */
+static uint64_t run_glyph_common(struct bench_ctx *ctx, bool use_outline)
+{
+	const char *s;
+	uint32_t c;
+	uint64_t pixels;
+	int x, y, w, h, len;
+
+	pixels = 0;
+	x = 0;
+	y = 0;
+	s = GLYPH_TEXT;
+	while (*s != '\0') {
+		len = utf8_to_utf32(s, &c);
+		if (len <= 0)
+			break;
+		s += len;
+
+		if (!draw_glyph(ctx->dst, FONT_GLOBAL, ctx->font_size, ctx->font_size,
+				use_outline, 2, x, y, make_pixel(255, 255, 255, 255),
+				make_pixel(255, 0, 0, 0), c, &w, &h, false))
+			break;
+		pixels += (uint64_t)w * (uint64_t)h;
+
+		x += w;
+		if (x + ctx->font_size * 2 > ctx->w) {
+			x = 0;
+			y += h;
+		}
+	}
+	return pixels;
+}
+
+/*
+ * Reveal GLYPH_TEXT into the message layer, a character per frame.
+ *  - After each character, the texture upload is counted and the dirty
+ *    rectangle is emptied, as the OpenGL HAL does. (Counted by the glyph
+ *    cells.)
+ *  - The message box is cleared first, and that upload is not counted.
+ */
+static uint64_t run_upload(struct bench_ctx *ctx)
+{
+	const char *s;
+	uint32_t c;
+	uint64_t pixels;
+	int x, y, w, h, len;
+
+	clear_image_color(ctx->dst, make_pixel(128, 0, 0, 0));
+	get_upload_bytes(ctx->dst);
+
+	pixels = 0;
+	x = 0;
+	y = 0;
+	s = GLYPH_TEXT;
+	while (*s != '\0') {
+		len = utf8_to_utf32(s, &c);
+		if (len <= 0)
+			break;
+		s += len;
+
+		if (!draw_glyph(ctx->dst, FONT_GLOBAL, ctx->font_size, ctx->font_size,
+				true, 2, x, y, make_pixel(255, 255, 255, 255),
+				make_pixel(255, 0, 0, 0), c, &w, &h, false))
+			break;
+		pixels += (uint64_t)w * (uint64_t)h;
+
+		upload_dirty_bytes += get_upload_bytes(ctx->dst);
+		upload_full_bytes += (uint64_t)ctx->w * (uint64_t)ctx->h * sizeof(pixel_t);
+		upload_frames++;
+
+		x += w;
+		if (x + ctx->font_size * 2 > ctx->w) {
+			x = 0;
+			y += h;
+		}
+	}
+	return pixels;
+}
+
+/*
+ * Get the bytes that update_texture_if_needed() of the OpenGL HAL sends,
+ * and empty the dirty rectangle.
+ *  - The full-width rows of the dirty rectangle, or the whole image.
+ */
+static uint64_t get_upload_bytes(struct image *img)
+{
+	uint64_t rows;
+
+	if (img->dirty_left < img->dirty_right)
+		rows = (uint64_t)(img->dirty_bottom - img->dirty_top);
+	else
+		rows = (uint64_t)img->height;
+
+	img->dirty_left = 0;
+	img->dirty_top = 0;
+	img->dirty_right = 0;
+	img->dirty_bottom = 0;
+
+	return rows * (uint64_t)img->width * sizeof(pixel_t);
+}
+
+static uint64_t run_glyph(struct bench_ctx *ctx)
+{
+	return run_glyph_common(ctx, false);
+}
+
+static uint64_t run_glyph_outline(struct bench_ctx *ctx)
+{
+	return run_glyph_common(ctx, true);
+}
+
+/*
+ * Checks
+ */
+
+/* Test the alpha handling. */
+static bool check_alpha(void)
+{
+	bool ok;
+
+	ok = true;
+#if defined(USE_PREMULTIPLIED_ALPHA)
+	ok = check_premultiply() && ok;
+#endif
+	ok = check_blend() && ok;
+	return ok;
+}
+
+#if defined(USE_PREMULTIPLIED_ALPHA)
+/*
+ * Test premultiply_image_alpha() for every alpha and color value.
+ *  - Each channel must be round(c * a / 255), and the alpha value is kept.
+ *  - Dividing it by the alpha value must give back the straight color
+ *    within the rounding error, which is 255 / (2 * a) + 0.5.
+ */
+static bool check_premultiply(void)
+{
+	struct image *img;
+	pixel_t p;
+	uint32_t a, c, pr, pg, pb, back;
+	int fail;
+
+	img = create_image(256, 256);
+	if (img == NULL)
+		exit(2);
+	for (a = 0; a < 256; a++) {
+		for (c = 0; c < 256; c++)
+			img->pixels[a * 256 + c] = make_pixel(a, c, 255 - c, c ^ 0x5a);
+	}
+	premultiply_image_alpha(img);
+
+	fail = 0;
+	for (a = 0; a < 256; a++) {
+		for (c = 0; c < 256; c++) {
+			p = img->pixels[a * 256 + c];
+			pr = get_pixel_r(p);
+			pg = get_pixel_g(p);
+			pb = get_pixel_b(p);
+			if (get_pixel_a(p) != a ||
+			    pr != (c * a * 2 + 255) / 510 ||
+			    pg != ((255 - c) * a * 2 + 255) / 510 ||
+			    pb != ((c ^ 0x5a) * a * 2 + 255) / 510) {
+				if (fail++ == 0)
+					fprintf(stderr, "premultiply: a=%u c=%u gives %08x\n",
+						a, c, (unsigned int)p);
+				continue;
+			}
+			if (a == 0)
+				continue;
+			back = (pr * 255 + a / 2) / a;
+			if ((back > c ? back - c : c - back) * 2 * a > 255 + a) {
+				if (fail++ == 0)
+					fprintf(stderr, "premultiply: a=%u c=%u comes back as %u\n",
+						a, c, back);
+			}
+		}
+	}
+	destroy_image(img);
+
+	printf("premultiply: %s\n", fail == 0 ? "ok" : "failed");
+	return fail == 0;
+}
+#endif
+
+/*
+ * Test draw_image_fast() against the floating point blend of the straight
+ * colors, with some opacities.
+ *  - The source is stored as the image loader stores it, so the result must
+ *    be the same in both alpha modes.
+ */
+static bool check_blend(void)
+{
+	static const uint32_t opacity_tbl[] = {255, 200, 17};
+	struct image *src, *dst;
+	pixel_t *straight, *base, s, d;
+	double f;
+	uint32_t a;
+	int i, j, n, diff, max_diff;
+
+	n = CHECK_SIZE * CHECK_SIZE;
+	src = create_image(CHECK_SIZE, CHECK_SIZE);
+	dst = create_image(CHECK_SIZE, CHECK_SIZE);
+	straight = malloc((size_t)n * sizeof(pixel_t));
+	base = malloc((size_t)n * sizeof(pixel_t));
+	if (src == NULL || dst == NULL || straight == NULL || base == NULL)
+		exit(2);
+	for (i = 0; i < n; i++) {
+		a = next_random() & 255;
+		straight[i] = make_pixel(a, next_random() & 255, next_random() & 255,
+					 next_random() & 255);
+		src->pixels[i] = a == 0 ? 0 : straight[i];
+		base[i] = make_pixel(255, next_random() & 255, next_random() & 255,
+				     next_random() & 255);
+	}
+#if defined(USE_PREMULTIPLIED_ALPHA)
+	premultiply_image_alpha(src);
+#endif
+	analyze_image_alpha(src);
+	notify_image_update(src);
+
+	max_diff = 0;
+	for (j = 0; j < (int)(sizeof(opacity_tbl) / sizeof(opacity_tbl[0])); j++) {
+		memcpy(dst->pixels, base, (size_t)n * sizeof(pixel_t));
+		notify_image_update(dst);
+		draw_image_fast(dst, 0, 0, src, CHECK_SIZE, CHECK_SIZE, 0, 0, (int)opacity_tbl[j]);
+		for (i = 0; i < n; i++) {
+			s = straight[i];
+			d = base[i];
+			f = (double)get_pixel_a(s) / 255.0 * (double)opacity_tbl[j] / 255.0;
+			diff = diff_channel(get_pixel_r(dst->pixels[i]),
+					    get_pixel_r(s) * f + get_pixel_r(d) * (1.0 - f));
+			if (diff > max_diff)
+				max_diff = diff;
+			diff = diff_channel(get_pixel_g(dst->pixels[i]),
+					    get_pixel_g(s) * f + get_pixel_g(d) * (1.0 - f));
+			if (diff > max_diff)
+				max_diff = diff;
+			diff = diff_channel(get_pixel_b(dst->pixels[i]),
+					    get_pixel_b(s) * f + get_pixel_b(d) * (1.0 - f));
+			if (diff > max_diff)
+				max_diff = diff;
+		}
+	}
+	destroy_image(src);
+	destroy_image(dst);
+	free(straight);
+	free(base);
+
+	printf("blend: %s (max %d LSB)\n", max_diff <= CHECK_TOLERANCE ? "ok" : "failed",
+	       max_diff);
+	return max_diff <= CHECK_TOLERANCE;
+}
+
+/* Get the difference of a channel from the floating point value. (LSB) */
+static int diff_channel(uint32_t actual, double expected)
+{
+	double d;
+
+	d = (double)actual - expected;
+	if (d < 0)
+		d = -d;
+	return (int)(d + 0.5);
+}
@@ -46,6 +46,11 @@ int conf_window_resize;
 int conf_window_default_width;
 int conf_window_default_height;
 
+/*
+ * 画像のメモリプールの設定
+ */
+int conf_image_pool_size;
+
 /*
  * ページモードの設定
  */
@@ -223,6 +228,7 @@ char *conf_switch_anime_unfocus[10];
  */
 int conf_save_data_thumb_width;
 int conf_save_data_thumb_height;
+int conf_save_data_thumb_filter;
 char *conf_save_data_new;
 
 /* 
@@ -529,6 +535,7 @@ static struct rule {
 	{"window.resize", 'i', &conf_window_resize, OPTIONAL, NOSAVE},
 	{"window.default.width", 'i', &conf_window_default_width, OPTIONAL, NOSAVE},
 	{"window.default.height", 'i', &conf_window_default_height, OPTIONAL, NOSAVE},
+	{"image.pool.size", 'i', &conf_image_pool_size, OPTIONAL, NOSAVE},
 	{"script.page", 'i', &conf_script_page, OPTIONAL, SAVE},
 	{"font.select", 'i', &conf_font_select, OPTIONAL, SAVE},
 	{"font.file", 's', &conf_font_global_file, MUST, SAVE},
@@ -747,6 +754,7 @@ static struct rule {
 	{"switch.anime.unfocus10", 's', &conf_switch_anime_unfocus[9], OPTIONAL, SAVE},
 	{"save.data.thumb.width", 'i', &conf_save_data_thumb_width, MUST, NOSAVE},
 	{"save.data.thumb.height", 'i', &conf_save_data_thumb_height, MUST, NOSAVE},
+	{"save.data.thumb.filter", 'i', &conf_save_data_thumb_filter, OPTIONAL, NOSAVE},
 	{"save.data.new", 's', &conf_save_data_new, OPTIONAL, NOSAVE},
 	{"sysmenu.x", 'i', &conf_sysmenu_x, MUST, SAVE},
 	{"sysmenu.y", 'i', &conf_sysmenu_y, MUST, SAVE},
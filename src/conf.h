@@ -54,6 +54,11 @@ extern int conf_window_resize;
 extern int conf_window_default_width;
 extern int conf_window_default_height;
 
+/*
+ * 画像のメモリプールの設定
+ */
+extern int conf_image_pool_size;
+
 /*
  * ページモードの設定
  */
@@ -230,6 +235,7 @@ extern char *conf_switch_anime_unfocus[10];
  */
 extern int conf_save_data_thumb_width;
 extern int conf_save_data_thumb_height;
+extern int conf_save_data_thumb_filter;
 extern char *conf_save_data_new;
 
 /* 
@@ -0,0 +1,182 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Polaris Engine
+ * Copyright (C) 2024, The Authors. All rights reserved.
+ */
+
+/*
+ * CPU Feature Detection
+ *  - x86_64: SSE2 is a part of the architecture. SSSE3 and AVX2 are
+ *    detected by cpuid, and AVX2 also needs the OS support of the YMM
+ *    registers (xgetbv).
+ *  - Arm64: NEON (Advanced SIMD) is a part of the architecture.
+ *  - Others: Scalar only.
+ */
+
+#include "polarisengine.h"
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>	/* _xgetbv() */
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+/* The environment variable to force a tier. */
+#define TIER_ENV	"POLARIS_ENGINE_SIMD"
+
+/* The tier names. (indexed by enum cpu_tier) */
+static const char *tier_name[] = {
+	"scalar",
+	"sse2",
+	"ssse3",
+	"avx2",
+	"neon",
+};
+
+/* The selected tier. (-1 before the detection) */
+static int cpu_tier = -1;
+
+/*
+ * Forward declarations.
+ */
+static int detect_cpu_tier(void);
+static bool is_tier_supported(int tier, int detected);
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *reg);
+static uint64_t xgetbv0(void);
+#endif
+
+/*
+ * Get the SIMD tier to use.
+ *  - The detection runs on the first call, so call this from the main
+ *    thread before starting a thread that uses kernels.
+ */
+int get_cpu_tier(void)
+{
+#if !defined(POLARIS_ENGINE_TARGET_UNITY)
+	const char *env;
+	int i;
+#endif
+	int detected;
+
+	if (cpu_tier != -1)
+		return cpu_tier;
+
+	detected = detect_cpu_tier();
+	cpu_tier = detected;
+
+#if !defined(POLARIS_ENGINE_TARGET_UNITY)
+	/* Apply a forced tier. */
+	env = getenv(TIER_ENV);
+	if (env == NULL || env[0] == '\0')
+		return cpu_tier;
+	for (i = 0; i < (int)(sizeof(tier_name) / sizeof(tier_name[0])); i++) {
+		if (strcmp(env, tier_name[i]) == 0)
+			break;
+	}
+	if (i == (int)(sizeof(tier_name) / sizeof(tier_name[0])) ||
+	    !is_tier_supported(i, detected)) {
+		log_warn("%s=%s is not supported on this CPU. Using %s.",
+			 TIER_ENV, env, tier_name[detected]);
+		return cpu_tier;
+	}
+	cpu_tier = i;
+	log_info("%s=%s is applied.", TIER_ENV, tier_name[i]);
+#endif
+
+	return cpu_tier;
+}
+
+/*
+ * Get the name of a SIMD tier.
+ */
+const char *get_cpu_tier_name(int tier)
+{
+	assert(tier >= CPU_TIER_SCALAR && tier <= CPU_TIER_NEON);
+
+	return tier_name[tier];
+}
+
+/* Detect the highest tier of the CPU. */
+static int detect_cpu_tier(void)
+{
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+	uint32_t reg[4];	/* EAX, EBX, ECX, EDX */
+	uint32_t max_leaf;
+
+	/* Get the maximum leaf. */
+	cpuid(0, 0, reg);
+	max_leaf = reg[0];
+
+	/* Check SSSE3. */
+	cpuid(1, 0, reg);
+	if ((reg[2] & (1U << 9)) == 0)
+		return CPU_TIER_SSE2;
+
+	/* Check that the OS saves the YMM registers. (OSXSAVE and AVX) */
+	if ((reg[2] & (1U << 27)) == 0 || (reg[2] & (1U << 28)) == 0)
+		return CPU_TIER_SSSE3;
+	if ((xgetbv0() & 6) != 6)
+		return CPU_TIER_SSSE3;
+
+	/* Check AVX2. */
+	if (max_leaf < 7)
+		return CPU_TIER_SSSE3;
+	cpuid(7, 0, reg);
+	if ((reg[1] & (1U << 5)) == 0)
+		return CPU_TIER_SSSE3;
+
+	return CPU_TIER_AVX2;
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+	return CPU_TIER_NEON;
+#else
+	return CPU_TIER_SCALAR;
+#endif
+}
+
+/* Check if a tier can run on the CPU. */
+static bool is_tier_supported(int tier, int detected)
+{
+	if (tier == CPU_TIER_SCALAR)
+		return true;
+	if (detected == CPU_TIER_NEON)
+		return tier == CPU_TIER_NEON;
+	if (tier == CPU_TIER_NEON)
+		return false;
+	return tier <= detected;
+}
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+/* Execute cpuid. */
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *reg)
+{
+#if defined(_MSC_VER)
+	int r[4];
+
+	__cpuidex(r, (int)leaf, (int)subleaf);
+	reg[0] = (uint32_t)r[0];
+	reg[1] = (uint32_t)r[1];
+	reg[2] = (uint32_t)r[2];
+	reg[3] = (uint32_t)r[3];
+#else
+	__cpuid_count(leaf, subleaf, reg[0], reg[1], reg[2], reg[3]);
+#endif
+}
+
+/* Get XCR0. (Call only if OSXSAVE is set.) */
+static uint64_t xgetbv0(void)
+{
+#if defined(_MSC_VER)
+	return (uint64_t)_xgetbv(0);
+#else
+	uint32_t eax, edx;
+
+	__asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+#endif
@@ -0,0 +1,53 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Polaris Engine
+ * Copyright (C) 2024, The Authors. All rights reserved.
+ */
+
+/*
+ * CPU Feature Detection
+ *  - Detects the SIMD features of the running CPU on the first call.
+ *  - Subsystems select their kernels by function pointers with the tier.
+ *  - The environment variable POLARIS_ENGINE_SIMD forces a tier:
+ *    "scalar", "sse2", "ssse3", "avx2" or "neon".
+ *    A tier the CPU doesn't support is ignored with a warning.
+ */
+
+#ifndef POLARIS_ENGINE_CPU_H
+#define POLARIS_ENGINE_CPU_H
+
+#include "types.h"
+
+/*
+ * SIMD tiers.
+ *  - On x86_64, a higher tier includes the lower ones.
+ *  - On Arm64, the tier is either CPU_TIER_SCALAR or CPU_TIER_NEON.
+ */
+enum cpu_tier {
+	CPU_TIER_SCALAR,
+	CPU_TIER_SSE2,
+	CPU_TIER_SSSE3,
+	CPU_TIER_AVX2,
+	CPU_TIER_NEON,
+};
+
+/*
+ * Attributes to compile a kernel for a tier higher than the build flags.
+ *  - MSVC accepts the intrinsics without them.
+ */
+#if defined(POLARIS_ENGINE_ARCH_X86_64) && (defined(__GNUC__) || defined(__llvm__))
+#define TARGET_SSSE3	__attribute__((target("ssse3")))
+#define TARGET_AVX2	__attribute__((target("avx2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
+/* Get the SIMD tier to use. */
+int get_cpu_tier(void);
+
+/* Get the name of a SIMD tier. */
+const char *get_cpu_tier_name(int tier);
+
+#endif
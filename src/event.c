@@ -24,6 +24,9 @@ bool on_event_init(void)
 	/* 変数の初期化処理を行う */
 	init_vars();
 
+	/* 画像のメモリプールを初期化する */
+	init_image_pool();
+
 	/* 文字レンダリングエンジンの初期化処理を行う */
 	if (!init_glyph())
 		return false;
@@ -35,6 +38,10 @@ bool on_event_init(void)
 	if (!init_save())
 		return false;
 
+	/* ワーカスレッドを開始する */
+	if (!init_workers())
+		return false;
+
 	/* ステージの初期化処理を行う */
 	if (!init_stage())
 		return false;
@@ -69,6 +76,9 @@ void on_event_cleanup(void)
 	/* ゲームループの終了処理を行う */
 	cleanup_game_loop();
 
+	/* 画像のデコード結果キャッシュを解放する */
+	cleanup_image_cache();
+
 	/* GUIの終了処理を行う */
 	cleanup_gui();
 
@@ -87,12 +97,18 @@ void on_event_cleanup(void)
 	/* ステージの終了処理を行う */
 	cleanup_stage();
 
+	/* ワーカスレッドを終了する */
+	cleanup_workers();
+
 	/* ミキサの終了処理を行う */
 	cleanup_mixer();
 
 	/* 文字レンダリングエンジンの終了処理を行う */
 	cleanup_glyph();
 
+	/* 画像のメモリプールを解放する */
+	cleanup_image_pool();
+
 	/* 変数の終了処理を行う */
 	cleanup_vars();
 }
@@ -26,11 +26,41 @@
 
 /*
  * fcntl.h is required on Win32.
+ *  - io.h is for _commit().
  */
 #ifdef POLARIS_ENGINE_TARGET_WIN32
 #include <fcntl.h>
+#include <io.h>
 #endif
 
+/*
+ * Memory-mapped I/O
+ *  - On POSIX platforms (including Android and Emscripten), we use mmap() to
+ *    map the package and real files.
+ *  - On Win32, we use a file mapping object to map the package.
+ *  - On other platforms, we use stdio as a fallback.
+ */
+#if defined(POLARIS_ENGINE_TARGET_POSIX) || defined(POLARIS_ENGINE_TARGET_MACOS) || defined(POLARIS_ENGINE_TARGET_IOS) || \
+    defined(POLARIS_ENGINE_TARGET_ANDROID) || defined(POLARIS_ENGINE_TARGET_WASM)
+#define USE_MMAP_POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#elif defined(POLARIS_ENGINE_TARGET_WIN32)
+#define USE_MMAP_WIN32
+#include <windows.h>
+#endif
+
+/* Lock for the I/O statistics */
+#if defined(USE_FILE_STATS) && !defined(POLARIS_ENGINE_TARGET_WIN32)
+#include <pthread.h>
+#endif
+
+/* zlib for compressed package entries */
+#include <zlib.h>
+
 /* Obfuscation Key */
 #include "key.h"
 
@@ -46,8 +76,6 @@ static volatile uint64_t key_obfuscated =
 	  (((OBFUSCATION_KEY >> 16) & 0xff) << 40) |
 	  (((OBFUSCATION_KEY >> 8)  & 0xff) << 48) |
 	  (((OBFUSCATION_KEY >> 0)  & 0xff) << 56));
-static volatile uint64_t key_reversed;
-static volatile uint64_t *key_ref = &key_reversed;
 
 /*
  * These keys are not secrets.
@@ -55,6 +83,23 @@ static volatile uint64_t *key_ref = &key_reversed;
 #define NEXT_MASK1	0xafcb8f2ff4fff33f
 #define NEXT_MASK2	0xfcbfaff8f2f4f3f0
 
+/*
+ * Constants for the version 2 keystream. (Not secrets, too.)
+ */
+#define BLOCK_MUL1	0x9e3779b97f4a7c15
+#define BLOCK_MUL2	0xbf58476d1ce4e5b9
+#define BLOCK_MUL3	0x94d049bb133111eb
+
+/*
+ * SIMD for the version 2 keystream XOR.
+ *  - SSE2 and NEON are always available on x86_64 and Arm64.
+ */
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+#include <emmintrin.h>
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+
 /*
  * File read stream
  */
@@ -65,37 +110,169 @@ struct rfile {
 	/* Is obfuscated? */
 	bool is_obfuscated;
 
-	/* stdio FILE pointer */
+	/* stdio FILE pointer (NULL for a packaged file) */
 	FILE *fp;
 
 	/* Obfuscation parameters */
 	uint64_t next_random;
-	uint64_t prev_random;
 
 	/* Effective for a packaged file: */
 	uint64_t index;
+	uint64_t nonce;
 	uint64_t size;
 	uint64_t offset;
 	uint64_t pos;
+
+	/* Pointer to the entry body in the mapped package (or NULL) */
+	const unsigned char *map;
+
+	/* Whole content for map_rfile() (or NULL) */
+	const unsigned char *data;
+
+	/* Is the data a mapping of a real file? (Otherwise, it's a heap memory.) */
+	bool is_data_mapped;
+	size_t data_size;
+
+	/*
+	 * Decoded read buffer (or NULL)
+	 *  - Bytes in [buf_pos, buf_len) are read ahead but not consumed yet.
+	 */
+	unsigned char *buf;
+	size_t buf_size;
+	size_t buf_len;
+	size_t buf_pos;
+
+#if defined(USE_FILE_STATS)
+	/* Statistics of this stream. (Merged at close_rfile()) */
+	uint32_t stat_index;
+	uint64_t stat_bytes;
+	uint64_t stat_read_ns;
+	uint64_t stat_decode_ns;
+#endif
 };
 
+/* Size of the read buffer of a rfile. */
+#define RFILE_BUF_SIZE	(64 * 1024)
+
 /*
  * File write stream.
+ *  - The content is built in memory and written at close_wfile().
+ *  - The file is written to "path.tmp" and then renamed to the path, so
+ *    that a crash in a save leaves the old file as it is.
  */
 struct wfile {
+	/* Real path and temporary path. */
+	char *path;
+	char *tmp_path;
+
+	/* Content. (Obfuscated at close_wfile()) */
+	unsigned char *buf;
+	size_t size;
+	size_t alloc;
+
+	/* Whether a write is failed. */
+	bool is_failed;
+
+	/* Temporary file that is written but not committed yet. */
 	FILE *fp;
-	uint64_t next_random;
+
+	/* Next pending stream in a batch. */
+	struct wfile *next;
 };
 
+/* Initial size of the buffer of a wfile. */
+#define WFILE_BUF_SIZE	(64 * 1024)
+
+/* Suffix of a temporary file. */
+#define WFILE_TMP_SUFFIX	".tmp"
+
+/* Whether a batch of write streams is in progress. */
+static bool is_wfile_batch;
+
+/* Streams whose commits are deferred to end_wfile_batch(). (In order) */
+static struct wfile *pending_wfile_head;
+static struct wfile *pending_wfile_tail;
+
+/*
+ * Keystream of the save data.
+ *  - All save files are obfuscated by the same stream from the seed 0.
+ *  - The generator is serial, so we keep its bytes and extend them on demand.
+ */
+static unsigned char *save_keystream;
+static size_t save_keystream_size;
+static uint64_t save_keystream_next;
+
 /* File entries in the package. */
-static struct file_entry entry[FILE_ENTRY_SIZE];
+static struct file_entry *entry;
 
 /* File entry count. */
 static uint64_t entry_count;
 
+/* Whether each entry shares its body with other entries. */
+static bool *entry_shared;
+
 /* Package file path. */
 static char *package_path;
 
+/*
+ * Entry hash table.
+ *  - Open addressing with linear probing.
+ *  - A slot holds (entry index + 1), and 0 means an empty slot.
+ *  - Names are hashed with ASCII case folding to match strcasecmp().
+ */
+static uint32_t *entry_hash;
+
+/* Mask for the entry hash table size. (The size is a power of two.) */
+static uint32_t entry_hash_mask;
+
+/* Max entry count for the hash table. (The size 2^31 is the largest.) */
+#define ENTRY_HASH_MAX_COUNT	((uint64_t)1 << 30)
+
+/* Locations of a file. */
+#define LOCATION_NONE		(0)	/* Not found */
+#define LOCATION_FS		(1)	/* Real file system */
+#define LOCATION_PACKAGE	(2)	/* Package entry */
+
+/*
+ * Resolved location cache keyed by "dir/file".
+ *  - Misses are cached, too.
+ *  - Open addressing with linear probing, and NULL name means an empty slot.
+ *  - Used on the main thread. (Not on the editor, which changes files.)
+ */
+struct resolved_path {
+	char *name;
+	int location;
+	uint64_t index;
+};
+static struct resolved_path *resolved;
+static uint32_t resolved_count;
+static uint32_t resolved_mask;
+
+/* Package version. (1 to 4, see the package format in file.h) */
+static int package_version;
+
+/* Mapped package. (NULL if the package is read by stdio.) */
+static const unsigned char *package_map;
+
+/* Size of the mapped package. */
+static uint64_t package_map_size;
+
+/*
+ * The package is opened once and shared by all packaged streams.
+ *  - A read is done by a positional read, so there is no seek state.
+ */
+#if defined(USE_MMAP_POSIX)
+/* File descriptor of the package. */
+static int package_fd = -1;
+#elif defined(USE_MMAP_WIN32)
+/* File handle and file mapping handle of the package. */
+static HANDLE package_file_handle = INVALID_HANDLE_VALUE;
+static HANDLE package_map_handle;
+#else
+/* FILE pointer of the package. (Reads are not thread-safe.) */
+static FILE *package_fp;
+#endif
+
 /*
  * Use utf-8 to utf-16 conversion on Win32.
  */
@@ -103,14 +280,116 @@ static char *package_path;
 const wchar_t *conv_utf8_to_utf16(const char *s);
 #endif
 
+#if defined(USE_ACCESS_TRACE)
+/* Access trace output. (Appended across runs) */
+static FILE *trace_fp;
+#endif
+
+#if defined(USE_FILE_STATS)
+/* Output files of the I/O statistics. */
+#define FILE_STATS_CSV		"file-stats.csv"
+#define FILE_STATS_JSON		"file-stats.json"
+
+/*
+ * I/O statistics per (dir, file).
+ */
+struct file_stat {
+	/* "dir/file" */
+	char *name;
+
+	/* Is read from the package? (Otherwise, from the real file system.) */
+	bool is_packaged;
+
+	/* Number of open_rfile() calls. */
+	uint64_t open_count;
+
+	/* Decoded bytes read. */
+	uint64_t read_bytes;
+
+	/* Time spent in reading, including deobfuscation and decompression. */
+	uint64_t read_ns;
+
+	/* Time spent in deobfuscation. */
+	uint64_t decode_ns;
+};
+
+/* Statistics in the order of the first open. */
+static struct file_stat *stats;
+static uint32_t stats_count;
+static uint32_t stats_alloc;
+
+/* Hash table of the statistics. (A slot holds (index + 1), and 0 means empty.) */
+static uint32_t *stats_hash;
+static uint32_t stats_hash_mask;
+
+/* Lock for the statistics. (Streams may be used on multiple threads.) */
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+static SRWLOCK stats_lock = SRWLOCK_INIT;
+#else
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+#endif
+
 /*
  * Forward declarations.
  */
+#if !defined(USE_EDITOR)
+static bool build_entry_hash(void);
+static bool open_package(void);
+static void map_package(void);
+#endif
+static void close_package(void);
+static void unmap_package(void);
+static size_t read_package(uint64_t offset, void *buf, size_t size);
+static uint32_t hash_entry_name(const char *name);
+static bool find_entry(const char *dir, const char *file, uint64_t *index);
+static int resolve_file(const char *dir, const char *file, uint64_t *index);
+static int probe_file(const char *dir, const char *file, uint64_t *index);
+static bool is_package_only(const char *dir);
+#if !defined(USE_EDITOR)
+static struct resolved_path *find_resolved_path(const char *name, uint32_t hash);
+static bool grow_resolved_paths(void);
+#endif
+static void forget_resolved_paths(const char *dir);
+static void free_resolved_paths(void);
+#if !defined(USE_EDITOR)
+static bool mark_shared_entries(void);
+static int cmp_entry_offset(const void *a, const void *b);
+#endif
 static void warn_file_name_case(const char *dir, const char *file);
-static void ungetc_rfile(struct rfile *rf, char c);
+#if defined(USE_ACCESS_TRACE)
+static void open_access_trace(void);
+static void trace_access(const char *dir, const char *file);
+#endif
+#if defined(USE_FILE_STATS)
+static void open_file_stat(struct rfile *rf, const char *dir, const char *file);
+static void close_file_stat(struct rfile *rf);
+static bool grow_file_stats(void);
+static void write_stat_name(FILE *fp, const char *name, bool json);
+static void free_file_stats(void);
+static void lock_file_stats(void);
+static void unlock_file_stats(void);
+static uint64_t get_stat_clock(void);
+#endif
+static bool inflate_entry(struct rfile *rf, uint64_t index);
+static uint64_t get_rfile_size64(struct rfile *rf);
+static bool seek_real_file(FILE *fp, int64_t offset, int whence);
+static uint64_t tell_real_file(FILE *fp);
+static size_t read_rfile_raw(struct rfile *rf, void *buf, size_t size);
+static bool fill_rfile_buf(struct rfile *rf);
+static void discard_rfile_buf(struct rfile *rf);
+static uint64_t get_key(void);
 static void set_random_seed(uint64_t index, uint64_t *next_random);
-static char get_next_random(uint64_t *next_random, uint64_t *prev_random);
-static void rewind_random(uint64_t *next_random, uint64_t *prev_random);
+static char get_next_random(uint64_t *next_random);
+static void decode_blocks(uint64_t nonce, uint64_t pos, void *buf, size_t size);
+static bool prepare_save_keystream(size_t size);
+static void xor_bytes(unsigned char *dst, const unsigned char *key, size_t size);
+static bool write_wfile_tmp(struct wfile *wf);
+static bool commit_wfiles(void);
+static void sync_file(FILE *fp);
+static bool replace_file(const char *src, const char *dst);
+static void sync_dir(const char *path);
+static void free_wfile(struct wfile *wf);
 
 /*
  * Initialization
@@ -121,12 +400,18 @@ static void rewind_random(uint64_t *next_random, uint64_t *prev_random);
  */
 bool init_file(void)
 {
+#if defined(USE_ACCESS_TRACE)
+	/* Start recording the access trace. */
+	open_access_trace();
+#endif
+
 #if defined(USE_EDITOR)
 	/* Disable the feature to open packages on the editor apps. */
 	return true;
 #else
+	char signature[PACKAGE_SIGNATURE_SIZE];
 	FILE *fp;
-	uint64_t i, next_random;
+	uint64_t i, next_random, version;
 	int j;
 
 	/* Get the actual path to "data01.arc". */
@@ -154,29 +439,73 @@ bool init_file(void)
 #endif
 	}
 
-	/* Read the number of the file entries. */
-	if (fread(&entry_count, sizeof(uint64_t), 1, fp) < 1) {
+	/* Detect the package version by the signature. */
+	if (fread(signature, PACKAGE_SIGNATURE_SIZE, 1, fp) < 1) {
 		log_package_file_error();
 		fclose(fp);
 		return false;
 	}
-	if (entry_count > FILE_ENTRY_SIZE) {
+	if (memcmp(signature, PACKAGE_SIGNATURE, PACKAGE_SIGNATURE_SIZE) == 0) {
+		/* Version 2 or later: read the version and the file count. */
+		if (fread(&version, sizeof(uint64_t), 1, fp) < 1 ||
+		    version < 2 || version > PACKAGE_VERSION ||
+		    fread(&entry_count, sizeof(uint64_t), 1, fp) < 1) {
+			log_package_file_error();
+			fclose(fp);
+			return false;
+		}
+		package_version = (int)version;
+	} else {
+		/* Version 1: the first 8 bytes are the file count. */
+		memcpy(&entry_count, signature, sizeof(uint64_t));
+		package_version = 1;
+	}
+	if (entry_count > SIZE_MAX / sizeof(struct file_entry)) {
 		log_package_file_error();
 		fclose(fp);
 		return false;
 	}
+	entry = malloc(entry_count > 0 ? (size_t)entry_count * sizeof(struct file_entry) : 1);
+	if (entry == NULL) {
+		log_memory();
+		fclose(fp);
+		return false;
+	}
 
 	/* Read the file entries. */
 	for (i = 0; i < entry_count; i++) {
 		if (fread(&entry[i].name, FILE_NAME_SIZE, 1, fp) < 1)
 			break;
-		set_random_seed(i, &next_random);
-		for (j = 0; j < FILE_NAME_SIZE; j++)
-			entry[i].name[j] ^= get_next_random(&next_random, NULL);
+		if (package_version == 1) {
+			set_random_seed(i, &next_random);
+			for (j = 0; j < FILE_NAME_SIZE; j++)
+				entry[i].name[j] ^= get_next_random(&next_random);
+		} else {
+			decode_blocks(~i, 0, entry[i].name, FILE_NAME_SIZE);
+		}
+		entry[i].name[FILE_NAME_SIZE - 1] = '\0';
 		if (fread(&entry[i].size, sizeof(uint64_t), 1, fp) < 1)
 			break;
 		if (fread(&entry[i].offset, sizeof(uint64_t), 1, fp) < 1)
 			break;
+		if (package_version >= 3) {
+			if (fread(&entry[i].raw_size, sizeof(uint64_t), 1, fp) < 1)
+				break;
+			if (fread(&entry[i].codec, sizeof(uint64_t), 1, fp) < 1)
+				break;
+			if (entry[i].codec != PACKAGE_CODEC_NONE &&
+			    entry[i].codec != PACKAGE_CODEC_DEFLATE)
+				break;
+		} else {
+			entry[i].raw_size = entry[i].size;
+			entry[i].codec = PACKAGE_CODEC_NONE;
+		}
+		if (package_version >= 4) {
+			if (fread(&entry[i].nonce, sizeof(uint64_t), 1, fp) < 1)
+				break;
+		} else {
+			entry[i].nonce = i;
+		}
 	}
 	if (i != entry_count) {
 		log_package_file_error();
@@ -184,9 +513,26 @@ bool init_file(void)
 		return false;
 	}
 
-	/* Close the package for now; we will open one FILE pointer per an input stream.*/
+	/* Close the FILE pointer for the header. */
 	fclose(fp);
 
+	/* Build the hash table for entry lookups. */
+	if (!build_entry_hash())
+		return false;
+
+	/* Find the bodies shared by multiple entries. */
+	if (!mark_shared_entries())
+		return false;
+
+	/* Open the package for the bodies. */
+	if (!open_package()) {
+		log_file_open(PACKAGE_FILE);
+		return false;
+	}
+
+	/* Map the package if possible. (Otherwise, we use positional reads.) */
+	map_package();
+
 	return true;
 #endif
 }
@@ -196,168 +542,765 @@ bool init_file(void)
  */
 void cleanup_file(void)
 {
+#if defined(USE_FILE_STATS)
+	dump_file_stats();
+	free_file_stats();
+#endif
+#if defined(USE_ACCESS_TRACE)
+	if (trace_fp != NULL) {
+		fclose(trace_fp);
+		trace_fp = NULL;
+	}
+#endif
+	if (pending_wfile_head != NULL) {
+		is_wfile_batch = false;
+		commit_wfiles();
+	}
+	free(save_keystream);
+	save_keystream = NULL;
+	save_keystream_size = 0;
+	free_resolved_paths();
+	unmap_package();
+	close_package();
 	free(package_path);
+	package_path = NULL;
+	free(entry_hash);
+	entry_hash = NULL;
+	entry_hash_mask = 0;
+	free(entry);
+	entry = NULL;
+	free(entry_shared);
+	entry_shared = NULL;
+	entry_count = 0;
+	package_version = 0;
 }
 
-/*
- * Read
- */
-
-/*
- * Check whether a file exists.
- */
-bool check_file_exist(const char *dir, const char *file)
+#if !defined(USE_EDITOR)
+/* Build the hash table of the package entries. */
+static bool build_entry_hash(void)
 {
-	char entry_name[FILE_NAME_SIZE];
-	FILE *fp;
 	uint64_t i;
+	uint32_t size, slot, index;
+
+	/*
+	 * Use a table at least twice as large as the entry count.
+	 *  - The slots hold 32-bit indices and the size is a 32-bit power of
+	 *    two, so cap the count instead of letting the size overflow.
+	 */
+	if (entry_count > ENTRY_HASH_MAX_COUNT) {
+		log_package_file_error();
+		return false;
+	}
+	size = 1;
+	while (size < entry_count * 2)
+		size <<= 1;
 
-#if !defined(POLARIS_ENGINE_TARGET_IOS) || !defined(POLARIS_ENGINE_TARGET_WASM)
-	/* Check a file on the real file system first. */
-	char *real_path;
-	real_path = make_valid_path(dir, file);
-	if (real_path == NULL) {
+	entry_hash = calloc(size, sizeof(uint32_t));
+	if (entry_hash == NULL) {
 		log_memory();
-		return NULL;
-	}
-#ifdef POLARIS_ENGINE_TARGET_WIN32
-	_fmode = _O_BINARY;
-	fp = _wfopen(conv_utf8_to_utf16(real_path), L"r");
-#else
-	fp = fopen(real_path, "r");
-#endif
-	if (fp != NULL) {
-		/* File exists. */
-		fclose(fp);
-		return true;
+		return false;
 	}
-#endif
+	entry_hash_mask = size - 1;
 
-	/* Check whether a package entry exists. */
-	snprintf(entry_name, FILE_NAME_SIZE, "%s/%s", dir, file);
 	for (i = 0; i < entry_count; i++) {
-		if (strcasecmp(entry[i].name, entry_name) == 0){
-			/* Entry exists. */
-			return true;
+		slot = hash_entry_name(entry[i].name) & entry_hash_mask;
+		while ((index = entry_hash[slot]) != 0) {
+			/* Keep the first one for duplicated names like the linear search did. */
+			if (strcasecmp(entry[index - 1].name, entry[i].name) == 0)
+				break;
+			slot = (slot + 1) & entry_hash_mask;
 		}
+		if (index == 0)
+			entry_hash[slot] = (uint32_t)(i + 1);
 	}
 
-	/* File does not exist. */
-	return false;
+	return true;
 }
 
 /*
- * Open a read file stream.
+ * Open the package to share among the packaged streams.
  */
-struct rfile *open_rfile(
-	const char *dir,
-	const char *file,
-	bool save_data)
+static bool open_package(void)
 {
-	char entry_name[FILE_NAME_SIZE];
-	char *real_path;
-	struct rfile *rf;
-	uint64_t i;
+#if defined(USE_MMAP_POSIX)
+	package_fd = open(package_path, O_RDONLY);
+	if (package_fd == -1)
+		return false;
+#elif defined(USE_MMAP_WIN32)
+	package_file_handle = CreateFileW(conv_utf8_to_utf16(package_path),
+					  GENERIC_READ, FILE_SHARE_READ, NULL,
+					  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+					  NULL);
+	if (package_file_handle == INVALID_HANDLE_VALUE)
+		return false;
+#else
+	package_fp = fopen(package_path, "rb");
+	if (package_fp == NULL)
+		return false;
+#endif
+	return true;
+}
 
-	warn_file_name_case(dir, file);
+/* Map the package onto memory. */
+static void map_package(void)
+{
+#if defined(USE_MMAP_POSIX)
+	struct stat st;
+	void *p;
 
-	/* Allocate a rfile struct. */
-	rf = malloc(sizeof(struct rfile));
-	if (rf == NULL) {
-		log_memory();
-		return NULL;
+	if (fstat(package_fd, &st) == -1 || st.st_size <= 0 ||
+	    (uint64_t)st.st_size > (uint64_t)SIZE_MAX)
+		return;
+
+	/* This may fail for a huge package on a 32-bit address space. */
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, package_fd, 0);
+	if (p == MAP_FAILED)
+		return;
+
+	package_map = p;
+	package_map_size = (uint64_t)st.st_size;
+#elif defined(USE_MMAP_WIN32)
+	LARGE_INTEGER size;
+	void *p;
+
+	if (!GetFileSizeEx(package_file_handle, &size) ||
+	    size.QuadPart <= 0 ||
+	    (uint64_t)size.QuadPart > (uint64_t)SIZE_MAX)
+		return;
+
+	package_map_handle = CreateFileMappingW(package_file_handle, NULL,
+						PAGE_READONLY, 0, 0, NULL);
+	if (package_map_handle == NULL)
+		return;
+
+	/* This may fail for a huge package on a 32-bit address space. */
+	p = MapViewOfFile(package_map_handle, FILE_MAP_READ, 0, 0, 0);
+	if (p == NULL) {
+		unmap_package();
+		return;
 	}
 
-	/* Make an effective path on the real file system. */
-	real_path = make_valid_path(dir, file);
-	if (real_path == NULL) {
+	package_map = p;
+	package_map_size = (uint64_t)size.QuadPart;
+#endif
+}
+#endif
+
+#if !defined(USE_EDITOR)
+/* Mark the entries which share their bodies. */
+static bool mark_shared_entries(void)
+{
+	uint64_t *sorted;
+	uint64_t i;
+
+	entry_shared = calloc(entry_count > 0 ? (size_t)entry_count : 1, sizeof(bool));
+	sorted = malloc((entry_count > 0 ? (size_t)entry_count : 1) * sizeof(uint64_t));
+	if (entry_shared == NULL || sorted == NULL) {
 		log_memory();
-		free(rf);
-		return NULL;
+		free(sorted);
+		return false;
 	}
 
-	/* Try a real file first. */
-#ifdef POLARIS_ENGINE_TARGET_WIN32
-	_fmode = _O_BINARY;
-	rf->fp = _wfopen(conv_utf8_to_utf16(real_path), L"r");
-#else
-	rf->fp = fopen(real_path, "r");
-#endif
-	if (rf->fp != NULL) {
-		/* Opened: use a real file. */
-		free(real_path);
-		rf->is_packaged = false;
-		if (save_data) {
-			rf->is_obfuscated = true;
-			set_random_seed(0, &rf->next_random);
-		} else {
-			rf->is_obfuscated = false;
+	/*
+	 * Sort the entries by offset and size, and check the neighbors.
+	 *  - An empty entry may have the offset of the next body.
+	 */
+	for (i = 0; i < entry_count; i++)
+		sorted[i] = i;
+	qsort(sorted, (size_t)entry_count, sizeof(uint64_t), cmp_entry_offset);
+	for (i = 1; i < entry_count; i++) {
+		if (entry[sorted[i]].offset == entry[sorted[i - 1]].offset &&
+		    entry[sorted[i]].size == entry[sorted[i - 1]].size &&
+		    entry[sorted[i]].size > 0) {
+			entry_shared[sorted[i]] = true;
+			entry_shared[sorted[i - 1]] = true;
 		}
-		return rf;
 	}
-	free(real_path);
 
-	/* If the file is save data, we don't search from the package. */
-	if (save_data) {
-		free(rf);
-		return NULL;
-	}
+	free(sorted);
+	return true;
+}
 
-	/* If we don't have a package, we failed to open a file. */
-	if (package_path == NULL) {
-		log_dir_file_open(dir, file);
-		free(rf);
-		return NULL;
+/* Compare the offsets and the sizes of the entries. */
+static int cmp_entry_offset(const void *a, const void *b)
+{
+	const struct file_entry *ea = &entry[*(const uint64_t *)a];
+	const struct file_entry *eb = &entry[*(const uint64_t *)b];
+
+	if (ea->offset != eb->offset)
+		return ea->offset < eb->offset ? -1 : 1;
+	if (ea->size != eb->size)
+		return ea->size < eb->size ? -1 : 1;
+	return 0;
+}
+#endif
+
+/* Unmap the package. */
+static void unmap_package(void)
+{
+#if defined(USE_MMAP_POSIX)
+	if (package_map != NULL)
+		munmap((void *)package_map, (size_t)package_map_size);
+#elif defined(USE_MMAP_WIN32)
+	if (package_map != NULL)
+		UnmapViewOfFile(package_map);
+	if (package_map_handle != NULL) {
+		CloseHandle(package_map_handle);
+		package_map_handle = NULL;
 	}
+#endif
+	package_map = NULL;
+	package_map_size = 0;
+}
 
-	/* Search a file entry on the package. */
-	snprintf(entry_name, FILE_NAME_SIZE, "%s/%s", dir, file);
-	for (i = 0; i < entry_count; i++) {
-		if (strcasecmp(entry[i].name, entry_name) == 0)
-			break;
+/*
+ * Close the package.
+ */
+static void close_package(void)
+{
+#if defined(USE_MMAP_POSIX)
+	if (package_fd != -1) {
+		close(package_fd);
+		package_fd = -1;
 	}
-	if (i == entry_count) {
-		/* Not found. */
-		log_dir_file_open(dir, file);
-		free(rf);
-		return NULL;
+#elif defined(USE_MMAP_WIN32)
+	if (package_file_handle != INVALID_HANDLE_VALUE) {
+		CloseHandle(package_file_handle);
+		package_file_handle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (package_fp != NULL) {
+		fclose(package_fp);
+		package_fp = NULL;
 	}
+#endif
+}
 
-	/* Found: open a new FILE pointer to "data01.arc". */
-#ifdef POLARIS_ENGINE_TARGET_WIN32
-	_fmode = _O_BINARY;
-	rf->fp = _wfopen(conv_utf8_to_utf16(package_path), L"r");
+/*
+ * Read bytes at an offset of the package.
+ *  - This is thread-safe except the stdio fallback.
+ *  - Returns the byte count read, which is short only at the end or on an error.
+ */
+static size_t read_package(uint64_t offset, void *buf, size_t size)
+{
+#if defined(USE_MMAP_POSIX)
+	ssize_t ret;
+	size_t done;
+
+	done = 0;
+	while (done < size) {
+#if defined(POLARIS_ENGINE_TARGET_ANDROID)
+		/* off_t is 32-bit on armv7, so use the 64-bit variant. */
+		ret = pread64(package_fd, (char *)buf + done, size - done,
+			      (off64_t)(offset + done));
 #else
-	rf->fp = fopen(package_path, "r");
+		ret = pread(package_fd, (char *)buf + done, size - done,
+			    (off_t)(offset + done));
 #endif
-	if (rf->fp == NULL) {
-		log_file_open(PACKAGE_FILE);
-		free(rf);
-		return NULL;
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		done += (size_t)ret;
 	}
-
-	/* Seek to the offset. */
-	if (fseek(rf->fp, (long)entry[i].offset, SEEK_SET) != 0) {
-		log_package_file_error();
-		fclose(rf->fp);
-		free(rf);
+	return done;
+#elif defined(USE_MMAP_WIN32)
+	OVERLAPPED ov;
+	DWORD len, ret;
+	size_t done;
+
+	done = 0;
+	while (done < size) {
+		len = size - done > 0x40000000 ? 0x40000000 : (DWORD)(size - done);
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = (DWORD)((offset + done) & 0xffffffff);
+		ov.OffsetHigh = (DWORD)((offset + done) >> 32);
+		if (!ReadFile(package_file_handle, (char *)buf + done, len, &ret, &ov) ||
+		    ret == 0)
+			break;
+		done += ret;
+	}
+	return done;
+#elif defined(_MSC_VER)
+	if (_fseeki64(package_fp, (__int64)offset, SEEK_SET) != 0)
+		return 0;
+	return fread(buf, 1, size, package_fp);
+#else
+	if (fseeko(package_fp, (off_t)offset, SEEK_SET) != 0)
 		return 0;
+	return fread(buf, 1, size, package_fp);
+#endif
+}
+
+/* Calculate a case-insensitive FNV-1a hash of an entry name. */
+static uint32_t hash_entry_name(const char *name)
+{
+	uint32_t hash;
+	unsigned char c;
+
+	hash = 2166136261U;
+	while ((c = (unsigned char)*name++) != '\0') {
+		if (c >= 'A' && c <= 'Z')
+			c = (unsigned char)(c - 'A' + 'a');
+		hash ^= c;
+		hash *= 16777619U;
 	}
 
-	/* Setup the rfile struct. */
-	rf->is_packaged = true;
-	rf->is_obfuscated = true;
-	rf->index = i;
+	return hash;
+}
+
+/* Search a package entry by a directory name and a file name. */
+static bool find_entry(const char *dir, const char *file, uint64_t *index)
+{
+	char entry_name[FILE_NAME_SIZE];
+	uint32_t slot, i;
+
+	if (entry_hash == NULL)
+		return false;
+
+	snprintf(entry_name, FILE_NAME_SIZE, "%s/%s", dir, file);
+
+	slot = hash_entry_name(entry_name) & entry_hash_mask;
+	while ((i = entry_hash[slot]) != 0) {
+		if (strcasecmp(entry[i - 1].name, entry_name) == 0) {
+			*index = i - 1;
+			return true;
+		}
+		slot = (slot + 1) & entry_hash_mask;
+	}
+
+	return false;
+}
+
+/*
+ * Read
+ */
+
+/*
+ * Check whether a file exists.
+ */
+bool check_file_exist(const char *dir, const char *file)
+{
+	uint64_t i;
+
+	return resolve_file(dir, file, &i) != LOCATION_NONE;
+}
+
+/*
+ * Get an identity of a package body which is shared by multiple entries.
+ */
+bool get_shared_body_id(const char *dir, const char *file, uint64_t *id)
+{
+	uint64_t i;
+
+	/* Check whether the entry shares its body. (A real file precedes the package.) */
+	if (entry_shared == NULL ||
+	    resolve_file(dir, file, &i) != LOCATION_PACKAGE ||
+	    !entry_shared[i])
+		return false;
+
+	/* The offset identifies a body. */
+	*id = entry[i].offset;
+	return true;
+}
+
+/*
+ * Resolve the location of a file.
+ *  - The result is cached, including a miss.
+ */
+static int resolve_file(const char *dir, const char *file, uint64_t *index)
+{
+#if !defined(USE_EDITOR)
+	struct resolved_path *rp;
+	char name[FILE_NAME_SIZE * 2];
+	uint32_t hash;
+
+	/* Save data is not cached because it changes. */
+	if (dir == NULL || strcmp(dir, SAVE_DIR) == 0)
+		return probe_file(dir, file, index);
+
+	/* Search the cache. */
+	snprintf(name, sizeof(name), "%s/%s", dir, file);
+	hash = hash_entry_name(name);
+	if (resolved != NULL) {
+		rp = find_resolved_path(name, hash);
+		if (rp->name != NULL) {
+			*index = rp->index;
+			return rp->location;
+		}
+	}
+
+	/* Resolve, and add to the cache. */
+	if (!grow_resolved_paths())
+		return probe_file(dir, file, index);
+	rp = find_resolved_path(name, hash);
+	rp->name = strdup(name);
+	if (rp->name == NULL) {
+		log_memory();
+		return probe_file(dir, file, index);
+	}
+	rp->location = probe_file(dir, file, &rp->index);
+	resolved_count++;
+
+	*index = rp->index;
+	return rp->location;
+#else
+	/* On the editor, files are changed any time. */
+	return probe_file(dir, file, index);
+#endif
+}
+
+/* Probe the real file system and the package. */
+static int probe_file(const char *dir, const char *file, uint64_t *index)
+{
+	char *real_path;
+	FILE *fp;
+
+	*index = 0;
+
+	/* Check a file on the real file system first. */
+	if (!is_package_only(dir)) {
+		real_path = make_valid_path(dir, file);
+		if (real_path == NULL) {
+			log_memory();
+			return LOCATION_NONE;
+		}
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+		_fmode = _O_BINARY;
+		fp = _wfopen(conv_utf8_to_utf16(real_path), L"r");
+#else
+		fp = fopen(real_path, "r");
+#endif
+		free(real_path);
+		if (fp != NULL) {
+			/* File exists. */
+			fclose(fp);
+			return LOCATION_FS;
+		}
+	}
+
+	/* Check whether a package entry exists. */
+	if (package_path != NULL && find_entry(dir, file, index))
+		return LOCATION_PACKAGE;
+
+	/* File does not exist. */
+	return LOCATION_NONE;
+}
+
+/*
+ * Check whether game files are read only from the package.
+ *  - On iOS and Wasm, the game files are always in the package.
+ *  - A release build with a package doesn't look at the real file system.
+ *  - Save data is always on the real file system.
+ */
+static bool is_package_only(const char *dir)
+{
+	if (package_path == NULL || dir == NULL || strcmp(dir, SAVE_DIR) == 0)
+		return false;
+#if defined(POLARIS_ENGINE_TARGET_IOS) || defined(POLARIS_ENGINE_TARGET_WASM)
+	return true;
+#else
+	return conf_release != 0;
+#endif
+}
+
+#if !defined(USE_EDITOR)
+/* Find a slot of the resolved path cache. (The found one or an empty one) */
+static struct resolved_path *find_resolved_path(const char *name, uint32_t hash)
+{
+	uint32_t slot;
+
+	for (slot = hash & resolved_mask; resolved[slot].name != NULL;
+	     slot = (slot + 1) & resolved_mask) {
+		if (strcmp(resolved[slot].name, name) == 0)
+			return &resolved[slot];
+	}
+	return &resolved[slot];
+}
+
+/* Make a room for a new resolved path, and keep the table half empty. */
+static bool grow_resolved_paths(void)
+{
+	struct resolved_path *old;
+	uint32_t old_size, i;
+
+	if (resolved != NULL && (resolved_count + 1) * 2 <= resolved_mask + 1)
+		return true;
+
+	old = resolved;
+	old_size = resolved != NULL ? resolved_mask + 1 : 0;
+	resolved_mask = old_size == 0 ? 255 : old_size * 2 - 1;
+	resolved = calloc((size_t)resolved_mask + 1, sizeof(struct resolved_path));
+	if (resolved == NULL) {
+		log_memory();
+		resolved = old;
+		resolved_mask = old_size - 1;
+		return false;
+	}
+	for (i = 0; i < old_size; i++) {
+		if (old[i].name != NULL)
+			*find_resolved_path(old[i].name, hash_entry_name(old[i].name)) = old[i];
+	}
+	free(old);
+
+	return true;
+}
+#endif
+
+/*
+ * Forget the resolved paths because a file in the directory is written or removed.
+ *  - Just drop the cache. (Writes outside the save data are rare.)
+ */
+static void forget_resolved_paths(const char *dir)
+{
+	if (dir != NULL && strcmp(dir, SAVE_DIR) != 0)
+		free_resolved_paths();
+}
+
+/* Free the resolved path cache. */
+static void free_resolved_paths(void)
+{
+	uint32_t i;
+
+	if (resolved == NULL)
+		return;
+	for (i = 0; i <= resolved_mask; i++)
+		free(resolved[i].name);
+	free(resolved);
+	resolved = NULL;
+	resolved_count = 0;
+	resolved_mask = 0;
+}
+
+/*
+ * Open a read file stream.
+ */
+struct rfile *open_rfile(
+	const char *dir,
+	const char *file,
+	bool save_data)
+{
+	char *real_path;
+	struct rfile *rf;
+	uint64_t i;
+
+	warn_file_name_case(dir, file);
+
+	/* Allocate a rfile struct. */
+	rf = malloc(sizeof(struct rfile));
+	if (rf == NULL) {
+		log_memory();
+		return NULL;
+	}
+
+	/* Make an effective path on the real file system. */
+	real_path = make_valid_path(dir, file);
+	if (real_path == NULL) {
+		log_memory();
+		free(rf);
+		return NULL;
+	}
+
+	/* Try a real file first. (Unless the game files are only in the package.) */
+	rf->fp = NULL;
+	if (save_data || !is_package_only(dir)) {
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+		_fmode = _O_BINARY;
+		rf->fp = _wfopen(conv_utf8_to_utf16(real_path), L"r");
+#else
+		rf->fp = fopen(real_path, "r");
+#endif
+	}
+	rf->map = NULL;
+	rf->data = NULL;
+	rf->is_data_mapped = false;
+	rf->data_size = 0;
+	rf->buf = NULL;
+	rf->buf_size = 0;
+	rf->buf_len = 0;
+	rf->buf_pos = 0;
+#if defined(USE_FILE_STATS)
+	rf->stat_bytes = 0;
+	rf->stat_read_ns = 0;
+	rf->stat_decode_ns = 0;
+#endif
+	if (rf->fp != NULL) {
+		/* Opened: use a real file. */
+		free(real_path);
+		rf->is_packaged = false;
+		if (save_data) {
+			rf->is_obfuscated = true;
+			set_random_seed(0, &rf->next_random);
+		} else {
+			rf->is_obfuscated = false;
+#if defined(USE_ACCESS_TRACE)
+			trace_access(dir, file);
+#endif
+		}
+#if defined(USE_FILE_STATS)
+		open_file_stat(rf, dir, file);
+#endif
+		return rf;
+	}
+	free(real_path);
+
+	/* If the file is save data, we don't search from the package. */
+	if (save_data) {
+		free(rf);
+		return NULL;
+	}
+
+	/* If we don't have a package, we failed to open a file. */
+	if (package_path == NULL) {
+		log_dir_file_open(dir, file);
+		free(rf);
+		return NULL;
+	}
+
+	/* Search a file entry on the package. */
+	if (!find_entry(dir, file, &i)) {
+		/* Not found. */
+		log_dir_file_open(dir, file);
+		free(rf);
+		return NULL;
+	}
+
+	/* Found: if the entry is compressed, decompress it onto memory. */
+	if (entry[i].codec != PACKAGE_CODEC_NONE) {
+		if (!inflate_entry(rf, i)) {
+			free(rf);
+			return NULL;
+		}
+#if defined(USE_ACCESS_TRACE)
+		trace_access(dir, file);
+#endif
+#if defined(USE_FILE_STATS)
+		open_file_stat(rf, dir, file);
+#endif
+		return rf;
+	}
+
+	/*
+	 * If the package is mapped, make a view to the entry.
+	 * Otherwise, the entry is read from the shared package by positional reads.
+	 */
+	if (package_map != NULL) {
+		if (entry[i].offset > package_map_size ||
+		    entry[i].size > package_map_size - entry[i].offset) {
+			log_package_file_error();
+			free(rf);
+			return NULL;
+		}
+		rf->map = package_map + entry[i].offset;
+	}
+
+	/* Setup the rfile struct. */
+	rf->fp = NULL;
+	rf->is_packaged = true;
+	rf->is_obfuscated = true;
+	rf->index = i;
+	rf->nonce = entry[i].nonce;
 	rf->size = entry[i].size;
 	rf->offset = entry[i].offset;
 	rf->pos = 0;
-	set_random_seed(i, &rf->next_random);
-	rf->prev_random = 0;
+	if (package_version == 1)
+		set_random_seed(i, &rf->next_random);
+
+#if defined(USE_ACCESS_TRACE)
+	trace_access(dir, file);
+#endif
+#if defined(USE_FILE_STATS)
+	open_file_stat(rf, dir, file);
+#endif
 
 	/* Return a pointer to a rfile. */
 	return rf;
 }
 
+/*
+ * Decompress a package entry into a heap memory.
+ *  - The rfile becomes a plain memory stream that map_rfile() can return as is.
+ */
+static bool inflate_entry(struct rfile *rf, uint64_t index)
+{
+	unsigned char *stored, *raw;
+	uLongf raw_len;
+	size_t stored_len;
+#if defined(USE_FILE_STATS)
+	uint64_t start, decode_start;
+
+	start = get_stat_clock();
+#endif
+
+	stored_len = (size_t)entry[index].size;
+
+	/* Copy the stored bytes because we decode them in-place. */
+	stored = malloc(stored_len > 0 ? stored_len : 1);
+	if (stored == NULL) {
+		log_memory();
+		return false;
+	}
+	if (package_map != NULL) {
+		if (entry[index].offset > package_map_size ||
+		    stored_len > package_map_size - entry[index].offset) {
+			log_package_file_error();
+			free(stored);
+			return false;
+		}
+		memcpy(stored, package_map + entry[index].offset, stored_len);
+	} else {
+		if (read_package(entry[index].offset, stored, stored_len) != stored_len) {
+			log_package_file_error();
+			free(stored);
+			return false;
+		}
+	}
+#if defined(USE_FILE_STATS)
+	decode_start = get_stat_clock();
+#endif
+	decode_blocks(entry[index].nonce, 0, stored, stored_len);
+#if defined(USE_FILE_STATS)
+	rf->stat_decode_ns += get_stat_clock() - decode_start;
+#endif
+
+	/* Decompress. */
+	raw = malloc(entry[index].raw_size > 0 ? (size_t)entry[index].raw_size : 1);
+	if (raw == NULL) {
+		log_memory();
+		free(stored);
+		return false;
+	}
+	raw_len = (uLongf)entry[index].raw_size;
+	if (uncompress(raw, &raw_len, stored, (uLong)stored_len) != Z_OK ||
+	    raw_len != entry[index].raw_size) {
+		log_package_file_error();
+		free(raw);
+		free(stored);
+		return false;
+	}
+	free(stored);
+#if defined(USE_FILE_STATS)
+	rf->stat_read_ns += get_stat_clock() - start;
+#endif
+
+	/* Setup the rfile struct. */
+	rf->fp = NULL;
+	rf->map = raw;
+	rf->data = raw;
+	rf->data_size = (size_t)raw_len;
+	rf->is_data_mapped = false;
+	rf->is_packaged = true;
+	rf->is_obfuscated = false;
+	rf->index = index;
+	rf->nonce = entry[index].nonce;
+	rf->size = entry[index].raw_size;
+	rf->offset = 0;
+	rf->pos = 0;
+	rf->next_random = 0;
+
+	return true;
+}
+
 /* Warn if a file name contains any upper case ASCII character. */
 static void warn_file_name_case(const char *dir, const char *file)
 {
@@ -397,167 +1340,767 @@ static void warn_file_name_case(const char *dir, const char *file)
 	}
 }
 
+#if defined(USE_ACCESS_TRACE)
+/* Open the access trace file. */
+static void open_access_trace(void)
+{
+	char *path;
+
+	path = make_valid_path(NULL, ACCESS_TRACE_FILE);
+	if (path == NULL)
+		return;
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	trace_fp = _wfopen(conv_utf8_to_utf16(path), L"a");
+#else
+	trace_fp = fopen(path, "a");
+#endif
+	free(path);
+}
+
+/* Record an open_rfile() call to the access trace. */
+static void trace_access(const char *dir, const char *file)
+{
+	if (trace_fp == NULL || dir == NULL)
+		return;
+
+	/* Flush each line so that a trace survives a crash. */
+	fprintf(trace_fp, "%s/%s\n", dir, file);
+	fflush(trace_fp);
+}
+#endif
+
+#if defined(USE_FILE_STATS)
+/* Count an open_rfile() call and bind the stream to the statistics of the file. */
+static void open_file_stat(struct rfile *rf, const char *dir, const char *file)
+{
+	char name[FILE_NAME_SIZE * 2];
+	uint32_t hash, slot, index;
+
+	rf->stat_index = (uint32_t)-1;
+	snprintf(name, sizeof(name), "%s/%s", dir != NULL ? dir : "", file);
+
+	lock_file_stats();
+
+	/* Search the statistics of the file. */
+	index = (uint32_t)-1;
+	hash = hash_entry_name(name);
+	if (stats_hash != NULL) {
+		for (slot = hash & stats_hash_mask; stats_hash[slot] != 0;
+		     slot = (slot + 1) & stats_hash_mask) {
+			if (strcmp(stats[stats_hash[slot] - 1].name, name) == 0) {
+				index = stats_hash[slot] - 1;
+				break;
+			}
+		}
+	}
+
+	/* If not found, add the statistics. */
+	if (index == (uint32_t)-1) {
+		if (!grow_file_stats()) {
+			unlock_file_stats();
+			return;
+		}
+		index = stats_count;
+		stats[index].name = strdup(name);
+		if (stats[index].name == NULL) {
+			unlock_file_stats();
+			return;
+		}
+		stats[index].is_packaged = rf->is_packaged;
+		stats[index].open_count = 0;
+		stats[index].read_bytes = 0;
+		stats[index].read_ns = 0;
+		stats[index].decode_ns = 0;
+		stats_count++;
+		for (slot = hash & stats_hash_mask; stats_hash[slot] != 0;
+		     slot = (slot + 1) & stats_hash_mask)
+			;
+		stats_hash[slot] = index + 1;
+	}
+
+	stats[index].open_count++;
+	rf->stat_index = index;
+
+	unlock_file_stats();
+}
+
+/* Merge the statistics of a stream. */
+static void close_file_stat(struct rfile *rf)
+{
+	if (rf->stat_index == (uint32_t)-1)
+		return;
+
+	lock_file_stats();
+	stats[rf->stat_index].read_bytes += rf->stat_bytes;
+	stats[rf->stat_index].read_ns += rf->stat_read_ns;
+	stats[rf->stat_index].decode_ns += rf->stat_decode_ns;
+	unlock_file_stats();
+}
+
+/* Make a room for the statistics of a new file, and keep the hash table half empty. */
+static bool grow_file_stats(void)
+{
+	struct file_stat *new_stats;
+	uint32_t *new_hash;
+	uint32_t new_alloc, mask, i, slot;
+
+	if (stats_count < stats_alloc)
+		return true;
+
+	new_alloc = stats_alloc == 0 ? 256 : stats_alloc * 2;
+	new_stats = realloc(stats, sizeof(struct file_stat) * new_alloc);
+	if (new_stats == NULL) {
+		log_memory();
+		return false;
+	}
+	stats = new_stats;
+
+	mask = new_alloc * 2 - 1;
+	new_hash = calloc((size_t)mask + 1, sizeof(uint32_t));
+	if (new_hash == NULL) {
+		log_memory();
+		return false;
+	}
+	for (i = 0; i < stats_count; i++) {
+		for (slot = hash_entry_name(stats[i].name) & mask; new_hash[slot] != 0;
+		     slot = (slot + 1) & mask)
+			;
+		new_hash[slot] = i + 1;
+	}
+	free(stats_hash);
+	stats_hash = new_hash;
+	stats_hash_mask = mask;
+	stats_alloc = new_alloc;
+
+	return true;
+}
+
+/*
+ * Dump the I/O statistics to "file-stats.csv" and "file-stats.json".
+ */
+void dump_file_stats(void)
+{
+	FILE *csv, *json;
+	char *path;
+	uint32_t i;
+
+	/* Open the output files. */
+	path = make_valid_path(NULL, FILE_STATS_CSV);
+	if (path == NULL)
+		return;
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	csv = _wfopen(conv_utf8_to_utf16(path), L"w");
+#else
+	csv = fopen(path, "w");
+#endif
+	free(path);
+	path = make_valid_path(NULL, FILE_STATS_JSON);
+	if (path == NULL) {
+		if (csv != NULL)
+			fclose(csv);
+		return;
+	}
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	json = _wfopen(conv_utf8_to_utf16(path), L"w");
+#else
+	json = fopen(path, "w");
+#endif
+	free(path);
+
+	lock_file_stats();
+
+	/* Write the CSV. */
+	if (csv != NULL) {
+		fprintf(csv, "file,source,opens,bytes,read_us,decode_us\n");
+		for (i = 0; i < stats_count; i++) {
+			write_stat_name(csv, stats[i].name, false);
+			fprintf(csv, ",%s,%llu,%llu,%llu,%llu\n",
+				stats[i].is_packaged ? "package" : "fs",
+				(unsigned long long)stats[i].open_count,
+				(unsigned long long)stats[i].read_bytes,
+				(unsigned long long)(stats[i].read_ns / 1000),
+				(unsigned long long)(stats[i].decode_ns / 1000));
+		}
+		fclose(csv);
+	}
+
+	/* Write the JSON. */
+	if (json != NULL) {
+		fprintf(json, "{\n  \"files\": [");
+		for (i = 0; i < stats_count; i++) {
+			fprintf(json, "%s\n    {\"file\": ", i == 0 ? "" : ",");
+			write_stat_name(json, stats[i].name, true);
+			fprintf(json, ", \"source\": \"%s\", \"opens\": %llu, "
+				"\"bytes\": %llu, \"read_us\": %llu, \"decode_us\": %llu}",
+				stats[i].is_packaged ? "package" : "fs",
+				(unsigned long long)stats[i].open_count,
+				(unsigned long long)stats[i].read_bytes,
+				(unsigned long long)(stats[i].read_ns / 1000),
+				(unsigned long long)(stats[i].decode_ns / 1000));
+		}
+		fprintf(json, "\n  ]\n}\n");
+		fclose(json);
+	}
+
+	unlock_file_stats();
+}
+
+/* Write a file name as a quoted CSV field or a JSON string. */
+static void write_stat_name(FILE *fp, const char *name, bool json)
+{
+	const unsigned char *c;
+
+	fputc('"', fp);
+	for (c = (const unsigned char *)name; *c != '\0'; c++) {
+		if (*c == '"')
+			fputs(json ? "\\\"" : "\"\"", fp);
+		else if (json && *c == '\\')
+			fputs("\\\\", fp);
+		else if (json && *c < 0x20)
+			fprintf(fp, "\\u%04x", *c);
+		else
+			fputc(*c, fp);
+	}
+	fputc('"', fp);
+}
+
+/* Free the statistics. */
+static void free_file_stats(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < stats_count; i++)
+		free(stats[i].name);
+	free(stats);
+	stats = NULL;
+	free(stats_hash);
+	stats_hash = NULL;
+	stats_hash_mask = 0;
+	stats_count = 0;
+	stats_alloc = 0;
+}
+
+/* Lock the statistics. */
+static void lock_file_stats(void)
+{
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	AcquireSRWLockExclusive(&stats_lock);
+#else
+	pthread_mutex_lock(&stats_lock);
+#endif
+}
+
+/* Unlock the statistics. */
+static void unlock_file_stats(void)
+{
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	ReleaseSRWLockExclusive(&stats_lock);
+#else
+	pthread_mutex_unlock(&stats_lock);
+#endif
+}
+
+/* Get a monotonic clock in nanoseconds. */
+static uint64_t get_stat_clock(void)
+{
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	LARGE_INTEGER count, freq;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (uint64_t)((double)count.QuadPart * 1000000000.0 / (double)freq.QuadPart);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+#endif
+
+/* Seek a real file with a 64-bit offset. (ftell() and fseek() are 32-bit on some targets.) */
+static bool seek_real_file(FILE *fp, int64_t offset, int whence)
+{
+#if defined(_WIN32)
+	return _fseeki64(fp, (__int64)offset, whence) == 0;
+#else
+	return fseeko(fp, (off_t)offset, whence) == 0;
+#endif
+}
+
+/* Get the position of a real file with a 64-bit offset. */
+static uint64_t tell_real_file(FILE *fp)
+{
+#if defined(_WIN32)
+	return (uint64_t)_ftelli64(fp);
+#else
+	return (uint64_t)ftello(fp);
+#endif
+}
+
+/* Get a file size with a 64-bit offset. */
+static uint64_t get_rfile_size64(struct rfile *rf)
+{
+	uint64_t pos, len;
+
+	/* If the rfile points to a real file. */
+	if (!rf->is_packaged) {
+		/* Return the file size. */
+		pos = tell_real_file(rf->fp);
+		seek_real_file(rf->fp, 0, SEEK_END);
+		len = tell_real_file(rf->fp);
+		seek_real_file(rf->fp, (int64_t)pos, SEEK_SET);
+		return len;
+	}
+
+	/* If the rfile points to a package entry. */
+	return rf->size;
+}
+
+/*
+ * Get a file size.
+ */
+size_t get_rfile_size(struct rfile *rf)
+{
+	return (size_t)get_rfile_size64(rf);
+}
+
+/*
+ * Read bytes from a read file stream.
+ */
+size_t read_rfile(struct rfile *rf, void *buf, size_t size)
+{
+	size_t len, avail;
+
+	assert(rf != NULL);
+	assert(rf->fp != NULL || rf->is_packaged);
+
+	/* Consume the read-ahead bytes first. */
+	len = 0;
+	avail = rf->buf_len - rf->buf_pos;
+	if (avail > 0) {
+		len = avail < size ? avail : size;
+		memcpy(buf, rf->buf + rf->buf_pos, len);
+		rf->buf_pos += len;
+		if (len == size)
+			return len;
+	}
+
+	/*
+	 * A large read goes to the destination directly, and so does any read
+	 * from a mapped package, which has no syscall to amortize.
+	 */
+	if (size - len >= RFILE_BUF_SIZE || rf->map != NULL)
+		return len + read_rfile_raw(rf, (char *)buf + len, size - len);
+
+	/* Otherwise, refill the buffer and copy from it. */
+	if (!fill_rfile_buf(rf))
+		return len;
+	avail = rf->buf_len - rf->buf_pos;
+	if (avail > size - len)
+		avail = size - len;
+	memcpy((char *)buf + len, rf->buf + rf->buf_pos, avail);
+	rf->buf_pos += avail;
+
+	return len + avail;
+}
+
+/* Read and decode bytes from the underlying file or package, bypassing the buffer. */
+static size_t read_rfile_raw(struct rfile *rf, void *buf, size_t size)
+{
+	size_t len, obf;
+#if defined(USE_FILE_STATS)
+	uint64_t start, decode_start;
+
+	start = get_stat_clock();
+#endif
+
+	assert(rf != NULL);
+	assert(rf->fp != NULL || rf->is_packaged);
+
+	if (!rf->is_packaged) {
+		/*
+		 * For the case the rfile points to a real file.
+		 */
+
+		/* Read. */
+		len = fread(buf, 1, size, rf->fp);
+
+		/* If the file is a save file, do obfuscation decode. */
+#if defined(USE_FILE_STATS)
+		decode_start = get_stat_clock();
+#endif
+		if (rf->is_obfuscated) {
+			for (obf = 0; obf < len; obf++)
+				*(((char *)buf) + obf) ^= get_next_random(&rf->next_random);
+		}
+	} else {
+		/*
+		 * For the case the rfile points to a package entry.
+		 */
+
+		/* Read. */
+		if (rf->pos + size > rf->size)
+			size = (size_t)(rf->size - rf->pos);
+		if (size == 0)
+			return 0;
+		if (rf->map != NULL) {
+			/* Copy from the mapped package. */
+			memcpy(buf, rf->map + rf->pos, size);
+			len = size;
+		} else {
+			/* Read from the shared package. */
+			len = read_package(rf->offset + rf->pos, buf, size);
+		}
+
+		/* Do obfuscation decode. (A decompressed entry is plain.) */
+#if defined(USE_FILE_STATS)
+		decode_start = get_stat_clock();
+#endif
+		if (!rf->is_obfuscated) {
+			/* Nothing to do. */
+		} else if (package_version == 1) {
+			for (obf = 0; obf < len; obf++)
+				*(((char *)buf) + obf) ^= get_next_random(&rf->next_random);
+		} else {
+			decode_blocks(rf->nonce, rf->pos, buf, len);
+		}
+		rf->pos += len;
+	}
+
+#if defined(USE_FILE_STATS)
+	rf->stat_decode_ns += get_stat_clock() - decode_start;
+	rf->stat_read_ns += get_stat_clock() - start;
+	rf->stat_bytes += len;
+#endif
+
+	return len;
+}
+
+/* Refill the read buffer if it is consumed. Returns false on EOF. */
+static bool fill_rfile_buf(struct rfile *rf)
+{
+	size_t size;
+
+	if (rf->buf_pos < rf->buf_len)
+		return true;
+
+	/* Allocate the buffer on the first use. (A small file gets a small buffer.) */
+	if (rf->buf == NULL) {
+		size = get_rfile_size(rf);
+		if (size > RFILE_BUF_SIZE || size == 0)
+			size = RFILE_BUF_SIZE;
+		rf->buf = malloc(size);
+		if (rf->buf == NULL) {
+			log_memory();
+			return false;
+		}
+		rf->buf_size = size;
+	}
+
+	rf->buf_len = read_rfile_raw(rf, rf->buf, rf->buf_size);
+	rf->buf_pos = 0;
+
+	return rf->buf_len > 0;
+}
+
+/* Discard the read-ahead bytes. (The underlying position is left as is.) */
+static void discard_rfile_buf(struct rfile *rf)
+{
+	rf->buf_len = 0;
+	rf->buf_pos = 0;
+}
+
+/*
+ * Read a line from a read file stream.
+ *  - A line ends with LF, CR+LF, CR or NUL.
+ */
+const char *gets_rfile(struct rfile *rf, char *buf, size_t size)
+{
+	const unsigned char *src, *end, *p;
+	size_t len, avail;
+	unsigned char c;
+
+	assert(rf != NULL);
+	assert(rf->fp != NULL || rf->is_packaged);
+	assert(buf != NULL);
+	assert(size > 0);
+
+	len = 0;
+	while (len < size - 1) {
+		/* Get the read-ahead bytes. */
+		if (!fill_rfile_buf(rf)) {
+			buf[len] = '\0';
+			return len == 0 ? NULL : buf;
+		}
+		src = rf->buf + rf->buf_pos;
+		avail = rf->buf_len - rf->buf_pos;
+		if (avail > size - 1 - len)
+			avail = size - 1 - len;
+
+		/* Search the end of the line. */
+		end = memchr(src, '\n', avail);
+		if (end == NULL)
+			end = src + avail;
+		p = memchr(src, '\r', (size_t)(end - src));
+		if (p != NULL)
+			end = p;
+		p = memchr(src, '\0', (size_t)(end - src));
+		if (p != NULL)
+			end = p;
+
+		/* Copy the bytes before the end. */
+		memcpy(buf + len, src, (size_t)(end - src));
+		len += (size_t)(end - src);
+		rf->buf_pos += (size_t)(end - src);
+		if (end == src + avail)
+			continue;
+
+		/* Consume the line terminator. (CR+LF is one terminator.) */
+		c = *end;
+		rf->buf_pos++;
+		if (c == '\r' && fill_rfile_buf(rf) && rf->buf[rf->buf_pos] == '\n')
+			rf->buf_pos++;
+		buf[len] = '\0';
+		return buf;
+	}
+	buf[len] = '\0';
+	if (len == 0)
+		return NULL;
+	return buf;
+}
+
+/*
+ * Close a read file stream.
+ */
+void close_rfile(struct rfile *rf)
+{
+	assert(rf != NULL);
+	assert(rf->fp != NULL || rf->is_packaged);
+
+#if defined(USE_FILE_STATS)
+	close_file_stat(rf);
+#endif
+
+	if (rf->data != NULL) {
+#if defined(USE_MMAP_POSIX)
+		if (rf->is_data_mapped)
+			munmap((void *)rf->data, rf->data_size);
+		else
+			free((void *)rf->data);
+#else
+		free((void *)rf->data);
+#endif
+	}
+	if (rf->fp != NULL)
+		fclose(rf->fp);
+	free(rf->buf);
+	free(rf);
+}
+
 /*
- * Get a file size.
+ * Rewind a read file stream.
  */
-size_t get_rfile_size(struct rfile *rf)
+void rewind_rfile(struct rfile *rf)
 {
-	long pos, len;
+	assert(rf != NULL);
+	assert(rf->fp != NULL || rf->is_packaged);
+
+	discard_rfile_buf(rf);
 
-	/* If the rfile points to a real file. */
 	if (!rf->is_packaged) {
-		/* Return the file size. */
-		pos = ftell(rf->fp);
-		fseek(rf->fp, 0, SEEK_END);
-		len = ftell(rf->fp);
-		fseek(rf->fp, pos, SEEK_SET);
-		return (size_t)len;
+		/* If a real file. */
+		rewind(rf->fp);
+		rf->pos = 0;
+		return;
 	}
 
-	/* If the rfile points to a package entry. */
-	return (size_t)rf->size;
+	/* If a package entry. (Only version 1 uses the random sequence.) */
+	rf->pos = 0;
+	if (package_version == 1)
+		set_random_seed(rf->index, &rf->next_random);
 }
 
 /*
- * Read bytes from a read file stream.
+ * Seek a read file stream.
  */
-size_t read_rfile(struct rfile *rf, void *buf, size_t size)
+bool seek_rfile(struct rfile *rf, int64_t offset, int whence)
 {
-	size_t len, obf;
+	uint64_t size, pos, i;
+	int64_t base;
 
 	assert(rf != NULL);
-	assert(rf->fp != NULL);
+	assert(rf->fp != NULL || rf->is_packaged);
+
+	/* Get the base position. */
+	size = get_rfile_size64(rf);
+	switch (whence) {
+	case SEEK_SET:
+		base = 0;
+		break;
+	case SEEK_CUR:
+		base = (int64_t)tell_rfile(rf);
+		break;
+	case SEEK_END:
+		base = (int64_t)size;
+		break;
+	default:
+		return false;
+	}
 
-	if (!rf->is_packaged) {
-		/*
-		 * For the case the rfile points to a real file.
-		 */
+	/* Check the range. (We don't allow seeking beyond the end.) */
+	if (offset < -base || (uint64_t)(base + offset) > size)
+		return false;
+	pos = (uint64_t)(base + offset);
 
-		/* Read. */
-		len = fread(buf, 1, size, rf->fp);
+	/* The underlying position is ahead of the buffer, so seek it absolutely. */
+	discard_rfile_buf(rf);
 
-		/* If the file is a save file, do obfuscation decode. */
+	if (!rf->is_packaged) {
+		/* If a real file. */
+		if (!seek_real_file(rf->fp, (int64_t)pos, SEEK_SET))
+			return false;
+
+		/* A save file uses the byte-serial keystream, so replay it. */
 		if (rf->is_obfuscated) {
-			for (obf = 0; obf < len; obf++)
-				*(((char *)buf) + obf) ^= get_next_random(&rf->next_random, NULL);
+			set_random_seed(0, &rf->next_random);
+			for (i = 0; i < pos; i++)
+				get_next_random(&rf->next_random);
 		}
-	} else {
-		/*
-		 * For the case the rfile points to a package entry.
-		 */
-
-		/* Read. */
-		if (rf->pos + size > rf->size)
-			size = (size_t)(rf->size - rf->pos);
-		if (size == 0)
-			return 0;
-		len = fread(buf, 1, size, rf->fp);
-		rf->pos += len;
+		return true;
+	}
 
-		/* Do obfuscation decode. */
-		for (obf = 0; obf < len; obf++)
-			*(((char *)buf) + obf) ^= get_next_random(&rf->next_random, &rf->prev_random);
+	/* If a package entry. */
+	if (package_version == 1 && rf->is_obfuscated) {
+		/* The version 1 keystream has to be replayed. */
+		if (pos < rf->pos) {
+			set_random_seed(rf->index, &rf->next_random);
+			rf->pos = 0;
+		}
+		for (i = rf->pos; i < pos; i++)
+			get_next_random(&rf->next_random);
 	}
+	rf->pos = pos;
 
-	return len;
+	return true;
 }
 
 /*
- * Read a line from a read file stream.
+ * Get the current position of a read file stream.
  */
-const char *gets_rfile(struct rfile *rf, char *buf, size_t size)
+uint64_t tell_rfile(struct rfile *rf)
 {
-	char *ptr;
-	size_t len, ret;
-	char c;
-
 	assert(rf != NULL);
-	assert(rf->fp != NULL);
-	assert(buf != NULL);
-	assert(size > 0);
+	assert(rf->fp != NULL || rf->is_packaged);
 
-	ptr = buf;
-	for (len = 0; len < size - 1; len++) {
-		ret = read_rfile(rf, &c, 1);
-		if (ret != 1) {
-			*ptr = '\0';
-			return len == 0 ? NULL : buf;
-		}
-		if (c == '\n' || c == '\0') {
-			*ptr = '\0';
-			return buf;
-		}
-		if (c == '\r') {
-			if (read_rfile(rf, &c, 1) != 1) {
-				*ptr = '\0';
-				return buf;
-			}
-			if (c == '\n') {
-				*ptr = '\0';
-				return buf;
-			}
-			ungetc_rfile(rf, c);
-			*ptr = '\0';
-			return buf;
-		}
-		*ptr++ = c;
-	}
-	*ptr = '\0';
-	if (len == 0)
-		return NULL;
-	return buf;
+	/* If a real file. (Excluding the read-ahead bytes.) */
+	if (!rf->is_packaged)
+		return tell_real_file(rf->fp) - (rf->buf_len - rf->buf_pos);
+
+	/* If a package entry. */
+	return rf->pos - (rf->buf_len - rf->buf_pos);
 }
 
-/* Push back a character to a read file stream. */
-static void ungetc_rfile(struct rfile *rf, char c)
+/*
+ * Check whether seek_rfile() is O(1) on a read file stream.
+ */
+bool is_rfile_seekable(struct rfile *rf)
 {
 	assert(rf != NULL);
-	assert(rf->fp != NULL);
 
-	if (!rf->is_packaged) {
-		/* If a real file. */
-		ungetc(c, rf->fp);
-	} else {
-		/* If a package entry. */
-		assert(rf->pos != 0);
-		ungetc(c, rf->fp);
-		rf->pos--;
-		rewind_random(&rf->next_random, &rf->prev_random);
-	}
+	/* A plain file, a decompressed entry and a version 2 entry. */
+	if (!rf->is_obfuscated)
+		return true;
+	return rf->is_packaged && package_version != 1;
 }
 
 /*
- * Close a read file stream.
+ * Map the whole content of a read file stream onto memory.
  */
-void close_rfile(struct rfile *rf)
+bool map_rfile(struct rfile *rf)
 {
+	unsigned char *buf;
+	size_t size;
+
 	assert(rf != NULL);
-	assert(rf->fp != NULL);
+	assert(rf->fp != NULL || rf->is_packaged);
 
-	fclose(rf->fp);
-	free(rf);
+	/* If already mapped. (Including a decompressed entry.) */
+	if (rf->data != NULL) {
+		rewind_rfile(rf);
+		return true;
+	}
+
+	size = get_rfile_size(rf);
+
+#if defined(USE_MMAP_POSIX)
+	/* For a plain real file, we can map the file itself without a copy. */
+	if (!rf->is_packaged && !rf->is_obfuscated && size > 0) {
+		void *p;
+		p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(rf->fp), 0);
+		if (p != MAP_FAILED) {
+			rewind_rfile(rf);
+			rf->data = p;
+			rf->data_size = size;
+			rf->is_data_mapped = true;
+			return true;
+		}
+	}
+#endif
+
+	/*
+	 * Otherwise, decode the whole content into a heap memory.
+	 *  - A packaged file is obfuscated, so it cannot be used in-place.
+	 */
+	buf = malloc(size > 0 ? size : 1);
+	if (buf == NULL) {
+		log_memory();
+		return false;
+	}
+	rewind_rfile(rf);
+	if (read_rfile(rf, buf, size) != size) {
+		free(buf);
+		return false;
+	}
+	rewind_rfile(rf);
+	rf->data = buf;
+	rf->data_size = size;
+	rf->is_data_mapped = false;
+
+	return true;
 }
 
 /*
- * Rewind a read file stream.
+ * Get a pointer to the content of a read file stream mapped by map_rfile().
  */
-void rewind_rfile(struct rfile *rf)
+const void *get_rfile_data(struct rfile *rf)
 {
 	assert(rf != NULL);
-	assert(rf->fp != NULL);
+	assert(rf->data != NULL);
 
-	if (!rf->is_packaged) {
-		/* If a real file. */
-		rewind(rf->fp);
-		rf->pos = 0;
-		return;
-	}
+	return rf->data;
+}
 
-	/* If a package entry. */
-	fseek(rf->fp, (long)rf->offset, SEEK_SET);
-	rf->pos = 0;
-	set_random_seed(rf->index, &rf->next_random);
-	rf->prev_random = 0;
+/*
+ * Get the obfuscation key.
+ *  - Streams are read on several threads (e.g. the sound thread), so the
+ *    key is unshuffled into a local and no global is written.
+ */
+static uint64_t get_key(void)
+{
+	uint64_t obfuscated, reversed;
+
+	/* The key is shuffled so that decompilers cannot read it directly. */
+	obfuscated = key_obfuscated;
+	reversed = ((((obfuscated >> 56) & 0xff) << 0) |
+		    (((obfuscated >> 48) & 0xff) << 8) |
+		    (((obfuscated >> 40) & 0xff) << 16) |
+		    (((obfuscated >> 32) & 0xff) << 24) |
+		    (((obfuscated >> 24) & 0xff) << 32) |
+		    (((obfuscated >> 16) & 0xff) << 40) |
+		    (((obfuscated >> 8)  & 0xff) << 48) |
+		    (((obfuscated >> 0)  & 0xff) << 56));
+	return ~reversed;
 }
 
 /* Set a random seed. */
@@ -565,16 +2108,7 @@ static void set_random_seed(uint64_t index, uint64_t *next_random)
 {
 	uint64_t i, next, lsb;
 
-	/* The key is shuffled so that decompilers cannot read it directly. */
-	key_reversed = ((((key_obfuscated >> 56) & 0xff) << 0) |
-			(((key_obfuscated >> 48) & 0xff) << 8) |
-			(((key_obfuscated >> 40) & 0xff) << 16) |
-			(((key_obfuscated >> 32) & 0xff) << 24) |
-			(((key_obfuscated >> 24) & 0xff) << 32) |
-			(((key_obfuscated >> 16) & 0xff) << 40) |
-			(((key_obfuscated >> 8)  & 0xff) << 48) |
-			(((key_obfuscated >> 0)  & 0xff) << 56));
-	next = ~(*key_ref);
+	next = get_key();
 	for (i = 0; i < index; i++) {
 		/* This XOR mask is not a secret. */
 		next ^= NEXT_MASK1;
@@ -586,29 +2120,80 @@ static void set_random_seed(uint64_t index, uint64_t *next_random)
 }
 
 /* Get a next random mask. */
-static char get_next_random(uint64_t *next_random, uint64_t *prev_random)
+static char get_next_random(uint64_t *next_random)
 {
-	uint64_t next;
+	uint64_t key, next;
 	char ret;
 
-	/* For ungetc(). */
-	if (prev_random != NULL)
-		*prev_random = *next_random;
-
+	key = get_key();
 	ret = (char)(*next_random);
 	next = *next_random;
-	next = (((~(*key_ref) & 0xff00) * next + (~(*key_ref) & 0xff)) %
-		~(*key_ref)) ^ NEXT_MASK2;
+	next = (((key & 0xff00) * next + (key & 0xff)) % key) ^ NEXT_MASK2;
 	*next_random = next;
 
 	return ret;
 }
 
-/* Go back to the previous random mask. */
-static void rewind_random(uint64_t *next_random, uint64_t *prev_random)
+/*
+ * Decode bytes of a version 2 package.
+ *  - The bytes in buf are at the position pos of the stream of the nonce.
+ *  - A keystream block is eight 64-bit words generated from
+ *    (key, nonce, block index), and is used in little endian.
+ *  - This must be the same as the one in package.c
+ */
+static void decode_blocks(uint64_t nonce, uint64_t pos, void *buf, size_t size)
 {
-	*next_random = *prev_random;
-	*prev_random = 0;
+	uint64_t ks[PACKAGE_BLOCK_SIZE / 8];
+	unsigned char *p;
+	uint64_t base, block, z;
+	size_t ofs, len, i;
+
+	p = buf;
+	base = get_key() ^ (nonce * BLOCK_MUL1);
+	while (size > 0) {
+		block = pos / PACKAGE_BLOCK_SIZE;
+		ofs = (size_t)(pos % PACKAGE_BLOCK_SIZE);
+		len = PACKAGE_BLOCK_SIZE - ofs;
+		if (len > size)
+			len = size;
+
+		/* Generate the keystream of the block. */
+		for (i = 0; i < PACKAGE_BLOCK_SIZE / 8; i++) {
+			z = base ^ (block * BLOCK_MUL2);
+			z += (uint64_t)(i + 1) * BLOCK_MUL1;
+			z = (z ^ (z >> 30)) * BLOCK_MUL2;
+			z = (z ^ (z >> 27)) * BLOCK_MUL3;
+			ks[i] = z ^ (z >> 31);
+		}
+
+		/* XOR the keystream. */
+		if (len == PACKAGE_BLOCK_SIZE) {
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+			for (i = 0; i < PACKAGE_BLOCK_SIZE; i += 16) {
+				_mm_storeu_si128((__m128i *)(void *)(p + i),
+						 _mm_xor_si128(_mm_loadu_si128((const __m128i *)(const void *)(p + i)),
+							       _mm_loadu_si128((const __m128i *)(const void *)((unsigned char *)ks + i))));
+			}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+			for (i = 0; i < PACKAGE_BLOCK_SIZE; i += 16) {
+				vst1q_u8(p + i, veorq_u8(vld1q_u8(p + i),
+							 vld1q_u8((unsigned char *)ks + i)));
+			}
+#else
+			for (i = 0; i < PACKAGE_BLOCK_SIZE; i++)
+				p[i] ^= (unsigned char)(ks[i / 8] >> ((i % 8) * 8));
+#endif
+		} else {
+			for (i = 0; i < len; i++) {
+				p[i] ^= (unsigned char)(ks[(ofs + i) / 8] >>
+							(((ofs + i) % 8) * 8));
+			}
+		}
+
+		p += len;
+		pos += len;
+		size -= len;
+	}
 }
 
 /*
@@ -617,11 +2202,12 @@ static void rewind_random(uint64_t *next_random, uint64_t *prev_random)
 
 /*
  * Open a write file stream.
+ *  - Nothing is written to the file system until close_wfile().
  */
 struct wfile *open_wfile(const char *dir, const char *file)
 {
-	char *path;
 	struct wfile *wf;
+	size_t len;
 
 	/* Allocate wfile struct. */
 	wf = malloc(sizeof(struct wfile));
@@ -629,81 +2215,347 @@ struct wfile *open_wfile(const char *dir, const char *file)
 		log_memory();
 		return NULL;
 	}
+	memset(wf, 0, sizeof(struct wfile));
 
-	/* Make a real file path. */
-	path = make_valid_path(dir, file);
-	if (path == NULL) {
+	/* The file may be a new one. */
+	forget_resolved_paths(dir);
+
+	/* Make a real file path and a temporary file path. */
+	wf->path = make_valid_path(dir, file);
+	if (wf->path == NULL) {
 		log_memory();
-		free(wf);
+		free_wfile(wf);
 		return NULL;
 	}
-
-	/* Open a real file. */
-#ifdef POLARIS_ENGINE_TARGET_WIN32
-	_fmode = _O_BINARY;
-	wf->fp = _wfopen(conv_utf8_to_utf16(path), L"w");
-#else
-	wf->fp = fopen(path, "w");
-#endif
-	if (wf->fp == NULL) {
-		log_file_open(path);
-		free(path);
-		free(wf);
+	len = strlen(wf->path) + strlen(WFILE_TMP_SUFFIX) + 1;
+	wf->tmp_path = malloc(len);
+	if (wf->tmp_path == NULL) {
+		log_memory();
+		free_wfile(wf);
 		return NULL;
 	}
-	free(path);
+	snprintf(wf->tmp_path, len, "%s%s", wf->path, WFILE_TMP_SUFFIX);
 
-	/* Initialize the random seed. */
-	set_random_seed(0, &wf->next_random);
+	/* Allocate the buffer. */
+	wf->buf = malloc(WFILE_BUF_SIZE);
+	if (wf->buf == NULL) {
+		log_memory();
+		free_wfile(wf);
+		return NULL;
+	}
+	wf->alloc = WFILE_BUF_SIZE;
 
 	return wf;
 }
 
 /*
  * Write bytes to a write file stream.
+ *  - The bytes are appended to the buffer.
  */
 size_t write_wfile(struct wfile *wf, const void *buf, size_t size)
 {
-	char obf[1024];
-	const char *src;
-	size_t block_size, out, total, i;
+	unsigned char *new_buf;
+	size_t new_alloc;
 
 	assert(wf != NULL);
-	assert(wf->fp != NULL);
-
-	src = buf;
-	total = 0;
-	while (size > 0) {
-		/* Get the block size. (Max. 1024 bytes) */
-		if (size > sizeof(obf))
-			block_size = sizeof(obf);
-		else
-			block_size = size;
+	assert(wf->buf != NULL);
 
-		/* Obfuscate the block. */
-		for (i = 0; i < block_size; i++)
-			obf[i] = *src++ ^ get_next_random(&wf->next_random, NULL);
+	if (wf->is_failed)
+		return 0;
 
-		/* Write the block to the stream. */
-		out = fwrite(obf, 1, block_size, wf->fp);
-		if (out != block_size)
-			return total + out;
-		total += out;
-		size -= out;
+	/* Extend the buffer. */
+	if (wf->size + size > wf->alloc) {
+		new_alloc = wf->alloc;
+		while (wf->size + size > new_alloc)
+			new_alloc *= 2;
+		new_buf = realloc(wf->buf, new_alloc);
+		if (new_buf == NULL) {
+			log_memory();
+			wf->is_failed = true;
+			return 0;
+		}
+		wf->buf = new_buf;
+		wf->alloc = new_alloc;
 	}
-	return total;
+
+	memcpy(wf->buf + wf->size, buf, size);
+	wf->size += size;
+	return size;
 }
 
 /*
  * Close a write file stream.
+ *  - The content is obfuscated and written to the temporary file, and then
+ *    the temporary file replaces the real file.
+ *  - In a batch, the replacement is deferred to end_wfile_batch().
+ *  - Returns false if the file is not saved. (The old file is kept.)
+ */
+bool close_wfile(struct wfile *wf)
+{
+	assert(wf != NULL);
+
+	if (wf->is_failed) {
+		free_wfile(wf);
+		return false;
+	}
+
+	/* Obfuscate the content in bulk. */
+	if (!prepare_save_keystream(wf->size)) {
+		free_wfile(wf);
+		return false;
+	}
+	xor_bytes(wf->buf, save_keystream, wf->size);
+
+	/* Write the temporary file. */
+	if (!write_wfile_tmp(wf)) {
+		free_wfile(wf);
+		return false;
+	}
+
+	/* The content is on the file, so free the buffer. */
+	free(wf->buf);
+	wf->buf = NULL;
+
+	/* Append to the pending list. */
+	if (pending_wfile_tail != NULL)
+		pending_wfile_tail->next = wf;
+	else
+		pending_wfile_head = wf;
+	pending_wfile_tail = wf;
+
+	/* Commit now if we are not in a batch. */
+	if (!is_wfile_batch)
+		return commit_wfiles();
+
+	return true;
+}
+
+/*
+ * Discard a write file stream.
+ *  - Nothing is written, and the old file is kept.
  */
-void close_wfile(struct wfile *wf)
+void discard_wfile(struct wfile *wf)
 {
 	assert(wf != NULL);
-	assert(wf->fp != NULL);
 
-	fflush(wf->fp);
-	fclose(wf->fp);
+	free_wfile(wf);
+}
+
+/*
+ * Begin a batch of write streams.
+ */
+void begin_wfile_batch(void)
+{
+	assert(!is_wfile_batch);
+
+	is_wfile_batch = true;
+}
+
+/*
+ * End a batch of write streams.
+ *  - The files closed in the batch are synced and replaced together.
+ */
+bool end_wfile_batch(void)
+{
+	assert(is_wfile_batch);
+
+	is_wfile_batch = false;
+	return commit_wfiles();
+}
+
+/* Make the keystream of the save data have the size at least. */
+static bool prepare_save_keystream(size_t size)
+{
+	unsigned char *new_keystream;
+	size_t new_size, i;
+
+	if (size <= save_keystream_size)
+		return true;
+
+	/* Round up to the buffer size. */
+	new_size = (size + WFILE_BUF_SIZE - 1) / WFILE_BUF_SIZE * WFILE_BUF_SIZE;
+	new_keystream = realloc(save_keystream, new_size);
+	if (new_keystream == NULL) {
+		log_memory();
+		return false;
+	}
+
+	/* Continue the generator from where we stopped. */
+	if (save_keystream_size == 0)
+		set_random_seed(0, &save_keystream_next);
+	for (i = save_keystream_size; i < new_size; i++)
+		new_keystream[i] = (unsigned char)get_next_random(&save_keystream_next);
+
+	save_keystream = new_keystream;
+	save_keystream_size = new_size;
+	return true;
+}
+
+/* XOR the key bytes to the bytes. */
+static void xor_bytes(unsigned char *dst, const unsigned char *key, size_t size)
+{
+	size_t i;
+
+	i = 0;
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+	for (; i + 16 <= size; i += 16) {
+		_mm_storeu_si128((__m128i *)(void *)(dst + i),
+				 _mm_xor_si128(_mm_loadu_si128((const __m128i *)(const void *)(dst + i)),
+					       _mm_loadu_si128((const __m128i *)(const void *)(key + i))));
+	}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+	for (; i + 16 <= size; i += 16)
+		vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), vld1q_u8(key + i)));
+#endif
+	for (; i < size; i++)
+		dst[i] ^= key[i];
+}
+
+/* Write the content of a stream to its temporary file. */
+static bool write_wfile_tmp(struct wfile *wf)
+{
+	bool success;
+
+	/* Open the temporary file. */
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	wf->fp = _wfopen(conv_utf8_to_utf16(wf->tmp_path), L"wb");
+#else
+	wf->fp = fopen(wf->tmp_path, "wb");
+#endif
+	if (wf->fp == NULL) {
+		log_file_open(wf->tmp_path);
+		return false;
+	}
+
+	/* Write the whole content at once. */
+	success = true;
+	if (wf->size > 0 && fwrite(wf->buf, 1, wf->size, wf->fp) != wf->size)
+		success = false;
+	if (fflush(wf->fp) != 0)
+		success = false;
+	if (!success) {
+		log_file_write(wf->tmp_path);
+		fclose(wf->fp);
+		wf->fp = NULL;
+		remove(wf->tmp_path);
+		return false;
+	}
+
+	return true;
+}
+
+/* Sync and replace the pending files. */
+static bool commit_wfiles(void)
+{
+	struct wfile *wf, *next;
+	const char *last_path;
+	bool success;
+
+	/* Sync all the temporary files first, then replace the files. */
+	for (wf = pending_wfile_head; wf != NULL; wf = wf->next)
+		sync_file(wf->fp);
+
+	success = true;
+	last_path = NULL;
+	for (wf = pending_wfile_head; wf != NULL; wf = wf->next) {
+		fclose(wf->fp);
+		wf->fp = NULL;
+		if (!replace_file(wf->tmp_path, wf->path)) {
+			log_file_write(wf->path);
+			remove(wf->tmp_path);
+			success = false;
+			continue;
+		}
+		last_path = wf->path;
+	}
+
+	/* Sync the directory once to persist the renames. */
+	if (last_path != NULL)
+		sync_dir(last_path);
+
+	/* Free the streams. */
+	for (wf = pending_wfile_head; wf != NULL; wf = next) {
+		next = wf->next;
+		free_wfile(wf);
+	}
+	pending_wfile_head = NULL;
+	pending_wfile_tail = NULL;
+
+	return success;
+}
+
+/* Flush a file to the storage. */
+static void sync_file(FILE *fp)
+{
+#if defined(USE_MMAP_POSIX)
+	fsync(fileno(fp));
+#elif defined(POLARIS_ENGINE_TARGET_WIN32)
+	_commit(_fileno(fp));
+#else
+	UNUSED_PARAMETER(fp);
+#endif
+}
+
+/* Replace a file by another file atomically. */
+static bool replace_file(const char *src, const char *dst)
+{
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	wchar_t *src_w;
+	BOOL ret;
+
+	/* conv_utf8_to_utf16() returns a static buffer. */
+	src_w = _wcsdup(conv_utf8_to_utf16(src));
+	if (src_w == NULL) {
+		log_memory();
+		return false;
+	}
+	ret = MoveFileExW(src_w, conv_utf8_to_utf16(dst),
+			  MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+	free(src_w);
+	return ret ? true : false;
+#else
+	return rename(src, dst) == 0;
+#endif
+}
+
+/* Sync the directory of a file so that the directory entry persists. */
+static void sync_dir(const char *path)
+{
+#if defined(USE_MMAP_POSIX)
+	char *dir, *slash;
+	int fd;
+
+	dir = strdup(path);
+	if (dir == NULL)
+		return;
+	slash = strrchr(dir, '/');
+	if (slash != NULL)
+		*slash = '\0';
+	else
+		strcpy(dir, ".");
+
+	fd = open(dir, O_RDONLY);
+	if (fd != -1) {
+		fsync(fd);
+		close(fd);
+	}
+	free(dir);
+#else
+	/* MoveFileExW() with MOVEFILE_WRITE_THROUGH covers this on Win32. */
+	UNUSED_PARAMETER(path);
+#endif
+}
+
+/* Free a write stream. */
+static void free_wfile(struct wfile *wf)
+{
+	if (wf->fp != NULL) {
+		fclose(wf->fp);
+		remove(wf->tmp_path);
+	}
+	free(wf->buf);
+	free(wf->tmp_path);
+	free(wf->path);
 	free(wf);
 }
 
@@ -723,6 +2575,7 @@ void remove_file(const char *dir, const char *file)
 
 	/* Remove the file from the file system. */
 	remove(path);
+	forget_resolved_paths(dir);
 
 	/* Free the memory of the path. */
 	free(path);
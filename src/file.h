@@ -20,7 +20,7 @@
  */
 
 /*
- * [Archive File Design]
+ * [Archive File Design (Version 1)]
  *
  * struct header {
  *     u64 file_count;
@@ -33,11 +33,59 @@
  * u8 file_body[file_count][file_length]; // Obfuscated
  */
 
+/*
+ * [Archive File Design (Version 2 to 4)]
+ *
+ * struct header {
+ *     u8  signature[8];   // "PLRSPACK"
+ *     u64 version;        // 2, 3 or 4
+ *     u64 file_count;
+ *     struct file_entry {
+ *         u8  file_name[256]; // Obfuscated with nonce ~index
+ *         u64 file_size;      // Stored size in the archive
+ *         u64 file_offset;
+ *         u64 raw_size;       // Version 3: Uncompressed size
+ *         u64 codec;          // Version 3: PACKAGE_CODEC_*
+ *         u64 nonce;          // Version 4: Content hash of the body
+ *     } [file_count];
+ * };
+ * u8 file_body[body_count][file_length]; // Obfuscated with nonce
+ *
+ *  - Until version 3, the nonce of a body is the entry index.
+ *  - Since version 4, the nonce is keyed on the payload, so that entries
+ *    with the same content share one body. (The same offset and size)
+ *
+ * The version 2 keystream is generated per 64-byte block from
+ * (key, nonce, block index), so that any offset can be decoded without
+ * replaying the preceding bytes. A version 1 archive starts with a small
+ * file count and never matches the signature.
+ */
+
 /* Package file name. */
 #define PACKAGE_FILE		"data01.arc"
 
-/* Maximum entries in a package. */
-#define FILE_ENTRY_SIZE		(65536)
+/* Signature of a version 2 (or later) package. */
+#define PACKAGE_SIGNATURE	"PLRSPACK"
+
+/* Size of the signature. */
+#define PACKAGE_SIGNATURE_SIZE	(8)
+
+/* Latest package version. */
+#define PACKAGE_VERSION		(4)
+
+/* Codecs of the package entries. (Version 3) */
+#define PACKAGE_CODEC_NONE	(0)	/* Stored as is */
+#define PACKAGE_CODEC_DEFLATE	(1)	/* zlib stream */
+
+/*
+ * Access trace file. (Written by a build with USE_ACCESS_TRACE)
+ *  - Each line is "dir/file" of an open_rfile() call in the order of calls.
+ *  - The packager can lay out the bodies in the first-touch order.
+ */
+#define ACCESS_TRACE_FILE	"access-trace.txt"
+
+/* Size of a keystream block of a version 2 package. */
+#define PACKAGE_BLOCK_SIZE	(64)
 
 /* File name length for an entry. */
 #define FILE_NAME_SIZE		(256)
@@ -49,11 +97,20 @@ struct file_entry {
 	/* File name. */
 	char name[FILE_NAME_SIZE];
 
-	/* File size. */
+	/* File size. (Stored size in the package file) */
 	uint64_t size;
 
 	/* Offset in the package file. */
 	uint64_t offset;
+
+	/* Uncompressed file size. */
+	uint64_t raw_size;
+
+	/* Codec. (PACKAGE_CODEC_*) */
+	uint64_t codec;
+
+	/* Nonce of the body keystream. */
+	uint64_t nonce;
 };
 
 /* File read stream. */
@@ -71,6 +128,22 @@ void cleanup_file(void);
 /* Check whether file exists. */
 bool check_file_exist(const char *dir, const char *file);
 
+/*
+ * Get an identity of a package body which is shared by multiple entries.
+ *  - Files with the same content share one body in a package.
+ *  - Returns false if the file is not such an entry.
+ *  - Callers can reuse a decode result for the same identity.
+ */
+bool get_shared_body_id(const char *dir, const char *file, uint64_t *id);
+
+#if defined(USE_FILE_STATS)
+/*
+ * Dump the I/O statistics per file to "file-stats.csv" and "file-stats.json".
+ *  - Called at cleanup_file(), and can be called any time.
+ */
+void dump_file_stats(void);
+#endif
+
 /* Open file read stream. */
 struct rfile *open_rfile(const char *dir, const char *file, bool save_data);
 
@@ -89,14 +162,66 @@ void close_rfile(struct rfile *rf);
 /* Go back to the top of a file stream. */
 void rewind_rfile(struct rfile *rf);
 
+/*
+ * Seek a file stream.
+ *  - whence is SEEK_SET, SEEK_CUR or SEEK_END.
+ *  - Seeking beyond the end fails.
+ *  - O(1) for a real file and a version 2 package entry.
+ */
+bool seek_rfile(struct rfile *rf, int64_t offset, int whence);
+
+/* Get the current position of a file stream. */
+uint64_t tell_rfile(struct rfile *rf);
+
+/*
+ * Check whether seek_rfile() is O(1) on a file stream.
+ *  - False for a version 1 package entry and a save file, where a seek
+ *    replays the keystream from the top.
+ *  - A decoder that seeks to probe the stream should read it
+ *    sequentially instead.
+ */
+bool is_rfile_seekable(struct rfile *rf);
+
+/*
+ * Map the whole content of a file stream onto memory.
+ *  - A plain real file is mapped without a copy where mmap() is available.
+ *  - A packaged file is decoded once into a memory owned by the stream.
+ *  - The stream position is rewound to the top.
+ */
+bool map_rfile(struct rfile *rf);
+
+/*
+ * Get a pointer to the content mapped by map_rfile().
+ *  - The pointer is valid until close_rfile().
+ *  - The size is get_rfile_size().
+ */
+const void *get_rfile_data(struct rfile *rf);
+
 /* Open a write file stream. */
 struct wfile *open_wfile(const char *dir, const char *file);
 
 /* Write to a file stream. */
 size_t write_wfile(struct wfile *wf, const void *buf, size_t size);
 
-/* Close a write file stream. */
-void close_wfile(struct wfile *wf);
+/*
+ * Close a write file stream.
+ *  - The file is replaced atomically, and the old file is kept on a failure.
+ *  - Returns false if the file is not saved.
+ */
+bool close_wfile(struct wfile *wf);
+
+/* Discard a write file stream without saving. */
+void discard_wfile(struct wfile *wf);
+
+/*
+ * Begin a batch of write streams.
+ *  - The files closed in a batch are synced to the storage together at
+ *    end_wfile_batch().
+ */
+void begin_wfile_batch(void);
+
+/* End a batch of write streams. (Returns false if a file is not saved.) */
+bool end_wfile_batch(void);
 
 /* Remove a file. */
 void remove_file(const char *dir, const char *file);
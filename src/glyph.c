@@ -19,6 +19,14 @@
 #include FT_FREETYPE_H
 #include <freetype/ftstroke.h>
 
+/* SIMD */
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+#include <emmintrin.h>
+#include <immintrin.h>	/* SSSE3は実行時に選択する */
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+
 /*
  * The scale constant
  */
@@ -29,7 +37,8 @@
  */
 static FT_Library library;
 static FT_Face face[FONT_COUNT];
-static FT_Byte *font_file_content[FONT_COUNT];
+static struct rfile *font_file[FONT_COUNT];
+static const FT_Byte *font_file_content[FONT_COUNT];
 static FT_Long font_file_size[FONT_COUNT];
 
 /*
@@ -37,12 +46,21 @@ static FT_Long font_file_size[FONT_COUNT];
  */
 static struct image *emoticon_image[EMOTICON_COUNT];
 
+/*
+ * The glyph blending kernel (selected in init_glyph())
+ */
+static void (*glyph_row)(pixel_t * RESTRICT dst,
+			 const unsigned char * RESTRICT src,
+			 int width,
+			 pixel_t color);
+
 /*
  * Forward declarations
  */
 static bool read_font_file_content(
 	const char *file_name,
-	FT_Byte **content,
+	struct rfile **rf,
+	const FT_Byte **content,
 	FT_Long *size);
 static bool draw_glyph_without_outline(
 	struct image *img,
@@ -62,9 +80,7 @@ static void draw_glyph_func(
 	int font_height,
 	int margin_left,
 	int margin_top,
-	pixel_t * RESTRICT image,
-	int image_width,
-	int image_height,
+	struct image *img,
 	int image_x,
 	int image_y,
 	pixel_t color);
@@ -74,12 +90,11 @@ static void draw_glyph_dim_func(
 	int font_height,
 	int margin_left,
 	int margin_top,
-	pixel_t * RESTRICT image,
-	int image_width,
-	int image_height,
+	struct image *img,
 	int image_x,
 	int image_y,
 	pixel_t color);
+static void select_glyph_kernel(void);
 static bool isgraph_extended(const char **mbs, uint32_t *wc);
 static int translate_font_type(int font_ype);
 static bool apply_font_size(int font_type, int size);
@@ -99,6 +114,9 @@ bool init_glyph(void)
 	cleanup_glyph();
 #endif
 
+	/* グリフのブレンド関数を選択する */
+	select_glyph_kernel();
+
 	/* FreeType2ライブラリを初期化する */
 	err = FT_Init_FreeType(&library);
 	if (err != 0) {
@@ -119,6 +137,7 @@ bool init_glyph(void)
 
 		/* フォントファイルの内容を読み込む */
 		if (!read_font_file_content(fname[i],
+					    &font_file[i],
 					    &font_file_content[i],
 					    &font_file_size[i]))
 			return false;
@@ -163,8 +182,9 @@ void cleanup_glyph(void)
 			FT_Done_Face(face[i]);
 			face[i] = NULL;
 		}
-		if (font_file_content[i] != NULL) {
-			free(font_file_content[i]);
+		if (font_file[i] != NULL) {
+			close_rfile(font_file[i]);
+			font_file[i] = NULL;
 			font_file_content[i] = NULL;
 		}
 	}
@@ -199,12 +219,14 @@ bool update_global_font(void)
 	assert(face[FONT_GLOBAL] != NULL);
 	FT_Done_Face(face[FONT_GLOBAL]);
 	face[FONT_GLOBAL] = NULL;
-	assert(font_file_content[FONT_GLOBAL] != NULL);
-	free(font_file_content[FONT_GLOBAL]);
+	assert(font_file[FONT_GLOBAL] != NULL);
+	close_rfile(font_file[FONT_GLOBAL]);
+	font_file[FONT_GLOBAL] = NULL;
 	font_file_content[FONT_GLOBAL] = NULL;
 
 	/* フォントファイルの内容を読み込む */
 	if (!read_font_file_content(conf_font_global_file,
+				    &font_file[FONT_GLOBAL],
 				    &font_file_content[FONT_GLOBAL],
 				    &font_file_size[FONT_GLOBAL]))
 		return false;
@@ -223,41 +245,37 @@ bool update_global_font(void)
 	return true;
 }
 
-/* フォントファイルの内容を読み込む */
+/*
+ * フォントファイルの内容を読み込む
+ *  - ファイルをメモリにマップし、FT_Done_Face()するまでrfileを開いたままにする
+ */
 static bool read_font_file_content(const char *file_name,
-				   FT_Byte **content,
+				   struct rfile **rf,
+				   const FT_Byte **content,
 				   FT_Long *size)
 {
-	struct rfile *rf;
-
 	/* フォントファイルを開く */
-	rf = open_rfile(FONT_DIR, file_name, false);
-	if (rf == NULL)
+	*rf = open_rfile(FONT_DIR, file_name, false);
+	if (*rf == NULL)
 		return false;
 
 	/* フォントファイルのサイズを取得する */
-	*size = (FT_Long)get_rfile_size(rf);
+	*size = (FT_Long)get_rfile_size(*rf);
 	if (*size == 0) {
 		log_font_file_error(file_name);
-		close_rfile(rf);
-		return false;
-	}
-
-	/* メモリを確保する */
-	*content = malloc((size_t)*size);
-	if (*content == NULL) {
-		log_memory();
-		close_rfile(rf);
+		close_rfile(*rf);
+		*rf = NULL;
 		return false;
 	}
 
-	/* ファイルの内容を読み込む */
-	if (read_rfile(rf, *content, (size_t)*size) != (size_t)*size) {
+	/* ファイルの内容をメモリにマップする */
+	if (!map_rfile(*rf)) {
 		log_font_file_error(file_name);
-		close_rfile(rf);
+		close_rfile(*rf);
+		*rf = NULL;
 		return false;
 	}
-	close_rfile(rf);
+	*content = get_rfile_data(*rf);
 
 	return true;
 }
@@ -543,9 +561,7 @@ bool draw_glyph(struct image *img,
 				(int)bitmapGlyph->bitmap.rows,
 				bitmapGlyph->left,
 				font_size - bitmapGlyph->top,
-				img->pixels,
-				img->width,
-				img->height,
+				img,
 				x,
 				y - (font_size - base_font_size),
 				outline_color);
@@ -568,9 +584,7 @@ bool draw_glyph(struct image *img,
 				(int)bitmapGlyph->bitmap.rows,
 				bitmapGlyph->left,
 				font_size - bitmapGlyph->top,
-				img->pixels,
-				img->width,
-				img->height,
+				img,
 				x,
 				y - (font_size - base_font_size),
 				outline_color);
@@ -595,9 +609,7 @@ bool draw_glyph(struct image *img,
 			(int)bitmapGlyph->bitmap.rows,
 			bitmapGlyph->left,
 			font_size - bitmapGlyph->top,
-			img->pixels,
-			img->width,
-			img->height,
+			img,
 			x,
 			y - (font_size - base_font_size),
 			color);
@@ -645,9 +657,7 @@ static bool draw_glyph_without_outline(struct image *img,
 					(int)face[font_type]->glyph->bitmap.rows,
 					face[font_type]->glyph->bitmap_left,
 					font_size - face[font_type]->glyph->bitmap_top,
-					img->pixels,
-					img->width,
-					img->height,
+					img,
 					x,
 					y - (font_size - base_font_size),
 					color);
@@ -657,9 +667,7 @@ static bool draw_glyph_without_outline(struct image *img,
 					    (int)face[font_type]->glyph->bitmap.rows,
 					    face[font_type]->glyph->bitmap_left,
 					    font_size - face[font_type]->glyph->bitmap_top,
-					    img->pixels,
-					    img->width,
-					    img->height,
+					    img,
 					    x,
 					    y - (font_size - base_font_size),
 					    color);
@@ -773,22 +781,21 @@ static void draw_glyph_func(unsigned char *font,
 			    int font_height,
 			    int margin_left,
 			    int margin_top,
-			    pixel_t * RESTRICT image,
-			    int image_width,
-			    int image_height,
+			    struct image *img,
 			    int image_x,
 			    int image_y,
 			    pixel_t color)
 {
-	unsigned char *src_ptr, src_pix;
-	pixel_t *dst_ptr, dst_pix, dst_a2;
-	float color_r, color_g, color_b;
-	float src_a, src_r, src_g, src_b;
-	float dst_a, dst_r, dst_g, dst_b;
+	unsigned char *src_ptr;
+	pixel_t *dst_ptr;
+	int image_width, image_height;
 	int image_real_x, image_real_y;
 	int font_real_x, font_real_y;
 	int font_real_width, font_real_height;
-	int px, py;
+	int py;
+
+	image_width = img->width;
+	image_height = img->height;
 
 	/* 完全に描画しない場合のクリッピングを行う */
 	if (image_x + margin_left + font_width < 0)
@@ -827,41 +834,219 @@ static void draw_glyph_func(unsigned char *font,
 	}
 
 	/* 描画する */
-	color_r = (float)get_pixel_r(color);
-	color_g = (float)get_pixel_g(color);
-	color_b = (float)get_pixel_b(color);
-	dst_ptr = image + image_real_y * image_width + image_real_x;
+	dst_ptr = img->pixels + image_real_y * image_width + image_real_x;
 	src_ptr = font + font_real_y * font_width + font_real_x;
-	for (py = font_real_y; py < font_real_y + font_real_height; py++) {
-		for (px = font_real_x; px < font_real_x + font_real_width; px++) {
-			/* 文字のピクセルの値を取得する */
-			src_pix = *src_ptr++;
-
-			/* 色にピクセルの値(アルファ値)を乗算する */
-			src_a = (float)src_pix / 255.0f;
-			dst_a = 1.0f - src_a;
-			src_r = src_a * color_r;
-			src_g = src_a * color_g;
-			src_b = src_a * color_b;
-
-			/* 転送先画像のピクセルの値を取得する */
-			dst_pix	= *dst_ptr;
-			dst_r  = dst_a * (float)get_pixel_r(dst_pix);
-			dst_g  = dst_a * (float)get_pixel_g(dst_pix);
-			dst_b  = dst_a * (float)get_pixel_b(dst_pix);
-			dst_a2 = src_pix + get_pixel_a(dst_pix);
-			if (dst_a2 > 255)
-				dst_a2 = 255;
-
-			/* 合成して転送先に格納する */
-			*dst_ptr++ = make_pixel((uint32_t)dst_a2,
-						(uint32_t)(src_r + dst_r),
-						(uint32_t)(src_g + dst_g),
-						(uint32_t)(src_b + dst_b));
-		}
-		dst_ptr += image_width - font_real_width;
-		src_ptr += font_width - font_real_width;
+	for (py = 0; py < font_real_height; py++) {
+		glyph_row(dst_ptr, src_ptr, font_real_width, color);
+		dst_ptr += image_width;
+		src_ptr += font_width;
 	}
+
+	add_image_dirty_rect(img, image_real_x, image_real_y, font_real_width, font_real_height);
+}
+
+/*
+ * グリフのブレンドの行関数
+ *  - 色 = 文字色 * カバレッジ + 転送先 * (255 - カバレッジ)
+ *  - アルファ値 = カバレッジ + 転送先のアルファ値 (255で飽和する)
+ *  - 固定小数点で計算し、以前の浮動小数点の計算結果とは±1の範囲で一致する
+ *  - x86_64ではSSE2とSSSE3、ARM64ではNEONの実装を実行時に選択する
+ */
+
+/* 0-65025の値を255で割って丸める */
+static INLINE uint32_t div255(uint32_t x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+/* 2つの16ビットフィールド(0x00ff00ffのマスク位置)をまとめて255で割って丸める */
+static INLINE uint32_t div255_pair(uint32_t x)
+{
+	x += 0x00800080;
+	return ((x + ((x >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+}
+
+/* 1行をブレンドする (端数はxから処理する) */
+static INLINE void glyph_row_tail(pixel_t * RESTRICT dst,
+				  const unsigned char * RESTRICT src,
+				  int width,
+				  pixel_t color,
+				  int x)
+{
+	uint32_t s, is, d, rb, g, a;
+
+	for (; x < width; x++) {
+		s = src[x];
+		if (s == 0)
+			continue;
+		is = 255 - s;
+		d = dst[x];
+		rb = div255_pair((color & 0x00ff00ff) * s + (d & 0x00ff00ff) * is);
+		g = div255(((color >> 8) & 0xff) * s + ((d >> 8) & 0xff) * is);
+		a = s + (d >> 24);
+		if (a > 255)
+			a = 255;
+		dst[x] = (a << 24) | (g << 8) | rb;
+	}
+}
+
+static void glyph_row_c(pixel_t * RESTRICT dst,
+			const unsigned char * RESTRICT src,
+			int width,
+			pixel_t color)
+{
+	glyph_row_tail(dst, src, width, color, 0);
+}
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+/* 16ビットレーンの値(0-65025)を255で割って丸める */
+static INLINE __m128i div255_epu16(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/*
+ * 4ピクセルをブレンドする
+ *  - sl/shは2ピクセル分ずつ、各ピクセルのカバレッジを4つの16ビットレーンに並べたもの
+ *  - saは各ピクセルのカバレッジをアルファ値の位置に置いたもの
+ */
+static INLINE __m128i glyph_blend4(__m128i dv, __m128i sl, __m128i sh, __m128i sa, __m128i cv)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i v255 = _mm_set1_epi16(255);
+	const __m128i amask = _mm_set1_epi32((int)0xff000000);
+	__m128i dl, dh, rgb, a;
+
+	dl = _mm_unpacklo_epi8(dv, zero);
+	dh = _mm_unpackhi_epi8(dv, zero);
+	dl = _mm_add_epi16(_mm_mullo_epi16(cv, sl), _mm_mullo_epi16(dl, _mm_sub_epi16(v255, sl)));
+	dh = _mm_add_epi16(_mm_mullo_epi16(cv, sh), _mm_mullo_epi16(dh, _mm_sub_epi16(v255, sh)));
+	rgb = _mm_packus_epi16(div255_epu16(dl), div255_epu16(dh));
+	a = _mm_adds_epu8(_mm_and_si128(dv, amask), sa);
+	return _mm_or_si128(_mm_andnot_si128(amask, rgb), a);
+}
+
+static void glyph_row_sse2(pixel_t * RESTRICT dst,
+			   const unsigned char * RESTRICT src,
+			   int width,
+			   pixel_t color)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i cv = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+	__m128i sv, s16, sa, sl, sh, dv;
+	uint32_t cov;
+	int x;
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		/* 4ピクセル分のカバレッジを読み込み、全て0なら飛ばす */
+		memcpy(&cov, src + x, sizeof(cov));
+		if (cov == 0)
+			continue;
+		sv = _mm_cvtsi32_si128((int)cov);
+		s16 = _mm_unpacklo_epi8(sv, zero);
+		sa = _mm_slli_epi32(_mm_unpacklo_epi16(s16, zero), 24);
+		s16 = _mm_unpacklo_epi16(s16, s16);
+		sl = _mm_unpacklo_epi32(s16, s16);
+		sh = _mm_unpackhi_epi32(s16, s16);
+		dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+		_mm_storeu_si128((__m128i *)(void *)(dst + x), glyph_blend4(dv, sl, sh, sa, cv));
+	}
+	glyph_row_tail(dst, src, width, color, x);
+}
+
+/* SSSE3ではカバレッジの展開を1命令(pshufb)で行う */
+static TARGET_SSSE3 void glyph_row_ssse3(pixel_t * RESTRICT dst,
+					 const unsigned char * RESTRICT src,
+					 int width,
+					 pixel_t color)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i cv = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+	const __m128i lo = _mm_setr_epi8(0, -1, 0, -1, 0, -1, 0, -1, 1, -1, 1, -1, 1, -1, 1, -1);
+	const __m128i hi = _mm_setr_epi8(2, -1, 2, -1, 2, -1, 2, -1, 3, -1, 3, -1, 3, -1, 3, -1);
+	const __m128i ba = _mm_setr_epi8(-1, -1, -1, 0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3);
+	__m128i sv, sl, sh, dv;
+	uint32_t cov;
+	int x;
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		/* 4ピクセル分のカバレッジを読み込み、全て0なら飛ばす */
+		memcpy(&cov, src + x, sizeof(cov));
+		if (cov == 0)
+			continue;
+		sv = _mm_cvtsi32_si128((int)cov);
+		sl = _mm_shuffle_epi8(sv, lo);
+		sh = _mm_shuffle_epi8(sv, hi);
+		dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+		_mm_storeu_si128((__m128i *)(void *)(dst + x),
+				 glyph_blend4(dv, sl, sh, _mm_shuffle_epi8(sv, ba), cv));
+	}
+	glyph_row_tail(dst, src, width, color, x);
+}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+/* 16ビットレーンの値(0-65025)を255で割って丸め、8ビットに狭める */
+static INLINE uint8x8_t div255_u16(uint16x8_t x)
+{
+	return vraddhn_u16(x, vrshrq_n_u16(x, 8));
+}
+
+static void glyph_row_neon(pixel_t * RESTRICT dst,
+			   const unsigned char * RESTRICT src,
+			   int width,
+			   pixel_t color)
+{
+	const uint8x8_t v255 = vdup_n_u8(255);
+	uint8x8_t cv[3], s, is;
+	uint8x8x4_t dv;
+	uint64_t cov;
+	int x, c;
+
+	for (c = 0; c < 3; c++)
+		cv[c] = vdup_n_u8((uint8_t)(color >> (8 * c)));
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		/* 8ピクセル分のカバレッジを読み込み、全て0なら飛ばす */
+		memcpy(&cov, src + x, sizeof(cov));
+		if (cov == 0)
+			continue;
+		s = vcreate_u8(cov);
+		is = vsub_u8(v255, s);
+		dv = vld4_u8((const uint8_t *)(dst + x));
+		for (c = 0; c < 3; c++)
+			dv.val[c] = div255_u16(vmlal_u8(vmull_u8(cv[c], s), dv.val[c], is));
+		dv.val[3] = vqadd_u8(dv.val[3], s);
+		vst4_u8((uint8_t *)(dst + x), dv);
+	}
+	glyph_row_tail(dst, src, width, color, x);
+}
+#endif
+
+/* グリフのブレンド関数を選択する (AVX2ではSSSE3の実装を使う) */
+static void select_glyph_kernel(void)
+{
+	int tier;
+
+	tier = get_cpu_tier();
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+	if (tier >= CPU_TIER_SSSE3) {
+		glyph_row = glyph_row_ssse3;
+		return;
+	}
+	if (tier == CPU_TIER_SSE2) {
+		glyph_row = glyph_row_sse2;
+		return;
+	}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+	if (tier == CPU_TIER_NEON) {
+		glyph_row = glyph_row_neon;
+		return;
+	}
+#else
+	UNUSED_PARAMETER(tier);
+#endif
+	glyph_row = glyph_row_c;
 }
 
 /*
@@ -872,20 +1057,22 @@ static void draw_glyph_dim_func(unsigned char *font,
 				int font_height,
 				int margin_left,
 				int margin_top,
-				pixel_t * RESTRICT image,
-				int image_width,
-				int image_height,
+				struct image *img,
 				int image_x,
 				int image_y,
 				pixel_t color)
 {
 	unsigned char *src_ptr;
 	pixel_t *dst_ptr;
+	int image_width, image_height;
 	int image_real_x, image_real_y;
 	int font_real_x, font_real_y;
 	int font_real_width, font_real_height;
 	int px, py;
 
+	image_width = img->width;
+	image_height = img->height;
+
 	/* 完全に描画しない場合のクリッピングを行う */
 	if (image_x + margin_left + font_width < 0)
 		return;
@@ -928,7 +1115,7 @@ static void draw_glyph_dim_func(unsigned char *font,
 			   get_pixel_b(color));
 
 	/* 描画する */
-	dst_ptr = image + image_real_y * image_width + image_real_x;
+	dst_ptr = img->pixels + image_real_y * image_width + image_real_x;
 	src_ptr = font + font_real_y * font_width + font_real_x;
 	for (py = font_real_y; py < font_real_y + font_real_height; py++) {
 		for (px = font_real_x; px < font_real_x + font_real_width; px++) {
@@ -941,6 +1128,8 @@ static void draw_glyph_dim_func(unsigned char *font,
 		dst_ptr += image_width - font_real_width;
 		src_ptr += font_width - font_real_width;
 	}
+
+	add_image_dirty_rect(img, image_real_x, image_real_y, font_real_width, font_real_height);
 }
 
 /*
@@ -74,6 +74,18 @@ bool check_file_exist(const char *dir, const char *file)
 	return false;
 }
 
+/*
+ * 複数のエントリで共有されるパッケージ内データの識別子を取得する
+ *  - パッケージを使用しないので、常に共有されない
+ */
+bool get_shared_body_id(const char *dir, const char *file, uint64_t *id)
+{
+	UNUSED_PARAMETER(dir);
+	UNUSED_PARAMETER(file);
+	UNUSED_PARAMETER(id);
+	return false;
+}
+
 /*
  * ファイル読み込みストリームを開く
  */
@@ -191,6 +203,68 @@ void rewind_rfile(struct rfile *rf)
 	rf->pos = 0;
 }
 
+/*
+ * ファイル読み込みストリームをシークする
+ */
+bool seek_rfile(struct rfile *rf, int64_t offset, int whence)
+{
+	int64_t base;
+
+	switch (whence) {
+	case SEEK_SET:
+		base = 0;
+		break;
+	case SEEK_CUR:
+		base = (int64_t)rf->pos;
+		break;
+	case SEEK_END:
+		base = (int64_t)rf->size;
+		break;
+	default:
+		return false;
+	}
+	if (offset < -base || (uint64_t)(base + offset) > rf->size)
+		return false;
+	rf->pos = (uint64_t)(base + offset);
+	return true;
+}
+
+/*
+ * ファイル読み込みストリームの現在位置を取得する
+ */
+uint64_t tell_rfile(struct rfile *rf)
+{
+	return rf->pos;
+}
+
+/*
+ * ファイル読み込みストリームがO(1)でシークできるか調べる
+ */
+bool is_rfile_seekable(struct rfile *rf)
+{
+	/* 内容全体がメモリ上にある */
+	UNUSED_PARAMETER(rf);
+	return true;
+}
+
+/*
+ * ファイル読み込みストリームの内容全体をメモリにマップする
+ */
+bool map_rfile(struct rfile *rf)
+{
+	/* 内容全体がすでにメモリ上にある */
+	rf->pos = 0;
+	return true;
+}
+
+/*
+ * マップされた内容へのポインタを取得する
+ */
+const void *get_rfile_data(struct rfile *rf)
+{
+	return rf->buf;
+}
+
 /*
  * ファイル読み込みストリームを閉じる
  */
@@ -275,13 +349,39 @@ size_t write_wfile(struct wfile *wf, const void *buf, size_t size)
 /*
  * ファイル読み込みストリームを閉じる
  */
-void close_wfile(struct wfile *wf)
+bool close_wfile(struct wfile *wf)
 {
 	jclass cls = (*jni_env)->FindClass(jni_env, "com/polarisengine/engineandroid/MainActivity");
 	jmethodID mid = (*jni_env)->GetMethodID(jni_env, cls, "bridgeCloseSaveFile", "(Ljava/io/OutputStream;)V");
 	(*jni_env)->CallVoidMethod(jni_env, main_activity, mid, wf->os);
 	(*jni_env)->DeleteGlobalRef(jni_env, wf->os);
 	free(wf);
+	return true;
+}
+
+/*
+ * ファイル書き込みストリームを破棄する
+ *  - Java側で書き込み済みのため、クローズと同じ
+ */
+void discard_wfile(struct wfile *wf)
+{
+	close_wfile(wf);
+}
+
+/*
+ * ファイル書き込みのバッチを開始する
+ *  - Java側で書き込むため、何もしない
+ */
+void begin_wfile_batch(void)
+{
+}
+
+/*
+ * ファイル書き込みのバッチを終了する
+ */
+bool end_wfile_batch(void)
+{
+	return true;
 }
 
 /*
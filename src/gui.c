@@ -170,6 +170,9 @@ static struct gui_button {
 		/* サムネイル、フォント描画用 */
 		struct image *img;
 
+		/* imgがクリア色でクリアされたことがあるか */
+		bool is_img_cleared;
+
 		/* ヒストリのオフセット */
 		int history_offset;
 
@@ -354,6 +357,7 @@ static void process_button_render_generic(int index);
 static void process_button_render_gallery(int index);
 static void process_button_render_namevar(int index);
 static void process_button_render_preview(int index);
+static void clear_button_image(struct gui_button *b);
 static bool init_save_buttons(void);
 static void update_save_buttons(void);
 static void draw_save_button(int button_index);
@@ -2478,6 +2482,36 @@ static void process_button_draw_namevar(struct image *target, int index)
  * セーブ・ロード
  */
 
+/*
+ * ボタンのイメージをクリア色でクリアする
+ *  - 2回目以降は、前回のクリア以降に描画された範囲(内容の外接矩形)だけをクリアする
+ *  - その外側は前回のクリア色のままなので、結果はイメージ全体のクリアと同じになる
+ */
+static void clear_button_image(struct gui_button *b)
+{
+	struct image_rect rect;
+	struct image *img;
+	pixel_t color;
+
+	img = b->rt.img;
+	color = make_pixel(0,
+			   (uint32_t)b->clear_r,
+			   (uint32_t)b->clear_g,
+			   (uint32_t)b->clear_b);
+
+	if (!b->rt.is_img_cleared) {
+		clear_image_color(img, color);
+		b->rt.is_img_cleared = true;
+		return;
+	}
+
+	rect.x = img->content_left;
+	rect.y = img->content_top;
+	rect.w = img->content_right - img->content_left;
+	rect.h = img->content_bottom - img->content_top;
+	clear_image_color_rects(img, &rect, 1, color);
+}
+
 /* TYPE_SAVE/TYPE_LOADのボタンの初期化を行う */
 static bool init_save_buttons(void)
 {
@@ -2540,11 +2574,7 @@ static void draw_save_button(int button_index)
 	save_time = get_save_date(save_index);
 
 	/* イメージをクリアする */
-	clear_image_color(b->rt.img,
-			  make_pixel(0,
-				     (uint32_t)b->clear_r,
-				     (uint32_t)b->clear_g,
-				     (uint32_t)b->clear_b));
+	clear_button_image(b);
 
 	/* サムネイルを描画する */
 	thumb = get_save_thumbnail(save_index);
@@ -2876,11 +2906,7 @@ static void draw_history_button(int index)
 	}
 
 	/* イメージをクリアする */
-	clear_image_color(b->rt.img,
-			  make_pixel(0,
-				     (uint32_t)b->clear_r,
-				     (uint32_t)b->clear_g,
-				     (uint32_t)b->clear_b));
+	clear_button_image(b);
 
 	/* メッセージを描画する */
 	if (b->rt.history_offset != -1)
@@ -3204,11 +3230,7 @@ static void reset_preview_button(int index)
 	b = &button[index];
 
 	/* イメージをクリアする */
-	clear_image_color(b->rt.img,
-			  make_pixel(0,
-				     (uint32_t)b->clear_r,
-				     (uint32_t)b->clear_g,
-				     (uint32_t)b->clear_b));
+	clear_button_image(b);
 	notify_image_update(b->rt.img);
 
 	color = make_pixel(0xff,
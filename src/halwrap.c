@@ -466,6 +466,14 @@ bool check_file_exist(const char *dir, const char *file)
 
 	return true;
 }
+
+bool get_shared_body_id(const char *dir, const char *file, uint64_t *id)
+{
+	UNUSED_PARAMETER(dir);
+	UNUSED_PARAMETER(file);
+	UNUSED_PARAMETER(id);
+	return false;
+}
 #endif
 
 #if defined(USE_UNITY)
@@ -572,6 +580,61 @@ void rewind_rfile(struct rfile *rf)
 }
 #endif
 
+#if defined(USE_UNITY)
+bool seek_rfile(struct rfile *rf, int64_t offset, int whence)
+{
+	int64_t base;
+
+	switch (whence) {
+	case SEEK_SET:
+		base = 0;
+		break;
+	case SEEK_CUR:
+		base = (int64_t)rf->cur;
+		break;
+	case SEEK_END:
+		base = (int64_t)rf->size;
+		break;
+	default:
+		return false;
+	}
+	if (offset < -base || (uint64_t)(base + offset) > rf->size)
+		return false;
+	rf->cur = (uint64_t)(base + offset);
+	return true;
+}
+#endif
+
+#if defined(USE_UNITY)
+uint64_t tell_rfile(struct rfile *rf)
+{
+	return rf->cur;
+}
+#endif
+
+#if defined(USE_UNITY)
+bool is_rfile_seekable(struct rfile *rf)
+{
+	UNUSED_PARAMETER(rf);
+	return true;
+}
+#endif
+
+#if defined(USE_UNITY)
+bool map_rfile(struct rfile *rf)
+{
+	rf->cur = 0;
+	return true;
+}
+#endif
+
+#if defined(USE_UNITY)
+const void *get_rfile_data(struct rfile *rf)
+{
+	return rf->data;
+}
+#endif
+
 #if defined(USE_UNITY)
 void close_rfile(struct rfile *rf)
 {
@@ -611,9 +674,32 @@ size_t write_wfile(struct wfile *wf, const void *buf, size_t size)
 #endif
 
 #if defined(USE_UNITY)
-void close_wfile(struct wfile *wf)
+bool close_wfile(struct wfile *wf)
 {
 	wrap_close_save_file();
+	free(wf);
+	return true;
+}
+#endif
+
+#if defined(USE_UNITY)
+void discard_wfile(struct wfile *wf)
+{
+	/* Unity側で書き込み済みのため、クローズと同じ */
+	close_wfile(wf);
+}
+#endif
+
+#if defined(USE_UNITY)
+void begin_wfile_batch(void)
+{
+}
+#endif
+
+#if defined(USE_UNITY)
+bool end_wfile_batch(void)
+{
+	return true;
 }
 #endif
 
@@ -15,14 +15,102 @@
 #include <malloc.h>	/* _aligned_mallo() */
 #endif
 
+/* SIMD */
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+#include <emmintrin.h>
+#include <immintrin.h>	/* AVX2は実行時に選択する */
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+
 /* 512-bit alignment */
 #define ALIGN_BYTES	(64)
 
+/* draw_image_ops()の帯の最小の行数と、スレッドあたりの帯の数 (負荷を均すため) */
+#define OPS_BAND_MIN_ROWS	(16)
+#define OPS_BANDS_PER_WORKER	(4)
+
+/* 非テンポラルストアで塗り潰す最小のバイト数 (キャッシュに収まらない画面サイズのクリア) */
+#define STREAM_FILL_MIN_BYTES	(1024 * 1024)
+
+/* ルール画像の値のビット位置 (image.hのget_pixel_b()と同じ) */
+#if defined(POLARIS_ENGINE_TARGET_WIN32) || defined(POLARIS_ENGINE_TARGET_MACOS) || defined(POLARIS_ENGINE_TARGET_IOS)
+#define RULE_SHIFT	(0)
+#else
+#define RULE_SHIFT	(16)
+#endif
+
+/*
+ * ピクセル列のメモリプール
+ *  - destroy_image()で解放したピクセル列をサイズクラスごとに保持し、create_image()で再利用する
+ *  - 同じサイズの画像(特に画面サイズ)の確保と解放の繰り返しで、ヒープの断片化と
+ *    ページフォルトを避ける
+ *  - サイズクラスは2の累乗の間を8等分した大きさで、切り上げの無駄は12.5%以下
+ *  - 保持する合計がimage.pool.size (MB単位、0なら画面4枚分、-1なら無効) を超える場合は解放する
+ *  - メインスレッドからのみ使う
+ */
+
+/* 最小のサイズクラスのバイト数のlog2 (4KB) */
+#define POOL_MIN_SHIFT		(12)
+
+/* 2の累乗あたりのサイズクラスの数のlog2 */
+#define POOL_STEP_SHIFT		(3)
+
+/* プールするサイズのlog2の上限 (これより大きいものは直接確保する) */
+#define POOL_MAX_SHIFT		(31)
+
+/* サイズクラスの数 */
+#define POOL_CLASS_COUNT	(((POOL_MAX_SHIFT - POOL_MIN_SHIFT) << POOL_STEP_SHIFT) + 1)
+
+/* 既定の上限 (画面の枚数) */
+#define POOL_DEFAULT_SCREENS	(4)
+
+/* サイズクラスごとの空きリスト (ピクセル列の先頭に次のポインタを格納する) */
+static void *pool_head[POOL_CLASS_COUNT];
+
+/* cleanup_image_pool()の後か */
+static bool is_pool_closed;
+
+/* 統計 */
+static struct image_pool_stats pool_stats;
+
 /*
  * テクスチャのID
  */
 static int id_top;
 
+/*
+ * draw_image_ops()の作業データ
+ */
+struct ops_job {
+	struct image *dst_image;
+	struct draw_op *ops;	/* クリッピング済みの命令 */
+	int count;
+	int bands;
+};
+
+/*
+ * 行関数 (select_kernels()で選択する)
+ */
+static void (*blend_row_fast)(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src,
+			      int width, uint32_t alpha);
+static void (*blend_row_emoji)(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src,
+			       int width, uint32_t alpha);
+static void (*blend_row_add)(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src,
+			     int width, uint32_t alpha);
+static void (*blend_row_dim)(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src,
+			     int width, uint32_t alpha);
+static void (*rule_row)(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src,
+			const pixel_t * RESTRICT rule, int width, uint32_t threshold);
+static void (*melt_row)(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src,
+			const pixel_t * RESTRICT rule, int width, uint32_t threshold,
+			const uint8_t *lut);
+static void (*box_sum_row)(uint32_t * RESTRICT vsum, const pixel_t * RESTRICT src,
+			   int width);
+static void (*fill_row)(pixel_t * RESTRICT dst, size_t n, pixel_t color);
+static void (*stream_fill_row)(pixel_t * RESTRICT dst, size_t n, pixel_t color);
+static void (*fill_alpha_row)(pixel_t * RESTRICT dst, size_t n);
+
 /*
  * 前方参照
  */
@@ -30,6 +118,34 @@ static int id_top;
 static bool check_draw_image(struct image *dst_image, int *dst_left, int *dst_top,
 			     struct image *src_image, int *width, int *height,
 			     int *src_left, int *src_top, int alpha);
+static bool clip_by_content(struct image *src_image, int *dst_left, int *dst_top,
+			    int *width, int *height, int *src_left, int *src_top);
+static void union_rect(int *left, int *top, int *right, int *bottom, int x, int y, int w, int h);
+static void fill_content_info(struct image *img, pixel_t color);
+static bool fill_image_rect(struct image *img, int x, int y, int w, int h, pixel_t color);
+static pixel_t *alloc_pixels(size_t bytes, int *pool_class);
+static void free_pixels(pixel_t *pixels, int pool_class);
+static void flush_pool(void);
+static int get_pool_class(size_t bytes, size_t *class_bytes);
+static size_t get_pool_class_bytes(int pool_class);
+static size_t get_pool_limit(void);
+static void *alloc_aligned(size_t bytes);
+static void free_aligned(void *p);
+#if defined(USE_PREMULTIPLIED_ALPHA)
+static INLINE pixel_t premultiply_pixel(pixel_t p);
+#endif
+static INLINE int scale_src_pos(int dst, float scale, int virtual_offset);
+static INLINE int scale_src_end(int dst, float scale, int virtual_offset, int begin, int limit);
+static void select_kernels(void);
+static void draw_ops_band(int index, void *arg);
+static void box_filter_row(pixel_t * RESTRICT row,
+			   uint32_t * RESTRICT vsum,
+			   struct image *src_image,
+			   const int *col_x0,
+			   const int *col_x1,
+			   int cols,
+			   int y0,
+			   int y1);
 
 /*
  * 初期化
@@ -53,20 +169,12 @@ struct image *create_image(int w, int h)
 	}
 
 	/* ピクセル列のメモリを確保する */
-#if defined(POLARIS_ENGINE_TARGET_WIN32)
-	pixels = _aligned_malloc((size_t)w * (size_t)h * sizeof(pixel_t), 64);
+	pixels = alloc_pixels((size_t)w * (size_t)h * sizeof(pixel_t), &img->pool_class);
 	if (pixels == NULL) {
 		log_memory();
 		free(img);
 		return NULL;
 	}
-#else
-	if (posix_memalign((void **)&pixels, 64, (size_t)w * (size_t)h * sizeof(pixel_t)) != 0) {
-		log_memory();
-		free(img);
-		return NULL;
-	}
-#endif
 
 	/* 構造体を初期化する */
 	img->width = w;
@@ -75,6 +183,20 @@ struct image *create_image(int w, int h)
 	img->texture = NULL;
 	img->need_upload = false;
 	img->id = id_top++;
+	img->context = 0;
+	img->dirty_left = 0;
+	img->dirty_top = 0;
+	img->dirty_right = 0;
+	img->dirty_bottom = 0;
+	img->drawn_left = 0;
+	img->drawn_top = 0;
+	img->drawn_right = w;
+	img->drawn_bottom = h;
+	img->content_left = 0;
+	img->content_top = 0;
+	img->content_right = w;
+	img->content_bottom = h;
+	img->is_opaque = false;
 
 	return img;
 }
@@ -131,6 +253,21 @@ struct image *create_image_with_pixels(int w, int h, pixel_t *pixels)
 	img->texture = NULL;
 	img->need_upload = false;
 	img->id = id_top++;
+	img->context = 0;
+	img->dirty_left = 0;
+	img->dirty_top = 0;
+	img->dirty_right = 0;
+	img->dirty_bottom = 0;
+	img->drawn_left = 0;
+	img->drawn_top = 0;
+	img->drawn_right = w;
+	img->drawn_bottom = h;
+	img->content_left = 0;
+	img->content_top = 0;
+	img->content_right = w;
+	img->content_bottom = h;
+	img->is_opaque = false;
+	img->pool_class = -1;
 
 	return img;
 }
@@ -148,11 +285,7 @@ void destroy_image(struct image *img)
 	notify_image_free(img);
 
 	/* ピクセル列のメモリを解放する */
-#if defined(POLARIS_ENGINE_TARGET_WIN32)
-	_aligned_free(img->pixels);
-#else
-	free(img->pixels);
-#endif
+	free_pixels(img->pixels, img->pool_class);
 	img->pixels = NULL;
 
 	/* イメージ構造体のメモリを解放する */
@@ -160,85 +293,1711 @@ void destroy_image(struct image *img)
 }
 
 /*
- * クリア
+ * ピクセル列のメモリプールを初期化する
+ *  - on_event_cleanup()の後に再初期化される場合に備えて、状態を戻す
+ */
+void init_image_pool(void)
+{
+	flush_pool();
+	memset(&pool_stats, 0, sizeof(pool_stats));
+	is_pool_closed = false;
+}
+
+/*
+ * ピクセル列のメモリプールの統計を取得する
+ */
+void get_image_pool_stats(struct image_pool_stats *stats)
+{
+	*stats = pool_stats;
+}
+
+/*
+ * ピクセル列のメモリプールを解放する
+ *  - これ以降に解放されたピクセル列はプールに戻さない
+ */
+void cleanup_image_pool(void)
+{
+	flush_pool();
+	is_pool_closed = true;
+}
+
+/* ピクセル列のメモリを確保する (プールにあれば再利用する) */
+static pixel_t *alloc_pixels(size_t bytes, int *pool_class)
+{
+	void *p;
+	size_t class_bytes;
+	int cls;
+
+	pool_stats.alloc_count++;
+
+	/* プールしないサイズの場合 */
+	cls = get_pool_class(bytes, &class_bytes);
+	if (cls == -1) {
+		*pool_class = -1;
+		return alloc_aligned(bytes);
+	}
+	*pool_class = cls;
+
+	/* 同じサイズクラスの空きがあれば再利用する */
+	p = pool_head[cls];
+	if (p != NULL) {
+		pool_head[cls] = *(void **)p;
+		pool_stats.reuse_count++;
+		pool_stats.pooled_bytes -= class_bytes;
+	} else {
+		/* 新しく確保する (失敗したらプールを空にして再試行する) */
+		p = alloc_aligned(class_bytes);
+		if (p == NULL) {
+			flush_pool();
+			p = alloc_aligned(class_bytes);
+			if (p == NULL)
+				return NULL;
+		}
+	}
+
+	pool_stats.used_bytes += class_bytes;
+	if (pool_stats.used_bytes > pool_stats.peak_used_bytes)
+		pool_stats.peak_used_bytes = pool_stats.used_bytes;
+
+	return p;
+}
+
+/* ピクセル列のメモリを解放する (上限までプールに戻す) */
+static void free_pixels(pixel_t *pixels, int pool_class)
+{
+	size_t class_bytes;
+
+	/* プール外のメモリの場合 */
+	if (pool_class == -1) {
+		free_aligned(pixels);
+		return;
+	}
+
+	class_bytes = get_pool_class_bytes(pool_class);
+	pool_stats.used_bytes -= class_bytes;
+
+	/* 上限を超える場合は解放する */
+	if (is_pool_closed || pool_stats.pooled_bytes + class_bytes > get_pool_limit()) {
+		pool_stats.discard_count++;
+		free_aligned(pixels);
+		return;
+	}
+
+	/* 空きリストの先頭に入れる */
+	*(void **)(void *)pixels = pool_head[pool_class];
+	pool_head[pool_class] = pixels;
+	pool_stats.pooled_bytes += class_bytes;
+	if (pool_stats.pooled_bytes > pool_stats.peak_pooled_bytes)
+		pool_stats.peak_pooled_bytes = pool_stats.pooled_bytes;
+}
+
+/* プールのメモリを全て解放する */
+static void flush_pool(void)
+{
+	void *p;
+	int i;
+
+	for (i = 0; i < POOL_CLASS_COUNT; i++) {
+		while (pool_head[i] != NULL) {
+			p = pool_head[i];
+			pool_head[i] = *(void **)p;
+			free_aligned(p);
+		}
+	}
+	pool_stats.pooled_bytes = 0;
+}
+
+/*
+ * バイト数のサイズクラスを求める
+ *  - 2^k < bytes <= 2^(k+1) のとき、2^kからの2^(k-3)刻みで切り上げる
+ *  - プールしないサイズの場合は-1を返す
+ */
+static int get_pool_class(size_t bytes, size_t *class_bytes)
+{
+	size_t step;
+	int k, j;
+
+	if (bytes <= ((size_t)1 << POOL_MIN_SHIFT)) {
+		*class_bytes = (size_t)1 << POOL_MIN_SHIFT;
+		return 0;
+	}
+	if (bytes > ((size_t)1 << POOL_MAX_SHIFT))
+		return -1;
+
+	k = POOL_MIN_SHIFT;
+	while (((size_t)1 << (k + 1)) < bytes)
+		k++;
+	step = (size_t)1 << (k - POOL_STEP_SHIFT);
+	j = (int)((bytes - ((size_t)1 << k) + step - 1) / step);
+
+	*class_bytes = ((size_t)1 << k) + (size_t)j * step;
+	return ((k - POOL_MIN_SHIFT) << POOL_STEP_SHIFT) + j;
+}
+
+/* サイズクラスのバイト数を求める */
+static size_t get_pool_class_bytes(int pool_class)
+{
+	int k, j;
+
+	if (pool_class == 0)
+		return (size_t)1 << POOL_MIN_SHIFT;
+
+	k = POOL_MIN_SHIFT + ((pool_class - 1) >> POOL_STEP_SHIFT);
+	j = ((pool_class - 1) & ((1 << POOL_STEP_SHIFT) - 1)) + 1;
+	return ((size_t)1 << k) + ((size_t)j << (k - POOL_STEP_SHIFT));
+}
+
+/* プールに保持するバイト数の上限を求める */
+static size_t get_pool_limit(void)
+{
+	if (conf_image_pool_size < 0)
+		return 0;
+	if (conf_image_pool_size > 0)
+		return (size_t)conf_image_pool_size * 1024 * 1024;
+	return (size_t)POOL_DEFAULT_SCREENS * (size_t)conf_window_width *
+	       (size_t)conf_window_height * sizeof(pixel_t);
+}
+
+/* アラインされたメモリを確保する */
+static void *alloc_aligned(size_t bytes)
+{
+	void *p;
+
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	p = _aligned_malloc(bytes, ALIGN_BYTES);
+#else
+	if (posix_memalign(&p, ALIGN_BYTES, bytes) != 0)
+		p = NULL;
+#endif
+
+	return p;
+}
+
+/* アラインされたメモリを解放する */
+static void free_aligned(void *p)
+{
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+/*
+ * イメージの更新矩形を広げる
+ *  - 描画関数はピクセルを書き換えた矩形をこれで記録してから更新を通知する
+ *  - 矩形はイメージの範囲にクリップ済みであること
+ *  - 描画された矩形とアルファ値が0でないピクセルの外接矩形も同じ矩形で広げる
+ *    (アルファ値を255未満にし得る描画関数は、別途is_opaqueをfalseにする)
+ */
+void add_image_dirty_rect(struct image *img, int x, int y, int w, int h)
+{
+	assert(img != NULL);
+	assert(x >= 0 && w >= 0 && x + w <= img->width);
+	assert(y >= 0 && h >= 0 && y + h <= img->height);
+
+	if (w == 0 || h == 0)
+		return;
+
+	union_rect(&img->dirty_left, &img->dirty_top, &img->dirty_right, &img->dirty_bottom,
+		   x, y, w, h);
+	union_rect(&img->drawn_left, &img->drawn_top, &img->drawn_right, &img->drawn_bottom,
+		   x, y, w, h);
+	union_rect(&img->content_left, &img->content_top, &img->content_right, &img->content_bottom,
+		   x, y, w, h);
+}
+
+/*
+ * イメージの描画された矩形を空にする
+ *  - 呼び出し元が内容を既知の状態に戻した後に呼ぶ
+ */
+void reset_image_drawn_rect(struct image *img)
+{
+	assert(img != NULL);
+
+	img->drawn_left = 0;
+	img->drawn_top = 0;
+	img->drawn_right = 0;
+	img->drawn_bottom = 0;
+}
+
+/* 矩形を広げて、別の矩形との外接矩形にする (右端と下端は含まない) */
+static void union_rect(int *left, int *top, int *right, int *bottom, int x, int y, int w, int h)
+{
+	/* 空の場合はそのまま設定する */
+	if (*left >= *right || *top >= *bottom) {
+		*left = x;
+		*top = y;
+		*right = x + w;
+		*bottom = y + h;
+		return;
+	}
+
+	/* 既存の矩形と合わせた外接矩形にする */
+	if (x < *left)
+		*left = x;
+	if (y < *top)
+		*top = y;
+	if (x + w > *right)
+		*right = x + w;
+	if (y + h > *bottom)
+		*bottom = y + h;
+}
+
+/*
+ * イメージのアルファ値を調べて外接矩形と不透明かを求める
+ *  - 画像ファイルの読み込み時に一度だけ呼ばれる
+ *  - 各行は左右の端から探すので、中身の多い行でも中央は読まない
+ *    (不透明の判定が残っている間だけ行全体を読む)
+ */
+void analyze_image_alpha(struct image *img)
+{
+	pixel_t *row;
+	int x, y, x0, x1, w, h, left, top, right, bottom;
+	bool opaque;
+
+	assert(img != NULL);
+
+	w = img->width;
+	h = img->height;
+	left = w;
+	top = h;
+	right = 0;
+	bottom = 0;
+	opaque = true;
+	for (y = 0; y < h; y++) {
+		row = img->pixels + (size_t)w * (size_t)y;
+
+		/* 左端から探す */
+		for (x0 = 0; x0 < w; x0++)
+			if ((row[x0] & 0xff000000) != 0)
+				break;
+		if (x0 == w) {
+			/* 行全体が透明 */
+			opaque = false;
+			continue;
+		}
+
+		/* 右端から探す */
+		for (x1 = w; x1 > x0; x1--)
+			if ((row[x1 - 1] & 0xff000000) != 0)
+				break;
+
+		/* 不透明か調べる */
+		if (opaque) {
+			if (x0 != 0 || x1 != w) {
+				opaque = false;
+			} else {
+				for (x = 0; x < w; x++) {
+					if ((row[x] & 0xff000000) != 0xff000000) {
+						opaque = false;
+						break;
+					}
+				}
+			}
+		}
+
+		/* 外接矩形を広げる */
+		if (x0 < left)
+			left = x0;
+		if (x1 > right)
+			right = x1;
+		if (y < top)
+			top = y;
+		bottom = y + 1;
+	}
+
+	if (left >= right) {
+		/* 完全に透明 */
+		img->content_left = 0;
+		img->content_top = 0;
+		img->content_right = 0;
+		img->content_bottom = 0;
+	} else {
+		img->content_left = left;
+		img->content_top = top;
+		img->content_right = right;
+		img->content_bottom = bottom;
+	}
+	img->is_opaque = opaque;
+}
+
+/*
+ * クリア
+ */
+
+/*
+ * イメージを黒色でクリアする
+ */
+void clear_image_black(struct image *img)
+{
+	clear_image_color_rect(img, 0, 0, img->width, img->height, make_pixel(0xff, 0, 0, 0));
+}
+
+/*
+ * イメージを白色でクリアする
+ */
+void clear_image_white(struct image *img)
+{
+	clear_image_color_rect(img, 0, 0, img->width, img->height, make_pixel(0xff, 0xff, 0xff, 0xff));
+}
+
+/*
+ * イメージを色でクリアする
+ */
+void clear_image_color(struct image *img, pixel_t color)
+{
+	clear_image_color_rect(img, 0, 0, img->width, img->height, color);
+}
+
+/*
+ * イメージの矩形を色でクリアする
+ */
+void clear_image_color_rect(struct image *img, int x, int y, int w, int h, pixel_t color)
+{
+	assert(img != NULL);
+	assert(img->width > 0 && img->height > 0);
+	assert(img->pixels != NULL);
+
+#if defined(USE_PREMULTIPLIED_ALPHA)
+	/* 色にアルファ値を乗算する */
+	color = premultiply_pixel(color);
+#endif
+
+	/* 矩形を塗り潰す */
+	if (!fill_image_rect(img, x, y, w, h, color))
+		return;
+
+	/* Request a texture update. */
+	notify_image_update(img);
+}
+
+/*
+ * イメージの複数の矩形を色でクリアする
+ *  - 描画した範囲だけを戻すときに、テクスチャの更新の通知を1回にまとめる
+ */
+void clear_image_color_rects(struct image *img, const struct image_rect *rects, int count,
+			     pixel_t color)
+{
+	bool is_filled;
+	int i;
+
+	assert(img != NULL);
+	assert(img->width > 0 && img->height > 0);
+	assert(img->pixels != NULL);
+	assert(rects != NULL || count == 0);
+
+#if defined(USE_PREMULTIPLIED_ALPHA)
+	/* 色にアルファ値を乗算する */
+	color = premultiply_pixel(color);
+#endif
+
+	/* 矩形を塗り潰す */
+	is_filled = false;
+	for (i = 0; i < count; i++) {
+		if (fill_image_rect(img, rects[i].x, rects[i].y, rects[i].w, rects[i].h, color))
+			is_filled = true;
+	}
+	if (!is_filled)
+		return;
+
+	/* Request a texture update. */
+	notify_image_update(img);
+}
+
+/*
+ * イメージの矩形を塗り潰して、更新矩形と不透明度の情報を更新する
+ *  - colorはアルファ値を乗算済みの色
+ *  - 描画範囲外なら偽を返す
+ */
+static bool fill_image_rect(struct image *img, int x, int y, int w, int h, pixel_t color)
+{
+	pixel_t *pixels;
+	size_t n;
+	int i, sx, sy;
+
+	/* 描画の必要があるか判定する */
+	if(w == 0 || h == 0)
+		return false;	/* 描画の必要がない*/
+	sx = sy = 0;
+	if(!clip_by_dest(img->width, img->height, &w, &h, &x, &y, &sx, &sy))
+		return false;	/* 描画範囲外 */
+
+	assert(x >= 0 && x < img->width);
+	assert(w >= 0 && x + w <= img->width);
+	assert(y >= 0 && y < img->height);
+	assert(h >= 0 && y + h <= img->height);
+
+	select_kernels();
+
+	/* ピクセル列の矩形を塗り潰す (全幅なら連続した1つの範囲として塗り潰す) */
+	pixels = img->pixels + img->width * y + x;
+	if (w == img->width) {
+		n = (size_t)w * (size_t)h;
+		if (n * sizeof(pixel_t) >= STREAM_FILL_MIN_BYTES)
+			stream_fill_row(pixels, n, color);
+		else
+			fill_row(pixels, n, color);
+	} else {
+		for (i = 0; i < h; i++)
+			fill_row(pixels + img->width * i, (size_t)w, color);
+	}
+
+	/*
+	 * 不透明度の情報を更新する
+	 *  - 透明色で塗り潰した範囲は内容の外接矩形を広げない
+	 *  - 内容の外接矩形をすべて透明色で覆ったら、内容は空になる
+	 */
+	if (w == img->width && h == img->height) {
+		add_image_dirty_rect(img, x, y, w, h);
+		fill_content_info(img, color);
+	} else if (get_pixel_a(color) == 0) {
+		union_rect(&img->dirty_left, &img->dirty_top, &img->dirty_right, &img->dirty_bottom,
+			   x, y, w, h);
+		union_rect(&img->drawn_left, &img->drawn_top, &img->drawn_right, &img->drawn_bottom,
+			   x, y, w, h);
+		if (x <= img->content_left && y <= img->content_top &&
+		    x + w >= img->content_right && y + h >= img->content_bottom) {
+			img->content_left = 0;
+			img->content_top = 0;
+			img->content_right = 0;
+			img->content_bottom = 0;
+		}
+		img->is_opaque = false;
+	} else {
+		add_image_dirty_rect(img, x, y, w, h);
+		if (get_pixel_a(color) != 255)
+			img->is_opaque = false;
+	}
+
+	return true;
+}
+
+/*
+ * イメージのアルファチャンネルを255でクリアする
+ */
+void fill_image_alpha(struct image *img)
+{
+	assert(img != NULL);
+
+	select_kernels();
+	fill_alpha_row(img->pixels, (size_t)img->width * (size_t)img->height);
+
+	add_image_dirty_rect(img, 0, 0, img->width, img->height);
+	img->is_opaque = true;
+}
+
+/*
+ * 塗り潰しの行関数
+ *  - x86_64ではSSE2/AVX2、ARM64ではNEONの実装を実行時に選択する
+ *  - stream_fill_row()はキャッシュを経由しない非テンポラルストアで書き込み、
+ *    画面サイズのクリアでキャッシュの内容を追い出さないようにする
+ *    (NEONには非テンポラルストアの組み込み関数がないため、通常のストアを使う)
+ *  - 端数のピクセルはスカラで処理する
+ */
+
+static void fill_row_c(pixel_t * RESTRICT dst, size_t n, pixel_t color)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = color;
+}
+
+static void fill_alpha_row_c(pixel_t * RESTRICT dst, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] |= 0xff000000;
+}
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+static void fill_row_sse2(pixel_t * RESTRICT dst, size_t n, pixel_t color)
+{
+	const __m128i v = _mm_set1_epi32((int)color);
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		_mm_storeu_si128((__m128i *)(void *)(dst + i), v);
+		_mm_storeu_si128((__m128i *)(void *)(dst + i + 4), v);
+	}
+	for (; i < n; i++)
+		dst[i] = color;
+}
+
+static void stream_fill_row_sse2(pixel_t * RESTRICT dst, size_t n, pixel_t color)
+{
+	const __m128i v = _mm_set1_epi32((int)color);
+	size_t i;
+
+	/* 16バイト境界までをスカラで処理する */
+	for (i = 0; i < n && ((uintptr_t)(dst + i) & 15) != 0; i++)
+		dst[i] = color;
+
+	for (; i + 8 <= n; i += 8) {
+		_mm_stream_si128((__m128i *)(void *)(dst + i), v);
+		_mm_stream_si128((__m128i *)(void *)(dst + i + 4), v);
+	}
+	_mm_sfence();
+
+	for (; i < n; i++)
+		dst[i] = color;
+}
+
+static void fill_alpha_row_sse2(pixel_t * RESTRICT dst, size_t n)
+{
+	const __m128i amask = _mm_set1_epi32((int)0xff000000);
+	__m128i v;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(const void *)(dst + i));
+		_mm_storeu_si128((__m128i *)(void *)(dst + i), _mm_or_si128(v, amask));
+	}
+	for (; i < n; i++)
+		dst[i] |= 0xff000000;
+}
+
+static TARGET_AVX2 void fill_row_avx2(pixel_t * RESTRICT dst, size_t n, pixel_t color)
+{
+	const __m256i v = _mm256_set1_epi32((int)color);
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		_mm256_storeu_si256((__m256i *)(void *)(dst + i), v);
+		_mm256_storeu_si256((__m256i *)(void *)(dst + i + 8), v);
+	}
+	for (; i < n; i++)
+		dst[i] = color;
+}
+
+static TARGET_AVX2 void stream_fill_row_avx2(pixel_t * RESTRICT dst, size_t n, pixel_t color)
+{
+	const __m256i v = _mm256_set1_epi32((int)color);
+	size_t i;
+
+	/* 32バイト境界までをスカラで処理する */
+	for (i = 0; i < n && ((uintptr_t)(dst + i) & 31) != 0; i++)
+		dst[i] = color;
+
+	for (; i + 16 <= n; i += 16) {
+		_mm256_stream_si256((__m256i *)(void *)(dst + i), v);
+		_mm256_stream_si256((__m256i *)(void *)(dst + i + 8), v);
+	}
+	_mm_sfence();
+
+	for (; i < n; i++)
+		dst[i] = color;
+}
+
+static TARGET_AVX2 void fill_alpha_row_avx2(pixel_t * RESTRICT dst, size_t n)
+{
+	const __m256i amask = _mm256_set1_epi32((int)0xff000000);
+	__m256i v;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *)(const void *)(dst + i));
+		_mm256_storeu_si256((__m256i *)(void *)(dst + i), _mm256_or_si256(v, amask));
+	}
+	for (; i < n; i++)
+		dst[i] |= 0xff000000;
+}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+static void fill_row_neon(pixel_t * RESTRICT dst, size_t n, pixel_t color)
+{
+	const uint32x4_t v = vdupq_n_u32(color);
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		vst1q_u32(dst + i, v);
+		vst1q_u32(dst + i + 4, v);
+	}
+	for (; i < n; i++)
+		dst[i] = color;
+}
+
+static void fill_alpha_row_neon(pixel_t * RESTRICT dst, size_t n)
+{
+	const uint32x4_t amask = vdupq_n_u32(0xff000000);
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		vst1q_u32(dst + i, vorrq_u32(vld1q_u32(dst + i), amask));
+	for (; i < n; i++)
+		dst[i] |= 0xff000000;
+}
+#endif
+
+#if defined(USE_PREMULTIPLIED_ALPHA)
+/*
+ * イメージの色にアルファ値を乗算する
+ *  - 完全に透明なピクセルのRGB値は0になる
+ */
+void premultiply_image_alpha(struct image *img)
+{
+	pixel_t *p;
+	size_t i, n;
+
+	assert(img != NULL);
+
+	p = img->pixels;
+	n = (size_t)img->width * (size_t)img->height;
+	for (i = 0; i < n; i++)
+		p[i] = premultiply_pixel(p[i]);
+
+	add_image_dirty_rect(img, 0, 0, img->width, img->height);
+	notify_image_update(img);
+}
+#endif
+
+/*
+ * ブレンドの行関数
+ *  - 固定小数点で計算し、浮動小数点の計算結果とは±1の範囲で一致する
+ *  - 実行時にCPUの対応状況(get_cpu_tier())を見て、スカラ/SSE2/AVX2/NEONの実装を選択する
+ *  - 端数のピクセルはスカラで処理する
+ */
+
+/* 0-65025の値を255で割って丸める */
+static INLINE uint32_t div255(uint32_t x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+/*
+ * 2つの16ビットフィールド(0x00ff00ffのマスク位置)をまとめて255で割って丸める
+ *  - チャンネルの順序に依存しない
+ */
+static INLINE uint32_t div255_pair(uint32_t x)
+{
+	x += 0x00800080;
+	return ((x + ((x >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+}
+
+/* 2つの8ビットフィールド(0x00ff00ffのマスク位置)を飽和加算する */
+static INLINE uint32_t adds_pair(uint32_t x, uint32_t y)
+{
+	uint32_t sum;
+
+	sum = x + y;
+	return (sum | (((sum >> 8) & 0x00010001) * 0xff)) & 0x00ff00ff;
+}
+
+#if defined(USE_PREMULTIPLIED_ALPHA)
+/* ピクセルの色にアルファ値を乗算する (チャンネルの順序に依存しない) */
+static INLINE pixel_t premultiply_pixel(pixel_t p)
+{
+	uint32_t a;
+
+	a = p >> 24;
+	return (a << 24) |
+	       (div255((p >> 8 & 0xff) * a) << 8) |
+	       div255_pair((p & 0x00ff00ff) * a);
+}
+
+/* 転送元の色に掛ける係数 (色にはアルファ値が乗算済みなので不透明度だけ) */
+#define SRC_MUL(a, alpha)	((void)(a), (alpha))
+#else
+/* 転送元の色に掛ける係数 (アルファ値と不透明度の積) */
+#define SRC_MUL(a, alpha)	(a)
+#endif
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+/* 16ビットレーンの値(0-65025)を255で割って丸める */
+static INLINE __m128i div255_epu16(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/* 2ピクセル分の16ビットレーンのアルファ値から転送元の係数(0-255)を求める */
+static INLINE __m128i src_factor_epu16(__m128i s, __m128i alpha)
+{
+	__m128i a;
+
+	a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xff), 0xff);
+	return div255_epu16(_mm_mullo_epi16(a, alpha));
+}
+#endif
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+/* 16ビットレーンの値(0-65025)を255で割って丸める */
+static INLINE TARGET_AVX2 __m256i div255_epu16_256(__m256i x)
+{
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+/* 4ピクセル分の16ビットレーンのアルファ値から転送元の係数(0-255)を求める */
+static INLINE TARGET_AVX2 __m256i src_factor_epu16_256(__m256i s, __m256i alpha)
+{
+	__m256i a;
+
+	a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xff), 0xff);
+	return div255_epu16_256(_mm256_mullo_epi16(a, alpha));
+}
+#endif
+
+#if defined(POLARIS_ENGINE_ARCH_ARM64)
+/* 16ビットレーンの値(0-65025)を255で割って丸め、8ビットに狭める */
+static INLINE uint8x8_t div255_u16(uint16x8_t x)
+{
+	return vraddhn_u16(x, vrshrq_n_u16(x, 8));
+}
+#endif
+
+/* 1行をアルファブレンドする (draw_image_fast()) */
+static INLINE void blend_row_fast_tail(pixel_t * RESTRICT dst,
+				       const pixel_t * RESTRICT src,
+				       int width,
+				       uint32_t alpha,
+				       int x)
+{
+	uint32_t s, d, a, ia, rb, ag;
+
+	/* 端数をスカラで処理する */
+	for (; x < width; x++) {
+		s = src[x];
+		d = dst[x];
+		a = div255(alpha * (s >> 24));
+		ia = 255 - a;
+		rb = div255_pair((s & 0x00ff00ff) * SRC_MUL(a, alpha) + (d & 0x00ff00ff) * ia);
+		ag = div255_pair(((s >> 8) & 0x00ff00ff) * SRC_MUL(a, alpha) + ((d >> 8) & 0x00ff00ff) * ia);
+		dst[x] = 0xff000000 | (ag << 8) | rb;
+	}
+}
+
+static void blend_row_fast_c(pixel_t * RESTRICT dst,
+			     const pixel_t * RESTRICT src,
+			     int width,
+			     uint32_t alpha)
+{
+	blend_row_fast_tail(dst, src, width, alpha, 0);
+}
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+static void blend_row_fast_sse2(pixel_t * RESTRICT dst,
+				const pixel_t * RESTRICT src,
+				int width,
+				uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i v255 = _mm_set1_epi16(255);
+		const __m128i valpha = _mm_set1_epi16((short)alpha);
+		const __m128i opaque = _mm_set1_epi32((int)0xff000000);
+		__m128i sv, dv, sl, sh, dl, dh, al, ah;
+
+		for (; x + 4 <= width; x += 4) {
+			sv = _mm_loadu_si128((const __m128i *)(const void *)(src + x));
+			dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+			sl = _mm_unpacklo_epi8(sv, zero);
+			sh = _mm_unpackhi_epi8(sv, zero);
+			dl = _mm_unpacklo_epi8(dv, zero);
+			dh = _mm_unpackhi_epi8(dv, zero);
+			al = src_factor_epu16(sl, valpha);
+			ah = src_factor_epu16(sh, valpha);
+			sl = _mm_add_epi16(_mm_mullo_epi16(sl, SRC_MUL(al, valpha)),
+					   _mm_mullo_epi16(dl, _mm_sub_epi16(v255, al)));
+			sh = _mm_add_epi16(_mm_mullo_epi16(sh, SRC_MUL(ah, valpha)),
+					   _mm_mullo_epi16(dh, _mm_sub_epi16(v255, ah)));
+			sv = _mm_packus_epi16(div255_epu16(sl), div255_epu16(sh));
+			_mm_storeu_si128((__m128i *)(void *)(dst + x), _mm_or_si128(sv, opaque));
+		}
+	}
+	blend_row_fast_tail(dst, src, width, alpha, x);
+}
+
+static TARGET_AVX2 void blend_row_fast_avx2(pixel_t * RESTRICT dst,
+					    const pixel_t * RESTRICT src,
+					    int width,
+					    uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i v255 = _mm256_set1_epi16(255);
+		const __m256i valpha = _mm256_set1_epi16((short)alpha);
+		const __m256i opaque = _mm256_set1_epi32((int)0xff000000);
+		__m256i sv, dv, sl, sh, dl, dh, al, ah;
+
+		for (; x + 8 <= width; x += 8) {
+			sv = _mm256_loadu_si256((const __m256i *)(const void *)(src + x));
+			dv = _mm256_loadu_si256((const __m256i *)(void *)(dst + x));
+			sl = _mm256_unpacklo_epi8(sv, zero);
+			sh = _mm256_unpackhi_epi8(sv, zero);
+			dl = _mm256_unpacklo_epi8(dv, zero);
+			dh = _mm256_unpackhi_epi8(dv, zero);
+			al = src_factor_epu16_256(sl, valpha);
+			ah = src_factor_epu16_256(sh, valpha);
+			sl = _mm256_add_epi16(_mm256_mullo_epi16(sl, SRC_MUL(al, valpha)),
+					      _mm256_mullo_epi16(dl, _mm256_sub_epi16(v255, al)));
+			sh = _mm256_add_epi16(_mm256_mullo_epi16(sh, SRC_MUL(ah, valpha)),
+					      _mm256_mullo_epi16(dh, _mm256_sub_epi16(v255, ah)));
+			sv = _mm256_packus_epi16(div255_epu16_256(sl), div255_epu16_256(sh));
+			_mm256_storeu_si256((__m256i *)(void *)(dst + x), _mm256_or_si256(sv, opaque));
+		}
+	}
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i v255 = _mm_set1_epi16(255);
+		const __m128i valpha = _mm_set1_epi16((short)alpha);
+		const __m128i opaque = _mm_set1_epi32((int)0xff000000);
+		__m128i sv, dv, sl, sh, dl, dh, al, ah;
+
+		for (; x + 4 <= width; x += 4) {
+			sv = _mm_loadu_si128((const __m128i *)(const void *)(src + x));
+			dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+			sl = _mm_unpacklo_epi8(sv, zero);
+			sh = _mm_unpackhi_epi8(sv, zero);
+			dl = _mm_unpacklo_epi8(dv, zero);
+			dh = _mm_unpackhi_epi8(dv, zero);
+			al = src_factor_epu16(sl, valpha);
+			ah = src_factor_epu16(sh, valpha);
+			sl = _mm_add_epi16(_mm_mullo_epi16(sl, SRC_MUL(al, valpha)),
+					   _mm_mullo_epi16(dl, _mm_sub_epi16(v255, al)));
+			sh = _mm_add_epi16(_mm_mullo_epi16(sh, SRC_MUL(ah, valpha)),
+					   _mm_mullo_epi16(dh, _mm_sub_epi16(v255, ah)));
+			sv = _mm_packus_epi16(div255_epu16(sl), div255_epu16(sh));
+			_mm_storeu_si128((__m128i *)(void *)(dst + x), _mm_or_si128(sv, opaque));
+		}
+	}
+	blend_row_fast_tail(dst, src, width, alpha, x);
+}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+static void blend_row_fast_neon(pixel_t * RESTRICT dst,
+				const pixel_t * RESTRICT src,
+				int width,
+				uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const uint8x8_t valpha = vdup_n_u8((uint8_t)alpha);
+		const uint8x8_t v255 = vdup_n_u8(255);
+		uint8x8x4_t sv, dv;
+		uint8x8_t a8, ia8;
+		int c;
+
+		for (; x + 8 <= width; x += 8) {
+			sv = vld4_u8((const uint8_t *)(src + x));
+			dv = vld4_u8((const uint8_t *)(dst + x));
+			a8 = div255_u16(vmull_u8(sv.val[3], valpha));
+			ia8 = vsub_u8(v255, a8);
+			for (c = 0; c < 3; c++) {
+				dv.val[c] = div255_u16(vmlal_u8(vmull_u8(sv.val[c], SRC_MUL(a8, valpha)),
+								dv.val[c], ia8));
+			}
+			dv.val[3] = v255;
+			vst4_u8((uint8_t *)(dst + x), dv);
+		}
+	}
+	blend_row_fast_tail(dst, src, width, alpha, x);
+}
+#endif
+
+/* 1行をアルファブレンドする (draw_image_emoji()) */
+static INLINE void blend_row_emoji_tail(pixel_t * RESTRICT dst,
+					const pixel_t * RESTRICT src,
+					int width,
+					uint32_t alpha,
+					int x)
+{
+	uint32_t s, d, a, ia, rb, ag;
+
+	/* 端数をスカラで処理する */
+	for (; x < width; x++) {
+		s = src[x];
+		d = dst[x];
+		a = div255(alpha * (s >> 24));
+		ia = 255 - a;
+		rb = div255_pair((s & 0x00ff00ff) * SRC_MUL(a, alpha) + (d & 0x00ff00ff) * ia);
+		ag = div255_pair(((s >> 8) & 0x00ff00ff) * SRC_MUL(a, alpha) + ((d >> 8) & 0x00ff00ff) * ia);
+		dst[x] = ((a >= 128 ? a : (d >> 24)) << 24) | ((ag & 0xff) << 8) | rb;
+	}
+}
+
+static void blend_row_emoji_c(pixel_t * RESTRICT dst,
+			      const pixel_t * RESTRICT src,
+			      int width,
+			      uint32_t alpha)
+{
+	blend_row_emoji_tail(dst, src, width, alpha, 0);
+}
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+static void blend_row_emoji_sse2(pixel_t * RESTRICT dst,
+				 const pixel_t * RESTRICT src,
+				 int width,
+				 uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i v127 = _mm_set1_epi16(127);
+		const __m128i v255 = _mm_set1_epi16(255);
+		const __m128i valpha = _mm_set1_epi16((short)alpha);
+		const __m128i amask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+		__m128i sv, dv, sl, sh, dl, dh, al, ah, ml, mh;
+
+		for (; x + 4 <= width; x += 4) {
+			sv = _mm_loadu_si128((const __m128i *)(const void *)(src + x));
+			dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+			sl = _mm_unpacklo_epi8(sv, zero);
+			sh = _mm_unpackhi_epi8(sv, zero);
+			dl = _mm_unpacklo_epi8(dv, zero);
+			dh = _mm_unpackhi_epi8(dv, zero);
+			al = src_factor_epu16(sl, valpha);
+			ah = src_factor_epu16(sh, valpha);
+
+			/* 転送元の係数が半分を超えればそれを、そうでなければ転送先のアルファ値を使う */
+			ml = _mm_and_si128(_mm_cmpgt_epi16(al, v127), amask);
+			mh = _mm_and_si128(_mm_cmpgt_epi16(ah, v127), amask);
+
+			sl = div255_epu16(_mm_add_epi16(_mm_mullo_epi16(sl, SRC_MUL(al, valpha)),
+							_mm_mullo_epi16(dl, _mm_sub_epi16(v255, al))));
+			sh = div255_epu16(_mm_add_epi16(_mm_mullo_epi16(sh, SRC_MUL(ah, valpha)),
+							_mm_mullo_epi16(dh, _mm_sub_epi16(v255, ah))));
+			sl = _mm_or_si128(_mm_andnot_si128(amask, sl),
+					  _mm_or_si128(_mm_and_si128(ml, al),
+						       _mm_andnot_si128(ml, _mm_and_si128(amask, dl))));
+			sh = _mm_or_si128(_mm_andnot_si128(amask, sh),
+					  _mm_or_si128(_mm_and_si128(mh, ah),
+						       _mm_andnot_si128(mh, _mm_and_si128(amask, dh))));
+			_mm_storeu_si128((__m128i *)(void *)(dst + x), _mm_packus_epi16(sl, sh));
+		}
+	}
+	blend_row_emoji_tail(dst, src, width, alpha, x);
+}
+
+static TARGET_AVX2 void blend_row_emoji_avx2(pixel_t * RESTRICT dst,
+					     const pixel_t * RESTRICT src,
+					     int width,
+					     uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i v127 = _mm256_set1_epi16(127);
+		const __m256i v255 = _mm256_set1_epi16(255);
+		const __m256i valpha = _mm256_set1_epi16((short)alpha);
+		const __m256i amask = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+		__m256i sv, dv, sl, sh, dl, dh, al, ah, ml, mh;
+
+		for (; x + 8 <= width; x += 8) {
+			sv = _mm256_loadu_si256((const __m256i *)(const void *)(src + x));
+			dv = _mm256_loadu_si256((const __m256i *)(void *)(dst + x));
+			sl = _mm256_unpacklo_epi8(sv, zero);
+			sh = _mm256_unpackhi_epi8(sv, zero);
+			dl = _mm256_unpacklo_epi8(dv, zero);
+			dh = _mm256_unpackhi_epi8(dv, zero);
+			al = src_factor_epu16_256(sl, valpha);
+			ah = src_factor_epu16_256(sh, valpha);
+
+			/* 転送元の係数が半分を超えればそれを、そうでなければ転送先のアルファ値を使う */
+			ml = _mm256_and_si256(_mm256_cmpgt_epi16(al, v127), amask);
+			mh = _mm256_and_si256(_mm256_cmpgt_epi16(ah, v127), amask);
+
+			sl = div255_epu16_256(_mm256_add_epi16(_mm256_mullo_epi16(sl, SRC_MUL(al, valpha)),
+							       _mm256_mullo_epi16(dl, _mm256_sub_epi16(v255, al))));
+			sh = div255_epu16_256(_mm256_add_epi16(_mm256_mullo_epi16(sh, SRC_MUL(ah, valpha)),
+							       _mm256_mullo_epi16(dh, _mm256_sub_epi16(v255, ah))));
+			sl = _mm256_or_si256(_mm256_andnot_si256(amask, sl),
+					     _mm256_or_si256(_mm256_and_si256(ml, al),
+							     _mm256_andnot_si256(ml, _mm256_and_si256(amask, dl))));
+			sh = _mm256_or_si256(_mm256_andnot_si256(amask, sh),
+					     _mm256_or_si256(_mm256_and_si256(mh, ah),
+							     _mm256_andnot_si256(mh, _mm256_and_si256(amask, dh))));
+			_mm256_storeu_si256((__m256i *)(void *)(dst + x), _mm256_packus_epi16(sl, sh));
+		}
+	}
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i v127 = _mm_set1_epi16(127);
+		const __m128i v255 = _mm_set1_epi16(255);
+		const __m128i valpha = _mm_set1_epi16((short)alpha);
+		const __m128i amask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+		__m128i sv, dv, sl, sh, dl, dh, al, ah, ml, mh;
+
+		for (; x + 4 <= width; x += 4) {
+			sv = _mm_loadu_si128((const __m128i *)(const void *)(src + x));
+			dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+			sl = _mm_unpacklo_epi8(sv, zero);
+			sh = _mm_unpackhi_epi8(sv, zero);
+			dl = _mm_unpacklo_epi8(dv, zero);
+			dh = _mm_unpackhi_epi8(dv, zero);
+			al = src_factor_epu16(sl, valpha);
+			ah = src_factor_epu16(sh, valpha);
+
+			/* 転送元の係数が半分を超えればそれを、そうでなければ転送先のアルファ値を使う */
+			ml = _mm_and_si128(_mm_cmpgt_epi16(al, v127), amask);
+			mh = _mm_and_si128(_mm_cmpgt_epi16(ah, v127), amask);
+
+			sl = div255_epu16(_mm_add_epi16(_mm_mullo_epi16(sl, SRC_MUL(al, valpha)),
+							_mm_mullo_epi16(dl, _mm_sub_epi16(v255, al))));
+			sh = div255_epu16(_mm_add_epi16(_mm_mullo_epi16(sh, SRC_MUL(ah, valpha)),
+							_mm_mullo_epi16(dh, _mm_sub_epi16(v255, ah))));
+			sl = _mm_or_si128(_mm_andnot_si128(amask, sl),
+					  _mm_or_si128(_mm_and_si128(ml, al),
+						       _mm_andnot_si128(ml, _mm_and_si128(amask, dl))));
+			sh = _mm_or_si128(_mm_andnot_si128(amask, sh),
+					  _mm_or_si128(_mm_and_si128(mh, ah),
+						       _mm_andnot_si128(mh, _mm_and_si128(amask, dh))));
+			_mm_storeu_si128((__m128i *)(void *)(dst + x), _mm_packus_epi16(sl, sh));
+		}
+	}
+	blend_row_emoji_tail(dst, src, width, alpha, x);
+}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+static void blend_row_emoji_neon(pixel_t * RESTRICT dst,
+				 const pixel_t * RESTRICT src,
+				 int width,
+				 uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const uint8x8_t valpha = vdup_n_u8((uint8_t)alpha);
+		const uint8x8_t v128 = vdup_n_u8(128);
+		const uint8x8_t v255 = vdup_n_u8(255);
+		uint8x8x4_t sv, dv;
+		uint8x8_t a8, ia8;
+		int c;
+
+		for (; x + 8 <= width; x += 8) {
+			sv = vld4_u8((const uint8_t *)(src + x));
+			dv = vld4_u8((const uint8_t *)(dst + x));
+			a8 = div255_u16(vmull_u8(sv.val[3], valpha));
+			ia8 = vsub_u8(v255, a8);
+			for (c = 0; c < 3; c++) {
+				dv.val[c] = div255_u16(vmlal_u8(vmull_u8(sv.val[c], SRC_MUL(a8, valpha)),
+								dv.val[c], ia8));
+			}
+			dv.val[3] = vbsl_u8(vcge_u8(a8, v128), a8, dv.val[3]);
+			vst4_u8((uint8_t *)(dst + x), dv);
+		}
+	}
+	blend_row_emoji_tail(dst, src, width, alpha, x);
+}
+#endif
+
+/* 1行を加算合成する (draw_image_add()) */
+static INLINE void blend_row_add_tail(pixel_t * RESTRICT dst,
+				      const pixel_t * RESTRICT src,
+				      int width,
+				      uint32_t alpha,
+				      int x)
+{
+	uint32_t s, d, a, rb, ag;
+
+	/* 端数をスカラで処理する */
+	for (; x < width; x++) {
+		s = src[x];
+		d = dst[x];
+		a = div255(alpha * (s >> 24));
+		rb = adds_pair(div255_pair((s & 0x00ff00ff) * SRC_MUL(a, alpha)), d & 0x00ff00ff);
+		ag = adds_pair(div255_pair(((s >> 8) & 0x00ff00ff) * SRC_MUL(a, alpha)), (d >> 8) & 0x00ff00ff);
+		dst[x] = 0xff000000 | (ag << 8) | rb;
+	}
+}
+
+static void blend_row_add_c(pixel_t * RESTRICT dst,
+			    const pixel_t * RESTRICT src,
+			    int width,
+			    uint32_t alpha)
+{
+	blend_row_add_tail(dst, src, width, alpha, 0);
+}
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+static void blend_row_add_sse2(pixel_t * RESTRICT dst,
+			       const pixel_t * RESTRICT src,
+			       int width,
+			       uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i valpha = _mm_set1_epi16((short)alpha);
+		const __m128i opaque = _mm_set1_epi32((int)0xff000000);
+		__m128i sv, dv, sl, sh;
+
+		for (; x + 4 <= width; x += 4) {
+			sv = _mm_loadu_si128((const __m128i *)(const void *)(src + x));
+			dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+			sl = _mm_unpacklo_epi8(sv, zero);
+			sh = _mm_unpackhi_epi8(sv, zero);
+			sl = div255_epu16(_mm_mullo_epi16(sl, SRC_MUL(src_factor_epu16(sl, valpha), valpha)));
+			sh = div255_epu16(_mm_mullo_epi16(sh, SRC_MUL(src_factor_epu16(sh, valpha), valpha)));
+			sv = _mm_adds_epu8(_mm_packus_epi16(sl, sh), dv);
+			_mm_storeu_si128((__m128i *)(void *)(dst + x), _mm_or_si128(sv, opaque));
+		}
+	}
+	blend_row_add_tail(dst, src, width, alpha, x);
+}
+
+static TARGET_AVX2 void blend_row_add_avx2(pixel_t * RESTRICT dst,
+					   const pixel_t * RESTRICT src,
+					   int width,
+					   uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i valpha = _mm256_set1_epi16((short)alpha);
+		const __m256i opaque = _mm256_set1_epi32((int)0xff000000);
+		__m256i sv, dv, sl, sh;
+
+		for (; x + 8 <= width; x += 8) {
+			sv = _mm256_loadu_si256((const __m256i *)(const void *)(src + x));
+			dv = _mm256_loadu_si256((const __m256i *)(void *)(dst + x));
+			sl = _mm256_unpacklo_epi8(sv, zero);
+			sh = _mm256_unpackhi_epi8(sv, zero);
+			sl = div255_epu16_256(_mm256_mullo_epi16(sl, SRC_MUL(src_factor_epu16_256(sl, valpha), valpha)));
+			sh = div255_epu16_256(_mm256_mullo_epi16(sh, SRC_MUL(src_factor_epu16_256(sh, valpha), valpha)));
+			sv = _mm256_adds_epu8(_mm256_packus_epi16(sl, sh), dv);
+			_mm256_storeu_si256((__m256i *)(void *)(dst + x), _mm256_or_si256(sv, opaque));
+		}
+	}
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i valpha = _mm_set1_epi16((short)alpha);
+		const __m128i opaque = _mm_set1_epi32((int)0xff000000);
+		__m128i sv, dv, sl, sh;
+
+		for (; x + 4 <= width; x += 4) {
+			sv = _mm_loadu_si128((const __m128i *)(const void *)(src + x));
+			dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+			sl = _mm_unpacklo_epi8(sv, zero);
+			sh = _mm_unpackhi_epi8(sv, zero);
+			sl = div255_epu16(_mm_mullo_epi16(sl, SRC_MUL(src_factor_epu16(sl, valpha), valpha)));
+			sh = div255_epu16(_mm_mullo_epi16(sh, SRC_MUL(src_factor_epu16(sh, valpha), valpha)));
+			sv = _mm_adds_epu8(_mm_packus_epi16(sl, sh), dv);
+			_mm_storeu_si128((__m128i *)(void *)(dst + x), _mm_or_si128(sv, opaque));
+		}
+	}
+	blend_row_add_tail(dst, src, width, alpha, x);
+}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+static void blend_row_add_neon(pixel_t * RESTRICT dst,
+			       const pixel_t * RESTRICT src,
+			       int width,
+			       uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const uint8x8_t valpha = vdup_n_u8((uint8_t)alpha);
+		uint8x8x4_t sv, dv;
+		uint8x8_t a8;
+		int c;
+
+		for (; x + 8 <= width; x += 8) {
+			sv = vld4_u8((const uint8_t *)(src + x));
+			dv = vld4_u8((const uint8_t *)(dst + x));
+			a8 = div255_u16(vmull_u8(sv.val[3], valpha));
+			for (c = 0; c < 3; c++)
+				dv.val[c] = vqadd_u8(div255_u16(vmull_u8(sv.val[c], SRC_MUL(a8, valpha))), dv.val[c]);
+			dv.val[3] = vdup_n_u8(255);
+			vst4_u8((uint8_t *)(dst + x), dv);
+		}
+	}
+	blend_row_add_tail(dst, src, width, alpha, x);
+}
+#endif
+
+/* 1行を50%暗くしてアルファブレンドする (draw_image_dim()) */
+static INLINE void blend_row_dim_tail(pixel_t * RESTRICT dst,
+				      const pixel_t * RESTRICT src,
+				      int width,
+				      uint32_t alpha,
+				      int x)
+{
+	uint32_t s, d, a, ia, rb, ag;
+
+	/* 端数をスカラで処理する */
+	for (; x < width; x++) {
+		s = src[x];
+		d = dst[x];
+		a = div255(alpha * (s >> 24));
+		ia = 255 - a;
+		rb = div255_pair((((s & 0x00ff00ff) * SRC_MUL(a, alpha)) >> 1 & 0x7fff7fff) +
+				 (d & 0x00ff00ff) * ia);
+		ag = div255_pair(((((s >> 8) & 0x00ff00ff) * SRC_MUL(a, alpha)) >> 1 & 0x7fff7fff) +
+				 ((d >> 8) & 0x00ff00ff) * ia);
+		dst[x] = 0xff000000 | (ag << 8) | rb;
+	}
+}
+
+static void blend_row_dim_c(pixel_t * RESTRICT dst,
+			    const pixel_t * RESTRICT src,
+			    int width,
+			    uint32_t alpha)
+{
+	blend_row_dim_tail(dst, src, width, alpha, 0);
+}
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+static void blend_row_dim_sse2(pixel_t * RESTRICT dst,
+			       const pixel_t * RESTRICT src,
+			       int width,
+			       uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i v255 = _mm_set1_epi16(255);
+		const __m128i valpha = _mm_set1_epi16((short)alpha);
+		const __m128i opaque = _mm_set1_epi32((int)0xff000000);
+		__m128i sv, dv, sl, sh, dl, dh, al, ah;
+
+		for (; x + 4 <= width; x += 4) {
+			sv = _mm_loadu_si128((const __m128i *)(const void *)(src + x));
+			dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+			sl = _mm_unpacklo_epi8(sv, zero);
+			sh = _mm_unpackhi_epi8(sv, zero);
+			dl = _mm_unpacklo_epi8(dv, zero);
+			dh = _mm_unpackhi_epi8(dv, zero);
+			al = src_factor_epu16(sl, valpha);
+			ah = src_factor_epu16(sh, valpha);
+			sl = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(sl, SRC_MUL(al, valpha)), 1),
+					   _mm_mullo_epi16(dl, _mm_sub_epi16(v255, al)));
+			sh = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(sh, SRC_MUL(ah, valpha)), 1),
+					   _mm_mullo_epi16(dh, _mm_sub_epi16(v255, ah)));
+			sv = _mm_packus_epi16(div255_epu16(sl), div255_epu16(sh));
+			_mm_storeu_si128((__m128i *)(void *)(dst + x), _mm_or_si128(sv, opaque));
+		}
+	}
+	blend_row_dim_tail(dst, src, width, alpha, x);
+}
+
+static TARGET_AVX2 void blend_row_dim_avx2(pixel_t * RESTRICT dst,
+					   const pixel_t * RESTRICT src,
+					   int width,
+					   uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i v255 = _mm256_set1_epi16(255);
+		const __m256i valpha = _mm256_set1_epi16((short)alpha);
+		const __m256i opaque = _mm256_set1_epi32((int)0xff000000);
+		__m256i sv, dv, sl, sh, dl, dh, al, ah;
+
+		for (; x + 8 <= width; x += 8) {
+			sv = _mm256_loadu_si256((const __m256i *)(const void *)(src + x));
+			dv = _mm256_loadu_si256((const __m256i *)(void *)(dst + x));
+			sl = _mm256_unpacklo_epi8(sv, zero);
+			sh = _mm256_unpackhi_epi8(sv, zero);
+			dl = _mm256_unpacklo_epi8(dv, zero);
+			dh = _mm256_unpackhi_epi8(dv, zero);
+			al = src_factor_epu16_256(sl, valpha);
+			ah = src_factor_epu16_256(sh, valpha);
+			sl = _mm256_add_epi16(_mm256_srli_epi16(_mm256_mullo_epi16(sl, SRC_MUL(al, valpha)), 1),
+					      _mm256_mullo_epi16(dl, _mm256_sub_epi16(v255, al)));
+			sh = _mm256_add_epi16(_mm256_srli_epi16(_mm256_mullo_epi16(sh, SRC_MUL(ah, valpha)), 1),
+					      _mm256_mullo_epi16(dh, _mm256_sub_epi16(v255, ah)));
+			sv = _mm256_packus_epi16(div255_epu16_256(sl), div255_epu16_256(sh));
+			_mm256_storeu_si256((__m256i *)(void *)(dst + x), _mm256_or_si256(sv, opaque));
+		}
+	}
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i v255 = _mm_set1_epi16(255);
+		const __m128i valpha = _mm_set1_epi16((short)alpha);
+		const __m128i opaque = _mm_set1_epi32((int)0xff000000);
+		__m128i sv, dv, sl, sh, dl, dh, al, ah;
+
+		for (; x + 4 <= width; x += 4) {
+			sv = _mm_loadu_si128((const __m128i *)(const void *)(src + x));
+			dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+			sl = _mm_unpacklo_epi8(sv, zero);
+			sh = _mm_unpackhi_epi8(sv, zero);
+			dl = _mm_unpacklo_epi8(dv, zero);
+			dh = _mm_unpackhi_epi8(dv, zero);
+			al = src_factor_epu16(sl, valpha);
+			ah = src_factor_epu16(sh, valpha);
+			sl = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(sl, SRC_MUL(al, valpha)), 1),
+					   _mm_mullo_epi16(dl, _mm_sub_epi16(v255, al)));
+			sh = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(sh, SRC_MUL(ah, valpha)), 1),
+					   _mm_mullo_epi16(dh, _mm_sub_epi16(v255, ah)));
+			sv = _mm_packus_epi16(div255_epu16(sl), div255_epu16(sh));
+			_mm_storeu_si128((__m128i *)(void *)(dst + x), _mm_or_si128(sv, opaque));
+		}
+	}
+	blend_row_dim_tail(dst, src, width, alpha, x);
+}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+static void blend_row_dim_neon(pixel_t * RESTRICT dst,
+			       const pixel_t * RESTRICT src,
+			       int width,
+			       uint32_t alpha)
+{
+	int x;
+
+	x = 0;
+	{
+		const uint8x8_t valpha = vdup_n_u8((uint8_t)alpha);
+		const uint8x8_t v255 = vdup_n_u8(255);
+		uint8x8x4_t sv, dv;
+		uint8x8_t a8, ia8;
+		int c;
+
+		for (; x + 8 <= width; x += 8) {
+			sv = vld4_u8((const uint8_t *)(src + x));
+			dv = vld4_u8((const uint8_t *)(dst + x));
+			a8 = div255_u16(vmull_u8(sv.val[3], valpha));
+			ia8 = vsub_u8(v255, a8);
+			for (c = 0; c < 3; c++) {
+				dv.val[c] = div255_u16(vmlal_u8(vshrq_n_u16(vmull_u8(sv.val[c], SRC_MUL(a8, valpha)), 1),
+								dv.val[c], ia8));
+			}
+			dv.val[3] = v255;
+			vst4_u8((uint8_t *)(dst + x), dv);
+		}
+	}
+	blend_row_dim_tail(dst, src, width, alpha, x);
+}
+#endif
+
+/*
+ * 1行をルール付き(1-bit)で描画する (draw_image_rule())
+ *  - ルール画像の値はget_pixel_b()と同じ位置のバイトから取得する
  */
+static INLINE void rule_row_tail(pixel_t * RESTRICT dst,
+				 const pixel_t * RESTRICT src,
+				 const pixel_t * RESTRICT rule,
+				 int width,
+				 uint32_t threshold,
+				 int x)
+{
+	/* 端数をスカラで処理する */
+	for (; x < width; x++)
+		if (((rule[x] >> RULE_SHIFT) & 0xff) <= threshold)
+			dst[x] = src[x];
+}
 
-/*
- * イメージを黒色でクリアする
- */
-void clear_image_black(struct image *img)
+static void rule_row_c(pixel_t * RESTRICT dst,
+		       const pixel_t * RESTRICT src,
+		       const pixel_t * RESTRICT rule,
+		       int width,
+		       uint32_t threshold)
 {
-	clear_image_color_rect(img, 0, 0, img->width, img->height, make_pixel(0xff, 0, 0, 0));
+	rule_row_tail(dst, src, rule, width, threshold, 0);
 }
 
-/*
- * イメージを白色でクリアする
- */
-void clear_image_white(struct image *img)
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+static void rule_row_sse2(pixel_t * RESTRICT dst,
+			  const pixel_t * RESTRICT src,
+			  const pixel_t * RESTRICT rule,
+			  int width,
+			  uint32_t threshold)
 {
-	clear_image_color_rect(img, 0, 0, img->width, img->height, make_pixel(0xff, 0xff, 0xff, 0xff));
+	int x;
+
+	x = 0;
+	{
+		const __m128i shift = _mm_cvtsi32_si128(RULE_SHIFT);
+		const __m128i mask = _mm_set1_epi32(0xff);
+		const __m128i thr = _mm_set1_epi32((int)threshold);
+		__m128i rv, keep;
+
+		for (; x + 4 <= width; x += 4) {
+			rv = _mm_loadu_si128((const __m128i *)(const void *)(rule + x));
+			rv = _mm_and_si128(_mm_srl_epi32(rv, shift), mask);
+			keep = _mm_cmpgt_epi32(rv, thr);
+			_mm_storeu_si128((__m128i *)(void *)(dst + x),
+					 _mm_or_si128(_mm_and_si128(keep, _mm_loadu_si128((const __m128i *)(void *)(dst + x))),
+						      _mm_andnot_si128(keep, _mm_loadu_si128((const __m128i *)(const void *)(src + x)))));
+		}
+	}
+	rule_row_tail(dst, src, rule, width, threshold, x);
 }
 
-/*
- * イメージを色でクリアする
- */
-void clear_image_color(struct image *img, pixel_t color)
+static TARGET_AVX2 void rule_row_avx2(pixel_t * RESTRICT dst,
+				      const pixel_t * RESTRICT src,
+				      const pixel_t * RESTRICT rule,
+				      int width,
+				      uint32_t threshold)
 {
-	clear_image_color_rect(img, 0, 0, img->width, img->height, color);
+	int x;
+
+	x = 0;
+	{
+		const __m128i shift = _mm_cvtsi32_si128(RULE_SHIFT);
+		const __m256i mask = _mm256_set1_epi32(0xff);
+		const __m256i thr = _mm256_set1_epi32((int)threshold + 1);
+		__m256i rv, copy;
+
+		for (; x + 8 <= width; x += 8) {
+			rv = _mm256_loadu_si256((const __m256i *)(const void *)(rule + x));
+			rv = _mm256_and_si256(_mm256_srl_epi32(rv, shift), mask);
+			copy = _mm256_cmpgt_epi32(thr, rv);
+			_mm256_maskstore_epi32((int *)(void *)(dst + x), copy,
+					       _mm256_loadu_si256((const __m256i *)(const void *)(src + x)));
+		}
+	}
+	{
+		const __m128i shift = _mm_cvtsi32_si128(RULE_SHIFT);
+		const __m128i mask = _mm_set1_epi32(0xff);
+		const __m128i thr = _mm_set1_epi32((int)threshold);
+		__m128i rv, keep;
+
+		for (; x + 4 <= width; x += 4) {
+			rv = _mm_loadu_si128((const __m128i *)(const void *)(rule + x));
+			rv = _mm_and_si128(_mm_srl_epi32(rv, shift), mask);
+			keep = _mm_cmpgt_epi32(rv, thr);
+			_mm_storeu_si128((__m128i *)(void *)(dst + x),
+					 _mm_or_si128(_mm_and_si128(keep, _mm_loadu_si128((const __m128i *)(void *)(dst + x))),
+						      _mm_andnot_si128(keep, _mm_loadu_si128((const __m128i *)(const void *)(src + x)))));
+		}
+	}
+	rule_row_tail(dst, src, rule, width, threshold, x);
+}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+static void rule_row_neon(pixel_t * RESTRICT dst,
+			  const pixel_t * RESTRICT src,
+			  const pixel_t * RESTRICT rule,
+			  int width,
+			  uint32_t threshold)
+{
+	int x;
+
+	x = 0;
+	{
+		const int32x4_t shift = vdupq_n_s32(-RULE_SHIFT);
+		const uint32x4_t mask = vdupq_n_u32(0xff);
+		const uint32x4_t thr = vdupq_n_u32(threshold);
+		uint32x4_t rv;
+
+		for (; x + 4 <= width; x += 4) {
+			rv = vandq_u32(vshlq_u32(vld1q_u32(rule + x), shift), mask);
+			vst1q_u32(dst + x, vbslq_u32(vcleq_u32(rv, thr),
+						     vld1q_u32(src + x),
+						     vld1q_u32(dst + x)));
+		}
+	}
+	rule_row_tail(dst, src, rule, width, threshold, x);
 }
+#endif
 
 /*
- * イメージの矩形を色でクリアする
+ * 1行をルール付き(メルト)で描画する (draw_image_melt())
+ *  - スカラではlutでルール画像の値から転送元の係数を引く
+ *  - SIMDではテーブル参照の代わりにlutと同じ値clamp(2*threshold-rule)を計算する
  */
-void clear_image_color_rect(struct image *img, int x, int y, int w, int h, pixel_t color)
+static INLINE void melt_row_tail(pixel_t * RESTRICT dst,
+				 const pixel_t * RESTRICT src,
+				 const pixel_t * RESTRICT rule,
+				 int width,
+				 const uint8_t *lut,
+				 int x)
 {
-	pixel_t *pixels;
-	int i, j, sx, sy;
-
-	assert(img != NULL);
-	assert(img->width > 0 && img->height > 0);
-	assert(img->pixels != NULL);
-
-	/* 描画の必要があるか判定する */
-	if(w == 0 || h == 0)
-		return;	/* 描画の必要がない*/
-	sx = sy = 0;
-	if(!clip_by_dest(img->width, img->height, &w, &h, &x, &y, &sx, &sy))
-		return;	/* 描画範囲外 */
-
-	assert(x >= 0 && x < img->width);
-	assert(w >= 0 && x + w <= img->width);
-	assert(y >= 0 && y < img->height);
-	assert(h >= 0 && y + h <= img->height);
+	uint32_t s, d, a, ia, rb, ag;
+
+	/* 端数をスカラで処理する */
+	for (; x < width; x++) {
+		s = src[x];
+		d = dst[x];
+		a = lut[(rule[x] >> RULE_SHIFT) & 0xff];
+		ia = 255 - a;
+		rb = div255_pair((s & 0x00ff00ff) * a + (d & 0x00ff00ff) * ia);
+		ag = div255_pair(((s >> 8) & 0x00ff00ff) * a + ((d >> 8) & 0x00ff00ff) * ia);
+		dst[x] = 0xff000000 | (ag << 8) | rb;
+	}
+}
 
-	/* ピクセル列の矩形をクリアする */
-	pixels = img->pixels;
-	for (i = y; i < y + h; i++)
-		for (j = x; j < x + w; j++)
-			pixels[img->width * i + j] = color;
+static void melt_row_c(pixel_t * RESTRICT dst,
+		       const pixel_t * RESTRICT src,
+		       const pixel_t * RESTRICT rule,
+		       int width,
+		       uint32_t threshold,
+		       const uint8_t *lut)
+{
+	UNUSED_PARAMETER(threshold);
 
-	/* Request a texture update. */
-	notify_image_update(img);
+	melt_row_tail(dst, src, rule, width, lut, 0);
 }
 
-/*
- * イメージのアルファチャンネルを255でクリアする
- */
-void fill_image_alpha(struct image *img)
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+static void melt_row_sse2(pixel_t * RESTRICT dst,
+			  const pixel_t * RESTRICT src,
+			  const pixel_t * RESTRICT rule,
+			  int width,
+			  uint32_t threshold,
+			  const uint8_t *lut)
 {
-	pixel_t *p;
-	int y, x;
-
-	assert(img != NULL);
+	int x;
+
+	x = 0;
+	{
+		const __m128i shift = _mm_cvtsi32_si128(RULE_SHIFT);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i mask = _mm_set1_epi32(0xff);
+		const __m128i v255 = _mm_set1_epi16(255);
+		const __m128i thr2 = _mm_set1_epi16((short)(threshold * 2));
+		const __m128i opaque = _mm_set1_epi32((int)0xff000000);
+		__m128i sv, dv, rv, sl, sh, dl, dh, al, ah;
+
+		for (; x + 4 <= width; x += 4) {
+			sv = _mm_loadu_si128((const __m128i *)(const void *)(src + x));
+			dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+			rv = _mm_loadu_si128((const __m128i *)(const void *)(rule + x));
+			rv = _mm_and_si128(_mm_srl_epi32(rv, shift), mask);
+			al = _mm_unpacklo_epi8(rv, zero);
+			ah = _mm_unpackhi_epi8(rv, zero);
+			al = _mm_shufflehi_epi16(_mm_shufflelo_epi16(al, 0), 0);
+			ah = _mm_shufflehi_epi16(_mm_shufflelo_epi16(ah, 0), 0);
+			al = _mm_min_epi16(_mm_subs_epu16(thr2, al), v255);
+			ah = _mm_min_epi16(_mm_subs_epu16(thr2, ah), v255);
+			sl = _mm_unpacklo_epi8(sv, zero);
+			sh = _mm_unpackhi_epi8(sv, zero);
+			dl = _mm_unpacklo_epi8(dv, zero);
+			dh = _mm_unpackhi_epi8(dv, zero);
+			sl = _mm_add_epi16(_mm_mullo_epi16(sl, al),
+					   _mm_mullo_epi16(dl, _mm_sub_epi16(v255, al)));
+			sh = _mm_add_epi16(_mm_mullo_epi16(sh, ah),
+					   _mm_mullo_epi16(dh, _mm_sub_epi16(v255, ah)));
+			sv = _mm_packus_epi16(div255_epu16(sl), div255_epu16(sh));
+			_mm_storeu_si128((__m128i *)(void *)(dst + x), _mm_or_si128(sv, opaque));
+		}
+	}
+	melt_row_tail(dst, src, rule, width, lut, x);
+}
 
-	p = img->pixels;
-	for (y = 0; y < img->height; y++) {
-		for (x = 0; x < img->width; x++) {
-			*p = (*p) | 0xff000000;
-			p++;
+static TARGET_AVX2 void melt_row_avx2(pixel_t * RESTRICT dst,
+				      const pixel_t * RESTRICT src,
+				      const pixel_t * RESTRICT rule,
+				      int width,
+				      uint32_t threshold,
+				      const uint8_t *lut)
+{
+	int x;
+
+	x = 0;
+	{
+		const __m128i shift = _mm_cvtsi32_si128(RULE_SHIFT);
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i mask = _mm256_set1_epi32(0xff);
+		const __m256i v255 = _mm256_set1_epi16(255);
+		const __m256i thr2 = _mm256_set1_epi16((short)(threshold * 2));
+		const __m256i opaque = _mm256_set1_epi32((int)0xff000000);
+		__m256i sv, dv, rv, sl, sh, dl, dh, al, ah;
+
+		for (; x + 8 <= width; x += 8) {
+			sv = _mm256_loadu_si256((const __m256i *)(const void *)(src + x));
+			dv = _mm256_loadu_si256((const __m256i *)(void *)(dst + x));
+			rv = _mm256_loadu_si256((const __m256i *)(const void *)(rule + x));
+			rv = _mm256_and_si256(_mm256_srl_epi32(rv, shift), mask);
+			al = _mm256_unpacklo_epi8(rv, zero);
+			ah = _mm256_unpackhi_epi8(rv, zero);
+			al = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(al, 0), 0);
+			ah = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(ah, 0), 0);
+			al = _mm256_min_epi16(_mm256_subs_epu16(thr2, al), v255);
+			ah = _mm256_min_epi16(_mm256_subs_epu16(thr2, ah), v255);
+			sl = _mm256_unpacklo_epi8(sv, zero);
+			sh = _mm256_unpackhi_epi8(sv, zero);
+			dl = _mm256_unpacklo_epi8(dv, zero);
+			dh = _mm256_unpackhi_epi8(dv, zero);
+			sl = _mm256_add_epi16(_mm256_mullo_epi16(sl, al),
+					      _mm256_mullo_epi16(dl, _mm256_sub_epi16(v255, al)));
+			sh = _mm256_add_epi16(_mm256_mullo_epi16(sh, ah),
+					      _mm256_mullo_epi16(dh, _mm256_sub_epi16(v255, ah)));
+			sv = _mm256_packus_epi16(div255_epu16_256(sl), div255_epu16_256(sh));
+			_mm256_storeu_si256((__m256i *)(void *)(dst + x), _mm256_or_si256(sv, opaque));
+		}
+	}
+	{
+		const __m128i shift = _mm_cvtsi32_si128(RULE_SHIFT);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i mask = _mm_set1_epi32(0xff);
+		const __m128i v255 = _mm_set1_epi16(255);
+		const __m128i thr2 = _mm_set1_epi16((short)(threshold * 2));
+		const __m128i opaque = _mm_set1_epi32((int)0xff000000);
+		__m128i sv, dv, rv, sl, sh, dl, dh, al, ah;
+
+		for (; x + 4 <= width; x += 4) {
+			sv = _mm_loadu_si128((const __m128i *)(const void *)(src + x));
+			dv = _mm_loadu_si128((const __m128i *)(void *)(dst + x));
+			rv = _mm_loadu_si128((const __m128i *)(const void *)(rule + x));
+			rv = _mm_and_si128(_mm_srl_epi32(rv, shift), mask);
+			al = _mm_unpacklo_epi8(rv, zero);
+			ah = _mm_unpackhi_epi8(rv, zero);
+			al = _mm_shufflehi_epi16(_mm_shufflelo_epi16(al, 0), 0);
+			ah = _mm_shufflehi_epi16(_mm_shufflelo_epi16(ah, 0), 0);
+			al = _mm_min_epi16(_mm_subs_epu16(thr2, al), v255);
+			ah = _mm_min_epi16(_mm_subs_epu16(thr2, ah), v255);
+			sl = _mm_unpacklo_epi8(sv, zero);
+			sh = _mm_unpackhi_epi8(sv, zero);
+			dl = _mm_unpacklo_epi8(dv, zero);
+			dh = _mm_unpackhi_epi8(dv, zero);
+			sl = _mm_add_epi16(_mm_mullo_epi16(sl, al),
+					   _mm_mullo_epi16(dl, _mm_sub_epi16(v255, al)));
+			sh = _mm_add_epi16(_mm_mullo_epi16(sh, ah),
+					   _mm_mullo_epi16(dh, _mm_sub_epi16(v255, ah)));
+			sv = _mm_packus_epi16(div255_epu16(sl), div255_epu16(sh));
+			_mm_storeu_si128((__m128i *)(void *)(dst + x), _mm_or_si128(sv, opaque));
+		}
+	}
+	melt_row_tail(dst, src, rule, width, lut, x);
+}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+static void melt_row_neon(pixel_t * RESTRICT dst,
+			  const pixel_t * RESTRICT src,
+			  const pixel_t * RESTRICT rule,
+			  int width,
+			  uint32_t threshold,
+			  const uint8_t *lut)
+{
+	int x;
+
+	x = 0;
+	{
+		const uint16x8_t thr2 = vdupq_n_u16((uint16_t)(threshold * 2));
+		const uint8x8_t v255 = vdup_n_u8(255);
+		uint8x8x4_t sv, dv, rv;
+		uint8x8_t a8, ia8;
+		int c;
+
+		for (; x + 8 <= width; x += 8) {
+			sv = vld4_u8((const uint8_t *)(src + x));
+			dv = vld4_u8((const uint8_t *)(dst + x));
+			rv = vld4_u8((const uint8_t *)(rule + x));
+			a8 = vqmovn_u16(vqsubq_u16(thr2, vmovl_u8(rv.val[RULE_SHIFT / 8])));
+			ia8 = vsub_u8(v255, a8);
+			for (c = 0; c < 3; c++) {
+				dv.val[c] = div255_u16(vmlal_u8(vmull_u8(sv.val[c], a8),
+								dv.val[c], ia8));
+			}
+			dv.val[3] = v255;
+			vst4_u8((uint8_t *)(dst + x), dv);
 		}
 	}
+	melt_row_tail(dst, src, rule, width, lut, x);
 }
+#endif
 
 /*
  * 描画
@@ -275,6 +2034,9 @@ void draw_image_copy(struct image *dst_image,
 		dst_ptr += dw;
 	}
 
+	add_image_dirty_rect(dst_image, dst_left, dst_top, width, height);
+	if (!src_image->is_opaque)
+		dst_image->is_opaque = false;
 	notify_image_update(dst_image);
 }
 
@@ -294,51 +2056,42 @@ void draw_image_fast(struct image *dst_image,
 {
 	pixel_t * RESTRICT src_ptr;
 	pixel_t * RESTRICT dst_ptr;
-	float a, src_r, src_g, src_b, src_a, dst_r, dst_g, dst_b, dst_a;
-	uint32_t src_pix, dst_pix;
-	int src_line_inc, dst_line_inc, x, y, sw, dw;
+	int y, sw, dw;
 
 	if (!check_draw_image(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, alpha))
 		return;
 
+	/*
+	 * 描画先が不透明なら、転送元の透明な部分は描画しても変わらないので省く
+	 *  - 描画先のアルファ値は常に255になるので、不透明でない場合は省けない
+	 */
+	if (dst_image->is_opaque &&
+	    !clip_by_content(src_image, &dst_left, &dst_top, &width, &height, &src_left, &src_top))
+		return;
+
+	select_kernels();
+
 	sw = src_image->width;
 	dw = dst_image->width;
 	src_ptr = src_image->pixels + sw * src_top + src_left;
 	dst_ptr = dst_image->pixels + dw * dst_top + dst_left;
-	src_line_inc = sw - width;
-	dst_line_inc = dw - width;
-	a = (float)alpha / 255.0f;
 
-	for(y = 0; y < height; y++) {
-		for(x = 0; x < width; x++) {
-			/* 転送元と転送先のピクセルを取得する */
-			src_pix	= *src_ptr++;
-			dst_pix	= *dst_ptr;
-
-			/* アルファ値を計算する */
-			src_a = a * ((float)get_pixel_a(src_pix) / 255.0f);
-			dst_a = 1.0f - src_a;
-
-			/* 転送元ピクセルにアルファ値を乗算する */
-			src_r = src_a * (float)get_pixel_r(src_pix);
-			src_g = src_a * (float)get_pixel_g(src_pix);
-			src_b = src_a * (float)get_pixel_b(src_pix);
-
-			/* 転送先ピクセルにアルファ値を乗算する */
-			dst_r = dst_a * (float)get_pixel_r(dst_pix);
-			dst_g = dst_a * (float)get_pixel_g(dst_pix);
-			dst_b = dst_a * (float)get_pixel_b(dst_pix);
-
-			/* 転送先に格納する */
-			*dst_ptr++ = make_pixel(0xff,
-						(uint32_t)(src_r + dst_r),
-						(uint32_t)(src_g + dst_g),
-						(uint32_t)(src_b + dst_b));
+	if (src_image->is_opaque && alpha == 255) {
+		/* 転送元が不透明なら、ブレンドの結果は転送元と同じになるのでコピーする */
+		for(y = 0; y < height; y++) {
+			memcpy(dst_ptr, src_ptr, sizeof(pixel_t) * (size_t)width);
+			src_ptr += sw;
+			dst_ptr += dw;
+		}
+	} else {
+		for(y = 0; y < height; y++) {
+			blend_row_fast(dst_ptr, src_ptr, width, (uint32_t)alpha);
+			src_ptr += sw;
+			dst_ptr += dw;
 		}
-		src_ptr += src_line_inc;
-		dst_ptr += dst_line_inc;
 	}
 
+	add_image_dirty_rect(dst_image, dst_left, dst_top, width, height);
 	notify_image_update(dst_image);
 }
 
@@ -358,54 +2111,31 @@ void draw_image_emoji(struct image *dst_image,
 {
 	pixel_t * RESTRICT src_ptr;
 	pixel_t * RESTRICT dst_ptr;
-	float a, src_r, src_g, src_b, src_a, dst_r, dst_g, dst_b, dst_a;
-	uint32_t src_pix, dst_pix, dst_a_i, alpha_i;
-	int src_line_inc, dst_line_inc, x, y, sw, dw;
+	int y, sw, dw;
 
 	if (!check_draw_image(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, alpha))
 		return;
 
+	/* 転送元の透明な部分は描画先を変えないので省く (アルファ値も保たれる) */
+	if (!clip_by_content(src_image, &dst_left, &dst_top, &width, &height, &src_left, &src_top))
+		return;
+
+	select_kernels();
+
 	sw = src_image->width;
 	dw = dst_image->width;
 	src_ptr = src_image->pixels + sw * src_top + src_left;
 	dst_ptr = dst_image->pixels + dw * dst_top + dst_left;
-	src_line_inc = sw - width;
-	dst_line_inc = dw - width;
-	a = (float)alpha / 255.0f;
 
 	for(y = 0; y < height; y++) {
-		for(x = 0; x < width; x++) {
-			/* 転送元と転送先のピクセルを取得する */
-			src_pix	= *src_ptr++;
-			dst_pix	= *dst_ptr;
-
-			/* アルファ値を計算する */
-			src_a = a * ((float)get_pixel_a(src_pix) / 255.0f);
-			dst_a = 1.0f - src_a;
-
-			/* 転送元ピクセルにアルファ値を乗算する */
-			src_r = src_a * (float)get_pixel_r(src_pix);
-			src_g = src_a * (float)get_pixel_g(src_pix);
-			src_b = src_a * (float)get_pixel_b(src_pix);
-
-			/* 転送先ピクセルにアルファ値を乗算する */
-			dst_r = dst_a * (float)get_pixel_r(dst_pix);
-			dst_g = dst_a * (float)get_pixel_g(dst_pix);
-			dst_b = dst_a * (float)get_pixel_b(dst_pix);
-			dst_a_i = get_pixel_a(dst_pix);
-
-			alpha_i = src_a > dst_a ? (uint32_t)(src_a * 255.0f) : dst_a_i;
-
-			/* 転送先に格納する */
-			*dst_ptr++ = make_pixel(alpha_i,
-						(uint32_t)(src_r + dst_r),
-						(uint32_t)(src_g + dst_g),
-						(uint32_t)(src_b + dst_b));
-		}
-		src_ptr += src_line_inc;
-		dst_ptr += dst_line_inc;
+		blend_row_emoji(dst_ptr, src_ptr, width, (uint32_t)alpha);
+		src_ptr += sw;
+		dst_ptr += dw;
 	}
 
+	add_image_dirty_rect(dst_image, dst_left, dst_top, width, height);
+	if (!src_image->is_opaque || alpha != 255)
+		dst_image->is_opaque = false;
 	notify_image_update(dst_image);
 }
 
@@ -424,63 +2154,30 @@ void draw_image_add(struct image *dst_image,
 {
 	pixel_t * RESTRICT src_ptr;
 	pixel_t * RESTRICT dst_ptr;
-	float a, src_a;
-	uint32_t src_pix, src_r, src_g, src_b;
-	uint32_t dst_pix, dst_r, dst_g, dst_b;
-	uint32_t add_r, add_g, add_b;
-	int src_line_inc, dst_line_inc, x, y, sw, dw;
+	int y, sw, dw;
 
 	if (!check_draw_image(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, alpha))
 		return;
 
+	/* 描画先が不透明なら、転送元の透明な部分は省く (draw_image_fast()と同じ) */
+	if (dst_image->is_opaque &&
+	    !clip_by_content(src_image, &dst_left, &dst_top, &width, &height, &src_left, &src_top))
+		return;
+
+	select_kernels();
+
 	sw = src_image->width;
 	dw = dst_image->width;
 	src_ptr = src_image->pixels + sw * src_top + src_left;
 	dst_ptr = dst_image->pixels + dw * dst_top + dst_left;
-	src_line_inc = sw - width;
-	dst_line_inc = dw - width;
-	a = (float)alpha / 255.0f;
 
 	for(y = 0; y < height; y++) {
-		for(x = 0; x < width; x++) {
-			/* 転送元と転送先のピクセルを取得する */
-			src_pix	= *src_ptr++;
-			dst_pix	= *dst_ptr;
-
-			/* アルファ値を計算する */
-			src_a = a * ((float)get_pixel_a(src_pix) / 255.0f);
-
-			/* 転送元ピクセルにアルファ値を乗算する */
-			src_r = (uint32_t)(src_a * ((float)get_pixel_r(src_pix) / 255.0f) * 255.0f);
-			src_g = (uint32_t)(src_a * ((float)get_pixel_g(src_pix) / 255.0f) * 255.0f);
-			src_b = (uint32_t)(src_a * ((float)get_pixel_b(src_pix) / 255.0f) * 255.0f);
-
-			/* 転送先ピクセルを取得する */
-			dst_r = get_pixel_r(dst_pix);
-			dst_g = get_pixel_g(dst_pix);
-			dst_b = get_pixel_b(dst_pix);
-
-			/* 飽和加算する */
-			add_r = src_r + dst_r;
-			if (add_r > 255)
-				add_r = 255;
-			add_g = src_g + dst_g;
-			if (add_g > 255)
-				add_g = 255;
-			add_b = src_b + dst_b;
-			if (add_b > 255)
-				add_b = 255;
-
-			/* 転送先に格納する */
-			*dst_ptr++ = make_pixel(0xff,
-						add_r,
-						add_g,
-						add_b);
-		}
-		src_ptr += src_line_inc;
-		dst_ptr += dst_line_inc;
+		blend_row_add(dst_ptr, src_ptr, width, (uint32_t)alpha);
+		src_ptr += sw;
+		dst_ptr += dw;
 	}
 
+	add_image_dirty_rect(dst_image, dst_left, dst_top, width, height);
 	notify_image_update(dst_image);
 }
 
@@ -497,52 +2194,32 @@ void draw_image_dim(struct image *dst_image,
 		    int src_top,
 		    int alpha)
 {
-	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
-	float a, src_r, src_g, src_b, src_a, dst_r, dst_g, dst_b, dst_a;
-	uint32_t src_pix, dst_pix;
-	int src_line_inc, dst_line_inc, x, y, sw, dw;
+	pixel_t * RESTRICT src_ptr;
+	pixel_t * RESTRICT dst_ptr;
+	int y, sw, dw;
 
 	if (!check_draw_image(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, 255))
 		return;
 
+	/* 描画先が不透明なら、転送元の透明な部分は省く (draw_image_fast()と同じ) */
+	if (dst_image->is_opaque &&
+	    !clip_by_content(src_image, &dst_left, &dst_top, &width, &height, &src_left, &src_top))
+		return;
+
+	select_kernels();
+
 	sw = src_image->width;
 	dw = dst_image->width;
 	src_ptr = src_image->pixels + sw * src_top + src_left;
 	dst_ptr = dst_image->pixels + dw * dst_top + dst_left;
-	src_line_inc = sw - width;
-	dst_line_inc = dw - width;
-	a = (float)alpha / 255.0f;
 
 	for(y = 0; y < height; y++) {
-		for(x = 0; x < width; x++) {
-			/* 転送元と転送先のピクセルを取得する */
-			src_pix	= *src_ptr++;
-			dst_pix	= *dst_ptr;
-
-			/* アルファ値を計算する */
-			src_a = a * ((float)get_pixel_a(src_pix) / 255.0f);
-			dst_a = 1.0f - src_a;
-
-			/* 転送元ピクセルにアルファ値とdim係数を乗算する */
-			src_r = src_a * 0.5f * (float)get_pixel_r(src_pix);
-			src_g = src_a * 0.5f * (float)get_pixel_g(src_pix);
-			src_b = src_a * 0.5f * (float)get_pixel_b(src_pix);
-
-			/* 転送先ピクセルにアルファ値を乗算する */
-			dst_r = dst_a * (float)get_pixel_r(dst_pix);
-			dst_g = dst_a * (float)get_pixel_g(dst_pix);
-			dst_b = dst_a * (float)get_pixel_b(dst_pix);
-
-			/* 転送先に格納する */
-			*dst_ptr++ = make_pixel(0xff,
-						(uint32_t)(src_r + dst_r),
-						(uint32_t)(src_g + dst_g),
-						(uint32_t)(src_b + dst_b));
-		}
-		src_ptr += src_line_inc;
-		dst_ptr += dst_line_inc;
+		blend_row_dim(dst_ptr, src_ptr, width, (uint32_t)alpha);
+		src_ptr += sw;
+		dst_ptr += dw;
 	}
 
+	add_image_dirty_rect(dst_image, dst_left, dst_top, width, height);
 	notify_image_update(dst_image);
 }
 
@@ -557,7 +2234,7 @@ void draw_image_rule(struct image *dst_image,
 	pixel_t * RESTRICT src_ptr;
 	pixel_t * RESTRICT dst_ptr;
 	pixel_t * RESTRICT rule_ptr;
-	int x, y, dw, sw, rw, w, dh, sh, rh, h;
+	int y, dw, sw, rw, w, dh, sh, rh, h;
 
 	assert(dst_image != NULL);
 	assert(src_image != NULL);
@@ -586,18 +2263,20 @@ void draw_image_rule(struct image *dst_image,
 		h = rh;
 
 	/* 描画する */
+	select_kernels();
 	dst_ptr = dst_image->pixels;
 	src_ptr = src_image->pixels;
 	rule_ptr = rule_image->pixels;
 	for (y = 0; y < h; y++) {
-		for (x = 0; x < w; x++)
-			if (get_pixel_b(*(rule_ptr + x)) <= (unsigned char)threshold)
-				*(dst_ptr + x) = *(src_ptr + x);
+		rule_row(dst_ptr, src_ptr, rule_ptr, w, (uint32_t)threshold);
 		dst_ptr += dw;
 		src_ptr += sw;
 		rule_ptr += rw;
 	}
 
+	add_image_dirty_rect(dst_image, 0, 0, w, h);
+	if (!src_image->is_opaque)
+		dst_image->is_opaque = false;
 	notify_image_update(dst_image);
 }
 
@@ -612,9 +2291,8 @@ void draw_image_melt(struct image *dst_image,
 	pixel_t * RESTRICT src_ptr;
 	pixel_t * RESTRICT dst_ptr;
 	pixel_t * RESTRICT rule_ptr;
-	pixel_t src_pix, dst_pix, rule_pix;
-	float src_a, src_r, src_g, src_b, dst_a, dst_r, dst_g, dst_b, rule_a;
-	int x, y, dw, sw, rw, w, dh, sh, rh, h;
+	uint8_t lut[256];
+	int i, a, y, dw, sw, rw, w, dh, sh, rh, h;
 
 	assert(dst_image != NULL);
 	assert(src_image != NULL);
@@ -642,72 +2320,189 @@ void draw_image_melt(struct image *dst_image,
 	if (rh < h)
 		h = rh;
 
+	/* ルール画像の値から転送元の係数を引くテーブルを作る */
+	for (i = 0; i < 256; i++) {
+		a = 2 * threshold - i;
+		lut[i] = (uint8_t)(a < 0 ? 0 : (a > 255 ? 255 : a));
+	}
+
 	/* 描画する */
+	select_kernels();
 	dst_ptr = dst_image->pixels;
 	src_ptr = src_image->pixels;
 	rule_ptr = rule_image->pixels;
 	for (y = 0; y < h; y++) {
-		for (x = 0; x < w; x++) {
-			/* 描画元のピクセルを取得する */
-			src_pix = src_ptr[x];
-
-			/* 描画先のピクセルを取得する */
-			dst_pix = dst_ptr[x];
-
-			/* ルール画像のピクセルを取得する */
-			rule_pix = rule_ptr[x];
-
-			/* アルファ値を計算する */
-			rule_a = (float)get_pixel_b(rule_pix) / 255.0f;
-			src_a = 2.0f * ((float)threshold / 255.0f) - rule_a;
-			src_a = src_a < 0 ? 0 : src_a;
-			src_a = src_a > 1.0f ? 1.0f : src_a;
-			dst_a = 1.0f - src_a;
-
-			/* 描画元ピクセルにアルファ値を乗算する */
-			src_r = src_a * (float)get_pixel_r(src_pix);
-			src_g = src_a * (float)get_pixel_g(src_pix);
-			src_b = src_a * (float)get_pixel_b(src_pix);
-
-			/* 描画先ピクセルにアルファ値を乗算する */
-			dst_r = dst_a * (float)get_pixel_r(dst_pix);
-			dst_g = dst_a * (float)get_pixel_g(dst_pix);
-			dst_b = dst_a * (float)get_pixel_b(dst_pix);
-
-			/* 描画先に格納する */
-			dst_ptr[x] = make_pixel(0xff,
-						(uint32_t)(src_r + dst_r),
-						(uint32_t)(src_g + dst_g),
-						(uint32_t)(src_b + dst_b));
-		}
+		melt_row(dst_ptr, src_ptr, rule_ptr, w, (uint32_t)threshold, lut);
 		dst_ptr += dw;
 		src_ptr += sw;
 		rule_ptr += rw;
 	}
 
+	add_image_dirty_rect(dst_image, 0, 0, w, h);
+	notify_image_update(dst_image);
+}
+
+/*
+ * 描画の命令の列を実行する
+ *  - 描画先を水平の帯に分け、帯ごとに全ての命令を順番に実行するので、重ね順は変わらない
+ *  - 帯はワーカスレッドで並列に処理する
+ *  - クリッピングと行関数の選択は呼び出し元のスレッドで先に行う
+ */
+void draw_image_ops(struct image *dst_image, const struct draw_op *ops, int count)
+{
+	struct ops_job job;
+	struct draw_op *op;
+	int i, bands;
+
+	assert(dst_image != NULL);
+	assert(ops != NULL);
+	assert(count > 0);
+
+	/*
+	 * 命令をクリッピングする
+	 *  - 描画先の不透明度の情報は命令の順に更新し、各命令の時点の値で
+	 *    draw_image_fast()などと同じ省略を行う
+	 */
+	job.dst_image = dst_image;
+	job.ops = malloc(sizeof(struct draw_op) * (size_t)count);
+	if (job.ops == NULL) {
+		log_memory();
+		return;
+	}
+	job.count = 0;
+	for (i = 0; i < count; i++) {
+		op = &job.ops[job.count];
+		*op = ops[i];
+		if (op->type == DRAW_OP_CLEAR) {
+#if defined(USE_PREMULTIPLIED_ALPHA)
+			op->color = premultiply_pixel(op->color);
+#endif
+			add_image_dirty_rect(dst_image, 0, 0, dst_image->width, dst_image->height);
+			fill_content_info(dst_image, op->color);
+		} else {
+			assert(op->type == DRAW_OP_COPY || op->type == DRAW_OP_FAST || op->type == DRAW_OP_DIM);
+			if (op->type == DRAW_OP_COPY)
+				op->alpha = 255;
+			if (!check_draw_image(dst_image, &op->dst_left, &op->dst_top,
+					      op->src_image, &op->width, &op->height,
+					      &op->src_left, &op->src_top, op->alpha))
+				continue;
+			if (op->type != DRAW_OP_COPY && dst_image->is_opaque &&
+			    !clip_by_content(op->src_image, &op->dst_left, &op->dst_top,
+					     &op->width, &op->height, &op->src_left, &op->src_top))
+				continue;
+			if (op->type == DRAW_OP_FAST && op->src_image->is_opaque && op->alpha == 255)
+				op->type = DRAW_OP_COPY;
+			add_image_dirty_rect(dst_image, op->dst_left, op->dst_top, op->width, op->height);
+			if (op->type == DRAW_OP_COPY && !op->src_image->is_opaque)
+				dst_image->is_opaque = false;
+		}
+		job.count++;
+	}
+
+	/* 帯の数を決める */
+	bands = get_worker_count() * OPS_BANDS_PER_WORKER;
+	if (bands > dst_image->height / OPS_BAND_MIN_ROWS)
+		bands = dst_image->height / OPS_BAND_MIN_ROWS;
+	if (bands < 1)
+		bands = 1;
+	job.bands = bands;
+
+	/* 帯ごとに描画する */
+	select_kernels();
+	run_workers(draw_ops_band, bands, &job);
+
+	free(job.ops);
+
 	notify_image_update(dst_image);
 }
 
+/* 1つの帯に命令の列を実行する (ワーカスレッドから呼ばれる) */
+static void draw_ops_band(int index, void *arg)
+{
+	struct ops_job *job;
+	struct image *dst_image;
+	struct draw_op *op;
+	pixel_t * RESTRICT src_ptr;
+	pixel_t * RESTRICT dst_ptr;
+	size_t n;
+	int i, y, y0, y1, top, bottom, sw, dw;
+
+	job = arg;
+	dst_image = job->dst_image;
+	dw = dst_image->width;
+
+	/* 帯の行の範囲を求める */
+	y0 = (int)((int64_t)dst_image->height * index / job->bands);
+	y1 = (int)((int64_t)dst_image->height * (index + 1) / job->bands);
+
+	for (i = 0; i < job->count; i++) {
+		op = &job->ops[i];
+
+		/*
+		 * クリアする (帯は全幅なので連続した1つの範囲として塗り潰す)
+		 *  - 後続の命令が同じ帯を描画する場合はキャッシュに残すため、
+		 *    非テンポラルストアは最後の命令の場合のみ使う
+		 */
+		if (op->type == DRAW_OP_CLEAR) {
+			n = (size_t)dw * (size_t)(y1 - y0);
+			if (i == job->count - 1 && n * sizeof(pixel_t) >= STREAM_FILL_MIN_BYTES)
+				stream_fill_row(dst_image->pixels + dw * y0, n, op->color);
+			else
+				fill_row(dst_image->pixels + dw * y0, n, op->color);
+			continue;
+		}
+
+		/* 帯と重なる行を求める */
+		top = op->dst_top > y0 ? op->dst_top : y0;
+		bottom = op->dst_top + op->height < y1 ? op->dst_top + op->height : y1;
+		if (top >= bottom)
+			continue;
+
+		sw = op->src_image->width;
+		src_ptr = op->src_image->pixels + sw * (op->src_top + top - op->dst_top) + op->src_left;
+		dst_ptr = dst_image->pixels + dw * top + op->dst_left;
+		for (y = top; y < bottom; y++) {
+			switch (op->type) {
+			case DRAW_OP_COPY:
+				memcpy(dst_ptr, src_ptr, sizeof(pixel_t) * (size_t)op->width);
+				break;
+			case DRAW_OP_FAST:
+				blend_row_fast(dst_ptr, src_ptr, op->width, (uint32_t)op->alpha);
+				break;
+			case DRAW_OP_DIM:
+				blend_row_dim(dst_ptr, src_ptr, op->width, (uint32_t)op->alpha);
+				break;
+			}
+			src_ptr += sw;
+			dst_ptr += dw;
+		}
+	}
+}
+
 /*
- * イメージをスケールして描画する (nearest-neighbor)
+ * イメージをスケールして描画する
+ *  - 描画先の列と行ごとに描画元の範囲をあらかじめ求めておく
+ *  - SCALE_FILTER_BOXでは各範囲のピクセルを平均する (非乗算ではアルファ値で重み付けする)
+ *  - それ以外では各範囲の先頭のピクセルを使う (ニアレストネイバー)
  */
 void draw_image_scale(struct image *dst_image,
 		      int virtual_dst_width,
 		      int virtual_dst_height,
 		      int virtual_dst_left,
 		      int virtual_dst_top,
-		      struct image *src_image)
+		      struct image *src_image,
+		      int filter)
 {
 	pixel_t * RESTRICT dst_ptr;
-	pixel_t * RESTRICT src_ptr;
+	pixel_t * RESTRICT row_ptr;
+	uint32_t *vsum;
+	int *col_x0, *col_x1;
 	float scale_x, scale_y;
-	pixel_t src_pix, dst_pix;
-	float src_a, src_r, src_g, src_b, dst_a, dst_r, dst_g, dst_b;
 	int real_dst_width, real_dst_height;
 	int real_src_width, real_src_height;
 	int real_draw_left, real_draw_top, real_draw_width, real_draw_height;
-	int virtual_x, virtual_y;
-	int i, j;
+	int left, top, right, bottom, cols, i, j, y0, y1, prev_y0, prev_y1;
 
 	assert(dst_image != NULL);
 	assert(src_image != NULL);
@@ -730,69 +2525,365 @@ void draw_image_scale(struct image *dst_image,
 	real_draw_width = (int)((float)real_src_width * scale_x);
 	real_draw_height = (int)((float)real_src_height * scale_y);
 
-	/* ピクセルへのポインタを取得する */
-	dst_ptr = dst_image->pixels;
-	src_ptr = src_image->pixels;
+	/*
+	 * 描画先の列の範囲を求める
+	 *  - 描画元のX座標は列に対して単調増加なので、有効な列は連続する
+	 */
+	left = real_draw_left < 0 ? 0 : real_draw_left;
+	right = real_draw_left + real_draw_width;
+	if (right > real_dst_width)
+		right = real_dst_width;
+	while (left < right && scale_src_pos(left, scale_x, virtual_dst_left) < 0)
+		left++;
+	while (left < right && scale_src_pos(right - 1, scale_x, virtual_dst_left) >= real_src_width)
+		right--;
+	if (left >= right)
+		return;
+	cols = right - left;
+
+	/* 描画先の行の範囲を求める */
+	top = real_draw_top < 0 ? 0 : real_draw_top;
+	bottom = real_draw_top + real_draw_height;
+	if (bottom > real_dst_height)
+		bottom = real_dst_height;
+	while (top < bottom && scale_src_pos(top, scale_y, virtual_dst_top) < 0)
+		top++;
+	while (top < bottom && scale_src_pos(bottom - 1, scale_y, virtual_dst_top) >= real_src_height)
+		bottom--;
+	if (top >= bottom)
+		return;
+
+	/* 作業用のメモリを確保する (1行分の描画元ピクセル, 列ごとの描画元のX範囲) */
+	row_ptr = malloc((sizeof(pixel_t) + sizeof(int) * 2) * (size_t)cols);
+	if (row_ptr == NULL) {
+		log_memory();
+		return;
+	}
+	col_x0 = (int *)(void *)(row_ptr + cols);
+	col_x1 = col_x0 + cols;
+
+	/* 列ごとの描画元のX範囲を求める */
+	for (j = 0; j < cols; j++) {
+		col_x0[j] = scale_src_pos(left + j, scale_x, virtual_dst_left);
+		col_x1[j] = scale_src_end(left + j, scale_x, virtual_dst_left, col_x0[j], real_src_width);
+	}
+
+	/* 平均化する場合、描画元の列ごとの縦方向の合計を格納するメモリを確保する */
+	vsum = NULL;
+	if (filter == SCALE_FILTER_BOX) {
+		vsum = malloc(sizeof(uint32_t) * 4 * (size_t)(col_x1[cols - 1] - col_x0[0]));
+		if (vsum == NULL) {
+			log_memory();
+			free(row_ptr);
+			return;
+		}
+	}
 
 	/* 描画する */
-	for (i = real_draw_top; i < real_draw_top + real_draw_height; i++) {
-		/* 描画先のY座標でクリッピングする */
-		if (i < 0)
-			continue;
-		if (i >= real_dst_height)
-			continue;
+	select_kernels();
+	dst_ptr = dst_image->pixels;
+	prev_y0 = prev_y1 = -1;
+	for (i = top; i < bottom; i++) {
+		/* 描画元のY範囲を求める */
+		y0 = scale_src_pos(i, scale_y, virtual_dst_top);
+		y1 = scale_src_end(i, scale_y, virtual_dst_top, y0, real_src_height);
+
+		/* 描画元のピクセルを1行分集める (同じ範囲が続く場合は再利用する) */
+		if (y0 != prev_y0 || (filter == SCALE_FILTER_BOX && y1 != prev_y1)) {
+			if (filter == SCALE_FILTER_BOX) {
+				box_filter_row(row_ptr, vsum, src_image, col_x0, col_x1, cols, y0, y1);
+			} else {
+				for (j = 0; j < cols; j++)
+					row_ptr[j] = src_image->pixels[real_src_width * y0 + col_x0[j]];
+			}
+			prev_y0 = y0;
+			prev_y1 = y1;
+		}
 
-		/* 描画元のY座標を求め、クリッピングする */
-		virtual_y = (int)((float)i / scale_y) - virtual_dst_top;
-		if (virtual_y < 0)
-			continue;
-		if (virtual_y >= real_src_height)
-			continue;
+		/* 描画先にアルファブレンドする */
+		blend_row_fast(dst_ptr + real_dst_width * i + left, row_ptr, cols, 255);
+	}
 
-		for (j = real_draw_left; j < real_draw_left + real_draw_width;
-		     j++) {
-			/* 描画先のX座標でクリッピングする */
-			if (j < 0)
-				continue;
-			if (j >= real_dst_width)
-				continue;
+	free(vsum);
+	free(row_ptr);
 
-			/* 描画元のX座標を求め、クリッピングする */
-			virtual_x = (int)((float)j / scale_x) - virtual_dst_left;
-			if (virtual_x < 0)
-				continue;
-			if (virtual_x >= real_src_width)
-				continue;
+	add_image_dirty_rect(dst_image, left, top, cols, bottom - top);
+	notify_image_update(dst_image);
+}
+
+/* 描画先の座標に対応する描画元の座標を求める */
+static INLINE int scale_src_pos(int dst, float scale, int virtual_offset)
+{
+	return (int)((float)dst / scale) - virtual_offset;
+}
+
+/* 描画先の座標に対応する描画元の範囲の終端を求める */
+static INLINE int scale_src_end(int dst, float scale, int virtual_offset, int begin, int limit)
+{
+	int end;
+
+	end = scale_src_pos(dst + 1, scale, virtual_offset);
+	if (end <= begin)
+		end = begin + 1;
+	if (end > limit)
+		end = limit;
+	return end;
+}
+
+/*
+ * 描画元の1行のピクセルを列ごとの合計に加算する
+ *  - 合計は描画元のピクセルと同じバイト順で、色にはアルファ値を乗算する
+ *  - 乗算済みアルファでは色にアルファ値が乗算済みなので、そのまま加算する
+ *  - 行数が66051未満であれば32ビットであふれない
+ */
+static INLINE void box_sum_row_tail(uint32_t * RESTRICT vsum,
+				    const pixel_t * RESTRICT src,
+				    int width,
+				    int x)
+{
+	uint32_t pix, a;
+
+	/* 端数をスカラで処理する */
+	for (; x < width; x++) {
+		pix = src[x];
+		a = pix >> 24;
+#if defined(USE_PREMULTIPLIED_ALPHA)
+		vsum[x * 4 + 0] += pix & 0xff;
+		vsum[x * 4 + 1] += (pix >> 8) & 0xff;
+		vsum[x * 4 + 2] += (pix >> 16) & 0xff;
+#else
+		vsum[x * 4 + 0] += (pix & 0xff) * a;
+		vsum[x * 4 + 1] += ((pix >> 8) & 0xff) * a;
+		vsum[x * 4 + 2] += ((pix >> 16) & 0xff) * a;
+#endif
+		vsum[x * 4 + 3] += a;
+	}
+}
+
+static void box_sum_row_c(uint32_t * RESTRICT vsum,
+			  const pixel_t * RESTRICT src,
+			  int width)
+{
+	box_sum_row_tail(vsum, src, width, 0);
+}
 
-			/* 描画元のピクセルを取得する */
-			src_pix = src_ptr[real_src_width * virtual_y + virtual_x];
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+static void box_sum_row_sse2(uint32_t * RESTRICT vsum,
+			     const pixel_t * RESTRICT src,
+			     int width)
+{
+	int x;
+
+	x = 0;
+	{
+		const __m128i zero = _mm_setzero_si128();
+#if !defined(USE_PREMULTIPLIED_ALPHA)
+		const __m128i amask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+		const __m128i aone = _mm_set_epi16(1, 0, 0, 0, 1, 0, 0, 0);
+		__m128i al, ah;
+#endif
+		__m128i sv, sl, sh;
+		__m128i *p;
+
+		for (; x + 4 <= width; x += 4) {
+			sv = _mm_loadu_si128((const __m128i *)(const void *)(src + x));
+			sl = _mm_unpacklo_epi8(sv, zero);
+			sh = _mm_unpackhi_epi8(sv, zero);
+
+#if !defined(USE_PREMULTIPLIED_ALPHA)
+			/* アルファ値を色のレーンに広げ、アルファのレーンは1にする */
+			al = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sl, 0xff), 0xff);
+			ah = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sh, 0xff), 0xff);
+			al = _mm_or_si128(_mm_andnot_si128(amask, al), aone);
+			ah = _mm_or_si128(_mm_andnot_si128(amask, ah), aone);
+			sl = _mm_mullo_epi16(sl, al);
+			sh = _mm_mullo_epi16(sh, ah);
+#endif
 
-			/* 描画先のピクセルを取得する */
-			dst_pix = dst_ptr[real_dst_width * i + j];
+			/* 32ビットに広げて加算する */
+			p = (__m128i *)(void *)(vsum + x * 4);
+			_mm_storeu_si128(p + 0, _mm_add_epi32(_mm_loadu_si128(p + 0), _mm_unpacklo_epi16(sl, zero)));
+			_mm_storeu_si128(p + 1, _mm_add_epi32(_mm_loadu_si128(p + 1), _mm_unpackhi_epi16(sl, zero)));
+			_mm_storeu_si128(p + 2, _mm_add_epi32(_mm_loadu_si128(p + 2), _mm_unpacklo_epi16(sh, zero)));
+			_mm_storeu_si128(p + 3, _mm_add_epi32(_mm_loadu_si128(p + 3), _mm_unpackhi_epi16(sh, zero)));
+		}
+	}
+	box_sum_row_tail(vsum, src, width, x);
+}
 
-			/* アルファ値を計算する */
-			src_a = (float)get_pixel_a(src_pix) / 255.0f;
-			dst_a = 1.0f - src_a;
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+static void box_sum_row_neon(uint32_t * RESTRICT vsum,
+			     const pixel_t * RESTRICT src,
+			     int width)
+{
+	int x;
+
+	x = 0;
+	{
+#if !defined(USE_PREMULTIPLIED_ALPHA)
+		static const uint8_t aidx[16] = {3, 3, 3, 16, 7, 7, 7, 16, 11, 11, 11, 16, 15, 15, 15, 16};
+		const uint8x16_t vidx = vld1q_u8(aidx);
+		const uint8x16_t aone = vreinterpretq_u8_u32(vdupq_n_u32(0x01000000));
+		uint8x16_t av;
+#endif
+		uint8x16_t sv;
+		uint16x8_t pl, ph;
+		uint32_t *p;
 
-			/* 描画元ピクセルにアルファ値を乗算する */
-			src_r = src_a * (float)get_pixel_r(src_pix);
-			src_g = src_a * (float)get_pixel_g(src_pix);
-			src_b = src_a * (float)get_pixel_b(src_pix);
+		for (; x + 4 <= width; x += 4) {
+			sv = vld1q_u8((const uint8_t *)(src + x));
 
-			/* 描画先ピクセルにアルファ値を乗算する */
-			dst_r = dst_a * (float)get_pixel_r(dst_pix);
-			dst_g = dst_a * (float)get_pixel_g(dst_pix);
-			dst_b = dst_a * (float)get_pixel_b(dst_pix);
+#if defined(USE_PREMULTIPLIED_ALPHA)
+			pl = vmovl_u8(vget_low_u8(sv));
+			ph = vmovl_high_u8(sv);
+#else
+			/* アルファ値を色のバイトに広げ、アルファのバイトは1にする (範囲外の添字は0になる) */
+			av = vorrq_u8(vqtbl1q_u8(sv, vidx), aone);
+			pl = vmull_u8(vget_low_u8(sv), vget_low_u8(av));
+			ph = vmull_high_u8(sv, av);
+#endif
 
-			/* 描画先に格納する */
-			dst_ptr[real_dst_width * i + j] = make_pixel(0xff,
-								     (uint32_t)(src_r + dst_r),
-								     (uint32_t)(src_g + dst_g),
-								     (uint32_t)(src_b + dst_b));
+			/* 32ビットに広げて加算する */
+			p = vsum + x * 4;
+			vst1q_u32(p + 0, vaddw_u16(vld1q_u32(p + 0), vget_low_u16(pl)));
+			vst1q_u32(p + 4, vaddw_high_u16(vld1q_u32(p + 4), pl));
+			vst1q_u32(p + 8, vaddw_u16(vld1q_u32(p + 8), vget_low_u16(ph)));
+			vst1q_u32(p + 12, vaddw_high_u16(vld1q_u32(p + 12), ph));
 		}
 	}
+	box_sum_row_tail(vsum, src, width, x);
+}
+#endif
 
-	notify_image_update(dst_image);
+/*
+ * 描画元の矩形の平均ピクセルを1行分求める
+ *  - 先に縦方向の合計を列ごとに求めてから、横方向に合計する
+ *  - 色はアルファ値で重み付けして平均し、非乗算の値に戻す
+ *  - 乗算済みアルファでは各チャンネルを単純に平均する
+ */
+static void box_filter_row(pixel_t * RESTRICT row,
+			   uint32_t * RESTRICT vsum,
+			   struct image *src_image,
+			   const int *col_x0,
+			   const int *col_x1,
+			   int cols,
+			   int y0,
+			   int y1)
+{
+	const uint32_t *v;
+	uint64_t s0, s1, s2, sa;
+	uint32_t n;
+	int base, span, x, y, j;
+
+	/* 縦方向の合計を求める */
+	base = col_x0[0];
+	span = col_x1[cols - 1] - base;
+	memset(vsum, 0, sizeof(uint32_t) * 4 * (size_t)span);
+	for (y = y0; y < y1; y++)
+		box_sum_row(vsum, src_image->pixels + src_image->width * y + base, span);
+
+	/* 横方向に合計して平均する */
+	for (j = 0; j < cols; j++) {
+		s0 = s1 = s2 = sa = 0;
+		for (x = col_x0[j]; x < col_x1[j]; x++) {
+			v = vsum + (x - base) * 4;
+			s0 += v[0];
+			s1 += v[1];
+			s2 += v[2];
+			sa += v[3];
+		}
+
+		n = (uint32_t)((col_x1[j] - col_x0[j]) * (y1 - y0));
+#if defined(USE_PREMULTIPLIED_ALPHA)
+		row[j] = ((uint32_t)((sa + n / 2) / n) << 24) |
+			 ((uint32_t)((s2 + n / 2) / n) << 16) |
+			 ((uint32_t)((s1 + n / 2) / n) << 8) |
+			 (uint32_t)((s0 + n / 2) / n);
+#else
+		/* 完全に透明な場合 */
+		if (sa == 0) {
+			row[j] = 0;
+			continue;
+		}
+
+		/* アルファ値は平均し、色はアルファ値の合計で割る */
+		row[j] = ((uint32_t)((sa + n / 2) / n) << 24) |
+			 ((uint32_t)((s2 + sa / 2) / sa) << 16) |
+			 ((uint32_t)((s1 + sa / 2) / sa) << 8) |
+			 (uint32_t)((s0 + sa / 2) / sa);
+#endif
+	}
+}
+
+/*
+ * 行関数を選択する
+ *  - 最初の描画で一度だけ選択する
+ *  - SSSE3はここでは使わないのでSSE2と同じ扱いにする
+ */
+static void select_kernels(void)
+{
+	int tier;
+
+	if (blend_row_fast != NULL)
+		return;
+
+	tier = get_cpu_tier();
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+	if (tier >= CPU_TIER_AVX2) {
+		blend_row_emoji = blend_row_emoji_avx2;
+		blend_row_add = blend_row_add_avx2;
+		blend_row_dim = blend_row_dim_avx2;
+		rule_row = rule_row_avx2;
+		melt_row = melt_row_avx2;
+		box_sum_row = box_sum_row_sse2;
+		fill_row = fill_row_avx2;
+		stream_fill_row = stream_fill_row_avx2;
+		fill_alpha_row = fill_alpha_row_avx2;
+		blend_row_fast = blend_row_fast_avx2;
+		return;
+	}
+	if (tier >= CPU_TIER_SSE2) {
+		blend_row_emoji = blend_row_emoji_sse2;
+		blend_row_add = blend_row_add_sse2;
+		blend_row_dim = blend_row_dim_sse2;
+		rule_row = rule_row_sse2;
+		melt_row = melt_row_sse2;
+		box_sum_row = box_sum_row_sse2;
+		fill_row = fill_row_sse2;
+		stream_fill_row = stream_fill_row_sse2;
+		fill_alpha_row = fill_alpha_row_sse2;
+		blend_row_fast = blend_row_fast_sse2;
+		return;
+	}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+	if (tier == CPU_TIER_NEON) {
+		blend_row_emoji = blend_row_emoji_neon;
+		blend_row_add = blend_row_add_neon;
+		blend_row_dim = blend_row_dim_neon;
+		rule_row = rule_row_neon;
+		melt_row = melt_row_neon;
+		box_sum_row = box_sum_row_neon;
+		fill_row = fill_row_neon;
+		stream_fill_row = fill_row_neon;
+		fill_alpha_row = fill_alpha_row_neon;
+		blend_row_fast = blend_row_fast_neon;
+		return;
+	}
+#else
+	UNUSED_PARAMETER(tier);
+#endif
+
+	/* スカラ */
+	blend_row_emoji = blend_row_emoji_c;
+	blend_row_add = blend_row_add_c;
+	blend_row_dim = blend_row_dim_c;
+	rule_row = rule_row_c;
+	melt_row = melt_row_c;
+	box_sum_row = box_sum_row_c;
+	fill_row = fill_row_c;
+	stream_fill_row = fill_row_c;
+	fill_alpha_row = fill_alpha_row_c;
+	blend_row_fast = blend_row_fast_c;
 }
 
 /*
@@ -831,6 +2922,62 @@ static bool check_draw_image(struct image *dst_image,
 	return true;
 }
 
+/*
+ * 転送矩形を転送元のアルファ値が0でないピクセルの外接矩形でクリッピングする
+ *  - 転送矩形が外接矩形と重ならない場合、偽を返す
+ */
+static bool clip_by_content(struct image *src_image,
+			    int *dst_left,
+			    int *dst_top,
+			    int *width,
+			    int *height,
+			    int *src_left,
+			    int *src_top)
+{
+	int d;
+
+	/* 左端と上端を合わせる */
+	d = src_image->content_left - *src_left;
+	if (d > 0) {
+		*src_left += d;
+		*dst_left += d;
+		*width -= d;
+	}
+	d = src_image->content_top - *src_top;
+	if (d > 0) {
+		*src_top += d;
+		*dst_top += d;
+		*height -= d;
+	}
+
+	/* 右端と下端を合わせる */
+	d = *src_left + *width - src_image->content_right;
+	if (d > 0)
+		*width -= d;
+	d = *src_top + *height - src_image->content_bottom;
+	if (d > 0)
+		*height -= d;
+
+	return *width > 0 && *height > 0;
+}
+
+/* イメージ全体を色で塗り潰したときの不透明度の情報を設定する */
+static void fill_content_info(struct image *img, pixel_t color)
+{
+	if (get_pixel_a(color) == 0) {
+		img->content_left = 0;
+		img->content_top = 0;
+		img->content_right = 0;
+		img->content_bottom = 0;
+	} else {
+		img->content_left = 0;
+		img->content_top = 0;
+		img->content_right = img->width;
+		img->content_bottom = img->height;
+	}
+	img->is_opaque = get_pixel_a(color) == 255;
+}
+
 /*
  * 転送元領域のサイズを元に転送矩形のクリッピングを行う
  *  - 転送元領域の有効な座標範囲を(0,0)-(src_cx-1,src_cy-1)とし、
@@ -17,6 +17,18 @@
 /* RGBAカラー形式のピクセル値 */
 typedef uint32_t pixel_t;
 
+/*
+ * 乗算済みアルファ (USE_PREMULTIPLIED_ALPHA)
+ *  - 定義すると、イメージの色にはアルファ値が乗算済みで格納される
+ *  - 画像ファイルは読み込み時に一度だけ乗算し、描画は転送元の色にアルファ値を掛けない
+ *  - シェーダを切り替えるのはOpenGLのHALだけなので、それ以外のHALでは使えない
+ */
+#if defined(USE_PREMULTIPLIED_ALPHA) && !defined(USE_QT) && \
+	(defined(POLARIS_ENGINE_TARGET_WIN32) || defined(POLARIS_ENGINE_TARGET_MACOS) || \
+	 defined(POLARIS_ENGINE_TARGET_IOS) || defined(POLARIS_ENGINE_TARGET_UNITY))
+#error "USE_PREMULTIPLIED_ALPHA is supported only with the OpenGL HAL."
+#endif
+
 /*
  * image構造体
  */
@@ -41,6 +53,67 @@ struct image {
 
 	/* (HAL internal) */
 	int context;
+
+	/*
+	 * 前回のテクスチャのアップロード以降に更新された矩形 (右端と下端は含まない)
+	 *  - image.cとglyph.cの描画関数がadd_image_dirty_rect()で広げ、OpenGLのHALがアップロード後に空にする
+	 *  - add_image_dirty_rect()は下記のdrawn_*とcontent_*も同時に広げる
+	 *  - 空のまま更新が通知された場合、HALはイメージ全体をアップロードする
+	 */
+	int dirty_left;
+	int dirty_top;
+	int dirty_right;
+	int dirty_bottom;
+
+	/*
+	 * reset_image_drawn_rect()以降に描画された矩形 (右端と下端は含まない)
+	 *  - dirty_*と同様に広がるが、HALのアップロードでは空にならない
+	 *  - 作成直後はピクセル値が不定なので、イメージ全体になる
+	 *  - メッセージボックスのリセットで、描画された範囲だけを元に戻すために使う
+	 */
+	int drawn_left;
+	int drawn_top;
+	int drawn_right;
+	int drawn_bottom;
+
+	/*
+	 * アルファ値が0でないピクセルの外接矩形 (右端と下端は含まない)
+	 *  - 画像ファイルの読み込み時に求め、CPUでの描画で広がる
+	 *  - 不明な場合はイメージ全体、空の場合は全て0になる
+	 */
+	int content_left;
+	int content_top;
+	int content_right;
+	int content_bottom;
+
+	/* 全てのピクセルのアルファ値が255か (不明な場合はfalse) */
+	bool is_opaque;
+
+	/* ピクセル列のメモリプールのサイズクラス (-1ならプール外) */
+	int pool_class;
+};
+
+/*
+ * ピクセル列のメモリプールの統計
+ *  - バイト数はサイズクラスに切り上げた値
+ */
+struct image_pool_stats {
+	/* create_image()の回数 */
+	uint64_t alloc_count;
+
+	/* そのうちプールのメモリを再利用した回数 */
+	uint64_t reuse_count;
+
+	/* destroy_image()で上限のためにプールに戻さず解放した回数 */
+	uint64_t discard_count;
+
+	/* プールに保持しているバイト数と、その最大値 */
+	size_t pooled_bytes;
+	size_t peak_pooled_bytes;
+
+	/* イメージが使用中のバイト数と、その最大値 */
+	size_t used_bytes;
+	size_t peak_used_bytes;
 };
 
 /*
@@ -110,6 +183,9 @@ struct image *create_image(int w, int h);
 /* ファイル名を指定してイメージを作成する */
 struct image *create_image_from_file(const char *dir, const char *file);
 
+/* 共有データのデコード結果キャッシュを解放する */
+void cleanup_image_cache(void);
+
 /* 文字列で色を指定してイメージを作成する */
 struct image *create_image_from_color_string(int w, int h, const char *color);
 
@@ -119,6 +195,24 @@ struct image *create_image_with_pixels(int w, int h, pixel_t *pixels);
 /* イメージを削除する */
 void destroy_image(struct image *img);
 
+/* ピクセル列のメモリプールを初期化する */
+void init_image_pool(void);
+
+/* ピクセル列のメモリプールの統計を取得する */
+void get_image_pool_stats(struct image_pool_stats *stats);
+
+/* ピクセル列のメモリプールを解放する */
+void cleanup_image_pool(void);
+
+/* イメージの更新矩形を広げる */
+void add_image_dirty_rect(struct image *img, int x, int y, int w, int h);
+
+/* イメージの描画された矩形を空にする */
+void reset_image_drawn_rect(struct image *img);
+
+/* イメージのアルファ値を調べて外接矩形と不透明かを求める */
+void analyze_image_alpha(struct image *img);
+
 /* イメージを黒色でクリアする */
 void clear_image_black(struct image *img);
 
@@ -129,9 +223,26 @@ void clear_image_white(struct image *img);
 void clear_image_color(struct image *img, pixel_t color);
 void clear_image_color_rect(struct image *img, int x, int y, int w, int h, pixel_t color);
 
+/* 矩形 (clear_image_color_rects()) */
+struct image_rect {
+	int x;
+	int y;
+	int w;
+	int h;
+};
+
+/* イメージの複数の矩形を色でクリアする */
+void clear_image_color_rects(struct image *img, const struct image_rect *rects, int count,
+			     pixel_t color);
+
 /* イメージのアルファチャンネルを255でクリアする */
 void fill_image_alpha(struct image *img);
 
+#if defined(USE_PREMULTIPLIED_ALPHA)
+/* イメージの色にアルファ値を乗算する */
+void premultiply_image_alpha(struct image *img);
+#endif
+
 /* イメージを描画する(コピー) */
 void draw_image_copy(struct image *dst_image,
 		     int dst_left,
@@ -198,13 +309,42 @@ void draw_image_melt(struct image *dst_image,
 		     struct image *rule_image,
 		     int threshold);
 
+/* スケーリングのフィルタ */
+#define SCALE_FILTER_NEAREST	(0)	/* ニアレストネイバー */
+#define SCALE_FILTER_BOX	(1)	/* 平均化 (縮小時のエイリアスを抑える) */
+
 /* イメージをスケールして描画する */
 void draw_image_scale(struct image *dst_image,
 		      int virtual_dst_width,
 		      int virtual_dst_height,
 		      int virtual_dst_left,
 		      int virtual_dst_top,
-		      struct image *src_image);
+		      struct image *src_image,
+		      int filter);
+
+/*
+ * 描画の命令 (draw_image_ops())
+ */
+#define DRAW_OP_CLEAR	(0)	/* 描画先全体をcolorでクリアする */
+#define DRAW_OP_COPY	(1)	/* draw_image_copy()と同じ */
+#define DRAW_OP_FAST	(2)	/* draw_image_fast()と同じ */
+#define DRAW_OP_DIM	(3)	/* draw_image_dim()と同じ */
+
+struct draw_op {
+	int type;
+	struct image *src_image;
+	int dst_left;
+	int dst_top;
+	int width;
+	int height;
+	int src_left;
+	int src_top;
+	int alpha;
+	pixel_t color;
+};
+
+/* 描画の命令の列を、描画先を水平の帯に分けて並列に実行する */
+void draw_image_ops(struct image *dst_image, const struct draw_op *ops, int count);
 
 /*
  * Helpers for rendering HALs.
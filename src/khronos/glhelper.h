@@ -117,6 +117,7 @@ extern void (APIENTRY *glActiveTexture)(GLenum texture);
 #define glTexParameteri q_glTexParameteri
 #define glTexParameteri q_glTexParameteri
 #define glTexImage2D q_glTexImage2D
+#define glTexSubImage2D q_glTexSubImage2D
 #define glActiveTexture q_glActiveTexture
 #define glDeleteTextures q_glDeleteTextures
 #define glEnable q_glEnable
@@ -135,6 +136,7 @@ void q_glDeleteTextures(GLsizei n, const GLuint *textures);
 void q_glPixelStorei(GLenum pname, GLint param);
 void q_glTexParameteri(GLenum target, GLenum pname, GLint param);
 void q_glTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid *pixels);
+void q_glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid *pixels);
 void q_glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices);
 /* OpenGL 2+ */
 #define glUseProgram q_glUseProgram
@@ -72,6 +72,17 @@
 #include "glhelper.h"
 #endif
 
+/*
+ * The source factor for alpha blending.
+ *  - With USE_PREMULTIPLIED_ALPHA, textures and shader outputs have
+ *    their colors multiplied by alpha.
+ */
+#if defined(USE_PREMULTIPLIED_ALPHA)
+#define BLEND_SRC_FACTOR	GL_ONE
+#else
+#define BLEND_SRC_FACTOR	GL_SRC_ALPHA
+#endif
+
 /*
  * Pipeline types.
  */
@@ -231,8 +242,12 @@ static const char *fragment_shader_src_normal =
 	"void main()                                         \n"
 	"{                                                   \n"
 	"  vec4 tex = texture2D(s_texture, v_texCoord);      \n"
+#if defined(USE_PREMULTIPLIED_ALPHA)
+	"  gl_FragColor = tex * v_alpha;                     \n"
+#else
 	"  tex.a = tex.a * v_alpha;                          \n"
 	"  gl_FragColor = tex;                               \n"
+#endif
 	"}                                                   \n";
 
 /* The character dimming shader. (RGB 50%) */
@@ -276,8 +291,12 @@ static const char *fragment_shader_src_rule =
 	"{                                                   \n"
         "  vec4 tex = texture2D(s_texture, v_texCoord);      \n"
 	"  vec4 rule = texture2D(s_rule, v_texCoord);        \n"
+#if defined(USE_PREMULTIPLIED_ALPHA)
+	"  gl_FragColor = vec4(tex.rgb, 1.0) * (1.0 - step(v_alpha, rule.b)); \n"
+#else
 	"  tex.a = 1.0 - step(v_alpha, rule.b);              \n"
 	"  gl_FragColor = tex;                               \n"
+#endif
 	"}                                                   \n";
 
 /* The melt shader. (8-bit universal transition) */
@@ -299,8 +318,12 @@ static const char *fragment_shader_src_melt =
 	"{                                                   \n"
         "  vec4 tex = texture2D(s_texture, v_texCoord);      \n"
 	"  vec4 rule = texture2D(s_rule, v_texCoord);        \n"
+#if defined(USE_PREMULTIPLIED_ALPHA)
+	"  gl_FragColor = vec4(tex.rgb, 1.0) * clamp((1.0 - rule.b) + (v_alpha * 2.0 - 1.0), 0.0, 1.0); \n"
+#else
 	"  tex.a = clamp((1.0 - rule.b) + (v_alpha * 2.0 - 1.0), 0.0, 1.0); \n"
 	"  gl_FragColor = tex;                               \n"
+#endif
 	"}                                                   \n";
 
 /* Indicates if the first rendering after re-init. */
@@ -668,7 +691,9 @@ void opengl_end_rendering(void)
  * Texture manipulation:
  *  - "Texture" here is a GPU backend of an image.
  *  - Polaris Engine abstracts modifications of textures by "notify" operations.
- *  - Updated textures will be uploaded to GPU using glTexImage2D() when they are rendered.
+ *  - Updated textures will be uploaded to GPU when they are rendered.
+ *  - A texture is created by glTexImage2D() only for the first upload in a context.
+ *    After that, only the rows of the dirty rectangle are sent by glTexSubImage2D().
  */
 
 /*
@@ -878,6 +903,60 @@ static void draw_elements(int dst_left,
 			  int alpha,
 			  int pipeline)
 {
+	float sx, sy;
+	int margin, left, top, right, bottom;
+
+	/*
+	 * 四角形を転送元のアルファ値が0でないピクセルの外接矩形に縮める
+	 *  - 透明なテクセルはどのパイプラインでもブレンド結果を変えないので、塗る面積を減らせる
+	 *  - 拡大縮小する場合は、バイリニアフィルタが隣のテクセルを読むので1テクセル広げる
+	 *  - ルール画像を使う場合は縮めない
+	 */
+	if (rule_image == NULL && src_width != 0 && src_height != 0) {
+		if (src_image->content_left >= src_image->content_right ||
+		    src_image->content_top >= src_image->content_bottom)
+			return;	/* 完全に透明 */
+
+		margin = (dst_width != src_width || dst_height != src_height) ? 1 : 0;
+		left = src_image->content_left - margin;
+		top = src_image->content_top - margin;
+		right = src_image->content_right + margin;
+		bottom = src_image->content_bottom + margin;
+		if (left < src_left)
+			left = src_left;
+		if (top < src_top)
+			top = src_top;
+		if (right > src_left + src_width)
+			right = src_left + src_width;
+		if (bottom > src_top + src_height)
+			bottom = src_top + src_height;
+		if (left >= right || top >= bottom)
+			return;	/* 転送元の矩形が透明 */
+
+		if (left != src_left || top != src_top ||
+		    right != src_left + src_width || bottom != src_top + src_height) {
+			sx = (float)dst_width / (float)src_width;
+			sy = (float)dst_height / (float)src_height;
+			draw_elements_3d((float)dst_left + (float)(left - src_left) * sx,
+					 (float)dst_top + (float)(top - src_top) * sy,
+					 (float)dst_left + (float)(right - src_left) * sx,
+					 (float)dst_top + (float)(top - src_top) * sy,
+					 (float)dst_left + (float)(left - src_left) * sx,
+					 (float)dst_top + (float)(bottom - src_top) * sy,
+					 (float)dst_left + (float)(right - src_left) * sx,
+					 (float)dst_top + (float)(bottom - src_top) * sy,
+					 src_image,
+					 NULL,
+					 left,
+					 top,
+					 right - left,
+					 bottom - top,
+					 alpha,
+					 pipeline);
+			return;
+		}
+	}
+
 	draw_elements_3d((float)dst_left,
 			 (float)dst_top,
 			 (float)(dst_left + dst_width),
@@ -1054,7 +1133,7 @@ static void draw_elements_3d(float x1,
 		glBindBuffer(GL_ARRAY_BUFFER, vbo_normal);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_normal);
 		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glBlendFunc(BLEND_SRC_FACTOR, GL_ONE_MINUS_SRC_ALPHA);
 		break;
 	case PIPELINE_ADD:
 		glUseProgram(program_normal);
@@ -1070,7 +1149,7 @@ static void draw_elements_3d(float x1,
 		glBindBuffer(GL_ARRAY_BUFFER, vbo_dim);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_dim);
 		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glBlendFunc(BLEND_SRC_FACTOR, GL_ONE_MINUS_SRC_ALPHA);
 		break;
 	case PIPELINE_RULE:
 		glUseProgram(program_rule);
@@ -1078,7 +1157,7 @@ static void draw_elements_3d(float x1,
 		glBindBuffer(GL_ARRAY_BUFFER, vbo_rule);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_rule);
 		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glBlendFunc(BLEND_SRC_FACTOR, GL_ONE_MINUS_SRC_ALPHA);
 		break;
 	case PIPELINE_MELT:
 		glUseProgram(program_melt);
@@ -1086,7 +1165,7 @@ static void draw_elements_3d(float x1,
 		glBindBuffer(GL_ARRAY_BUFFER, vbo_melt);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_melt);
 		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glBlendFunc(BLEND_SRC_FACTOR, GL_ONE_MINUS_SRC_ALPHA);
 		break;
 	default:
 		assert(0);
@@ -1108,38 +1187,67 @@ static void draw_elements_3d(float x1,
 	glDrawElements(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_SHORT, 0);
 }
 
+/*
+ * Upload an image to its texture if it is updated.
+ *  - A texture of an older context is dead, so we create a new one and
+ *    upload the whole image.
+ *  - Otherwise, we reuse the texture storage and upload the rows of the
+ *    dirty rectangle only. (GLES2 and WebGL1 lack GL_UNPACK_ROW_LENGTH,
+ *    so we send full-width rows.)
+ *  - An update without a dirty rectangle means the whole image.
+ */
 static void update_texture_if_needed(struct image *img)
 {
 	GLuint id;
+	int top, bottom;
 
 	if (img == NULL)
 		return;
-	if (img->context == reinit_count && !is_after_reinit && !img->need_upload)
-		return;
 
-	if (img->context == reinit_count || is_after_reinit || img->texture == NULL) {
+	if (img->texture == NULL || img->context != reinit_count) {
+		/* Create an OpenGL texture. */
 		glGenTextures(1, &id);
 		img->texture = (void *)(intptr_t)(id + 1);
-	} else {
-		id = (GLuint)(intptr_t)img->texture - 1;
-	}
-
-	/* Create or update an OpenGL texture. */
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glBindTexture(GL_TEXTURE_2D, id);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D, id);
 #ifdef POLARIS_ENGINE_TARGET_WASM
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 #else
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 #endif
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img->width, img->height, 0,
-		     GL_RGBA, GL_UNSIGNED_BYTE, img->pixels);
-	glActiveTexture(GL_TEXTURE0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img->width, img->height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, img->pixels);
+		glActiveTexture(GL_TEXTURE0);
+	} else if (img->need_upload) {
+		/* Get the rows to upload. */
+		if (img->dirty_left < img->dirty_right) {
+			top = img->dirty_top;
+			bottom = img->dirty_bottom;
+		} else {
+			top = 0;
+			bottom = img->height;
+		}
+
+		/* Update the OpenGL texture. */
+		id = (GLuint)(intptr_t)img->texture - 1;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D, id);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, top, img->width, bottom - top,
+				GL_RGBA, GL_UNSIGNED_BYTE,
+				img->pixels + (size_t)img->width * (size_t)top);
+		glActiveTexture(GL_TEXTURE0);
+	} else {
+		return;
+	}
 
 	img->need_upload = false;
 	img->context = reinit_count;
+	img->dirty_left = 0;
+	img->dirty_top = 0;
+	img->dirty_right = 0;
+	img->dirty_bottom = 0;
 }
 
 /*
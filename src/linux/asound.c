@@ -22,6 +22,14 @@
 /* ALSA */
 #include <alsa/asoundlib.h>
 
+/* SIMD */
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+#include <emmintrin.h>
+#include <immintrin.h>	/* AVX2 is selected at runtime. */
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+
 /*
  * Format
  */
@@ -74,6 +82,9 @@ static float volume[MIXER_STREAMS];
 /* Finish Flags */
 static bool finish[MIXER_STREAMS];
 
+/* Volume Kernel (selected by select_scale_kernel()) */
+static void (*scale_kernel)(uint32_t *buf, int frames, float scale);
+
 /*
  * Forward Declarations
  */
@@ -81,6 +92,7 @@ static bool init_pcm(int n);
 static void *sound_thread(void *p);
 static bool playback_period(int n);
 static void scale_samples(uint32_t *buf, int frames, float vol);
+static void select_scale_kernel(void);
 
 /*
  * Initialize ALSA.
@@ -89,6 +101,9 @@ bool init_asound(void)
 {
 	int n, ret;
 
+	/* Select a volume kernel before starting the sound threads. */
+	select_scale_kernel();
+
 	for (n = 0; n < MIXER_STREAMS; n++) {
 		/* Initialize per stream data. */
 		pcm[n] = NULL;
@@ -430,11 +445,6 @@ static bool playback_period(int n)
 static void scale_samples(uint32_t *buf, int frames, float vol)
 {
 	float scale;
-	uint32_t frame;
-	int32_t il, ir;	/* intermediate L/R */
-	int16_t sl, sr;	/* source L/R*/
-	int16_t dl, dr;	/* destination L/R */
-	int i;
 
 	/* For relaxed consistencies. Not needed for x86 and arm processors. */
 	__sync_synchronize();
@@ -443,7 +453,24 @@ static void scale_samples(uint32_t *buf, int frames, float vol)
 	scale = (powf(10.0f, vol) - 1.0f) / (10.0f - 1.0f);
 
 	/* Scale samples. */
-	for (i = 0; i < frames; i++) {
+	scale_kernel(buf, frames, scale);
+}
+
+/*
+ * Volume Kernels
+ *  - A sample is multiplied in float, truncated toward zero, then saturated.
+ *  - All kernels give the same result as the scalar one.
+ */
+
+/* Scale samples from the index i. (scalar) */
+static INLINE void scale_tail(uint32_t *buf, int frames, float scale, int i)
+{
+	uint32_t frame;
+	int32_t il, ir;	/* intermediate L/R */
+	int16_t sl, sr;	/* source L/R*/
+	int16_t dl, dr;	/* destination L/R */
+
+	for (; i < frames; i++) {
 		frame = buf[i];
 
 		sl = (int16_t)(uint16_t)frame;
@@ -463,3 +490,92 @@ static void scale_samples(uint32_t *buf, int frames, float vol)
 		buf[i] = ((uint32_t)(uint16_t)dl) | (((uint32_t)(uint16_t)dr) << 16);
 	}
 }
+
+static void scale_c(uint32_t *buf, int frames, float scale)
+{
+	scale_tail(buf, frames, scale, 0);
+}
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+/* SSE2: 4 frames (8 samples) per iteration. */
+static void scale_sse2(uint32_t *buf, int frames, float scale)
+{
+	const __m128 vs = _mm_set1_ps(scale);
+	__m128i v, lo, hi;
+	int i;
+
+	for (i = 0; i + 4 <= frames; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(void *)(buf + i));
+		lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), vs));
+		hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), vs));
+		_mm_storeu_si128((__m128i *)(void *)(buf + i), _mm_packs_epi32(lo, hi));
+	}
+	scale_tail(buf, frames, scale, i);
+}
+
+/* AVX2: 8 frames (16 samples) per iteration. */
+static TARGET_AVX2 void scale_avx2(uint32_t *buf, int frames, float scale)
+{
+	const __m256 vs = _mm256_set1_ps(scale);
+	__m256i v, lo, hi;
+	int i;
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *)(void *)(buf + i));
+		lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+		hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+		lo = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), vs));
+		hi = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(hi), vs));
+
+		/* packs works per 128-bit lane, so restore the order. */
+		v = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8);
+		_mm256_storeu_si256((__m256i *)(void *)(buf + i), v);
+	}
+	scale_tail(buf, frames, scale, i);
+}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+/* NEON: 4 frames (8 samples) per iteration. */
+static void scale_neon(uint32_t *buf, int frames, float scale)
+{
+	int16x8_t v;
+	int32x4_t lo, hi;
+	int i;
+
+	for (i = 0; i + 4 <= frames; i += 4) {
+		v = vreinterpretq_s16_u32(vld1q_u32(buf + i));
+		lo = vcvtq_s32_f32(vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+		hi = vcvtq_s32_f32(vmulq_n_f32(vcvtq_f32_s32(vmovl_high_s16(v)), scale));
+		v = vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi));
+		vst1q_u32(buf + i, vreinterpretq_u32_s16(v));
+	}
+	scale_tail(buf, frames, scale, i);
+}
+#endif
+
+/* Select a volume kernel. */
+static void select_scale_kernel(void)
+{
+	int tier;
+
+	tier = get_cpu_tier();
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+	if (tier >= CPU_TIER_AVX2) {
+		scale_kernel = scale_avx2;
+		return;
+	}
+	if (tier >= CPU_TIER_SSE2) {
+		scale_kernel = scale_sse2;
+		return;
+	}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+	if (tier == CPU_TIER_NEON) {
+		scale_kernel = scale_neon;
+		return;
+	}
+#else
+	UNUSED_PARAMETER(tier);
+#endif
+	scale_kernel = scale_c;
+}
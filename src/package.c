@@ -12,6 +12,13 @@
 #include "polarisengine.h"
 #include "package.h"
 
+/*
+ * Replace POSIX strcasecmp() to DOS _stricmp() on MSVC.
+ */
+#ifdef _MSC_VER
+#define strcasecmp _stricmp
+#endif
+
 /* Obfuscation Key */
 #include "key.h"
 
@@ -19,16 +26,35 @@
 #include <windows.h>
 #else
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
 #endif
 
+/* stat() for the modification time */
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* zlib for compression */
+#include <zlib.h>
+
 /* Max path size */
 #define PATH_SIZE		(256)
 
-/* Size of file count which is written at top of an archive */
-#define FILE_COUNT_BYTES	(8)
+/* Size of the header which is written at top of an archive (signature, version and file count) */
+#define HEADER_BYTES		(PACKAGE_SIGNATURE_SIZE + 8 + 8)
 
 /* Size of file entry */
-#define ENTRY_BYTES		(256 + 8 + 8)
+#define ENTRY_BYTES		(256 + 8 + 8 + 8 + 8 + 8)
+
+/* Extensions of already-compressed files that we store as is */
+static const char *stored_exts[] = {
+	".png", ".jpg", ".jpeg", ".webp", ".ogg", ".mp4", ".wmv", ".webm"
+};
+
+/* Size of the extensions */
+#define STORED_EXT_COUNT	((int)(sizeof(stored_exts) / sizeof(const char *)))
 
 /* Directory names */
 const char *dir_names[] = {
@@ -39,26 +65,166 @@ const char *dir_names[] = {
 /* Size of directory names */
 #define DIR_COUNT	((int)(sizeof(dir_names) / sizeof(const char *)))
 
-/* File entry */
-struct file_entry entry[FILE_ENTRY_SIZE];
+/* Max number of worker threads */
+#define JOBS_MAX		(64)
+
+/* Size of a chunk to stream a stored file */
+#define CHUNK_SIZE		(1024 * 1024)
+
+/* Total size of compressed bodies we keep on memory between the passes */
+#define KEEP_BUDGET		((uint64_t)256 * 1024 * 1024)
+
+/* Sidecar manifest of the archive (not packaged) */
+#define MANIFEST_FILE		"data01.arc.manifest"
+
+/* Signature and version at the top of a manifest */
+#define MANIFEST_SIGNATURE	"PLRSMANIFEST"
+#define MANIFEST_VERSION	(2)
+
+/* Archive being written by a full rebuild (renamed at the end) */
+#define TEMP_PACKAGE_FILE	"data01.arc.tmp"
+
+/* Content hash (FNV-1a 64-bit) */
+#define HASH_INIT		0xcbf29ce484222325ULL
+#define HASH_PRIME		0x100000001b3ULL
+
+/* No entry */
+#define NO_ENTRY		((uint64_t)-1)
+
+/* Source of an entry body */
+#define SOURCE_FILE		(0)	/* Read (and compress) the input file */
+#define SOURCE_ARCHIVE		(1)	/* Copy the body in the old archive */
+
+/* Entry information which is not a part of the archive (recorded in the manifest) */
+struct entry_info {
+	uint64_t mtime;
+	uint64_t hash;		/* Also the nonce of the body */
+	uint64_t old_index;	/* Index in the old archive (or NO_ENTRY) */
+	uint64_t dup_of;	/* Index of the entry with the same content (or NO_ENTRY) */
+	int source;
+};
+
+/* File entries (grown on demand) */
+static struct file_entry *entry;
+static struct entry_info *info;
 
 /* File count */
 static uint64_t file_count;
 
-/* Current processing file's offset in archive file */
-static uint64_t offset;
+/* Allocated count of the file entries */
+static uint64_t entry_alloc;
+
+/* Compressed and obfuscated bodies kept from the first pass (or NULL) */
+static char **kept_body;
+
+/* Total size of the kept bodies */
+static uint64_t kept_size;
+
+/* Base directory of the input files */
+static const char *input_base;
+
+/* Access trace to order the bodies (or NULL) */
+static const char *trace_path;
+
+/* Entry indices in the order of the bodies in the archive */
+static uint64_t *layout;
+
+/* Entry indices sorted by name (to look up the trace) */
+static uint64_t *name_sorted;
+
+/* Size of the archive we write */
+static uint64_t archive_size;
+
+/* Are we updating the archive in-place? */
+static bool is_updating;
+
+/* Entries of the old archive loaded from the manifest */
+static struct file_entry *old_entry;
+static struct entry_info *old_info;
+static uint64_t old_count;
+static uint64_t old_archive_size;
+
+/* Old entry indices sorted by name */
+static uint64_t *old_sorted;
+
+/* Number of worker threads (0 for the processor count) */
+static int job_count;
+
+/* Progress callback (or NULL) */
+static void (*progress_func)(uint64_t done, uint64_t total);
 
-/* Next random number. */
-static uint64_t next_random;
+/* Job state shared by the worker threads (guarded by the lock) */
+static bool (*job_func)(uint64_t index);
+static bool job_progress;
+static uint64_t job_next;
+static uint64_t job_done;
+static bool job_failed;
+
+/* Lock for the job state */
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+static CRITICAL_SECTION job_lock;
+#else
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Output archive and old archive */
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+static HANDLE archive_handle = INVALID_HANDLE_VALUE;
+static HANDLE old_handle = INVALID_HANDLE_VALUE;
+#else
+static int archive_fd = -1;
+static int old_fd = -1;
+#endif
+
+/* Constants for the keystream. (Must be the same as file.c) */
+#define BLOCK_MUL1	0x9e3779b97f4a7c15ULL
+#define BLOCK_MUL2	0xbf58476d1ce4e5b9ULL
+#define BLOCK_MUL3	0x94d049bb133111ebULL
 
 /* forward declaration */
+static bool pack(const char *base_dir, bool update);
+static struct file_entry *add_entry(void);
 static bool get_file_names(const char *base_dir, const char *dir);
-static bool get_file_sizes(const char *base_dir);
 static bool write_archive_file(const char *base_dir);
-static bool write_file_entries(FILE *fp);
-static bool write_file_bodies(const char *base_dir, FILE *fp);
-static void set_random_seed(uint64_t index);
-static char get_next_random(void);
+static bool update_archive_file(const char *base_dir);
+static bool measure_file(uint64_t index);
+static bool write_file_body(uint64_t index);
+static bool copy_old_body(uint64_t index);
+static bool write_file_entries(void);
+static void make_input_path(uint64_t index, char *path, size_t size);
+static void make_archive_path(const char *base_dir, const char *file, char *path, size_t size);
+static bool get_file_stat(const char *path, uint64_t *size, uint64_t *mtime);
+static bool read_input_file(uint64_t index, char **raw);
+static bool hash_input_file(uint64_t index, uint64_t *hash);
+static uint64_t hash_bytes(uint64_t hash, const char *buf, size_t size);
+static bool is_compressible(const char *name);
+static bool compress_body(uint64_t index, const char *raw, char **body);
+static void reuse_old_body(uint64_t index);
+static bool order_bodies(void);
+static uint64_t find_entry_by_name(const char *name);
+static int cmp_entry_name(const void *a, const void *b);
+static bool load_manifest(const char *base_dir);
+static bool write_manifest(const char *base_dir);
+static bool dedupe_entries(void);
+static bool verify_duplicate(uint64_t index);
+static bool is_same_file(uint64_t a, uint64_t b);
+static uint64_t find_old_entry(const char *name);
+static int cmp_old_entry(const void *a, const void *b);
+static void free_old_entries(void);
+static bool run_jobs(bool (*func)(uint64_t index), bool progress);
+static void do_jobs(void);
+static int get_job_count(void);
+static void lock_jobs(void);
+static void unlock_jobs(void);
+static bool open_archive(const char *path, bool update);
+static bool write_archive_at(const void *buf, size_t size, uint64_t pos);
+static bool close_archive(void);
+static bool open_old_archive(const char *path);
+static bool read_old_archive_at(void *buf, size_t size, uint64_t pos);
+static void close_old_archive(void);
+static bool replace_archive(const char *from, const char *to);
+static void cleanup_package(void);
+static void encode_blocks(uint64_t nonce, uint64_t pos, char *buf, size_t size);
 
 #ifdef POLARIS_ENGINE_TARGET_WIN32
 const wchar_t *conv_utf8_to_utf16(const char *utf8_message);
@@ -67,33 +233,162 @@ const char *conv_utf16_to_utf8(const wchar_t *utf16_message);
 
 /*
  * Create package.
+ *  - The archive is rewritten in the canonical layout. The output is the same
+ *    as a build from scratch, but the bodies of unchanged files are copied
+ *    from the old archive if the manifest is valid. (Compaction)
  */
 bool create_package(const char *base_dir)
 {
+	return pack(base_dir, false);
+}
+
+/*
+ * Update package.
+ *  - Unchanged files are left in place, and new or changed files are
+ *    appended to the archive. The space of the old bodies is not reused
+ *    until create_package() compacts the archive.
+ *  - Without a valid manifest, this is the same as create_package().
+ */
+bool update_package(const char *base_dir)
+{
+	return pack(base_dir, true);
+}
+
+/* Create or update package. */
+static bool pack(const char *base_dir, bool update)
+{
+	char path[1024];
+	uint64_t j;
+	bool success;
 	int i;
 
 	file_count = 0;
-	offset = 0;
-	next_random = 0;
+	input_base = base_dir;
 
 	/* Get list of files. */
+	success = true;
 	for (i = 0; i < DIR_COUNT; i++) {
 		if (!get_file_names(base_dir, dir_names[i])) {
 			if (strcmp(dir_names[i], "anime") == 0)
 				continue;
-			return false;
+			success = false;
+			break;
 		}
 	}
 
-	/* Get all file sizes and decide all offsets in archive. */
-	if (!get_file_sizes(base_dir))
-		return false;
+	/* Load the manifest of the old archive if exists. */
+	if (success && load_manifest(base_dir)) {
+		make_archive_path(base_dir, PACKAGE_FILE, path, sizeof(path));
+		if (!open_old_archive(path))
+			free_old_entries();
+	}
 
 	/* Write archive file. */
-	if (!write_archive_file(base_dir))
-		return false;
+	if (success) {
+		for (j = 0; j < file_count; j++)
+			info[j].old_index = find_old_entry(entry[j].name);
+		is_updating = update && old_count > 0;
+		if (is_updating)
+			success = update_archive_file(base_dir);
+		else
+			success = write_archive_file(base_dir);
+	}
+	close_old_archive();
 
-	return true;
+	/* Write the manifest for the next update. */
+	if (success)
+		success = write_manifest(base_dir);
+
+	cleanup_package();
+
+	return success;
+}
+
+/*
+ * Set the number of worker threads. (0 for the processor count)
+ */
+void set_package_jobs(int jobs)
+{
+	job_count = jobs < 0 ? 0 : jobs;
+}
+
+/*
+ * Set an access trace to lay out the bodies in the first-touch order. (NULL to disable)
+ */
+void set_package_access_trace(const char *file)
+{
+	trace_path = file;
+}
+
+/*
+ * Set a progress callback.
+ *  - Each file counts twice: once measured, and once written.
+ *  - The callback is called with a lock, so it doesn't need to be thread-safe.
+ */
+void set_package_progress_callback(void (*func)(uint64_t done, uint64_t total))
+{
+	progress_func = func;
+}
+
+/* Free the file entries. */
+static void cleanup_package(void)
+{
+	uint64_t i;
+
+	if (kept_body != NULL) {
+		for (i = 0; i < file_count; i++)
+			free(kept_body[i]);
+		free(kept_body);
+		kept_body = NULL;
+	}
+	kept_size = 0;
+
+	free(layout);
+	layout = NULL;
+	free(name_sorted);
+	name_sorted = NULL;
+
+	free(entry);
+	entry = NULL;
+	free(info);
+	info = NULL;
+	entry_alloc = 0;
+	file_count = 0;
+
+	free_old_entries();
+	is_updating = false;
+}
+
+/* Add a file entry. */
+static struct file_entry *add_entry(void)
+{
+	struct file_entry *e;
+	struct entry_info *ei;
+	uint64_t new_alloc;
+
+	if (file_count == entry_alloc) {
+		new_alloc = entry_alloc == 0 ? 1024 : entry_alloc * 2;
+		e = realloc(entry, sizeof(struct file_entry) * (size_t)new_alloc);
+		if (e == NULL) {
+			log_memory();
+			return NULL;
+		}
+		entry = e;
+		ei = realloc(info, sizeof(struct entry_info) * (size_t)new_alloc);
+		if (ei == NULL) {
+			log_memory();
+			return NULL;
+		}
+		info = ei;
+		entry_alloc = new_alloc;
+	}
+
+	memset(&info[file_count], 0, sizeof(struct entry_info));
+	info[file_count].old_index = NO_ENTRY;
+	info[file_count].dup_of = NO_ENTRY;
+	e = &entry[file_count++];
+	memset(e, 0, sizeof(struct file_entry));
+	return e;
 }
 
 #if defined(POLARIS_ENGINE_TARGET_WIN32)
@@ -126,6 +421,7 @@ static bool get_file_names_recursive(const wchar_t *base_dir, const wchar_t *dir
     wchar_t findpath[PATH_SIZE];
     char u8dir[PATH_SIZE];
     char *separator;
+    struct file_entry *e;
 
     /* Make path. */
     if (wcscmp(base_dir, L"") == 0) {
@@ -160,16 +456,20 @@ static bool get_file_names_recursive(const wchar_t *base_dir, const wchar_t *dir
     {
         if(!(wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
         {
+            e = add_entry();
+            if (e == NULL) {
+                FindClose(hFind);
+                return false;
+            }
 #if defined(__GNUC__) && !defined(__llvm__)
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat-truncation"
 #endif
-            snprintf(entry[file_count].name, FILE_NAME_SIZE, "%s/%s", u8dir,
+            snprintf(e->name, FILE_NAME_SIZE, "%s/%s", u8dir,
                  conv_utf16_to_utf8(wfd.cFileName));
 #if defined(__GNUC__) && !defined(__llvm__)
 #pragma GCC diagnostic pop
 #endif
-            file_count++;
         }
         else if((wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
             wfd.cFileName[0] != L'.')
@@ -203,6 +503,7 @@ static bool get_file_names_recursive(const char *game_base, const char *base_dir
     char new_path[1024];
     char query_path[1024];
     struct dirent **names;
+    struct file_entry *e;
     int i, count;
     bool succeeded;
 
@@ -227,21 +528,20 @@ static bool get_file_names_recursive(const char *game_base, const char *base_dir
             /* Ignore . and .. (also .*)*/
             continue;
         }
-        if (count >= FILE_ENTRY_SIZE) {
-            log_too_many_files();
-            succeeded = false;
-            break;
-        }
         if (names[i]->d_type == DT_DIR) {
             if (!get_file_names_recursive(game_base, new_path, names[i]->d_name, depth + 1)) {
                 succeeded = false;
                 break;
             }
         } else {
-            snprintf(entry[file_count].name, FILE_NAME_SIZE,
+            e = add_entry();
+            if (e == NULL) {
+                succeeded = false;
+                break;
+            }
+            snprintf(e->name, FILE_NAME_SIZE,
                      "%s/%s", new_path, names[i]->d_name);
-            printf("%s\n", entry[file_count].name);
-            file_count++;
+            printf("%s\n", e->name);
         }
     }
     for (i = 0; i < count; i++)
@@ -268,6 +568,7 @@ static bool get_file_names_recursive(const char *base_dir, const char *dir, int
 {
     char new_path[1024];
     struct dirent **names;
+    struct file_entry *e;
     int i, count;
     bool succeeded;
 
@@ -296,28 +597,27 @@ static bool get_file_names_recursive(const char *base_dir, const char *dir, int
             /* Ignore . and .. (also .*)*/
             continue;
         }
-        if (count >= FILE_ENTRY_SIZE) {
-            log_too_many_files();
-            succeeded = false;
-            break;
-        }
         if (names[i]->d_type == DT_DIR) {
             if (!get_file_names_recursive(new_path, names[i]->d_name, depth + 1)) {
                 succeeded = false;
                 break;
             }
         } else {
+            e = add_entry();
+            if (e == NULL) {
+                succeeded = false;
+                break;
+            }
 #if defined(__GNUC__) && !defined(__llvm__)
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat-truncation"
 #endif
-            snprintf(entry[file_count].name, FILE_NAME_SIZE,
+            snprintf(e->name, FILE_NAME_SIZE,
                      "%s/%s", new_path, names[i]->d_name);
 #if defined(__GNUC__) && !defined(__llvm__)
 #pragma GCC diagnostic pop
 #endif
-            printf("%s\n", entry[file_count].name);
-            file_count++;
+            printf("%s\n", e->name);
         }
     }
     for (i = 0; i < count; i++)
@@ -327,202 +627,1297 @@ static bool get_file_names_recursive(const char *base_dir, const char *dir, int
 }
 #endif
 
-/* Get sizes of each files. */
-static bool get_file_sizes(const char *base_dir)
+/*
+ * Write archive file.
+ *  - The first pass measures each file and compresses it if worth it.
+ *  - Files with the same content share one body.
+ *  - Then we decide all offsets in the archive in the layout order.
+ *    (The first-touch order in the access trace, then the entry order)
+ *  - The second pass writes each body to its own range.
+ *  - Both passes run on the worker threads, and the output doesn't depend
+ *    on the number of the threads.
+ *  - We write to a temporary file because we may copy bodies from the old
+ *    archive.
+ */
+static bool write_archive_file(const char *base_dir)
 {
-	FILE *fp;
-	uint64_t i;
+	char tmp_path[1024], path[1024];
+	uint64_t i, j, offset;
+	bool success;
 
-	UNUSED_PARAMETER(base_dir);
+	/* Allocate the table of the kept bodies. */
+	kept_body = calloc(file_count > 0 ? (size_t)file_count : 1, sizeof(char *));
+	if (kept_body == NULL) {
+		log_memory();
+		return false;
+	}
 
-	/* Get each file size, and calc offsets. */
-	offset = FILE_COUNT_BYTES + ENTRY_BYTES * file_count;
-	for (i = 0; i < file_count; i++) {
-		/*
-		 * Make a path and open the file.
-		 */
-#if defined(POLARIS_ENGINE_TARGET_WIN32)
-		/* Make a path on Windows. */
-		char *path = strdup(entry[i].name);
-		char *slash;
-		if (path == NULL) {
-			log_memory();
-			return false;
-		}
-		slash = strchr(path, '/');
-		if (slash == NULL)
-			return false;
-		*slash = '\\';
-		fp = fopen(path, "rb");
-		free(path);
-#else
-		/* Make path on Mac/Linux. */
-		char abspath[1024];
-		if (strcmp(base_dir, "") == 0)
-			snprintf(abspath, sizeof(abspath), "%s", entry[i].name);
-		else
-			snprintf(abspath, sizeof(abspath), "%s/%s", base_dir, entry[i].name);
-		fp = fopen(abspath, "r");
-#endif
+	/* First pass: get all file sizes. */
+	job_done = 0;
+	if (!run_jobs(measure_file, true))
+		return false;
 
-		/* Check the fp. */
-		if (fp == NULL) {
-			log_file_open(entry[i].name);
-			return false;
-		}
+	/* Find the files with the same content. */
+	if (!dedupe_entries())
+		return false;
 
-		/* Get the file size. */
-		fseek(fp, 0, SEEK_END);
-		entry[i].size = (uint64_t)ftell(fp);
-		entry[i].offset = offset;
-		fclose(fp);
+	/* Decide the order of the bodies. */
+	if (!order_bodies())
+		return false;
 
-		/* Increment the offset. */
-		offset += entry[i].size;
+	/* Decide all offsets in archive. (A shared body is placed at its first touch.) */
+	offset = HEADER_BYTES + ENTRY_BYTES * file_count;
+	for (i = 0; i < file_count; i++)
+		entry[i].offset = 0;
+	for (i = 0; i < file_count; i++) {
+		j = layout[i];
+		if (info[j].dup_of != NO_ENTRY)
+			j = info[j].dup_of;
+		if (entry[j].offset != 0)
+			continue;
+		entry[j].offset = offset;
+		offset += entry[j].size;
 	}
-	return true;
+	for (i = 0; i < file_count; i++) {
+		if (info[i].dup_of != NO_ENTRY)
+			entry[i].offset = entry[info[i].dup_of].offset;
+	}
+	archive_size = offset;
+
+	/* Second pass: write the bodies, then the header and the entries. */
+	make_archive_path(base_dir, TEMP_PACKAGE_FILE, tmp_path, sizeof(tmp_path));
+	make_archive_path(base_dir, PACKAGE_FILE, path, sizeof(path));
+	if (!open_archive(tmp_path, false))
+		return false;
+	success = run_jobs(write_file_body, true) && write_file_entries();
+	if (!close_archive())
+		success = false;
+	close_old_archive();
+	if (success)
+		success = replace_archive(tmp_path, path);
+	if (!success) {
+		remove(tmp_path);
+		log_file_write(PACKAGE_FILE);
+	}
+
+	return success;
 }
 
-/* Write archive file. */
-static bool write_archive_file(const char *base_dir)
+/*
+ * Update archive file in-place.
+ *  - Unchanged bodies stay at their offsets.
+ *  - New and changed bodies are appended at the end, unless the same
+ *    content is already in the archive.
+ *  - If the entry table grows, the bodies under the new table are moved to
+ *    the end, too.
+ */
+static bool update_archive_file(const char *base_dir)
 {
-	FILE *fp;
+	char path[1024];
+	uint64_t i, j, table_end, tail;
 	bool success;
 
-#ifdef POLARIS_ENGINE_TARGET_WIN32
-	fp = fopen(PACKAGE_FILE, "wb");
-	UNUSED_PARAMETER(base_dir);
-#else
-	char abspath[1024];
-	if (strcmp(base_dir, "") == 0)
-		snprintf(abspath, sizeof(abspath), "%s", PACKAGE_FILE);
-	else
-		snprintf(abspath, sizeof(abspath), "%s/%s", base_dir, PACKAGE_FILE);
-	fp = fopen(abspath, "w");
-#endif
-	if (fp == NULL) {
-		log_file_open(PACKAGE_FILE);
+	/* Allocate the table of the kept bodies. */
+	kept_body = calloc(file_count > 0 ? (size_t)file_count : 1, sizeof(char *));
+	if (kept_body == NULL) {
+		log_memory();
 		return false;
 	}
 
-	success = false;
-	do {
-		if (fwrite(&file_count, sizeof(uint64_t), 1, fp) < 1)
-			break;
-		if (!write_file_entries(fp))
-			break;
-		if (!write_file_bodies(base_dir, fp))
-			break;
-		fclose(fp);
-		success = true;
-	} while (0);
+	/* First pass: get all file sizes. */
+	job_done = 0;
+	if (!run_jobs(measure_file, true))
+		return false;
+
+	/* Find the files with the same content. */
+	if (!dedupe_entries())
+		return false;
+
+	/* Decide the order of the appended bodies. */
+	if (!order_bodies())
+		return false;
+
+	/* Decide all offsets in archive. */
+	table_end = HEADER_BYTES + ENTRY_BYTES * file_count;
+	tail = old_archive_size > table_end ? old_archive_size : table_end;
+	for (i = 0; i < file_count; i++) {
+		j = layout[i];
+		if (info[j].dup_of != NO_ENTRY)
+			continue;
+		if (info[j].source == SOURCE_ARCHIVE &&
+		    old_entry[info[j].old_index].offset >= table_end) {
+			entry[j].offset = old_entry[info[j].old_index].offset;
+		} else {
+			entry[j].offset = tail;
+			tail += entry[j].size;
+		}
+	}
+	for (i = 0; i < file_count; i++) {
+		if (info[i].dup_of != NO_ENTRY)
+			entry[i].offset = entry[info[i].dup_of].offset;
+	}
+	archive_size = tail;
 
+	/* Remove the manifest first, so that an interrupted update is not trusted. */
+	make_archive_path(base_dir, MANIFEST_FILE, path, sizeof(path));
+	remove(path);
+
+	/* Second pass: write the bodies, then the header and the entries. */
+	make_archive_path(base_dir, PACKAGE_FILE, path, sizeof(path));
+	if (!open_archive(path, true))
+		return false;
+	success = run_jobs(write_file_body, true) && write_file_entries();
+	if (!close_archive())
+		success = false;
 	if (!success)
 		log_file_write(PACKAGE_FILE);
 
-	return true;
+	return success;
 }
 
-/* Write file entries. */
-static bool write_file_entries(FILE *fp)
+/* Measure a file and compress it if needed. (First pass) */
+static bool measure_file(uint64_t index)
 {
-	char xor[FILE_NAME_SIZE];
-	uint64_t i;
-	int j;
-
-	for (i = 0; i < file_count; i++) {
-		set_random_seed(i);
-		for (j = 0; j < FILE_NAME_SIZE; j++)
-			xor[j] = entry[i].name[j] ^ get_next_random();
+	char path[1024];
+	char *raw, *body;
+	uint64_t old;
+	bool keep;
+
+	/* Get the file size and the modification time. */
+	make_input_path(index, path, sizeof(path));
+	if (!get_file_stat(path, &entry[index].raw_size, &info[index].mtime)) {
+		lock_jobs();
+		log_file_open(entry[index].name);
+		unlock_jobs();
+		return false;
+	}
+	entry[index].size = entry[index].raw_size;
+	entry[index].codec = PACKAGE_CODEC_NONE;
+	info[index].hash = HASH_INIT;
+	info[index].source = SOURCE_FILE;
+
+	/* If the file is not touched since the last build, reuse the old body. */
+	old = info[index].old_index;
+	if (old != NO_ENTRY && old_entry[old].raw_size == entry[index].raw_size &&
+	    old_info[old].mtime == info[index].mtime) {
+		reuse_old_body(index);
+		return true;
+	}
 
-		if (fwrite(xor, FILE_NAME_SIZE, 1, fp) < 1)
+	/* If the file may be compressed, read it and get the hash. */
+	if (is_compressible(entry[index].name) && entry[index].raw_size > 0) {
+		if (!read_input_file(index, &raw))
 			return false;
-		if (fwrite(&entry[i].size, sizeof(uint64_t), 1, fp) < 1)
+		info[index].hash = hash_bytes(HASH_INIT, raw, (size_t)entry[index].raw_size);
+
+		/* If the content is the same as the last build, reuse the old body. */
+		if (old != NO_ENTRY && old_entry[old].raw_size == entry[index].raw_size &&
+		    old_info[old].hash == info[index].hash) {
+			free(raw);
+			reuse_old_body(index);
+			return true;
+		}
+
+		/* Compress. */
+		if (!compress_body(index, raw, &body)) {
+			free(raw);
 			return false;
-		if (fwrite(&entry[i].offset, sizeof(uint64_t), 1, fp) < 1)
+		}
+		free(raw);
+
+		/* Keep the body if we have a room, otherwise compress it again later. */
+		if (body != NULL) {
+			lock_jobs();
+			keep = kept_size + entry[index].size <= KEEP_BUDGET;
+			if (keep)
+				kept_size += entry[index].size;
+			unlock_jobs();
+			if (keep)
+				kept_body[index] = body;
+			else
+				free(body);
+		}
+		return true;
+	}
+
+	/* If the file is stored as is, get the hash. (The nonce and the key to dedupe) */
+	if (entry[index].raw_size > 0) {
+		if (!hash_input_file(index, &info[index].hash))
 			return false;
+		if (old != NO_ENTRY && old_entry[old].raw_size == entry[index].raw_size &&
+		    old_info[old].hash == info[index].hash)
+			reuse_old_body(index);
 	}
+
 	return true;
 }
 
-/* Write file bodies. */
-static bool write_file_bodies(const char *base_dir, FILE *fp)
+/* Use the body in the old archive for an entry. */
+static void reuse_old_body(uint64_t index)
 {
-	char buf[8192];
-	FILE *fpin;
-	uint64_t i;
-	size_t len, obf;
+	uint64_t old;
 
-	for (i = 0; i < file_count; i++) {
-#ifdef POLARIS_ENGINE_TARGET_WIN32
-		char *path = strdup(entry[i].name);
-		char *slash;
-		if (path == NULL) {
-			log_memory();
-			return false;
-		}
-		slash = strchr(path, '/');
-		if (slash == NULL)
+	old = info[index].old_index;
+	entry[index].size = old_entry[old].size;
+	entry[index].codec = old_entry[old].codec;
+	info[index].hash = old_info[old].hash;
+	info[index].source = SOURCE_ARCHIVE;
+}
+
+/* Write a file body to its range. (Second pass) */
+static bool write_file_body(uint64_t index)
+{
+	FILE *fp;
+	char path[1024];
+	char *buf, *raw;
+	uint64_t pos, hash;
+	size_t len;
+	bool success;
+
+	/* If the body is shared with another entry. */
+	if (info[index].dup_of != NO_ENTRY)
+		return true;
+
+	/* If the compressed body is kept. */
+	if (kept_body[index] != NULL) {
+		success = write_archive_at(kept_body[index], (size_t)entry[index].size,
+					   entry[index].offset);
+		free(kept_body[index]);
+		kept_body[index] = NULL;
+		return success;
+	}
+
+	/* If the body is in the old archive. */
+	if (info[index].source == SOURCE_ARCHIVE)
+		return copy_old_body(index);
+
+	if (entry[index].size == 0)
+		return true;
+
+	/* If the body is compressed, do it again. (The result is the same.) */
+	if (entry[index].codec == PACKAGE_CODEC_DEFLATE) {
+		if (!read_input_file(index, &raw))
 			return false;
-		*slash = '\\';
-		fpin = fopen(path, "rb");
-		UNUSED_PARAMETER(base_dir);
-#else
-		char abspath[1024];
-		if (strcmp(base_dir, "") == 0)
-			snprintf(abspath, sizeof(abspath), "%s", entry[i].name);
-		else
-			snprintf(abspath, sizeof(abspath), "%s/%s", base_dir,
-				 entry[i].name);
-		fpin = fopen(abspath, "r");
-#endif
-		if (fpin == NULL) {
-			log_file_open(entry[i].name);
+		if (!compress_body(index, raw, &buf) || buf == NULL) {
+			free(raw);
 			return false;
 		}
-		set_random_seed(i);
-		do  {
-			len = fread(buf, 1, sizeof(buf), fpin);
-			if (len > 0) {
-				for (obf = 0; obf < len; obf++)
-					buf[obf] ^= get_next_random();
-				if (fwrite(buf, len, 1, fp) < 1) {
-					log_file_write(entry[i].name);
-					return false;
-				}
-			}
-		} while (len == sizeof(buf));
-#ifdef _WIN32
-		free(path);
-#endif
-		fclose(fpin);
+		free(raw);
+		success = write_archive_at(buf, (size_t)entry[index].size,
+					   entry[index].offset);
+		free(buf);
+		return success;
 	}
-	return true;
+
+	/* Otherwise, stream the file as is. */
+	make_input_path(index, path, sizeof(path));
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		lock_jobs();
+		log_file_open(entry[index].name);
+		unlock_jobs();
+		return false;
+	}
+	buf = malloc(CHUNK_SIZE);
+	if (buf == NULL) {
+		lock_jobs();
+		log_memory();
+		unlock_jobs();
+		fclose(fp);
+		return false;
+	}
+	success = true;
+	hash = HASH_INIT;
+	pos = 0;
+	while (pos < entry[index].size) {
+		len = fread(buf, 1, CHUNK_SIZE, fp);
+		if (len == 0 || pos + len > entry[index].size) {
+			/* The file was changed after the first pass. */
+			success = false;
+			break;
+		}
+		hash = hash_bytes(hash, buf, len);
+		encode_blocks(info[index].hash, pos, buf, len);
+		if (!write_archive_at(buf, len, entry[index].offset + pos)) {
+			success = false;
+			break;
+		}
+		pos += len;
+	}
+	if (hash != info[index].hash) {
+		/* The file was changed after the first pass. */
+		success = false;
+	}
+	free(buf);
+	fclose(fp);
+
+	return success;
 }
 
-/* Set random seed. */
-static void set_random_seed(uint64_t index)
+/* Copy a body from the old archive. */
+static bool copy_old_body(uint64_t index)
 {
-	uint64_t i, lsb;
+	char *buf;
+	uint64_t old, pos;
+	size_t len;
+	bool success;
 
-	next_random = OBFUSCATION_KEY;
-	for (i = 0; i < index; i++) {
-		next_random ^= 0xafcb8f2ff4fff33fULL;
-		lsb = next_random >> 63;
-		next_random = (next_random << 1) | lsb;
+	old = info[index].old_index;
+
+	/* If the body is already there. */
+	if (is_updating && old_entry[old].offset == entry[index].offset)
+		return true;
+
+	buf = malloc(CHUNK_SIZE);
+	if (buf == NULL) {
+		lock_jobs();
+		log_memory();
+		unlock_jobs();
+		return false;
+	}
+	success = true;
+	for (pos = 0; pos < entry[index].size; pos += len) {
+		len = entry[index].size - pos > CHUNK_SIZE ?
+			CHUNK_SIZE : (size_t)(entry[index].size - pos);
+		if (!read_old_archive_at(buf, len, old_entry[old].offset + pos)) {
+			success = false;
+			break;
+		}
+
+		if (!write_archive_at(buf, len, entry[index].offset + pos)) {
+			success = false;
+			break;
+		}
 	}
+	free(buf);
+
+	return success;
 }
 
-/* Get next random number. */
-char get_next_random(void)
+/* Write the header and the file entries. */
+static bool write_file_entries(void)
 {
-	char ret;
+	char *buf, *p;
+	uint64_t i, version;
+	size_t size;
+	bool success;
+
+	size = HEADER_BYTES + ENTRY_BYTES * (size_t)file_count;
+	buf = malloc(size);
+	if (buf == NULL) {
+		log_memory();
+		return false;
+	}
+
+	/* Header. */
+	p = buf;
+	version = PACKAGE_VERSION;
+	memcpy(p, PACKAGE_SIGNATURE, PACKAGE_SIGNATURE_SIZE);
+	p += PACKAGE_SIGNATURE_SIZE;
+	memcpy(p, &version, sizeof(uint64_t));
+	p += sizeof(uint64_t);
+	memcpy(p, &file_count, sizeof(uint64_t));
+	p += sizeof(uint64_t);
+
+	/* Entries. */
+	for (i = 0; i < file_count; i++) {
+		memcpy(p, entry[i].name, FILE_NAME_SIZE);
+		encode_blocks(~i, 0, p, FILE_NAME_SIZE);
+		p += FILE_NAME_SIZE;
+		memcpy(p, &entry[i].size, sizeof(uint64_t));
+		p += sizeof(uint64_t);
+		memcpy(p, &entry[i].offset, sizeof(uint64_t));
+		p += sizeof(uint64_t);
+		memcpy(p, &entry[i].raw_size, sizeof(uint64_t));
+		p += sizeof(uint64_t);
+		memcpy(p, &entry[i].codec, sizeof(uint64_t));
+		p += sizeof(uint64_t);
+		memcpy(p, &info[i].hash, sizeof(uint64_t));
+		p += sizeof(uint64_t);
+	}
+
+	success = write_archive_at(buf, size, 0);
+	free(buf);
 
-	ret = (char)next_random;
+	return success;
+}
 
-	next_random = (((OBFUSCATION_KEY & 0xff00) * next_random +
-			(OBFUSCATION_KEY & 0xff)) % OBFUSCATION_KEY) ^
-		      0xfcbfaff8f2f4f3f0;
+/* Make a path to an input file. */
+static void make_input_path(uint64_t index, char *path, size_t size)
+{
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	char *slash;
+	snprintf(path, size, "%s", entry[index].name);
+	slash = strchr(path, '/');
+	if (slash != NULL)
+		*slash = '\\';
+#else
+#if defined(__GNUC__) && !defined(__llvm__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-truncation"
+#endif
+	if (strcmp(input_base, "") == 0)
+		snprintf(path, size, "%s", entry[index].name);
+	else
+		snprintf(path, size, "%s/%s", input_base, entry[index].name);
+#if defined(__GNUC__) && !defined(__llvm__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+}
 
-	return ret;
+/* Make a path to a file next to the archive. */
+static void make_archive_path(const char *base_dir, const char *file, char *path, size_t size)
+{
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	UNUSED_PARAMETER(base_dir);
+	snprintf(path, size, "%s", file);
+#else
+	if (strcmp(base_dir, "") == 0)
+		snprintf(path, size, "%s", file);
+	else
+		snprintf(path, size, "%s/%s", base_dir, file);
+#endif
+}
+
+/* Get the size and the modification time of a file. */
+static bool get_file_stat(const char *path, uint64_t *size, uint64_t *mtime)
+{
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	struct _stat64 st;
+	if (_stat64(path, &st) != 0)
+		return false;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return false;
+#endif
+	*size = (uint64_t)st.st_size;
+	*mtime = (uint64_t)st.st_mtime;
+	return true;
+}
+
+/* Read the whole content of an input file. */
+static bool read_input_file(uint64_t index, char **raw)
+{
+	FILE *fp;
+	char path[1024];
+	size_t len;
+
+	len = (size_t)entry[index].raw_size;
+
+	make_input_path(index, path, sizeof(path));
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		lock_jobs();
+		log_file_open(entry[index].name);
+		unlock_jobs();
+		return false;
+	}
+	*raw = malloc(len > 0 ? len : 1);
+	if (*raw == NULL) {
+		lock_jobs();
+		log_memory();
+		unlock_jobs();
+		fclose(fp);
+		return false;
+	}
+	if (fread(*raw, 1, len, fp) != len) {
+		lock_jobs();
+		log_file_open(entry[index].name);
+		unlock_jobs();
+		free(*raw);
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+
+	return true;
+}
+
+/* Get the hash of an input file without reading it on memory at once. */
+static bool hash_input_file(uint64_t index, uint64_t *hash)
+{
+	FILE *fp;
+	char path[1024];
+	char *buf;
+	size_t len;
+
+	make_input_path(index, path, sizeof(path));
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		lock_jobs();
+		log_file_open(entry[index].name);
+		unlock_jobs();
+		return false;
+	}
+	buf = malloc(CHUNK_SIZE);
+	if (buf == NULL) {
+		lock_jobs();
+		log_memory();
+		unlock_jobs();
+		fclose(fp);
+		return false;
+	}
+	*hash = HASH_INIT;
+	while ((len = fread(buf, 1, CHUNK_SIZE, fp)) > 0)
+		*hash = hash_bytes(*hash, buf, len);
+	free(buf);
+	fclose(fp);
+
+	return true;
+}
+
+/* Update a content hash. */
+static uint64_t hash_bytes(uint64_t hash, const char *buf, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= (unsigned char)buf[i];
+		hash *= HASH_PRIME;
+	}
+	return hash;
+}
+
+/* Check whether a file is worth compression by its extension. */
+static bool is_compressible(const char *name)
+{
+	const char *ext;
+	int i;
+
+	ext = strrchr(name, '.');
+	if (ext == NULL)
+		return true;
+
+	for (i = 0; i < STORED_EXT_COUNT; i++) {
+		if (strcasecmp(ext, stored_exts[i]) == 0)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Compress a file content and set the codec and the stored size.
+ *  - If the compression doesn't save 1/8 of the size, the file is stored as
+ *    is, and *body is set to NULL.
+ *  - Otherwise, *body is set to the compressed and obfuscated body.
+ *  - The hash has to be set before, because it is the nonce.
+ */
+static bool compress_body(uint64_t index, const char *raw, char **body)
+{
+	char *comp;
+	uLongf comp_len;
+	size_t raw_len;
+
+	*body = NULL;
+	raw_len = (size_t)entry[index].raw_size;
+
+	/* Compress. */
+	comp_len = compressBound((uLong)raw_len);
+	comp = malloc(comp_len);
+	if (comp == NULL) {
+		lock_jobs();
+		log_memory();
+		unlock_jobs();
+		return false;
+	}
+	if (compress2((Bytef *)comp, &comp_len, (const Bytef *)raw,
+		      (uLong)raw_len, Z_BEST_COMPRESSION) != Z_OK ||
+	    comp_len > raw_len - raw_len / 8) {
+		/* Not worth it. */
+		entry[index].codec = PACKAGE_CODEC_NONE;
+		entry[index].size = raw_len;
+		free(comp);
+		return true;
+	}
+
+	/* Obfuscate. */
+	encode_blocks(info[index].hash, 0, comp, (size_t)comp_len);
+	entry[index].codec = PACKAGE_CODEC_DEFLATE;
+	entry[index].size = comp_len;
+	*body = comp;
+
+	return true;
+}
+
+/*
+ * Manifest
+ *  - The first line is "PLRSMANIFEST <version> <archive size> <entry count>".
+ *  - Each line has "<hash> <mtime> <raw size> <size> <offset> <codec> <name>"
+ *    in the entry order.
+ *  - The hash is the nonce of the body, too.
+ */
+
+/* Load the manifest of the old archive. */
+static bool load_manifest(const char *base_dir)
+{
+	char path[1024], line[1024];
+	FILE *fp;
+	char *name, *nl;
+	unsigned long long size, count, hash, mtime, raw_size, stored_size, offset, codec;
+	uint64_t i, real_size, real_mtime;
+	int version, n;
+
+	free_old_entries();
+
+	make_archive_path(base_dir, MANIFEST_FILE, path, sizeof(path));
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return false;
+
+	/* Check the header and the archive size. */
+	if (fgets(line, sizeof(line), fp) == NULL ||
+	    sscanf(line, MANIFEST_SIGNATURE " %d %llu %llu", &version, &size, &count) != 3 ||
+	    version != MANIFEST_VERSION) {
+		fclose(fp);
+		return false;
+	}
+	make_archive_path(base_dir, PACKAGE_FILE, path, sizeof(path));
+	if (!get_file_stat(path, &real_size, &real_mtime) || real_size != size ||
+	    count == 0 || count > SIZE_MAX / sizeof(struct file_entry)) {
+		fclose(fp);
+		return false;
+	}
+
+	/* Read the entries. */
+	old_entry = calloc((size_t)count, sizeof(struct file_entry));
+	old_info = calloc((size_t)count, sizeof(struct entry_info));
+	old_sorted = calloc((size_t)count, sizeof(uint64_t));
+	if (old_entry == NULL || old_info == NULL || old_sorted == NULL) {
+		log_memory();
+		fclose(fp);
+		free_old_entries();
+		return false;
+	}
+	for (i = 0; i < count; i++) {
+		if (fgets(line, sizeof(line), fp) == NULL)
+			break;
+		if (sscanf(line, "%llx %llu %llu %llu %llu %llu %n", &hash, &mtime,
+			   &raw_size, &stored_size, &offset, &codec, &n) != 6)
+			break;
+		name = line + n;
+		nl = strchr(name, '\n');
+		if (nl != NULL)
+			*nl = '\0';
+		if (strlen(name) >= FILE_NAME_SIZE || offset > size || stored_size > size - offset ||
+		    (codec != PACKAGE_CODEC_NONE && codec != PACKAGE_CODEC_DEFLATE))
+			break;
+		strcpy(old_entry[i].name, name);
+		old_entry[i].raw_size = raw_size;
+		old_entry[i].size = stored_size;
+		old_entry[i].offset = offset;
+		old_entry[i].codec = codec;
+		old_info[i].hash = hash;
+		old_info[i].mtime = mtime;
+		old_sorted[i] = i;
+	}
+	fclose(fp);
+	if (i != count) {
+		free_old_entries();
+		return false;
+	}
+	old_count = count;
+	old_archive_size = size;
+
+	/* Sort the entries by name for lookups. */
+	qsort(old_sorted, (size_t)old_count, sizeof(uint64_t), cmp_old_entry);
+
+	return true;
+}
+
+/* Write the manifest of the archive. */
+static bool write_manifest(const char *base_dir)
+{
+	char path[1024];
+	FILE *fp;
+	uint64_t i;
+
+	make_archive_path(base_dir, MANIFEST_FILE, path, sizeof(path));
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		log_file_open(MANIFEST_FILE);
+		return false;
+	}
+
+	fprintf(fp, MANIFEST_SIGNATURE " %d %llu %llu\n", MANIFEST_VERSION,
+		(unsigned long long)archive_size, (unsigned long long)file_count);
+	for (i = 0; i < file_count; i++) {
+		fprintf(fp, "%016llx %llu %llu %llu %llu %llu %s\n",
+			(unsigned long long)info[i].hash,
+			(unsigned long long)info[i].mtime,
+			(unsigned long long)entry[i].raw_size,
+			(unsigned long long)entry[i].size,
+			(unsigned long long)entry[i].offset,
+			(unsigned long long)entry[i].codec,
+			entry[i].name);
+	}
+	if (fclose(fp) != 0) {
+		log_file_write(MANIFEST_FILE);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Decide the order of the bodies.
+ *  - The files in the access trace come first in the first-touch order, so
+ *    that the files used together are placed next to each other.
+ *  - The rest follow in the entry order.
+ */
+static bool order_bodies(void)
+{
+	FILE *fp;
+	char line[1024];
+	bool *placed;
+	uint64_t i, index, count;
+	size_t len;
+
+	layout = malloc((file_count > 0 ? (size_t)file_count : 1) * sizeof(uint64_t));
+	placed = calloc(file_count > 0 ? (size_t)file_count : 1, sizeof(bool));
+	if (layout == NULL || placed == NULL) {
+		log_memory();
+		free(placed);
+		return false;
+	}
+	count = 0;
+
+	/* Place the traced files. (A missing trace is not an error.) */
+	fp = trace_path != NULL ? fopen(trace_path, "r") : NULL;
+	if (fp != NULL) {
+		name_sorted = malloc((file_count > 0 ? (size_t)file_count : 1) * sizeof(uint64_t));
+		if (name_sorted == NULL) {
+			log_memory();
+			fclose(fp);
+			free(placed);
+			return false;
+		}
+		for (i = 0; i < file_count; i++)
+			name_sorted[i] = i;
+		qsort(name_sorted, (size_t)file_count, sizeof(uint64_t), cmp_entry_name);
+
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			len = strlen(line);
+			while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+				line[--len] = '\0';
+			index = find_entry_by_name(line);
+			if (index == NO_ENTRY || placed[index])
+				continue;
+			placed[index] = true;
+			layout[count++] = index;
+		}
+		fclose(fp);
+	}
+
+	/* Place the rest. */
+	for (i = 0; i < file_count; i++) {
+		if (!placed[i])
+			layout[count++] = i;
+	}
+	assert(count == file_count);
+
+	free(placed);
+	return true;
+}
+
+/* Find an entry by name. (Case-insensitive as file.c) */
+static uint64_t find_entry_by_name(const char *name)
+{
+	uint64_t lo, hi, mid;
+	int cmp;
+
+	lo = 0;
+	hi = file_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strcasecmp(name, entry[name_sorted[mid]].name);
+		if (cmp == 0)
+			return name_sorted[mid];
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NO_ENTRY;
+}
+
+/* Compare the names of the entries. */
+static int cmp_entry_name(const void *a, const void *b)
+{
+	return strcasecmp(entry[*(const uint64_t *)a].name,
+			  entry[*(const uint64_t *)b].name);
+}
+
+/*
+ * Find the files with the same content.
+ *  - A file is a duplicate of the first file with the same hash and size.
+ *  - On an update, the bodies in the archive are preferred.
+ *  - The contents are compared to be sure.
+ */
+static bool dedupe_entries(void)
+{
+	uint64_t *slot;
+	uint64_t i, h, mask, size, c;
+	int pass;
+
+	/* Make a hash table. (The hash is already a hash.) */
+	size = 16;
+	while (size < file_count * 2)
+		size *= 2;
+	mask = size - 1;
+	slot = calloc((size_t)size, sizeof(uint64_t));
+	if (slot == NULL) {
+		log_memory();
+		return false;
+	}
+
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < file_count; i++) {
+			/* On an update, register the bodies in the archive first. */
+			if (is_updating && (pass == 0) != (info[i].source == SOURCE_ARCHIVE))
+				continue;
+			if (!is_updating && pass == 1)
+				break;
+
+			for (h = info[i].hash & mask; slot[h] != 0; h = (h + 1) & mask) {
+				c = slot[h] - 1;
+				if (info[c].hash == info[i].hash &&
+				    entry[c].raw_size == entry[i].raw_size)
+					break;
+			}
+			if (slot[h] == 0) {
+				slot[h] = i + 1;
+				continue;
+			}
+			info[i].dup_of = slot[h] - 1;
+		}
+	}
+	free(slot);
+
+	/* Compare the contents of the duplicates. */
+	if (!run_jobs(verify_duplicate, false))
+		return false;
+
+	/* Share the bodies. */
+	for (i = 0; i < file_count; i++) {
+		c = info[i].dup_of;
+		if (c == NO_ENTRY)
+			continue;
+		entry[i].size = entry[c].size;
+		entry[i].codec = entry[c].codec;
+		if (kept_body[i] != NULL) {
+			free(kept_body[i]);
+			kept_body[i] = NULL;
+		}
+	}
+
+	return true;
+}
+
+/* Check a duplicate by comparing the contents. */
+static bool verify_duplicate(uint64_t index)
+{
+	/* Not the same in fact: the hash collided. */
+	if (info[index].dup_of != NO_ENTRY && !is_same_file(index, info[index].dup_of))
+		info[index].dup_of = NO_ENTRY;
+	return true;
+}
+
+/* Compare the contents of two input files. */
+static bool is_same_file(uint64_t a, uint64_t b)
+{
+	FILE *fp[2];
+	char path[1024];
+	char *buf;
+	size_t len[2];
+	bool same;
+
+	make_input_path(a, path, sizeof(path));
+	fp[0] = fopen(path, "rb");
+	make_input_path(b, path, sizeof(path));
+	fp[1] = fopen(path, "rb");
+	buf = malloc(CHUNK_SIZE * 2);
+	same = fp[0] != NULL && fp[1] != NULL && buf != NULL;
+	while (same) {
+		len[0] = fread(buf, 1, CHUNK_SIZE, fp[0]);
+		len[1] = fread(buf + CHUNK_SIZE, 1, CHUNK_SIZE, fp[1]);
+		if (len[0] != len[1] || memcmp(buf, buf + CHUNK_SIZE, len[0]) != 0)
+			same = false;
+		if (len[0] < CHUNK_SIZE)
+			break;
+	}
+	free(buf);
+	if (fp[0] != NULL)
+		fclose(fp[0]);
+	if (fp[1] != NULL)
+		fclose(fp[1]);
+
+	return same;
+}
+
+/* Find an entry in the old archive by name. */
+static uint64_t find_old_entry(const char *name)
+{
+	uint64_t lo, hi, mid;
+	int cmp;
+
+	lo = 0;
+	hi = old_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strcmp(name, old_entry[old_sorted[mid]].name);
+		if (cmp == 0)
+			return old_sorted[mid];
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NO_ENTRY;
+}
+
+/* Compare the names of the old entries. */
+static int cmp_old_entry(const void *a, const void *b)
+{
+	return strcmp(old_entry[*(const uint64_t *)a].name,
+		      old_entry[*(const uint64_t *)b].name);
+}
+
+/* Free the old entries. */
+static void free_old_entries(void)
+{
+	free(old_entry);
+	old_entry = NULL;
+	free(old_info);
+	old_info = NULL;
+	free(old_sorted);
+	old_sorted = NULL;
+	old_count = 0;
+	old_archive_size = 0;
+}
+
+/*
+ * Worker threads
+ */
+
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+static DWORD WINAPI job_thread(LPVOID param)
+{
+	UNUSED_PARAMETER(param);
+	do_jobs();
+	return 0;
+}
+#else
+static void *job_thread(void *param)
+{
+	UNUSED_PARAMETER(param);
+	do_jobs();
+	return NULL;
+}
+#endif
+
+/* Run a function for each file entry on the worker threads. */
+static bool run_jobs(bool (*func)(uint64_t index), bool progress)
+{
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	HANDLE thread[JOBS_MAX];
+#else
+	pthread_t thread[JOBS_MAX];
+#endif
+	int i, jobs, started;
+
+	job_func = func;
+	job_progress = progress;
+	job_next = 0;
+	job_failed = false;
+
+	jobs = get_job_count();
+	if ((uint64_t)jobs > file_count)
+		jobs = file_count > 0 ? (int)file_count : 1;
+
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	InitializeCriticalSection(&job_lock);
+#endif
+
+	/* Start the worker threads. (The current thread is the last one.) */
+	started = 0;
+	for (i = 0; i < jobs - 1; i++) {
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+		thread[i] = CreateThread(NULL, 0, job_thread, NULL, 0, NULL);
+		if (thread[i] == NULL)
+			break;
+#else
+		if (pthread_create(&thread[i], NULL, job_thread, NULL) != 0)
+			break;
+#endif
+		started++;
+	}
+
+	/* Work on the current thread, too. */
+	do_jobs();
+
+	/* Wait for the worker threads. */
+	for (i = 0; i < started; i++) {
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+		WaitForSingleObject(thread[i], INFINITE);
+		CloseHandle(thread[i]);
+#else
+		pthread_join(thread[i], NULL);
+#endif
+	}
+
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	DeleteCriticalSection(&job_lock);
+#endif
+
+	return !job_failed;
+}
+
+/* Take file entries one by one and process them. */
+static void do_jobs(void)
+{
+	uint64_t index;
+	bool success;
+
+	while (1) {
+		lock_jobs();
+		if (job_failed || job_next >= file_count) {
+			unlock_jobs();
+			break;
+		}
+		index = job_next++;
+		unlock_jobs();
+
+		success = job_func(index);
+
+		lock_jobs();
+		if (!success)
+			job_failed = true;
+		if (job_progress) {
+			job_done++;
+			if (success && progress_func != NULL)
+				progress_func(job_done, file_count * 2);
+		}
+		unlock_jobs();
+	}
+}
+
+/* Get the number of the worker threads. */
+static int get_job_count(void)
+{
+	int jobs;
+
+	jobs = job_count;
+	if (jobs == 0) {
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		jobs = (int)si.dwNumberOfProcessors;
+#else
+		jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	}
+	if (jobs < 1)
+		jobs = 1;
+	if (jobs > JOBS_MAX)
+		jobs = JOBS_MAX;
+
+	return jobs;
+}
+
+static void lock_jobs(void)
+{
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	EnterCriticalSection(&job_lock);
+#else
+	pthread_mutex_lock(&job_lock);
+#endif
+}
+
+static void unlock_jobs(void)
+{
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	LeaveCriticalSection(&job_lock);
+#else
+	pthread_mutex_unlock(&job_lock);
+#endif
+}
+
+/*
+ * Output archive
+ */
+
+/* Open the archive file. (Truncated unless updating) */
+static bool open_archive(const char *path, bool update)
+{
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	archive_handle = CreateFileW(conv_utf8_to_utf16(path), GENERIC_READ | GENERIC_WRITE,
+				     FILE_SHARE_READ, NULL,
+				     update ? OPEN_EXISTING : CREATE_ALWAYS,
+				     FILE_ATTRIBUTE_NORMAL, NULL);
+	if (archive_handle == INVALID_HANDLE_VALUE) {
+		log_file_open(PACKAGE_FILE);
+		return false;
+	}
+#else
+	archive_fd = open(path, update ? O_RDWR : (O_WRONLY | O_CREAT | O_TRUNC), 0644);
+	if (archive_fd == -1) {
+		log_file_open(PACKAGE_FILE);
+		return false;
+	}
+#endif
+	return true;
+}
+
+/* Write bytes to a position of the archive file. (Thread-safe) */
+static bool write_archive_at(const void *buf, size_t size, uint64_t pos)
+{
+	const char *p;
+
+	p = buf;
+	while (size > 0) {
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+		OVERLAPPED ov;
+		DWORD len, written;
+		len = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = (DWORD)pos;
+		ov.OffsetHigh = (DWORD)(pos >> 32);
+		if (!WriteFile(archive_handle, p, len, &written, &ov) || written == 0)
+			return false;
+#else
+		ssize_t written;
+		written = pwrite(archive_fd, p, size, (off_t)pos);
+		if (written == -1 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+#endif
+		p += written;
+		pos += (uint64_t)written;
+		size -= (size_t)written;
+	}
+	return true;
+}
+
+/* Close the archive file. */
+static bool close_archive(void)
+{
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	bool success = CloseHandle(archive_handle) ? true : false;
+	archive_handle = INVALID_HANDLE_VALUE;
+#else
+	bool success = close(archive_fd) == 0;
+	archive_fd = -1;
+#endif
+	return success;
+}
+
+/* Open the old archive to copy bodies. */
+static bool open_old_archive(const char *path)
+{
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	old_handle = CreateFileW(conv_utf8_to_utf16(path), GENERIC_READ,
+				 FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+				 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (old_handle == INVALID_HANDLE_VALUE)
+		return false;
+#else
+	old_fd = open(path, O_RDONLY);
+	if (old_fd == -1)
+		return false;
+#endif
+	return true;
+}
+
+/* Read bytes at a position of the old archive. (Thread-safe) */
+static bool read_old_archive_at(void *buf, size_t size, uint64_t pos)
+{
+	char *p;
+
+	p = buf;
+	while (size > 0) {
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+		OVERLAPPED ov;
+		DWORD len, read;
+		len = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = (DWORD)pos;
+		ov.OffsetHigh = (DWORD)(pos >> 32);
+		if (!ReadFile(old_handle, p, len, &read, &ov) || read == 0)
+			return false;
+#else
+		ssize_t read;
+		read = pread(old_fd, p, size, (off_t)pos);
+		if (read == -1 && errno == EINTR)
+			continue;
+		if (read <= 0)
+			return false;
+#endif
+		p += read;
+		pos += (uint64_t)read;
+		size -= (size_t)read;
+	}
+	return true;
+}
+
+/* Close the old archive. */
+static void close_old_archive(void)
+{
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	if (old_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(old_handle);
+	old_handle = INVALID_HANDLE_VALUE;
+#else
+	if (old_fd != -1)
+		close(old_fd);
+	old_fd = -1;
+#endif
+}
+
+/* Replace the archive with the new one. */
+static bool replace_archive(const char *from, const char *to)
+{
+#ifdef POLARIS_ENGINE_TARGET_WIN32
+	wchar_t wfrom[1024];
+	wcsncpy(wfrom, conv_utf8_to_utf16(from), 1023);
+	wfrom[1023] = L'\0';
+	return MoveFileExW(wfrom, conv_utf8_to_utf16(to), MOVEFILE_REPLACE_EXISTING) ? true : false;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+/*
+ * Encode bytes by the version 2 keystream.
+ *  - The bytes in buf are at the position pos of the stream of the nonce.
+ *  - This must be the same as decode_blocks() in file.c
+ */
+static void encode_blocks(uint64_t nonce, uint64_t pos, char *buf, size_t size)
+{
+	uint64_t base, block, z;
+	size_t i, w, skip, len;
+
+	base = OBFUSCATION_KEY ^ (nonce * BLOCK_MUL1);
+	while (size > 0) {
+		/* Generate a keystream word per 8 bytes. */
+		block = pos / PACKAGE_BLOCK_SIZE;
+		w = (size_t)((pos % PACKAGE_BLOCK_SIZE) / 8);
+		z = base ^ (block * BLOCK_MUL2);
+		z += (uint64_t)(w + 1) * BLOCK_MUL1;
+		z = (z ^ (z >> 30)) * BLOCK_MUL2;
+		z = (z ^ (z >> 27)) * BLOCK_MUL3;
+		z ^= z >> 31;
+
+		/* XOR the bytes in the word. */
+		skip = (size_t)(pos % 8);
+		len = 8 - skip < size ? 8 - skip : size;
+		for (i = 0; i < len; i++)
+			buf[i] ^= (char)(z >> ((skip + i) * 8));
+
+		buf += len;
+		pos += len;
+		size -= len;
+	}
 }
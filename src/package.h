@@ -17,4 +17,16 @@
 /* パッケージを作成する */
 bool create_package(const char *base_dir);
 
+/* パッケージを差分更新する (マニフェストがなければ作成する) */
+bool update_package(const char *base_dir);
+
+/* パッケージ作成のスレッド数を設定する (0なら論理プロセッサ数) */
+void set_package_jobs(int jobs);
+
+/* アクセストレースを設定する (初回アクセス順にファイル本体を配置する, NULLで無効) */
+void set_package_access_trace(const char *file);
+
+/* パッケージ作成の進捗コールバックを設定する */
+void set_package_progress_callback(void (*func)(uint64_t done, uint64_t total));
+
 #endif
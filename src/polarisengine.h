@@ -33,6 +33,7 @@
 #include "anime.h"	/* The animation subsystem */
 #include "ciel.h"	/* The Ciel direction subsystem */
 #include "conf.h"	/* The configuration subsystem */
+#include "cpu.h"	/* The CPU feature subsystem */
 #include "event.h"	/* The event handling subsystem */
 #include "file.h"	/* The file subsystem */
 #include "glyph.h"	/* The glyph rendering and text layout subsystem */
@@ -52,6 +53,7 @@
 #include "vars.h"	/* The variable subsystem */
 #include "wave.h"	/* The sound stream subsystem */
 #include "wms.h"	/* The WMS subsystem */
+#include "workers.h"	/* The worker thread subsystem */
 
 /* Polaris Engine Pro */
 #if defined(USE_EDITOR)
@@ -7,6 +7,14 @@
 
 #include "polarisengine.h"
 
+/* SIMD */
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+#include <emmintrin.h>
+#include <immintrin.h>	/* AVX2は実行時に選択する */
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+
 struct image *create_image_from_file_png(const char *dir, const char *file);
 #if !defined(NO_JPEG)
 struct image *create_image_from_file_jpeg(const char *dir, const char *file);
@@ -15,9 +23,43 @@ struct image *create_image_from_file_jpeg(const char *dir, const char *file);
 struct image *create_image_from_file_webp(const char *dir, const char *file);
 #endif
 
+/*
+ * 共有データのデコード結果キャッシュ
+ *  - パッケージ内で同じデータを共有するファイルは、一度だけデコードする
+ */
+#define SHARED_CACHE_COUNT	(8)
+#define SHARED_CACHE_BYTES	(64 * 1024 * 1024)
+
+static struct shared_image {
+	/* パッケージ内データの識別子 */
+	uint64_t id;
+
+	/* デコード結果 (NULLなら空き) */
+	struct image *img;
+
+	/* 最後に使用された時刻 */
+	uint64_t last_used;
+} shared_cache[SHARED_CACHE_COUNT];
+
+/* キャッシュの時刻 */
+static uint64_t shared_cache_clock;
+
+/* キャッシュの合計バイト数 */
+static size_t shared_cache_bytes;
+
+#if !defined(USE_PREMULTIPLIED_ALPHA)
+/* 完全に透明なピクセルを0にする関数 (select_clear_transparent()で選択する) */
+static void (*clear_transparent)(pixel_t *p, size_t n);
+#endif
+
 /*
  * 前方参照
  */
+static struct image *load_image(const char *dir, const char *file,
+				struct image *(*loader)(const char *, const char *));
+static struct image *find_shared_image(uint64_t id);
+static void add_shared_image(uint64_t id, struct image *img);
+static void evict_shared_image(int index);
 static bool is_png_ext(const char *str);
 #if !defined(NO_JPEG)
 static bool is_jpg_ext(const char *str);
@@ -25,6 +67,9 @@ static bool is_jpg_ext(const char *str);
 #if !defined(NO_WEBP)
 static bool is_webp_ext(const char *str);
 #endif
+#if !defined(USE_PREMULTIPLIED_ALPHA)
+static void select_clear_transparent(void);
+#endif
 
 /*
  * イメージをファイルから読み込む
@@ -33,14 +78,13 @@ struct image *create_image_from_file(const char *dir, const char *file)
 {
 	char fname[128];
 	struct image *img;
-	int y, x;
 
 	if (0) {
 	}
 #if !defined(NO_JPEG)
 	/* JPEGファイルの場合 */
 	else if (is_jpg_ext(file)) {
-		img = create_image_from_file_jpeg(dir, file);
+		img = load_image(dir, file, create_image_from_file_jpeg);
 		if (img == NULL)
 			return NULL;
 		return img;
@@ -49,14 +93,14 @@ struct image *create_image_from_file(const char *dir, const char *file)
 #if !defined(NO_WEBP)
 	/* WebPファイルの場合 */
 	else if (is_webp_ext(file)) {
-		img = create_image_from_file_webp(dir, file);
+		img = load_image(dir, file, create_image_from_file_webp);
 		if (img == NULL)
 			return NULL;
 	}
 #endif
 	/* PNGファイルの場合 */
 	else if (is_png_ext(file)) {
-		img = create_image_from_file_png(dir, file);
+		img = load_image(dir, file, create_image_from_file_png);
 		if (img == NULL)
 			return NULL;
 	} else {
@@ -64,7 +108,7 @@ struct image *create_image_from_file(const char *dir, const char *file)
 			/* 自動拡張子付与(.png)でチェックする */
 			snprintf(fname, sizeof(fname), "%s.png", file);
 			if (check_file_exist(dir, fname)) {
-				img = create_image_from_file_png(dir, fname);
+				img = load_image(dir, fname, create_image_from_file_png);
 				if (img == NULL)
 					return NULL;
 				break;
@@ -73,7 +117,7 @@ struct image *create_image_from_file(const char *dir, const char *file)
 			/* 自動拡張子付与(.PNG)でチェックする */
 			snprintf(fname, sizeof(fname), "%s.PNG", file);
 			if (check_file_exist(dir, fname)) {
-				img = create_image_from_file_png(dir, fname);
+				img = load_image(dir, fname, create_image_from_file_png);
 				if (img == NULL)
 					return NULL;
 				break;
@@ -83,7 +127,7 @@ struct image *create_image_from_file(const char *dir, const char *file)
 			/* 自動拡張子付与(.jpg)でチェックする */
 			snprintf(fname, sizeof(fname), "%s.jpg", file);
 			if (check_file_exist(dir, fname)) {
-				img = create_image_from_file_jpeg(dir, fname);
+				img = load_image(dir, fname, create_image_from_file_jpeg);
 				if (img == NULL)
 					return NULL;
 				break;
@@ -92,7 +136,7 @@ struct image *create_image_from_file(const char *dir, const char *file)
 			/* 自動拡張子付与(.JPG)でチェックする */
 			snprintf(fname, sizeof(fname), "%s.JPG", file);
 			if (check_file_exist(dir, fname)) {
-				img = create_image_from_file_jpeg(dir, fname);
+				img = load_image(dir, fname, create_image_from_file_jpeg);
 				if (img == NULL)
 					return NULL;
 				break;
@@ -103,7 +147,7 @@ struct image *create_image_from_file(const char *dir, const char *file)
 			/* 自動拡張子付与(.webp)でチェックする */
 			snprintf(fname, sizeof(fname), "%s.webp", file);
 			if (check_file_exist(dir, fname)) {
-				img = create_image_from_file_webp(dir, fname);
+				img = load_image(dir, fname, create_image_from_file_webp);
 				if (img == NULL)
 					return NULL;
 				break;
@@ -112,7 +156,7 @@ struct image *create_image_from_file(const char *dir, const char *file)
 			/* 自動拡張子付与(.WEBP)でチェックする */
 			snprintf(fname, sizeof(fname), "%s.WEBP", file);
 			if (check_file_exist(dir, fname)) {
-				img = create_image_from_file_webp(dir, fname);
+				img = load_image(dir, fname, create_image_from_file_webp);
 				if (img == NULL)
 					return NULL;
 				break;
@@ -120,21 +164,142 @@ struct image *create_image_from_file(const char *dir, const char *file)
 #endif
 
 			/* その他の場合はPNGとして開いてみる */
-			img = create_image_from_file_png(dir, file);
+			img = load_image(dir, file, create_image_from_file_png);
 			if (img == NULL)
 				return NULL;
 		} while (0);
 	}
 
+#if defined(USE_PREMULTIPLIED_ALPHA)
+	/* 色にアルファ値を乗算する (完全に透明なピクセルのRGB値は0になる) */
+	premultiply_image_alpha(img);
+#else
 	/* 完全に透明なピクセルのRGB値を0にする */
-	for (y = 0; y < img->height; y++)
-		for (x = 0; x < img->width; x++)
-			if (get_pixel_a(img->pixels[y * img->width + x]) == 0)
-				img->pixels[y * img->width + x] = make_pixel(0, 0, 0, 0);
+	select_clear_transparent();
+	clear_transparent(img->pixels, (size_t)img->width * (size_t)img->height);
+#endif
+
+	/* 描画を省くために、アルファ値が0でない範囲と不透明かを調べておく */
+	analyze_image_alpha(img);
 
 	return img;
 }
 
+/*
+ * 共有データのデコード結果キャッシュを解放する
+ */
+void cleanup_image_cache(void)
+{
+	int i;
+
+	for (i = 0; i < SHARED_CACHE_COUNT; i++)
+		if (shared_cache[i].img != NULL)
+			evict_shared_image(i);
+	shared_cache_clock = 0;
+}
+
+/* 画像をデコードする (共有データならキャッシュを使う) */
+static struct image *load_image(const char *dir, const char *file,
+				struct image *(*loader)(const char *, const char *))
+{
+	struct image *img;
+	uint64_t id;
+	bool shared;
+
+	/* 共有データで、デコード済みならコピーを返す */
+	shared = get_shared_body_id(dir, file, &id);
+	if (shared) {
+		img = find_shared_image(id);
+		if (img != NULL)
+			return img;
+	}
+
+	/* デコードする */
+	img = loader(dir, file);
+	if (img == NULL)
+		return NULL;
+
+	/* 共有データならキャッシュに追加する */
+	if (shared)
+		add_shared_image(id, img);
+
+	return img;
+}
+
+/* キャッシュからコピーを作成する */
+static struct image *find_shared_image(uint64_t id)
+{
+	struct image *img;
+	int i;
+
+	for (i = 0; i < SHARED_CACHE_COUNT; i++) {
+		if (shared_cache[i].img == NULL || shared_cache[i].id != id)
+			continue;
+
+		img = create_image(shared_cache[i].img->width, shared_cache[i].img->height);
+		if (img == NULL)
+			return NULL;
+		memcpy(img->pixels, shared_cache[i].img->pixels,
+		       (size_t)img->width * (size_t)img->height * sizeof(pixel_t));
+		shared_cache[i].last_used = ++shared_cache_clock;
+		return img;
+	}
+	return NULL;
+}
+
+/* キャッシュにコピーを追加する */
+static void add_shared_image(uint64_t id, struct image *img)
+{
+	struct image *copy;
+	size_t bytes;
+	int i, slot, lru;
+
+	/* 大きすぎる画像はキャッシュしない */
+	bytes = (size_t)img->width * (size_t)img->height * sizeof(pixel_t);
+	if (bytes > SHARED_CACHE_BYTES)
+		return;
+
+	/* 空きと容量ができるまで、最も古いものを捨てる */
+	while (1) {
+		slot = -1;
+		lru = -1;
+		for (i = 0; i < SHARED_CACHE_COUNT; i++) {
+			if (shared_cache[i].img == NULL) {
+				if (slot == -1)
+					slot = i;
+			} else if (lru == -1 ||
+				   shared_cache[i].last_used < shared_cache[lru].last_used) {
+				lru = i;
+			}
+		}
+		if (slot != -1 && shared_cache_bytes + bytes <= SHARED_CACHE_BYTES)
+			break;
+		evict_shared_image(lru);
+	}
+
+	/* コピーを作成する */
+	copy = create_image(img->width, img->height);
+	if (copy == NULL)
+		return;
+	memcpy(copy->pixels, img->pixels, bytes);
+
+	shared_cache[slot].id = id;
+	shared_cache[slot].img = copy;
+	shared_cache[slot].last_used = ++shared_cache_clock;
+	shared_cache_bytes += bytes;
+}
+
+/* キャッシュのエントリを捨てる */
+static void evict_shared_image(int index)
+{
+	struct image *img;
+
+	img = shared_cache[index].img;
+	shared_cache_bytes -= (size_t)img->width * (size_t)img->height * sizeof(pixel_t);
+	destroy_image(img);
+	shared_cache[index].img = NULL;
+}
+
 /* 拡張子がPNGであるかチェックする */
 static bool is_png_ext(const char *str)
 {
@@ -178,3 +343,97 @@ static bool is_webp_ext(const char *str)
 	return false;
 }
 #endif
+
+#if !defined(USE_PREMULTIPLIED_ALPHA)
+/*
+ * 完全に透明なピクセルを0にする
+ *  - x86_64ではSSE2/AVX2、ARM64ではNEONの実装を実行時に選択する
+ *  - 端数のピクセルはスカラで処理する
+ */
+
+static INLINE void clear_transparent_tail(pixel_t *p, size_t n, size_t i)
+{
+	for (; i < n; i++)
+		if ((p[i] & 0xff000000) == 0)
+			p[i] = 0;
+}
+
+static void clear_transparent_c(pixel_t *p, size_t n)
+{
+	clear_transparent_tail(p, n, 0);
+}
+
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+static void clear_transparent_sse2(pixel_t *p, size_t n)
+{
+	const __m128i amask = _mm_set1_epi32((int)0xff000000);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v, m;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(void *)(p + i));
+		m = _mm_cmpeq_epi32(_mm_and_si128(v, amask), zero);
+		_mm_storeu_si128((__m128i *)(void *)(p + i), _mm_andnot_si128(m, v));
+	}
+	clear_transparent_tail(p, n, i);
+}
+
+static TARGET_AVX2 void clear_transparent_avx2(pixel_t *p, size_t n)
+{
+	const __m256i amask = _mm256_set1_epi32((int)0xff000000);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i v, m;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *)(void *)(p + i));
+		m = _mm256_cmpeq_epi32(_mm256_and_si256(v, amask), zero);
+		_mm256_storeu_si256((__m256i *)(void *)(p + i), _mm256_andnot_si256(m, v));
+	}
+	clear_transparent_tail(p, n, i);
+}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+static void clear_transparent_neon(pixel_t *p, size_t n)
+{
+	const uint32x4_t amask = vdupq_n_u32(0xff000000);
+	uint32x4_t v;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = vld1q_u32(p + i);
+		vst1q_u32(p + i, vandq_u32(v, vtstq_u32(v, amask)));
+	}
+	clear_transparent_tail(p, n, i);
+}
+#endif
+
+/* 完全に透明なピクセルを0にする関数を選択する */
+static void select_clear_transparent(void)
+{
+	int tier;
+
+	if (clear_transparent != NULL)
+		return;
+
+	tier = get_cpu_tier();
+#if defined(POLARIS_ENGINE_ARCH_X86_64)
+	if (tier >= CPU_TIER_AVX2) {
+		clear_transparent = clear_transparent_avx2;
+		return;
+	}
+	if (tier >= CPU_TIER_SSE2) {
+		clear_transparent = clear_transparent_sse2;
+		return;
+	}
+#elif defined(POLARIS_ENGINE_ARCH_ARM64)
+	if (tier == CPU_TIER_NEON) {
+		clear_transparent = clear_transparent_neon;
+		return;
+	}
+#else
+	UNUSED_PARAMETER(tier);
+#endif
+	clear_transparent = clear_transparent_c;
+}
+#endif
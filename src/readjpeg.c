@@ -25,7 +25,7 @@ struct image *create_image_from_file_jpeg(const char *dir, const char *file)
 	struct rfile *rf;
 	struct image *img;
 	pixel_t *p;
-	unsigned char *raw_data;
+	const unsigned char *raw_data;
 	unsigned char *line;
 	size_t file_size;
 	unsigned int width, height, x, y;
@@ -39,22 +39,13 @@ struct image *create_image_from_file_jpeg(const char *dir, const char *file)
 	/* ファイルのサイズを取得する */
 	file_size = get_rfile_size(rf);
 
-	/* ファイル全体を読み込むメモリを確保する */
-	raw_data = malloc(file_size);
-	if (raw_data == NULL) {
-		log_memory();
-		close_rfile(rf);
-		return NULL;
-	}
-
-	/* ファイル全体を読み込む */
-	if (read_rfile(rf, raw_data, file_size) < file_size) {
+	/* ファイル全体をメモリにマップする (可能ならコピーしない) */
+	if (!map_rfile(rf)) {
 		log_image_file_error(dir, file);
-		free(raw_data);
 		close_rfile(rf);
 		return NULL;
 	}
-	close_rfile(rf);
+	raw_data = get_rfile_data(rf);
 
 	/* デコードを開始する */
 	jpeg_create_decompress(&jpeg);
@@ -69,7 +60,7 @@ struct image *create_image_from_file_jpeg(const char *dir, const char *file)
 	components = jpeg.out_color_components;
 	if (components != 3) {
 		log_image_file_error(dir, file);
-		free(raw_data);
+		close_rfile(rf);
 		jpeg_destroy_decompress(&jpeg);
 		return NULL;
 	}
@@ -78,7 +69,7 @@ struct image *create_image_from_file_jpeg(const char *dir, const char *file)
 	line = malloc(width * height * 3);
 	if (line == NULL) {
 		log_memory();
-		free(raw_data);
+		close_rfile(rf);
 		jpeg_destroy_decompress(&jpeg);
 		return NULL;
 	}
@@ -88,7 +79,7 @@ struct image *create_image_from_file_jpeg(const char *dir, const char *file)
 	if (img == NULL) {
 		log_memory();
 		free(line);
-		free(raw_data);
+		close_rfile(rf);
 		jpeg_destroy_decompress(&jpeg);
 		return NULL;
 	}
@@ -142,7 +133,7 @@ struct image *create_image_from_file_jpeg(const char *dir, const char *file)
 
 	/* 終了処理を行う */
 	free(line);
-	free(raw_data);
+	close_rfile(rf);
 	jpeg_destroy_decompress(&jpeg);
 
 	return img;
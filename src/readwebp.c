@@ -19,7 +19,8 @@ struct image *create_image_from_file_webp(const char *dir, const char *file)
 	struct image *img;
 	struct rfile *rf;
 	pixel_t *p;
-	uint8_t *pixels, *raw_data;
+	const uint8_t *raw_data;
+	uint8_t *pixels;
 	size_t file_size;
 	int width, height;
 	int x, y;
@@ -32,27 +33,18 @@ struct image *create_image_from_file_webp(const char *dir, const char *file)
 	/* ファイルのサイズを取得する */
 	file_size = get_rfile_size(rf);
 
-	/* ファイル全体を読み込むメモリを確保する */
-	raw_data = malloc(file_size);
-	if (raw_data == NULL) {
-		log_memory();
-		close_rfile(rf);
-		return NULL;
-	}
-
-	/* ファイル全体を読み込む */
-	if (read_rfile(rf, raw_data, file_size) < file_size) {
+	/* ファイル全体をメモリにマップする (可能ならコピーしない) */
+	if (!map_rfile(rf)) {
 		log_image_file_error(dir, file);
-		free(raw_data);
 		close_rfile(rf);
 		return NULL;
 	}
-	close_rfile(rf);
+	raw_data = get_rfile_data(rf);
 
 	/* 画像の幅と高さを取得する */
 	if (!WebPGetInfo(raw_data, file_size, &width, &height)) {
 		log_image_file_error(dir, file);
-		free(raw_data);
+		close_rfile(rf);
 		return NULL;
 	}
 
@@ -60,7 +52,7 @@ struct image *create_image_from_file_webp(const char *dir, const char *file)
 	img = create_image(width, height);
 	if (img == NULL) {
 		log_memory();
-		free(raw_data);
+		close_rfile(rf);
 		return NULL;
 	}
 
@@ -68,7 +60,7 @@ struct image *create_image_from_file_webp(const char *dir, const char *file)
 	pixels = WebPDecodeRGBA(raw_data, file_size, &width, &height);
 	if (pixels == NULL) {
 		log_image_file_error(dir, file);
-		free(raw_data);
+		close_rfile(rf);
 		return NULL;
 	}
 
@@ -108,7 +100,7 @@ struct image *create_image_from_file_webp(const char *dir, const char *file)
 
 	/* メモリを解放する */
 	WebPFree(pixels);
-	free(raw_data);
+	close_rfile(rf);
 
 	return img;
 }
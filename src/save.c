@@ -322,9 +322,14 @@ bool quick_save(bool extra)
 
 	fname = !extra ? QUICK_SAVE_FILE : QUICK_SAVE_EXTRA_FILE;
 
+	/* 3つのファイルをまとめてストレージに同期する */
+	begin_wfile_batch();
+
 	/* ローカルデータのシリアライズを行う */
-	if (!serialize_all(fname, &timestamp, -1))
+	if (!serialize_all(fname, &timestamp, -1)) {
+		end_wfile_batch();
 		return false;
+	}
 
 	/* 既読フラグのセーブを行う */
 	save_seen();
@@ -332,6 +337,10 @@ bool quick_save(bool extra)
 	/* グローバル変数のセーブを行う */
 	save_global_data();
 
+	/* ファイルを置き換える */
+	if (!end_wfile_batch())
+		return false;
+
 	/* クイックセーブの時刻を更新する */
 	quick_save_time = (time_t)timestamp;
 
@@ -358,9 +367,14 @@ bool execute_save(int index)
 	/* ファイル名を求める */
 	snprintf(s, sizeof(s), "%03d.sav", index);
 
+	/* 3つのファイルをまとめてストレージに同期する */
+	begin_wfile_batch();
+
 	/* ローカルデータのシリアライズを行う */
-	if (!serialize_all(s, &timestamp, index))
+	if (!serialize_all(s, &timestamp, index)) {
+		end_wfile_batch();
 		return false;
+	}
 
 	/* 既読フラグのセーブを行う */
 	save_seen();
@@ -368,6 +382,10 @@ bool execute_save(int index)
 	/* グローバル変数のセーブを行う */
 	save_global_data();
 
+	/* ファイルを置き換える */
+	if (!end_wfile_batch())
+		return false;
+
 	/* 時刻を保存する */
 	save_time[index] = (time_t)timestamp;
 
@@ -467,8 +485,11 @@ static bool serialize_all(const char *fname, uint64_t *timestamp, int index)
 		success = true;
 	} while (0);
 
-	/* ファイルをクローズする */
-	close_wfile(wf);
+	/* ファイルをクローズする (失敗時は古いファイルを残す) */
+	if (success)
+		success = close_wfile(wf);
+	else
+		discard_wfile(wf);
 
 	/* 時刻を保存する */
 	*timestamp = t;
@@ -1567,8 +1588,10 @@ void save_global_data(void)
 
 	/* マスターボリュームをシリアライズする */
 	f = get_master_volume();
-	if (write_wfile(wf, &f, sizeof(f)) < sizeof(f))
+	if (write_wfile(wf, &f, sizeof(f)) < sizeof(f)) {
+		discard_wfile(wf);
 		return;
+	}
 
 	/* グローバルボリュームをシリアライズする */
 	for (i = 0; i < MIXER_STREAMS; i++) {
@@ -132,8 +132,11 @@ bool save_seen(void)
 		success = true;
 	} while (0);
 
-	/* ファイルをクローズする */
-	close_wfile(wf);
+	/* ファイルをクローズする (失敗時は古いファイルを残す) */
+	if (success)
+		success = close_wfile(wf);
+	else
+		discard_wfile(wf);
 
 	return success;
 #endif
@@ -146,6 +146,10 @@ static float layer_center_x[STAGE_LAYERS];
 /* レイヤの中心Y座標 */
 static float layer_center_y[STAGE_LAYERS];
 
+/* FO/FIを描画する命令 (背景のクリアと各レイヤ) */
+static struct draw_op layer_ops[STAGE_LAYERS + 1];
+static int layer_op_count;
+
 /* レイヤの回転(rad) */
 static float layer_rotate[STAGE_LAYERS];
 
@@ -221,6 +225,7 @@ static bool setup_thumb(void);
 static void restore_text_layers(void);
 static bool create_fade_layer_images(void);
 static void destroy_layer_image(int layer);
+static void fill_layer_drawn_rect(struct image *img, struct image *src);
 static void draw_fo_common(void);
 static void draw_fi_common(bool show_msgbox);
 static void render_fade_normal(void);
@@ -251,7 +256,9 @@ static void render_fade_slit_open_v(void);
 static void render_fade_slit_close_v(void);
 static void render_fade_shake(void);
 static void render_layer_image(int layer);
-static void draw_layer_image(struct image *target, int layer);
+static void begin_layer_ops(void);
+static void add_layer_op(int layer);
+static void draw_layer_ops(struct image *target);
 
 /*
  * 初期化
@@ -1928,7 +1935,8 @@ void draw_stage_to_thumb(void)
 				 conf_window_height,
 				 layer_x[i],
 				 layer_y[i],
-				 layer_image[i]);
+				 layer_image[i],
+				 conf_save_data_thumb_filter);
 	}
 }
 
@@ -1937,7 +1945,8 @@ void draw_stage_to_thumb(void)
  */
 void draw_switch_to_thumb(struct image *img, int x, int y)
 {
-	draw_image_scale(thumb_image, conf_window_width, conf_window_height, x, y, img);
+	draw_image_scale(thumb_image, conf_window_width, conf_window_height, x, y, img,
+			 conf_save_data_thumb_filter);
 }
 
 /*
@@ -2315,89 +2324,85 @@ void finish_fade(void)
 /* FOにステージの内容を描画する */
 static void draw_fo_common(void)
 {
-	if (conf_window_white)
-		clear_image_white(fo_image);
-	else
-		clear_image_black(fo_image);
-	draw_layer_image(fo_image, LAYER_BG);
-	draw_layer_image(fo_image, LAYER_BG2);
-	draw_layer_image(fo_image, LAYER_EFFECT5);
-	draw_layer_image(fo_image, LAYER_EFFECT6);
-	draw_layer_image(fo_image, LAYER_EFFECT7);
-	draw_layer_image(fo_image, LAYER_EFFECT8);
-	draw_layer_image(fo_image, LAYER_CHB);
-	draw_layer_image(fo_image, LAYER_CHL);
-	draw_layer_image(fo_image, LAYER_CHLC);
-	draw_layer_image(fo_image, LAYER_CHR);
-	draw_layer_image(fo_image, LAYER_CHRC);
-	draw_layer_image(fo_image, LAYER_CHC);
-	draw_layer_image(fo_image, LAYER_EFFECT1);
-	draw_layer_image(fo_image, LAYER_EFFECT2);
-	draw_layer_image(fo_image, LAYER_EFFECT3);
-	draw_layer_image(fo_image, LAYER_EFFECT4);
+	begin_layer_ops();
+	add_layer_op(LAYER_BG);
+	add_layer_op(LAYER_BG2);
+	add_layer_op(LAYER_EFFECT5);
+	add_layer_op(LAYER_EFFECT6);
+	add_layer_op(LAYER_EFFECT7);
+	add_layer_op(LAYER_EFFECT8);
+	add_layer_op(LAYER_CHB);
+	add_layer_op(LAYER_CHL);
+	add_layer_op(LAYER_CHLC);
+	add_layer_op(LAYER_CHR);
+	add_layer_op(LAYER_CHRC);
+	add_layer_op(LAYER_CHC);
+	add_layer_op(LAYER_EFFECT1);
+	add_layer_op(LAYER_EFFECT2);
+	add_layer_op(LAYER_EFFECT3);
+	add_layer_op(LAYER_EFFECT4);
 	if (is_msgbox_visible)
-		draw_layer_image(fo_image, LAYER_MSG);
+		add_layer_op(LAYER_MSG);
 	if (is_namebox_visible && !conf_namebox_hidden)
-		draw_layer_image(fo_image, LAYER_NAME);
+		add_layer_op(LAYER_NAME);
 	if (is_msgbox_visible)
-		draw_layer_image(fo_image, LAYER_CHF);
+		add_layer_op(LAYER_CHF);
 	if (is_auto_visible)
-		draw_layer_image(fo_image, LAYER_AUTO);
+		add_layer_op(LAYER_AUTO);
 	if (is_skip_visible)
-		draw_layer_image(fo_image, LAYER_SKIP);
-	draw_layer_image(fo_image, LAYER_TEXT1);
-	draw_layer_image(fo_image, LAYER_TEXT2);
-	draw_layer_image(fo_image, LAYER_TEXT3);
-	draw_layer_image(fo_image, LAYER_TEXT4);
-	draw_layer_image(fo_image, LAYER_TEXT5);
-	draw_layer_image(fo_image, LAYER_TEXT6);
-	draw_layer_image(fo_image, LAYER_TEXT7);
-	draw_layer_image(fo_image, LAYER_TEXT8);
+		add_layer_op(LAYER_SKIP);
+	add_layer_op(LAYER_TEXT1);
+	add_layer_op(LAYER_TEXT2);
+	add_layer_op(LAYER_TEXT3);
+	add_layer_op(LAYER_TEXT4);
+	add_layer_op(LAYER_TEXT5);
+	add_layer_op(LAYER_TEXT6);
+	add_layer_op(LAYER_TEXT7);
+	add_layer_op(LAYER_TEXT8);
+	draw_layer_ops(fo_image);
 }
 
 /* FIにステージの内容を描画する */
 static void draw_fi_common(bool show_msgbox)
 {
-	if (conf_window_white)
-		clear_image_white(fi_image);
-	else
-		clear_image_black(fi_image);
-	draw_layer_image(fi_image, LAYER_BG);
-	draw_layer_image(fi_image, LAYER_BG2);
-	draw_layer_image(fi_image, LAYER_EFFECT5);
-	draw_layer_image(fi_image, LAYER_EFFECT6);
-	draw_layer_image(fi_image, LAYER_EFFECT7);
-	draw_layer_image(fi_image, LAYER_EFFECT8);
-	draw_layer_image(fi_image, LAYER_CHB);
-	draw_layer_image(fi_image, LAYER_CHL);
-	draw_layer_image(fi_image, LAYER_CHLC);
-	draw_layer_image(fi_image, LAYER_CHR);
-	draw_layer_image(fi_image, LAYER_CHRC);
-	draw_layer_image(fi_image, LAYER_CHC);
-	draw_layer_image(fi_image, LAYER_EFFECT1);
-	draw_layer_image(fi_image, LAYER_EFFECT2);
-	draw_layer_image(fi_image, LAYER_EFFECT3);
-	draw_layer_image(fi_image, LAYER_EFFECT4);
+	begin_layer_ops();
+	add_layer_op(LAYER_BG);
+	add_layer_op(LAYER_BG2);
+	add_layer_op(LAYER_EFFECT5);
+	add_layer_op(LAYER_EFFECT6);
+	add_layer_op(LAYER_EFFECT7);
+	add_layer_op(LAYER_EFFECT8);
+	add_layer_op(LAYER_CHB);
+	add_layer_op(LAYER_CHL);
+	add_layer_op(LAYER_CHLC);
+	add_layer_op(LAYER_CHR);
+	add_layer_op(LAYER_CHRC);
+	add_layer_op(LAYER_CHC);
+	add_layer_op(LAYER_EFFECT1);
+	add_layer_op(LAYER_EFFECT2);
+	add_layer_op(LAYER_EFFECT3);
+	add_layer_op(LAYER_EFFECT4);
 	if (show_msgbox) {
 		if (is_msgbox_visible)
-			draw_layer_image(fi_image, LAYER_MSG);
+			add_layer_op(LAYER_MSG);
 		if (is_namebox_visible && !conf_namebox_hidden)
-			draw_layer_image(fi_image, LAYER_NAME);
+			add_layer_op(LAYER_NAME);
 		if (is_msgbox_visible)
-			draw_layer_image(fi_image, LAYER_CHF);
+			add_layer_op(LAYER_CHF);
 	}
 	if (is_auto_visible)
-		draw_layer_image(fi_image, LAYER_AUTO);
+		add_layer_op(LAYER_AUTO);
 	if (is_skip_visible)
-		draw_layer_image(fi_image, LAYER_SKIP);
-	draw_layer_image(fi_image, LAYER_TEXT1);
-	draw_layer_image(fi_image, LAYER_TEXT2);
-	draw_layer_image(fi_image, LAYER_TEXT3);
-	draw_layer_image(fi_image, LAYER_TEXT4);
-	draw_layer_image(fi_image, LAYER_TEXT5);
-	draw_layer_image(fi_image, LAYER_TEXT6);
-	draw_layer_image(fi_image, LAYER_TEXT7);
-	draw_layer_image(fi_image, LAYER_TEXT8);
+		add_layer_op(LAYER_SKIP);
+	add_layer_op(LAYER_TEXT1);
+	add_layer_op(LAYER_TEXT2);
+	add_layer_op(LAYER_TEXT3);
+	add_layer_op(LAYER_TEXT4);
+	add_layer_op(LAYER_TEXT5);
+	add_layer_op(LAYER_TEXT6);
+	add_layer_op(LAYER_TEXT7);
+	add_layer_op(LAYER_TEXT8);
+	draw_layer_ops(fi_image);
 }
 
 /*
@@ -3958,12 +3963,7 @@ void fill_namebox(void)
 	if (namebox_image == NULL)
 		return;
 
-	draw_image_copy(layer_image[LAYER_NAME],
-			0, 0,
-			namebox_image,
-			layer_image[LAYER_NAME]->width,
-			layer_image[LAYER_NAME]->height,
-			0, 0);
+	fill_layer_drawn_rect(layer_image[LAYER_NAME], namebox_image);
 }
 
 /*
@@ -3997,12 +3997,27 @@ void fill_msgbox(void)
 	if (msgbox_bg_image == NULL)
 		return;
 
-	draw_image_copy(layer_image[LAYER_MSG],
-			0, 0,
-			msgbox_bg_image,
-			layer_image[LAYER_MSG]->width,
-			layer_image[LAYER_MSG]->height,
-			0, 0);
+	fill_layer_drawn_rect(layer_image[LAYER_MSG], msgbox_bg_image);
+}
+
+/*
+ * レイヤのイメージの描画された範囲だけを元の画像で埋める
+ *  - 範囲の外側は前回埋めたときのままなので、結果は全体を埋めるのと同じになる
+ *  - 作成直後のイメージは全体が描画された範囲になる
+ */
+static void fill_layer_drawn_rect(struct image *img, struct image *src)
+{
+	if (img->drawn_left < img->drawn_right && img->drawn_top < img->drawn_bottom) {
+		draw_image_copy(img,
+				img->drawn_left,
+				img->drawn_top,
+				src,
+				img->drawn_right - img->drawn_left,
+				img->drawn_bottom - img->drawn_top,
+				img->drawn_left,
+				img->drawn_top);
+	}
+	reset_image_drawn_rect(img);
 }
 
 /*
@@ -4335,10 +4350,24 @@ static void render_layer_image(int layer)
 			    layer_alpha[layer]);
 }
 
-/* レイヤを描画する */
-static void draw_layer_image(struct image *target, int layer)
+/* FO/FIを描画する命令を作り始める (背景色でクリアする命令を積む) */
+static void begin_layer_ops(void)
+{
+	layer_ops[0].type = DRAW_OP_CLEAR;
+	if (conf_window_white)
+		layer_ops[0].color = make_pixel(0xff, 0xff, 0xff, 0xff);
+	else
+		layer_ops[0].color = make_pixel(0xff, 0, 0, 0);
+	layer_op_count = 1;
+}
+
+/* レイヤを描画する命令を積む */
+static void add_layer_op(int layer)
 {
+	struct draw_op *op;
+
 	assert(layer >= 0 && layer < STAGE_LAYERS);
+	assert(layer_op_count < STAGE_LAYERS + 1);
 
 	/* 背景イメージは必ずセットされている必要がある */
 	if (layer == LAYER_BG)
@@ -4348,41 +4377,37 @@ static void draw_layer_image(struct image *target, int layer)
 	if (layer_image[layer] == NULL)
 		return;
 
+	op = &layer_ops[layer_op_count++];
+	op->src_image = layer_image[layer];
+	op->dst_left = layer_x[layer];
+	op->dst_top = layer_y[layer];
+	op->width = layer_image[layer]->width;
+	op->height = layer_image[layer]->height;
+	op->src_left = 0;
+	op->src_top = 0;
+	op->alpha = layer_alpha[layer];
+
 	/* 背景レイヤの場合 */
 	if (layer == LAYER_BG) {
-		draw_image_copy(target,
-				layer_x[layer],
-				layer_y[layer],
-				layer_image[layer],
-				layer_image[layer]->width,
-				layer_image[layer]->height,
-				0, 0);
+		op->type = DRAW_OP_COPY;
 		return;
 	}
 
 	/* キャラクタレイヤを暗く描画する場合 */
 	if (layer >= LAYER_CHB && layer <= LAYER_CHC &&
 	    ch_dim[layer_to_chpos(layer)]) {
-		draw_image_dim(target,
-			       layer_x[layer],
-			       layer_y[layer],
-			       layer_image[layer],
-			       layer_image[layer]->width,
-			       layer_image[layer]->height,
-			       0, 0,
-			       layer_alpha[layer]);
+		op->type = DRAW_OP_DIM;
 		return;
 	}
 
 	/* 普通に描画する */
-	draw_image_fast(target,
-			layer_x[layer],
-			layer_y[layer],
-			layer_image[layer],
-			layer_image[layer]->width,
-			layer_image[layer]->height,
-			0, 0,
-			layer_alpha[layer]);
+	op->type = DRAW_OP_FAST;
+}
+
+/* 積んだ命令でFO/FIを描画する */
+static void draw_layer_ops(struct image *target)
+{
+	draw_image_ops(target, layer_ops, layer_op_count);
 }
 
 /*
@@ -41,6 +41,8 @@
 #define POLARIS_ENGINE_TARGET_WASM
 #elif defined(USE_UNITY)
 #define POLARIS_ENGINE_TARGET_UNITY
+#elif defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#define POLARIS_ENGINE_TARGET_POSIX
 #else
 #error "No target detected."
 #endif
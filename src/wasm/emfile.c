@@ -119,6 +119,18 @@ bool check_file_exist(const char *dir, const char *file)
 	return true;
 }
 
+/*
+ * 複数のエントリで共有されるパッケージ内データの識別子を取得する
+ *  - パッケージを使用しないので、常に共有されない
+ */
+bool get_shared_body_id(const char *dir, const char *file, uint64_t *id)
+{
+	UNUSED_PARAMETER(dir);
+	UNUSED_PARAMETER(file);
+	UNUSED_PARAMETER(id);
+	return false;
+}
+
 /*
  * ファイル読み込みストリームを開く
  */
@@ -237,6 +249,68 @@ const char *gets_rfile(struct rfile *rf, char *buf, size_t size)
 	return buf;
 }
 
+/*
+ * ファイル読み込みストリームをシークする
+ */
+bool seek_rfile(struct rfile *rf, int64_t offset, int whence)
+{
+	int64_t base;
+
+	switch (whence) {
+	case SEEK_SET:
+		base = 0;
+		break;
+	case SEEK_CUR:
+		base = (int64_t)rf->pos;
+		break;
+	case SEEK_END:
+		base = (int64_t)rf->size;
+		break;
+	default:
+		return false;
+	}
+	if (offset < -base || (uint64_t)(base + offset) > rf->size)
+		return false;
+	rf->pos = (uint64_t)(base + offset);
+	return true;
+}
+
+/*
+ * ファイル読み込みストリームの現在位置を取得する
+ */
+uint64_t tell_rfile(struct rfile *rf)
+{
+	return rf->pos;
+}
+
+/*
+ * ファイル読み込みストリームがO(1)でシークできるか調べる
+ */
+bool is_rfile_seekable(struct rfile *rf)
+{
+	/* 内容全体がメモリ上にある */
+	UNUSED_PARAMETER(rf);
+	return true;
+}
+
+/*
+ * ファイル読み込みストリームの内容全体をメモリにマップする
+ */
+bool map_rfile(struct rfile *rf)
+{
+	/* 内容全体がすでにメモリ上にある */
+	rf->pos = 0;
+	return true;
+}
+
+/*
+ * マップされた内容へのポインタを取得する
+ */
+const void *get_rfile_data(struct rfile *rf)
+{
+	return rf->data;
+}
+
 /*
  * ファイル読み込みストリームを閉じる
  */
@@ -269,9 +343,33 @@ size_t write_wfile(struct wfile *wf, const void *buf, size_t size)
 /*
  * ファイル読み込みストリームを閉じる
  */
-void close_wfile(struct wfile *wf)
+bool close_wfile(struct wfile *wf)
 {
 	/* TODO */
+	return false;
+}
+
+/*
+ * ファイル書き込みストリームを破棄する
+ */
+void discard_wfile(struct wfile *wf)
+{
+	/* TODO */
+}
+
+/*
+ * ファイル書き込みのバッチを開始する
+ */
+void begin_wfile_batch(void)
+{
+}
+
+/*
+ * ファイル書き込みのバッチを終了する
+ */
+bool end_wfile_batch(void)
+{
+	return true;
 }
 
 /*
@@ -57,7 +57,10 @@ struct wave {
  * 前方参照
  */
 static bool reopen(struct wave *w, bool loop);
+static bool loop_back(struct wave *w, int sample_bytes);
 static size_t read_func(void *ptr, size_t size, size_t nmemb, void *datasource);
+static int seek_func(void *datasource, ogg_int64_t offset, int whence);
+static long tell_func(void *datasource);
 static int get_wave_samples_monaural(struct wave *w, uint32_t *buf, int samples);
 static int get_wave_samples_stereo(struct wave *w, uint32_t *buf, int samples);
 static void skip_if_needed(struct wave *w, int sample_bytes);
@@ -165,12 +168,22 @@ static bool reopen(struct wave *w, bool loop)
 		rewind_rfile(w->rf);
 	}
 
-	/* コールバックを使ってファイルを開く */
+	/*
+	 * コールバックを使ってファイルを開く
+	 *  - O(1)でシークできるときだけシーク可能として開く
+	 *  - vorbisfileはオープン時に終端までシークするので、バージョン1の
+	 *    パッケージではシークのたびに鍵ストリームを再生することになる
+	 */
 	memset(&cb, 0, sizeof(cb));
 	cb.read_func = read_func;
 	cb.close_func = NULL;
-	cb.seek_func = NULL;
-	cb.tell_func = NULL;
+	if (is_rfile_seekable(w->rf)) {
+		cb.seek_func = seek_func;
+		cb.tell_func = tell_func;
+	} else {
+		cb.seek_func = NULL;
+		cb.tell_func = NULL;
+	}
 	err = ov_open_callbacks(w, &w->ovf, NULL, 0, cb);
 	if (err != 0) {
 		log_audio_file_error(w->dir, w->file);
@@ -186,6 +199,22 @@ static bool reopen(struct wave *w, bool loop)
 	return true;
 }
 
+/* ループの先頭に戻る */
+static bool loop_back(struct wave *w, int sample_bytes)
+{
+	/* シーク可能であればLOOPSTARTへ直接シークする */
+	if (ov_seekable(&w->ovf) &&
+	    ov_pcm_seek(&w->ovf, (ogg_int64_t)w->loop_start) == 0) {
+		w->do_skip = false;
+		w->consumed_bytes = (long)w->loop_start * sample_bytes;
+		return true;
+	}
+
+	/* シークできなければストリームを再度オープンする */
+	ov_clear(&w->ovf);
+	return reopen(w, true);
+}
+
 /* ファイル読み込みコールバック */
 static size_t read_func(void *ptr, size_t size, size_t nmemb, void *datasource)
 {
@@ -202,6 +231,33 @@ static size_t read_func(void *ptr, size_t size, size_t nmemb, void *datasource)
 	return len / size;
 }
 
+/* ファイルシークコールバック */
+static int seek_func(void *datasource, ogg_int64_t offset, int whence)
+{
+	struct wave *w;
+
+	assert(datasource != NULL);
+
+	w = (struct wave *)datasource;
+
+	if (!seek_rfile(w->rf, (int64_t)offset, whence))
+		return -1;
+
+	return 0;
+}
+
+/* ファイル位置取得コールバック */
+static long tell_func(void *datasource)
+{
+	struct wave *w;
+
+	assert(datasource != NULL);
+
+	w = (struct wave *)datasource;
+
+	return (long)tell_rfile(w->rf);
+}
+
 #if 0
 /* ファイルクローズコールバック */
 static int close_func(void *datasource)
@@ -298,11 +354,10 @@ static int get_wave_samples_monaural(struct wave *w, uint32_t *buf, int samples)
 		if (ret_bytes == 0 || (loop_end && ret_bytes == read_bytes)) {
 			/* 終端に達した */
 			if ((w->loop && (w->times == -1 || w->times > 0)) || loop_end) {
-				/* ストリームを再度オープンする */
+				/* ループの先頭に戻る */
 				if (last_ret_bytes == 0)
 					return 0; 	/* エラー */
-				ov_clear(&w->ovf);
-				if (!reopen(w, true))
+				if (!loop_back(w, 2))
 					return 0;	/* エラー */
 				last_ret_bytes = 0;
 				if (w->times != -1)
@@ -356,11 +411,10 @@ static int get_wave_samples_stereo(struct wave *w, uint32_t *buf, int samples)
 		if (ret_bytes == 0 || (loop_end && ret_bytes == read_bytes)) {
 			/* 終端に達した */
 			if ((w->loop && (w->times == -1 || w->times > 0)) || loop_end) {
-				/* ストリームを再度オープンする */
+				/* ループの先頭に戻る */
 				if (last_ret_bytes == 0)
 					return 0; 	/* エラー */
-				ov_clear(&w->ovf);
-				if (!reopen(w, true))
+				if (!loop_back(w, 4))
 					return 0;	/* エラー */
 				last_ret_bytes = 0;
 				if (w->times != -1)
@@ -0,0 +1,314 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Polaris Engine
+ * Copyright (C) 2024, The Authors. All rights reserved.
+ */
+
+/*
+ * Worker Thread Pool
+ *  - The threads wait on a condition variable, and the main thread wakes
+ *    them up by incrementing the job generation.
+ *  - Every thread takes job indices one by one, so a slow index doesn't
+ *    stall the others.
+ */
+
+#include "polarisengine.h"
+
+#if defined(POLARIS_ENGINE_TARGET_WASM) || defined(POLARIS_ENGINE_TARGET_UNITY)
+#define NO_WORKERS
+#elif defined(POLARIS_ENGINE_TARGET_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* The maximum number of the worker threads. (Excluding the main thread.) */
+#define WORKERS_MAX	(15)
+
+#if !defined(NO_WORKERS)
+
+/* Threads */
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+static HANDLE thread[WORKERS_MAX];
+#else
+static pthread_t thread[WORKERS_MAX];
+#endif
+static int thread_count;
+
+/* Lock and condition variables */
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+static CRITICAL_SECTION lock;
+static CONDITION_VARIABLE wake_cond;
+static CONDITION_VARIABLE done_cond;
+#else
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+/* Job state (guarded by the lock) */
+static void (*job_func)(int index, void *arg);
+static void *job_arg;
+static int job_count;
+static int job_next;
+static int job_finished;
+static unsigned int job_generation;
+static bool quit;
+
+/*
+ * Forward declarations.
+ */
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+static DWORD WINAPI worker_thread(LPVOID param);
+#else
+static void *worker_thread(void *param);
+#endif
+static void run_on_threads(void (*func)(int index, void *arg), int count, void *arg);
+static void do_jobs(void);
+static int get_cpu_count(void);
+static void lock_workers(void);
+static void unlock_workers(void);
+static void wait_wake(void);
+static void wait_done(void);
+
+#endif /* !defined(NO_WORKERS) */
+
+/*
+ * Start the worker threads.
+ *  - Failing to create a thread is not an error. We just use fewer threads.
+ */
+bool init_workers(void)
+{
+#if !defined(NO_WORKERS)
+	int i, count;
+
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	InitializeCriticalSection(&lock);
+	InitializeConditionVariable(&wake_cond);
+	InitializeConditionVariable(&done_cond);
+#endif
+
+	quit = false;
+	job_generation = 0;
+	thread_count = 0;
+
+	count = get_cpu_count() - 1;
+	if (count > WORKERS_MAX)
+		count = WORKERS_MAX;
+	for (i = 0; i < count; i++) {
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+		thread[i] = CreateThread(NULL, 0, worker_thread, NULL, 0, NULL);
+		if (thread[i] == NULL)
+			break;
+#else
+		if (pthread_create(&thread[i], NULL, worker_thread, NULL) != 0)
+			break;
+#endif
+		thread_count++;
+	}
+#endif
+
+	return true;
+}
+
+/*
+ * Stop the worker threads.
+ */
+void cleanup_workers(void)
+{
+#if !defined(NO_WORKERS)
+	int i;
+
+	lock_workers();
+	quit = true;
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	WakeAllConditionVariable(&wake_cond);
+#else
+	pthread_cond_broadcast(&wake_cond);
+#endif
+	unlock_workers();
+
+	for (i = 0; i < thread_count; i++) {
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+		WaitForSingleObject(thread[i], INFINITE);
+		CloseHandle(thread[i]);
+#else
+		pthread_join(thread[i], NULL);
+#endif
+	}
+	thread_count = 0;
+
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	DeleteCriticalSection(&lock);
+#endif
+#endif
+}
+
+/*
+ * Get the number of threads that run jobs, including the calling thread.
+ */
+int get_worker_count(void)
+{
+#if !defined(NO_WORKERS)
+	return thread_count + 1;
+#else
+	return 1;
+#endif
+}
+
+/*
+ * Run jobs on the worker threads and the calling thread.
+ */
+void run_workers(void (*func)(int index, void *arg), int count, void *arg)
+{
+	int i;
+
+#if !defined(NO_WORKERS)
+	if (thread_count > 0 && count > 1) {
+		run_on_threads(func, count, arg);
+		return;
+	}
+#endif
+
+	for (i = 0; i < count; i++)
+		func(i, arg);
+}
+
+#if !defined(NO_WORKERS)
+
+/* Publish a job to the worker threads and wait for it. */
+static void run_on_threads(void (*func)(int index, void *arg), int count, void *arg)
+{
+	lock_workers();
+	{
+		/* Publish a job and wake up the worker threads. */
+		job_func = func;
+		job_arg = arg;
+		job_count = count;
+		job_next = 0;
+		job_finished = 0;
+		job_generation++;
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+		WakeAllConditionVariable(&wake_cond);
+#else
+		pthread_cond_broadcast(&wake_cond);
+#endif
+
+		/* Work on the calling thread, too. */
+		do_jobs();
+
+		/* Wait for the indices taken by the worker threads. */
+		while (job_finished < job_count)
+			wait_done();
+	}
+	unlock_workers();
+}
+
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+static DWORD WINAPI worker_thread(LPVOID param)
+#else
+static void *worker_thread(void *param)
+#endif
+{
+	unsigned int generation;
+
+	UNUSED_PARAMETER(param);
+
+	lock_workers();
+	generation = job_generation;
+	while (1) {
+		/* Sleep until a new job or a quit request. */
+		while (!quit && generation == job_generation)
+			wait_wake();
+		if (quit)
+			break;
+		generation = job_generation;
+
+		do_jobs();
+	}
+	unlock_workers();
+
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+/* Take job indices one by one and run them. (Call with the lock held.) */
+static void do_jobs(void)
+{
+	int index;
+
+	while (job_next < job_count) {
+		index = job_next++;
+
+		unlock_workers();
+		job_func(index, job_arg);
+		lock_workers();
+
+		if (++job_finished == job_count) {
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+			WakeConditionVariable(&done_cond);
+#else
+			pthread_cond_signal(&done_cond);
+#endif
+		}
+	}
+}
+
+/* Get the number of the logical processors. */
+static int get_cpu_count(void)
+{
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	return (int)si.dwNumberOfProcessors;
+#else
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : (int)n;
+#endif
+}
+
+static void lock_workers(void)
+{
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	EnterCriticalSection(&lock);
+#else
+	pthread_mutex_lock(&lock);
+#endif
+}
+
+static void unlock_workers(void)
+{
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	LeaveCriticalSection(&lock);
+#else
+	pthread_mutex_unlock(&lock);
+#endif
+}
+
+static void wait_wake(void)
+{
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	SleepConditionVariableCS(&wake_cond, &lock, INFINITE);
+#else
+	pthread_cond_wait(&wake_cond, &lock);
+#endif
+}
+
+static void wait_done(void)
+{
+#if defined(POLARIS_ENGINE_TARGET_WIN32)
+	SleepConditionVariableCS(&done_cond, &lock, INFINITE);
+#else
+	pthread_cond_wait(&done_cond, &lock);
+#endif
+}
+
+#endif /* !defined(NO_WORKERS) */
@@ -0,0 +1,38 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Polaris Engine
+ * Copyright (C) 2024, The Authors. All rights reserved.
+ */
+
+/*
+ * Worker Thread Pool
+ *  - A small pool of persistent threads for the CPU compositing.
+ *  - The threads are created in init_workers() and sleep between jobs.
+ *  - On Wasm and Unity targets, there is no thread and jobs run on the
+ *    calling thread.
+ */
+
+#ifndef POLARIS_ENGINE_WORKERS_H
+#define POLARIS_ENGINE_WORKERS_H
+
+#include "types.h"
+
+/* Start the worker threads. */
+bool init_workers(void);
+
+/* Stop the worker threads. */
+void cleanup_workers(void);
+
+/* Get the number of threads that run jobs, including the calling thread. */
+int get_worker_count(void);
+
+/*
+ * Run func(0, arg) ... func(count - 1, arg) on the worker threads and the
+ * calling thread, and return after all of them finish.
+ *  - Call this from the main thread only.
+ *  - func must not call HAL functions or log functions.
+ */
+void run_workers(void (*func)(int index, void *arg), int count, void *arg);
+
+#endif
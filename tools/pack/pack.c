@@ -1,11 +1,15 @@
 #include "package.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <assert.h>
 
 #ifdef _WIN32
 #include <windows.h>
+#include <shellapi.h>
+
+const char *conv_utf16_to_utf8(const wchar_t *utf16_message);
 
 int WINAPI wWinMain(
 	HINSTANCE hInstance,
@@ -14,16 +18,79 @@ int WINAPI wWinMain(
 	int nCmdShow)
 {
 	int main(int, char *[]);
-	return main(2, NULL);
+	wchar_t **wargv;
+	char **argv;
+	int argc, i, ret;
+
+	/* Convert the command line to UTF-8 for the options. */
+	wargv = CommandLineToArgvW(GetCommandLineW(), &argc);
+	if (wargv == NULL)
+		return main(1, NULL);
+	argv = calloc((size_t)argc + 1, sizeof(char *));
+	if (argv == NULL) {
+		LocalFree(wargv);
+		return 1;
+	}
+	for (i = 0; i < argc; i++) {
+		argv[i] = strdup(conv_utf16_to_utf8(wargv[i]));
+		if (argv[i] == NULL) {
+			argc = i;
+			break;
+		}
+	}
+	LocalFree(wargv);
+
+	ret = main(argc, argv);
+
+	for (i = 0; i < argc; i++)
+		free(argv[i]);
+	free(argv);
+	return ret;
 }
 #endif
 
+static void show_progress(uint64_t done, uint64_t total)
+{
+	static int last_percent = -1;
+	int percent;
+
+	percent = (int)(done * 100 / total);
+	if (percent == last_percent)
+		return;
+	last_percent = percent;
+
+	printf("\r%3d%%", percent);
+	if (done == total)
+		printf("\n");
+	fflush(stdout);
+}
+
 int main(int argc, char *argv[])
 {
+	bool update;
+	int i;
+
 	printf("Hello, this is a packager!\n");
 
-	/* Create a package. */
-	if (!create_package("")) {
+	/*
+	 * Parse the options.
+	 *  -j N:    set the number of the threads
+	 *  -u:      update the package incrementally
+	 *  -t FILE: lay out the files in the order of an access trace
+	 */
+	update = false;
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			set_package_jobs(atoi(argv[++i]));
+		else if (strcmp(argv[i], "-u") == 0)
+			update = true;
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			set_package_access_trace(argv[++i]);
+	}
+	set_package_progress_callback(show_progress);
+
+	/* Create or update a package. */
+	if (!(update ? update_package("") : create_package(""))) {
 		printf("Failed.\n");
 		return 1;
 	}